@@ -0,0 +1,429 @@
+/**
+ * Cycle-accurate timing benchmark of the Arduino sketch *cam_and_light_sync.ino*: runs the
+ * compiled sketch on an ATmega328P simulated by simavr, acts as its serial client, and
+ * records the waveform of the camera trigger pin, e.g., to catch timing regressions of the
+ * trigger engine before the sketch is uploaded to the rig.
+ *
+ * Usage:
+ *
+ *   kwa-firmware-bench --elf <sketch.elf> [--rates <fps,...>] [--frames <n>] [--trigger-pin <port><bit>]
+ *                      [--max-jitter-us <us>] [--report <file.json>]
+ *
+ * For each frame rate (default: 1 to 1000 Hz), the sketch is reset, a recording is started,
+ * and stopped after <n> (default: 10) trigger pulses, in the middle of a frame. Measured
+ * are the trigger period (mean error against the exact period, standard deviation, and max.
+ * deviation of single periods), the pulse width, and the stop latency, i.e., the time from
+ * the receipt of the last byte of the stop command to the trigger timer being stopped. The
+ * pulse count and the trigger telemetry reported by the sketch are checked against the
+ * waveform.
+ *
+ * The report (JSON) is written to <file.json> or standard output. The exit code is 1 if any
+ * rate failed a check: a pulse count or telemetry mismatch, a pulse after the stop, a mean
+ * period off by more than one cycle, or a single period deviating by more than
+ * <us> (default: 2) microseconds.
+ *
+ * The trigger pin defaults to B5 (digital pin 13); it must match `baslerGpioInPin`.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "avr_ioport.h"
+#include "avr_uart.h"
+
+#include "ArduinoProtocol.h"
+#include "Framing.h"
+#include "TriggerTelemetry.h"
+
+using namespace KwaController;
+
+
+namespace {
+
+	// Data space addresses of ATmega328P registers polled by the benchmark.
+	const uint16_t REG_TCCR1B = 0x81;
+	const uint16_t REG_UCSR0A = 0xC0;
+	const uint8_t RXC0_MASK = 0x80;
+	const uint8_t TIMER1_CLOCK_MASK = 0x07;  // CS12..CS10; zero while Timer1 is stopped.
+
+	const double CPU_CLOCK_HZ = ARDUINO_CPU_CLOCK_HZ;
+
+	/// <summary>
+	/// Results of one frame rate.
+	/// </summary>
+	struct RateResult {
+		double fps;
+		bool completed;             // All steps of the run completed (no timeout).
+		std::string error;          // Why the run did not complete.
+		size_t pulses;              // Rising edges of the trigger pin while recording.
+		uint32_t reportedPulses;    // Pulse count in the reply to the stop command.
+		size_t telemetryEdges;      // Edges received as trigger telemetry.
+		size_t pulsesAfterStop;     // Rising edges after the timer was stopped.
+		double nominalPeriodUs;
+		double meanPeriodErrorCycles;  // Mean period minus the exact (fractional) period.
+		double periodStdDevUs;
+		double maxPeriodDeviationUs;   // Max. deviation of a single period from the exact period.
+		double minPulseWidthUs;
+		double maxPulseWidthUs;
+		double stopLatencyUs;
+		bool passed;
+	};
+
+	/// <summary>
+	/// The simulated Arduino and the serial client talking to it.
+	/// </summary>
+	class Bench {
+	public:
+		Bench(avr_t* avr, char triggerPort, int triggerBit) : avr(avr), nextSeq(0) {
+			uint32_t flags = 0;
+			avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+			flags &= ~AVR_UART_FLAG_STDIO;  // Do not echo the sketch's output to the console.
+			avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+			this->uartInput = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+			avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+				&Bench::OnUartOutput, this);
+			avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(triggerPort), triggerBit),
+				&Bench::OnTriggerPin, this);
+		}
+
+		RateResult Run(double fps, size_t frames) {
+			RateResult result = {};
+			result.fps = fps;
+			uint32_t rate = static_cast<uint32_t>(std::lround(fps * FPS_RATE_SCALE));
+			double periodCycles = CPU_CLOCK_HZ * FPS_RATE_SCALE / rate;
+			result.nominalPeriodUs = periodCycles * 1e6 / CPU_CLOCK_HZ;
+
+			avr_reset(this->avr);
+			this->Clear();
+			if (!this->RunUntil([this]() { return this->ReceivedType(EVT_READY); }, CPU_CLOCK_HZ)) {
+				result.error = "No ready event after reset.";
+				return result;
+			}
+
+			// Record `frames` pulses, then stop in the middle of a frame.
+			std::vector<uint8_t> payload;
+			AppendLong(payload, rate);
+			uint8_t startSeq = this->Send(CMD_START_REC, payload);
+			uint64_t limit = static_cast<uint64_t>((frames + 2) * periodCycles + CPU_CLOCK_HZ);
+			if (!this->RunUntil([&]() { return this->rises.size() >= frames; }, limit) || !this->ReceivedReply(startSeq, RSP_ACK)) {
+				result.error = "Recording did not start.";
+				return result;
+			}
+			uint64_t stopAt = this->rises.back() + static_cast<uint64_t>(periodCycles / 2);
+			this->RunUntil([&]() { return this->avr->cycle >= stopAt; }, periodCycles + 1);
+
+			// Stop; the sketch stops the timer in the receive interrupt of the last byte.
+			uint8_t stopSeq = this->Send(CMD_STOP_REC, std::vector<uint8_t>());
+			size_t stopBytes = FRAME_OVERHEAD;
+			uint64_t lastByteCycle = 0;
+			bool rxcSet = false;
+			uint64_t stoppedCycle = 0;
+			bool stopped = this->RunUntil([&]() {
+				bool rxc = (this->avr->data[REG_UCSR0A] & RXC0_MASK) != 0;
+				if (rxc && !rxcSet && stopBytes > 0 && --stopBytes == 0) {
+					lastByteCycle = this->avr->cycle;
+				}
+				rxcSet = rxc;
+				if (stopBytes == 0 && (this->avr->data[REG_TCCR1B] & TIMER1_CLOCK_MASK) == 0) {
+					stoppedCycle = this->avr->cycle;
+					return true;
+				}
+				return false;
+			}, CPU_CLOCK_HZ);
+			size_t recordedRises = this->rises.size();
+			const Frame* stopReply = nullptr;
+			if (stopped) {
+				this->RunUntil([&]() { return (stopReply = this->ReceivedReply(stopSeq, RSP_ACK)) != nullptr; }, CPU_CLOCK_HZ);
+			}
+			if (!stopReply) {
+				result.error = "Recording did not stop.";
+				return result;
+			}
+			result.reportedPulses = stopReply->payload.size() >= 4 ? ReadLong(stopReply->payload.data()) : 0;
+			// No pulse must follow the stop.
+			uint64_t quietUntil = this->avr->cycle + static_cast<uint64_t>(periodCycles) + 1;
+			this->RunUntil([&]() { return this->avr->cycle >= quietUntil; }, periodCycles + 2);
+
+			result.completed = true;
+			result.pulses = recordedRises;
+			result.pulsesAfterStop = this->rises.size() - recordedRises;
+			result.telemetryEdges = this->telemetryEdges;
+			result.stopLatencyUs = (stoppedCycle - lastByteCycle) * 1e6 / CPU_CLOCK_HZ;
+			this->Analyze(periodCycles, recordedRises, result);
+			return result;
+		}
+
+	private:
+		void Clear() {
+			this->frameDecoder.Reset();
+			this->frames.clear();
+			this->telemetryDecoder.Reset();
+			this->telemetryEdges = 0;
+			this->rises.clear();
+			this->falls.clear();
+		}
+
+		/// <summary>
+		/// Run the simulation until <c>done()</c> returns <c>true</c>, checked after every
+		/// instruction, but for at most <c>maxCycles</c> cycles.
+		/// </summary>
+		template <typename Predicate>
+		bool RunUntil(Predicate done, double maxCycles) {
+			uint64_t limit = this->avr->cycle + static_cast<uint64_t>(maxCycles);
+			while (!done()) {
+				if (this->avr->cycle >= limit) {
+					return false;
+				}
+				int state = avr_run(this->avr);
+				if (state == cpu_Done || state == cpu_Crashed) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		uint8_t Send(uint8_t type, const std::vector<uint8_t>& payload) {
+			uint8_t seq = this->nextSeq++;
+			std::vector<uint8_t> msg;
+			AppendFrame(msg, type, seq, payload.data(), payload.size());
+			// The UART model queues the bytes and receives them at the configured baudrate.
+			for (uint8_t value : msg) {
+				avr_raise_irq(this->uartInput, value);
+			}
+			return seq;
+		}
+
+		bool ReceivedType(uint8_t type) const {
+			for (const Frame& frame : this->frames) {
+				if (frame.type == type) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		const Frame* ReceivedReply(uint8_t seq, uint8_t type) const {
+			for (const Frame& frame : this->frames) {
+				if (frame.seq == seq && frame.type == type) {
+					return &frame;
+				}
+			}
+			return nullptr;
+		}
+
+		void Analyze(double periodCycles, size_t pulses, RateResult& result) {
+			double sum = 0.0;
+			double sumSquares = 0.0;
+			double maxDeviation = 0.0;
+			size_t periods = pulses > 1 ? pulses - 1 : 0;
+			for (size_t i = 1; i < pulses; ++i) {
+				double period = static_cast<double>(this->rises[i] - this->rises[i - 1]);
+				sum += period;
+				sumSquares += period * period;
+				maxDeviation = std::fmax(maxDeviation, std::fabs(period - periodCycles));
+			}
+			if (periods > 0) {
+				double mean = sum / periods;
+				result.meanPeriodErrorCycles = mean - periodCycles;
+				double variance = periods > 1 ? (sumSquares - sum * mean) / (periods - 1) : 0.0;
+				result.periodStdDevUs = std::sqrt(std::fmax(variance, 0.0)) * 1e6 / CPU_CLOCK_HZ;
+				result.maxPeriodDeviationUs = maxDeviation * 1e6 / CPU_CLOCK_HZ;
+			}
+
+			result.minPulseWidthUs = 0.0;
+			result.maxPulseWidthUs = 0.0;
+			size_t fall = 0;
+			for (size_t i = 0; i < pulses; ++i) {
+				while (fall < this->falls.size() && this->falls[fall] <= this->rises[i]) {
+					++fall;
+				}
+				if (fall == this->falls.size()) {
+					break;
+				}
+				double width = (this->falls[fall] - this->rises[i]) * 1e6 / CPU_CLOCK_HZ;
+				result.minPulseWidthUs = i == 0 ? width : std::fmin(result.minPulseWidthUs, width);
+				result.maxPulseWidthUs = std::fmax(result.maxPulseWidthUs, width);
+			}
+		}
+
+		static void OnUartOutput(avr_irq_t*, uint32_t value, void* param) {
+			Bench* bench = static_cast<Bench*>(param);
+			if (!bench->frameDecoder.Feed(static_cast<uint8_t>(value), bench->frame)) {
+				return;
+			}
+			if (bench->frame.type == EVT_TELEMETRY) {
+				std::vector<TriggerEdge> edges;
+				bench->telemetryDecoder.Decode(bench->frame.payload.data(), bench->frame.payload.size());
+				bench->telemetryDecoder.TakeEdges(edges);
+				bench->telemetryEdges += edges.size();
+			}
+			else {
+				bench->frames.push_back(bench->frame);
+			}
+		}
+
+		static void OnTriggerPin(avr_irq_t*, uint32_t value, void* param) {
+			Bench* bench = static_cast<Bench*>(param);
+			(value ? bench->rises : bench->falls).push_back(bench->avr->cycle);
+		}
+
+		avr_t* avr;
+		avr_irq_t* uartInput;
+		uint8_t nextSeq;
+		FrameDecoder frameDecoder;
+		Frame frame;
+		std::vector<Frame> frames;        // Replies and events received, except telemetry.
+		TelemetryDecoder telemetryDecoder;
+		size_t telemetryEdges;
+		std::vector<uint64_t> rises;      // Cycles of the rising edges of the trigger pin.
+		std::vector<uint64_t> falls;      // Cycles of the falling edges of the trigger pin.
+	};
+
+	bool Check(RateResult& result, double maxJitterUs) {
+		result.passed = result.completed &&
+			result.reportedPulses == result.pulses &&
+			result.telemetryEdges == result.pulses &&
+			result.pulsesAfterStop == 0 &&
+			std::fabs(result.meanPeriodErrorCycles) <= 1.0 &&
+			result.maxPeriodDeviationUs <= maxJitterUs;
+		return result.passed;
+	}
+
+	std::string ToJson(const std::vector<RateResult>& results, bool passed) {
+		std::ostringstream out;
+		out.precision(6);
+		out << std::fixed << "{\n  \"passed\": " << (passed ? "true" : "false") << ",\n  \"rates\": [\n";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const RateResult& r = results[i];
+			out << "    {\"fps\": " << r.fps
+				<< ", \"passed\": " << (r.passed ? "true" : "false")
+				<< ", \"error\": \"" << r.error << "\""
+				<< ", \"pulses\": " << r.pulses
+				<< ", \"reported_pulses\": " << r.reportedPulses
+				<< ", \"telemetry_edges\": " << r.telemetryEdges
+				<< ", \"pulses_after_stop\": " << r.pulsesAfterStop
+				<< ", \"nominal_period_us\": " << r.nominalPeriodUs
+				<< ", \"mean_period_error_cycles\": " << r.meanPeriodErrorCycles
+				<< ", \"period_stddev_us\": " << r.periodStdDevUs
+				<< ", \"max_period_deviation_us\": " << r.maxPeriodDeviationUs
+				<< ", \"min_pulse_width_us\": " << r.minPulseWidthUs
+				<< ", \"max_pulse_width_us\": " << r.maxPulseWidthUs
+				<< ", \"stop_latency_us\": " << r.stopLatencyUs
+				<< "}" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		out << "  ]\n}\n";
+		return out.str();
+	}
+
+	void PrintUsage() {
+		std::fprintf(stderr,
+			"Usage: kwa-firmware-bench --elf <sketch.elf> [--rates <fps,...>] [--frames <n>]\n"
+			"                          [--trigger-pin <port><bit>] [--max-jitter-us <us>] [--report <file.json>]\n");
+	}
+}
+
+
+int main(int argc, char* argv[]) {
+	std::string elfPath;
+	std::string reportPath;
+	std::vector<double> rates = { 1, 2, 5, 10, 29.97, 60, 100, 244, 250, 500, 720, 725.16, 1000 };
+	size_t frames = 10;
+	char triggerPort = 'B';
+	int triggerBit = 5;
+	double maxJitterUs = 2.0;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--elf" && hasValue) {
+			elfPath = argv[++i];
+		}
+		else if (arg == "--report" && hasValue) {
+			reportPath = argv[++i];
+		}
+		else if (arg == "--rates" && hasValue) {
+			rates.clear();
+			std::istringstream list(argv[++i]);
+			std::string value;
+			while (std::getline(list, value, ',')) {
+				rates.push_back(std::atof(value.c_str()));
+			}
+		}
+		else if (arg == "--frames" && hasValue) {
+			frames = static_cast<size_t>(std::atoi(argv[++i]));
+		}
+		else if (arg == "--trigger-pin" && hasValue && std::strlen(argv[i + 1]) == 2) {
+			triggerPort = argv[++i][0];
+			triggerBit = argv[i][1] - '0';
+		}
+		else if (arg == "--max-jitter-us" && hasValue) {
+			maxJitterUs = std::atof(argv[++i]);
+		}
+		else {
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (elfPath.empty() || frames < 2 || triggerBit < 0 || triggerBit > 7) {
+		PrintUsage();
+		return 2;
+	}
+	for (double fps : rates) {
+		if (!(fps > 0.0)) {
+			PrintUsage();
+			return 2;
+		}
+	}
+
+	elf_firmware_t firmware = {};
+	if (elf_read_firmware(elfPath.c_str(), &firmware) != 0) {
+		std::fprintf(stderr, "Could not read firmware %s.\n", elfPath.c_str());
+		return 1;
+	}
+	avr_t* avr = avr_make_mcu_by_name("atmega328p");
+	if (!avr) {
+		std::fprintf(stderr, "simavr does not support the ATmega328P.\n");
+		return 1;
+	}
+	avr_init(avr);
+	avr->frequency = static_cast<uint32_t>(CPU_CLOCK_HZ);
+	avr_load_firmware(avr, &firmware);
+
+	Bench bench(avr, triggerPort, triggerBit);
+	std::vector<RateResult> results;
+	bool passed = true;
+	for (double fps : rates) {
+		RateResult result = bench.Run(fps, frames);
+		passed = Check(result, maxJitterUs) && passed;
+		std::fprintf(stderr, "%10.3f FPS: %s  period error %+.2f cycles, max. deviation %.3f us, pulse %.3f-%.3f us, stop latency %.2f us%s%s\n",
+			fps, result.passed ? "ok  " : "FAIL", result.meanPeriodErrorCycles, result.maxPeriodDeviationUs,
+			result.minPulseWidthUs, result.maxPulseWidthUs, result.stopLatencyUs,
+			result.error.empty() ? "" : "  ", result.error.c_str());
+		results.push_back(result);
+	}
+	avr_terminate(avr);
+
+	std::string report = ToJson(results, passed);
+	if (reportPath.empty()) {
+		std::fputs(report.c_str(), stdout);
+	}
+	else {
+		FILE* file = std::fopen(reportPath.c_str(), "w");
+		if (!file) {
+			std::fprintf(stderr, "Could not create report file %s.\n", reportPath.c_str());
+			return 1;
+		}
+		std::fputs(report.c_str(), file);
+		std::fclose(file);
+	}
+	return passed ? 0 : 1;
+}
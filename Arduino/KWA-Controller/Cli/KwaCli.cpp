@@ -0,0 +1,553 @@
+/**
+ * Command-line front-end of the KWA controller core, e.g., to run the rig from a Linux
+ * acquisition computer or to measure the command round-trip latency to the Arduino.
+ *
+ * Usage:
+ *
+ *   kwa-cli -p <port> record [--fps <rate>] [--lights <pattern>] [--strobe <offset:width>] [--aux-trigger <phase>]
+ *                            [--set-fps <s>:<rate>]... [--duration <s>] [--log <file.csv>]
+ *       Turn on lights and trigger the camera at <rate> Hz (default: 720) until <s> seconds
+ *       passed or Ctrl+C is pressed. Prints trigger statistics every second and optionally
+ *       writes all trigger edges to <file.csv>, with their time on the host's monotonic clock,
+ *       and the clock synchronization samples to <file>.clock.csv (see `ClockSync`). Finally,
+ *       prints the number of trigger pulses counted by the Arduino, e.g., to compare it with
+ *       the number of recorded frames, and the drift of the Arduino's clock.
+ *       <pattern> gives the lights of consecutive frames, repeated over the recording, e.g.,
+ *       "white,white,uv" (default: "white"; see `ParseLightPattern()`).
+ *       With --strobe, the lights of each frame are only on from <offset> to <offset> + <width>
+ *       microseconds after its trigger edge, e.g., "0:300" for a 300 us exposure (default: "off",
+ *       i.e., on for the whole frame).
+ *       With --aux-trigger, the Arduino's auxiliary trigger output (e.g., for a second camera)
+ *       pulses <phase> microseconds after each trigger edge (default: "off").
+ *       Each --set-fps changes the frame rate to <rate> Hz <s> seconds after the start, without
+ *       interrupting the recording (e.g., "--set-fps 10:30 --set-fps 20:720" for a ramp).
+ *
+ *   kwa-cli -p <port>[@<offset>] -p <port>[@<offset>]... record [options as above]
+ *       Record with several Arduinos as one rig (see `RigGroup`), all with the same options.
+ *       The boards start together at a scheduled time, each delayed by its <offset> in
+ *       microseconds (default: 0), so that all cameras fire on a common timeline. Statistics
+ *       are printed per board, and finally each board's start skew as measured by the clock
+ *       synchronization. With --log, board N writes <file>-N.csv and <file>-N.clock.csv.
+ *
+ *   kwa-cli -p <port> ping [--count <n>]
+ *       Measure the round-trip time of <n> (default: 1000) ping requests and print statistics.
+ *
+ *   kwa-cli discover
+ *       Probe all serial ports concurrently for Arduinos (see `DeviceDiscovery`) and print
+ *       each one found with its device ID, firmware version, and capabilities. Their ports
+ *       are cached, so that they are found right away by the next discovery.
+ *
+ * Instead of a port name, -p takes "auto" for the Arduino found on the serial ports (the one
+ * used last, if there are several), or "id:<device ID>" for the Arduino with that device ID
+ * (e.g., "id:3F09A2C1", as printed by `kwa-cli discover`), also for the boards of a rig.
+ * Option `--scan <port>,<port>...` gives the ports probed by a discovery (default: all USB
+ * serial ports), e.g., to spare other serial devices or to include an emulator.
+ *
+ * Option `--baud <rate>` selects the baudrate negotiated with the Arduino after connecting
+ * (default: 1000000); 115200 keeps the rate the Arduino starts with.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ArduinoController.h"
+#include "RigGroup.h"
+
+using namespace KwaController;
+
+
+namespace {
+
+	std::atomic<bool> interrupted(false);
+
+	void OnInterrupt(int) {
+		interrupted = true;
+	}
+
+	void PrintUsage() {
+		std::fprintf(stderr,
+			"Usage:\n"
+			"  kwa-cli -p <port> record [--fps <rate>] [--lights <pattern>] [--strobe <offset:width>]\n"
+			"                           [--aux-trigger <phase>] [--set-fps <s>:<rate>]... [--duration <s>]\n"
+			"                           [--log <file.csv>]\n"
+			"  kwa-cli -p <port>[@<offset>] -p <port>[@<offset>]... record [options as above]\n"
+			"  kwa-cli -p <port> ping [--count <n>]\n"
+			"  kwa-cli discover\n"
+			"<port> may be \"auto\" or \"id:<device ID>\" to find the Arduino on the serial ports.\n"
+			"Options:\n"
+			"  --baud <rate>         Baudrate negotiated with the Arduino (default: %d)\n"
+			"  --scan <port>,...     Serial ports probed to find Arduinos (default: all USB serial ports)\n",
+			ARDUINO_FAST_BAUDRATE);
+	}
+
+	void PrintStats(const TriggerStats& stats) {
+		std::printf("Edges: %llu  Lost: %llu  Missed: %llu  Period: %.3f us  Jitter: %.3f us\n",
+			static_cast<unsigned long long>(stats.EdgeCount()),
+			static_cast<unsigned long long>(stats.LostEdges()),
+			static_cast<unsigned long long>(stats.MissedDeadlines()),
+			stats.MeanPeriodUs(), stats.JitterUs());
+		std::fflush(stdout);
+	}
+
+	std::string FormatCapabilities(const DeviceInfo& device) {
+		static const struct {
+			uint16_t capability;
+			const char* name;
+		} CAPABILITY_NAMES[] = {
+			{ CAP_LIGHT_PATTERN, "lights" }, { CAP_STROBE, "strobe" }, { CAP_SET_RATE, "set-fps" },
+			{ CAP_CLOCK_SYNC, "clock-sync" }, { CAP_AUX_TRIGGER, "aux-trigger" }, { CAP_START_AT, "start-at" },
+			{ CAP_STIMULUS, "stimulus" },
+		};
+		std::string text;
+		for (const auto& name : CAPABILITY_NAMES) {
+			if (device.Has(name.capability)) {
+				text += (text.empty() ? "" : ",") + std::string(name.name);
+			}
+		}
+		return text.empty() ? "-" : text;
+	}
+
+	/// <summary>
+	/// Replace the port names "auto" and "id:<device ID>" of <c>boards</c> by the ports the
+	/// Arduinos were found on.
+	/// </summary>
+	bool ResolvePorts(std::vector<BoardConfig>& boards, const std::vector<std::string>& scanPorts) {
+		DeviceDiscovery discovery;
+		for (BoardConfig& board : boards) {
+			uint32_t deviceId = 0;
+			if (board.portName == "auto") {
+				if (boards.size() > 1) {
+					std::fprintf(stderr, "Select the boards of a rig by their device IDs (id:<device ID>).\n");
+					return false;
+				}
+			}
+			else if (board.portName.compare(0, 3, "id:") == 0) {
+				if (!ParseDeviceId(board.portName.substr(3), deviceId)) {
+					std::fprintf(stderr, "Invalid device ID %s.\n", board.portName.c_str() + 3);
+					return false;
+				}
+			}
+			else {
+				continue;
+			}
+			DeviceInfo device;
+			if (!discovery.Find(device, deviceId, scanPorts)) {
+				std::fprintf(stderr, "%s\n", discovery.LastError().c_str());
+				return false;
+			}
+			std::printf("Found Arduino %s on %s in %.0f ms.\n",
+				device.IsIdentified() ? FormatDeviceId(device.deviceId).c_str() : "(unidentified)", device.portName.c_str(),
+				device.probeMs);
+			board.portName = device.portName;
+		}
+		return true;
+	}
+
+	int Discover(const std::vector<std::string>& scanPorts) {
+		DeviceDiscovery discovery;
+		auto start = std::chrono::steady_clock::now();
+		std::vector<DeviceInfo> devices = discovery.Scan(scanPorts);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		for (const DeviceInfo& device : devices) {
+			if (device.IsIdentified()) {
+				std::printf("%s  ID: %s  Firmware: %d.%d  Capabilities: %s  Probe: %.0f ms\n", device.portName.c_str(),
+					FormatDeviceId(device.deviceId).c_str(), device.firmwareMajor, device.firmwareMinor,
+					FormatCapabilities(device).c_str(), device.probeMs);
+				discovery.Remember(device);
+			}
+			else {
+				std::printf("%s  Sketch without identification; upload the latest sketch.\n", device.portName.c_str());
+			}
+		}
+		std::printf("Found %zu Arduino(s) on %zu serial port(s) in %.3f s.\n", devices.size(), scanPorts.size(), seconds);
+		return devices.empty() ? 1 : 0;
+	}
+
+	/// <summary>
+	/// Frame rate change during a recording (option --set-fps).
+	/// </summary>
+	struct FpsChange {
+		double seconds;  // Time since the start of the recording.
+		double fps;
+	};
+
+	/// <summary>
+	/// Path <c>logPath</c> without the extension ".csv".
+	/// </summary>
+	std::string LogPathBase(const std::string& logPath) {
+		const std::string extension = ".csv";
+		std::string base = logPath;
+		if (base.size() > extension.size() && base.compare(base.size() - extension.size(), extension.size(), extension) == 0) {
+			base.resize(base.size() - extension.size());
+		}
+		return base;
+	}
+
+	/// <summary>
+	/// Path of the clock synchronization table written along with the trigger log <c>logPath</c>.
+	/// </summary>
+	std::string ClockTablePath(const std::string& logPath) {
+		return LogPathBase(logPath) + ".clock.csv";
+	}
+
+	int Record(ArduinoController& controller, double fps, const LightPattern& lights, const Strobe& strobe,
+		const TriggerPhases& auxTriggers, const std::vector<FpsChange>& fpsChanges, double duration, const std::string& logPath) {
+		TriggerStats stats;
+		ClockSync clock;
+		TriggerLogWriter log;
+		if (!logPath.empty() && !log.Open(logPath)) {
+			std::fprintf(stderr, "Could not create trigger log file %s.\n", logPath.c_str());
+			return 1;
+		}
+
+		if (!controller.StartRecording(fps, lights, strobe, auxTriggers)) {
+			std::fprintf(stderr, "%s\n", controller.LastError().c_str());
+			return 1;
+		}
+		std::printf("Recording at %.3f FPS. Press Ctrl+C to stop.\n", fps);
+
+		std::vector<TriggerEdge> edges;
+		std::vector<ClockSample> clockSamples;
+		auto process = [&]() {
+			controller.TakeClockSamples(clockSamples);
+			for (const ClockSample& sample : clockSamples) {
+				clock.Add(sample);
+			}
+			controller.TakeEdges(edges);
+			for (const TriggerEdge& edge : edges) {
+				stats.Add(edge);
+			}
+			log.Write(edges, clock.Model());
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		auto nextReport = start + std::chrono::seconds(1);
+		size_t nextChange = 0;
+		bool ok = true;
+		while (!interrupted) {
+			auto now = std::chrono::steady_clock::now();
+			if (duration > 0 && std::chrono::duration<double>(now - start).count() >= duration) {
+				break;
+			}
+			if (!controller.IsConnected()) {
+				ok = false;  // Connection lost; the error has been printed by the handler.
+				break;
+			}
+			if (nextChange < fpsChanges.size() &&
+				std::chrono::duration<double>(now - start).count() >= fpsChanges[nextChange].seconds) {
+				if (controller.SetFps(fpsChanges[nextChange].fps)) {
+					std::printf("Changed to %.3f FPS.\n", fpsChanges[nextChange].fps);
+				}
+				else {
+					std::fprintf(stderr, "%s\n", controller.LastError().c_str());
+				}
+				++nextChange;
+			}
+			process();
+			if (now >= nextReport) {
+				PrintStats(stats);
+				nextReport += std::chrono::seconds(1);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+
+		if (ok && !controller.StopRecording()) {
+			std::fprintf(stderr, "%s\n", controller.LastError().c_str());
+			ok = false;
+		}
+		process();
+		PrintStats(stats);
+		if (ok) {
+			TriggerSummary summary = controller.LastTriggerSummary();
+			std::printf("Trigger pulses: %lu  Last pulse: %.6f s\n",
+				static_cast<unsigned long>(summary.pulseCount), summary.lastPulseTicks / ARDUINO_CPU_CLOCK_HZ);
+			if (stats.EdgeCount() + stats.LostEdges() != summary.pulseCount) {
+				std::printf("Telemetry covers %llu of the trigger pulses.\n",
+					static_cast<unsigned long long>(stats.EdgeCount() + stats.LostEdges()));
+			}
+		}
+		const ClockModel& model = clock.Model();
+		if (model.valid) {
+			std::printf("Clock drift: %.1f ppm  Residual: %.1f us  Samples: %lu of %lu\n", model.DriftPpm(),
+				model.residualUs, static_cast<unsigned long>(model.sampleCount), static_cast<unsigned long>(clock.SampleCount()));
+		}
+		if (!logPath.empty() && !clock.WriteTable(ClockTablePath(logPath))) {
+			std::fprintf(stderr, "Could not write clock table %s.\n", ClockTablePath(logPath).c_str());
+		}
+		return ok ? 0 : 1;
+	}
+
+	/// <summary>
+	/// Record with all boards of <c>rig</c> (see <c>Record()</c>).
+	/// </summary>
+	int RecordRig(RigGroup& rig, double fps, const std::vector<FpsChange>& fpsChanges, double duration,
+		const std::string& logPath) {
+		if (!logPath.empty() && !rig.OpenLogs(LogPathBase(logPath))) {
+			std::fprintf(stderr, "%s\n", rig.LastError().c_str());
+			return 1;
+		}
+		if (!rig.StartRecording(fps)) {
+			std::fprintf(stderr, "%s\n", rig.LastError().c_str());
+			return 1;
+		}
+		std::printf("Recording at %.3f FPS with %zu boards. Press Ctrl+C to stop.\n", fps, rig.BoardCount());
+
+		auto printStats = [&]() {
+			for (size_t i = 0; i < rig.BoardCount(); ++i) {
+				std::printf("[%zu] ", i + 1);
+				PrintStats(rig.Stats(i));
+			}
+		};
+		auto start = std::chrono::steady_clock::now();
+		auto nextReport = start + std::chrono::seconds(1);
+		size_t nextChange = 0;
+		bool ok = true;
+		while (!interrupted) {
+			auto now = std::chrono::steady_clock::now();
+			if (duration > 0 && std::chrono::duration<double>(now - start).count() >= duration) {
+				break;
+			}
+			for (size_t i = 0; i < rig.BoardCount(); ++i) {
+				ok = ok && rig.Controller(i).IsConnected();  // Otherwise, the error has been printed by the handler.
+			}
+			if (!ok) {
+				break;
+			}
+			if (nextChange < fpsChanges.size() &&
+				std::chrono::duration<double>(now - start).count() >= fpsChanges[nextChange].seconds) {
+				if (rig.SetFps(fpsChanges[nextChange].fps)) {
+					std::printf("Changed to %.3f FPS.\n", fpsChanges[nextChange].fps);
+				}
+				else {
+					std::fprintf(stderr, "%s\n", rig.LastError().c_str());
+				}
+				++nextChange;
+			}
+			rig.Poll();
+			if (now >= nextReport) {
+				printStats();
+				nextReport += std::chrono::seconds(1);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+
+		if (!rig.StopRecording()) {
+			std::fprintf(stderr, "%s\n", rig.LastError().c_str());
+			ok = false;
+		}
+		printStats();
+		for (size_t i = 0; i < rig.BoardCount(); ++i) {
+			TriggerSummary summary = rig.Controller(i).LastTriggerSummary();
+			const ClockModel& model = rig.Clock(i);
+			std::printf("[%zu] %s  Trigger pulses: %lu  Start offset: %d us  Start skew: %.1f us  Clock drift: %.1f ppm\n",
+				i + 1, rig.Config(i).portName.c_str(), static_cast<unsigned long>(summary.pulseCount), rig.Config(i).startOffsetUs,
+				rig.StartSkewUs(i), model.valid ? model.DriftPpm() : 0.0);
+		}
+		std::printf("Start spread: %.1f us\n", rig.StartSpreadUs());
+		return ok ? 0 : 1;
+	}
+
+	int Ping(ArduinoController& controller, int count) {
+		std::vector<double> roundTrips;
+		roundTrips.reserve(count);
+		for (int i = 0; i < count && !interrupted; ++i) {
+			double roundTripUs = 0.0;
+			if (!controller.Ping(roundTripUs)) {
+				std::fprintf(stderr, "%s\n", controller.LastError().c_str());
+				return 1;
+			}
+			roundTrips.push_back(roundTripUs);
+		}
+		if (roundTrips.empty()) {
+			return 1;
+		}
+
+		std::sort(roundTrips.begin(), roundTrips.end());
+		double sum = 0.0;
+		for (double value : roundTrips) {
+			sum += value;
+		}
+		auto percentile = [&](double p) {
+			return roundTrips[static_cast<size_t>(p * (roundTrips.size() - 1) + 0.5)];
+		};
+		std::printf("Round trips: %zu  min: %.1f us  mean: %.1f us  median: %.1f us  p99: %.1f us  max: %.1f us\n",
+			roundTrips.size(), roundTrips.front(), sum / roundTrips.size(),
+			percentile(0.5), percentile(0.99), roundTrips.back());
+		return 0;
+	}
+}
+
+
+int main(int argc, char* argv[]) {
+	std::vector<BoardConfig> boards;
+	std::string command;
+	std::string logPath;
+	double fps = 720.0;
+	LightPattern lights(1, LIGHT_WHITE);
+	Strobe strobe = Strobe();
+	TriggerPhases auxTriggers;
+	std::vector<FpsChange> fpsChanges;
+	double duration = 0.0;
+	int count = 1000;
+	int baudrate = ARDUINO_FAST_BAUDRATE;
+	std::vector<std::string> scanPorts = ListSerialPorts();
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if ((arg == "-p" || arg == "--port") && hasValue) {
+			// Port, optionally followed by "@" and the start offset of the board in a rig.
+			BoardConfig board(argv[++i]);
+			size_t at = board.portName.rfind('@');
+			if (at != std::string::npos) {
+				char extra;
+				if (std::sscanf(board.portName.c_str() + at + 1, "%d%c", &board.startOffsetUs, &extra) != 1 ||
+					board.startOffsetUs < 0) {
+					std::fprintf(stderr, "Invalid start offset in %s.\n", argv[i]);
+					return 2;
+				}
+				board.portName.resize(at);
+			}
+			boards.push_back(board);
+		}
+		else if (arg == "--fps" && hasValue) {
+			fps = std::atof(argv[++i]);
+		}
+		else if (arg == "--lights" && hasValue) {
+			if (!ParseLightPattern(argv[++i], lights)) {
+				std::fprintf(stderr, "Invalid light pattern %s.\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (arg == "--strobe" && hasValue) {
+			if (!ParseStrobe(argv[++i], strobe)) {
+				std::fprintf(stderr, "Invalid strobe %s.\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (arg == "--aux-trigger" && hasValue) {
+			if (!ParseTriggerPhases(argv[++i], auxTriggers)) {
+				std::fprintf(stderr, "Invalid auxiliary trigger phase %s.\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (arg == "--set-fps" && hasValue) {
+			FpsChange change;
+			char extra;
+			if (std::sscanf(argv[++i], "%lf:%lf%c", &change.seconds, &change.fps, &extra) != 2) {
+				std::fprintf(stderr, "Invalid FPS change %s.\n", argv[i]);
+				return 2;
+			}
+			std::string fpsError = CheckFps(change.fps);
+			if (!fpsError.empty()) {
+				std::fprintf(stderr, "%s: %s\n", argv[i], fpsError.c_str());
+				return 2;
+			}
+			fpsChanges.push_back(change);
+		}
+		else if (arg == "--duration" && hasValue) {
+			duration = std::atof(argv[++i]);
+		}
+		else if (arg == "--log" && hasValue) {
+			logPath = argv[++i];
+		}
+		else if (arg == "--count" && hasValue) {
+			count = std::atoi(argv[++i]);
+		}
+		else if (arg == "--baud" && hasValue) {
+			baudrate = std::atoi(argv[++i]);
+		}
+		else if (arg == "--scan" && hasValue) {
+			scanPorts.clear();
+			std::string ports = argv[++i];
+			for (size_t begin = 0, end; begin <= ports.size(); begin = end + 1) {
+				end = std::min(ports.find(',', begin), ports.size());
+				if (end > begin) {
+					scanPorts.push_back(ports.substr(begin, end - begin));
+				}
+			}
+		}
+		else if (command.empty() && arg[0] != '-') {
+			command = arg;
+		}
+		else {
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (command == "discover" && boards.empty()) {
+		return Discover(scanPorts);
+	}
+	if (boards.empty() || (command != "record" && command != "ping") || (command == "ping" && boards.size() > 1)) {
+		PrintUsage();
+		return 2;
+	}
+	std::string settingsError = CheckFps(fps);
+	if (settingsError.empty()) {
+		settingsError = CheckStrobe(strobe, fps);
+	}
+	if (settingsError.empty()) {
+		settingsError = CheckTriggerPhases(auxTriggers, fps);
+	}
+	if (command == "record" && !settingsError.empty()) {
+		std::fprintf(stderr, "%s\n", settingsError.c_str());
+		return 2;
+	}
+	std::stable_sort(fpsChanges.begin(), fpsChanges.end(),
+		[](const FpsChange& a, const FpsChange& b) { return a.seconds < b.seconds; });
+
+	std::signal(SIGINT, OnInterrupt);
+	std::signal(SIGTERM, OnInterrupt);
+
+	if (!ResolvePorts(boards, scanPorts)) {
+		return 1;
+	}
+	if (boards.size() > 1) {
+		for (BoardConfig& board : boards) {
+			board.lights = lights;
+			board.strobe = strobe;
+			board.auxTriggers = auxTriggers;
+		}
+		RigGroup rig;
+		if (!rig.Connect(boards, baudrate)) {
+			std::fprintf(stderr, "%s\n", rig.LastError().c_str());
+			return 1;
+		}
+		for (size_t i = 0; i < rig.BoardCount(); ++i) {
+			std::string portName = boards[i].portName;
+			rig.Controller(i).SetConnectionLostHandler([portName](const std::string& error) {
+				std::fprintf(stderr, "Connection lost: %s: %s\n", portName.c_str(), error.c_str());
+			});
+		}
+		int result = RecordRig(rig, fps, fpsChanges, duration, logPath);
+		rig.Disconnect();
+		return result;
+	}
+
+	const std::string& port = boards[0].portName;
+	ArduinoController controller;
+	controller.SetConnectionLostHandler([](const std::string& error) {
+		std::fprintf(stderr, "Connection lost: %s\n", error.c_str());
+	});
+	if (!controller.Connect(port, baudrate)) {
+		std::fprintf(stderr, "%s\n", controller.LastError().c_str());
+		return 1;
+	}
+	if (controller.Baudrate() != baudrate) {
+		std::fprintf(stderr, "Arduino did not accept %d baud; using %d baud.\n", baudrate, controller.Baudrate());
+	}
+
+	int result = command == "record"
+		? Record(controller, fps, lights, strobe, auxTriggers, fpsChanges, duration, logPath)
+		: Ping(controller, count);
+	controller.Disconnect();
+	return result;
+}
@@ -0,0 +1,521 @@
+/**
+ * Emulator of the Arduino sketch *cam_and_light_sync.ino* on a pseudo-terminal (Linux),
+ * for running the KWA controller (e.g., `kwa-cli`) without hardware, e.g., to measure the
+ * command round-trip latency of the host side or to test protocol changes.
+ *
+ * Usage:
+ *
+ *   kwa-emulator [--link <path>] [--drift-ppm <ppm>] [--id <device ID>] [--latency-us <us>]
+ *
+ * Prints the name of the pseudo-terminal to connect to; with `--link`, a symbolic link
+ * <path> to it is created, too. Trigger edges are generated on the host's monotonic clock
+ * and reported as trigger telemetry in the same format as the Arduino, with timestamps
+ * converted to Arduino CPU cycles. Baudrate changes are acknowledged, but have no effect.
+ * With `--drift-ppm`, the emulated CPU clock runs <ppm> parts per million fast (or slow,
+ * if negative), e.g., to test the clock synchronization. The emulator identifies itself with
+ * a random device ID, or the one given by `--id` (hexadecimal), e.g., to test the discovery.
+ * With `--latency-us`, each command is executed <us> microseconds after it was received,
+ * emulating the latency of a USB serial adapter, e.g., to develop a closed loop (kwa-loop),
+ * whose stimulus commands are switched at the next trigger edge after their execution.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "ArduinoController.h"
+#include "ArduinoProtocol.h"
+#include "Framing.h"
+
+using namespace KwaController;
+
+
+namespace {
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Telemetry batching; must match defs. in Arduino sketch.
+	const size_t TELEMETRY_BATCH_SIZE = 16;
+	const double TELEMETRY_MAX_AGE_S = 0.25;
+	// Firmware version of the emulated sketch.
+	const uint8_t EMULATED_FIRMWARE_MAJOR = 1;
+	const uint8_t EMULATED_FIRMWARE_MINOR = 1;
+
+	volatile std::sig_atomic_t interrupted = 0;
+
+	void OnInterrupt(int) {
+		interrupted = 1;
+	}
+
+	/// <summary>
+	/// Emulated Arduino state; mirrors the main loop of the Arduino sketch.
+	/// </summary>
+	class Emulator {
+	public:
+		Emulator(int fd, double driftPpm, uint32_t deviceId, int latencyUs) : fd(fd), deviceId(deviceId), cpuClockHz(ARDUINO_CPU_CLOCK_HZ * (1.0 + driftPpm * 1e-6)),
+			latency(std::chrono::microseconds(latencyUs)), recording(false), fpsScaled(0), periodTicks(0), previousPeriodTicks(0),
+			strobe(), stimulusLights(0), rateStartIndex(0), frameCounter(0), lastEdgeTicks(0), sentEdges(0), eventSeq(0) {
+		}
+
+		/// <summary>
+		/// Run until interrupted.
+		/// </summary>
+		void Run() {
+			this->SendEvent(EVT_READY);
+			while (!interrupted) {
+				pollfd pfd = { this->fd, POLLIN, 0 };
+				int ready = ::poll(&pfd, 1, this->TimeoutMs());
+				if (ready > 0 && (pfd.revents & POLLIN)) {
+					uint8_t buf[256];
+					ssize_t count = ::read(this->fd, buf, sizeof(buf));
+					for (ssize_t i = 0; i < count; ++i) {
+						if (this->decoder.Feed(buf[i], this->frame)) {
+							this->received.push_back({ Clock::now() + this->latency, this->frame });
+						}
+					}
+				}
+				while (!this->received.empty() && this->received.front().due <= Clock::now()) {
+					this->HandleFrame(this->received.front().command);
+					this->received.pop_front();
+				}
+				this->Tick();
+			}
+		}
+
+	private:
+		int TimeoutMs() const {
+			if (!this->recording && this->received.empty()) {
+				return 100;
+			}
+			Clock::time_point next = this->recording ? this->EdgeTime(this->frameCounter) : this->received.front().due;
+			if (!this->received.empty()) {
+				next = std::min(next, this->received.front().due);
+			}
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+			return left > 0 ? static_cast<int>(left) : 0;
+		}
+
+		Clock::time_point EdgeTime(uint64_t index) const {
+			// Exact rational period (1000 / fpsScaled s) since the last rate change, like the
+			// Arduino's phase accumulator.
+			auto ns = static_cast<Clock::rep>((index - this->rateStartIndex) * 1000000000000ull / this->fpsScaled
+				* (ARDUINO_CPU_CLOCK_HZ / this->cpuClockHz));
+			return this->rateStartTime + std::chrono::nanoseconds(ns);
+		}
+
+		void HandleFrame(const Frame& command) {
+			switch (command.type) {
+			case CMD_PING:
+				this->Reply(command, RSP_ACK, this->recording ? PING_STATE_RECORDING : PING_STATE_IDLE);
+				break;
+
+			case CMD_START_REC:
+			case CMD_START_REC_AT: {
+				// The payload of CMD_START_REC_AT is that of CMD_START_REC preceded by the delay.
+				size_t skip = command.type == CMD_START_REC_AT ? 4 : 0;
+				uint32_t delayUs = skip && command.payload.size() >= skip ? ReadLong(command.payload.data()) : 0;
+				std::vector<uint8_t> payload(command.payload.begin() + std::min(skip, command.payload.size()), command.payload.end());
+				if (command.payload.size() < skip || (payload.size() != 4 && payload.size() < 8)) {
+					this->Reply(command, RSP_NAK, NAK_BAD_PAYLOAD);
+				}
+				else if (this->recording) {
+					this->Reply(command, RSP_NAK, NAK_INVALID_STATE);
+				}
+				else if (!CheckFps(static_cast<double>(ReadLong(payload.data())) / FPS_RATE_SCALE).empty() ||
+					delayUs > ARDUINO_MAX_START_DELAY_US || !IsValidLights(payload) ||
+					!CheckTriggerPhases(this->auxTriggers, static_cast<double>(ReadLong(payload.data())) / FPS_RATE_SCALE).empty()) {
+					this->Reply(command, RSP_NAK, NAK_BAD_PAYLOAD);
+				}
+				else {
+					this->Reply(command, RSP_ACK);
+					this->strobe = Strobe();
+					if (payload.size() >= 8) {
+						this->strobe.offsetUs = ReadShort(payload.data() + 4);
+						this->strobe.widthUs = ReadShort(payload.data() + 6);
+					}
+					this->StartRecording(ReadLong(payload.data()), delayUs);
+				}
+				break;
+			}
+
+			case CMD_SET_TRIGGERS:
+				if (command.payload.size() != 0 && command.payload.size() != 2 * MAX_AUX_TRIGGERS) {
+					this->Reply(command, RSP_NAK, NAK_BAD_PAYLOAD);
+				}
+				else if (this->recording) {
+					this->Reply(command, RSP_NAK, NAK_INVALID_STATE);
+				}
+				else {
+					this->Reply(command, RSP_ACK);
+					// Trigger outputs are not emulated otherwise.
+					this->auxTriggers.clear();
+					for (size_t i = 0; i < command.payload.size(); i += 2) {
+						this->auxTriggers.push_back(ReadShort(command.payload.data() + i));
+					}
+				}
+				break;
+
+			case CMD_SET_RATE:
+				if (command.payload.size() != 4 ||
+					!CheckFps(static_cast<double>(ReadLong(command.payload.data())) / FPS_RATE_SCALE).empty()) {
+					this->Reply(command, RSP_NAK, NAK_BAD_PAYLOAD);
+				}
+				else if (!this->recording) {
+					this->Reply(command, RSP_NAK, NAK_INVALID_STATE);
+				}
+				else if (!CheckStrobe(this->strobe, static_cast<double>(ReadLong(command.payload.data())) / FPS_RATE_SCALE).empty() ||
+					!CheckTriggerPhases(this->auxTriggers, static_cast<double>(ReadLong(command.payload.data())) / FPS_RATE_SCALE).empty()) {
+					this->Reply(command, RSP_NAK, NAK_BAD_PAYLOAD);
+				}
+				else {
+					this->Reply(command, RSP_ACK);
+					this->SetRate(ReadLong(command.payload.data()));
+				}
+				break;
+
+			case CMD_SYNC:
+				if (!this->recording || Clock::now() < this->recordingStart) {
+					this->Reply(command, RSP_NAK, NAK_INVALID_STATE);
+				}
+				else {
+					std::vector<uint8_t> payload;
+					AppendLong(payload, this->Ticks(Clock::now()));
+					this->Write(RSP_ACK, command.seq, payload);
+				}
+				break;
+
+			case CMD_SET_STIMULUS:
+				if (command.payload.size() != 1 || (command.payload[0] & ~LIGHT_ALL)) {
+					this->Reply(command, RSP_NAK, NAK_BAD_PAYLOAD);
+				}
+				else if (!this->recording || Clock::now() < this->recordingStart) {
+					this->Reply(command, RSP_NAK, NAK_INVALID_STATE);
+				}
+				else {
+					// Lit from the next trigger edge on, like on the Arduino.
+					this->GenerateEdges();
+					this->stimulusLights = command.payload[0];
+					std::vector<uint8_t> payload;
+					AppendLong(payload, static_cast<uint32_t>(this->frameCounter));
+					AppendLong(payload, this->Ticks(Clock::now()));
+					this->Write(RSP_ACK, command.seq, payload);
+				}
+				break;
+
+			case CMD_STOP_REC:
+				if (this->recording) {
+					this->GenerateEdges();
+					while (!this->pendingEdges.empty()) {
+						this->SendTelemetry();
+					}
+					this->recording = false;
+				}
+				{
+					// Counters of the last recording (zero if none).
+					std::vector<uint8_t> payload;
+					AppendLong(payload, static_cast<uint32_t>(this->frameCounter));
+					AppendLong(payload, this->lastEdgeTicks);
+					this->Write(RSP_ACK, command.seq, payload);
+				}
+				break;
+
+			case CMD_IDENTIFY: {
+				std::vector<uint8_t> payload(IDENTIFY_MAGIC, IDENTIFY_MAGIC + 3);
+				payload.push_back(EMULATED_FIRMWARE_MAJOR);
+				payload.push_back(EMULATED_FIRMWARE_MINOR);
+				AppendLong(payload, this->deviceId);
+				AppendShort(payload, CAP_LIGHT_PATTERN | CAP_STROBE | CAP_SET_RATE | CAP_CLOCK_SYNC | CAP_AUX_TRIGGER | CAP_START_AT |
+					CAP_STIMULUS);
+				this->Write(RSP_ACK, command.seq, payload);
+				break;
+			}
+
+			case CMD_SET_BAUDRATE:
+				// A pseudo-terminal has no baudrate; accept any rate.
+				if (command.payload.size() != 4) {
+					this->Reply(command, RSP_NAK, NAK_BAD_PAYLOAD);
+				}
+				else {
+					this->Reply(command, RSP_ACK);
+				}
+				break;
+
+			default:
+				this->Reply(command, RSP_NAK, NAK_UNKNOWN_COMMAND);
+				break;
+			}
+		}
+
+		/// <summary>
+		/// Check the strobe and light pattern following the frame rate in a start command.
+		/// Lights are not emulated otherwise.
+		/// </summary>
+		static bool IsValidLights(const std::vector<uint8_t>& payload) {
+			if (payload.size() == 4) {
+				return true;
+			}
+			if (payload.size() > 8 + MAX_LIGHT_PATTERN) {
+				return false;
+			}
+			Strobe strobe = { ReadShort(payload.data() + 4), ReadShort(payload.data() + 6) };
+			if ((strobe.widthUs == 0 && strobe.offsetUs != 0) ||
+				!CheckStrobe(strobe, static_cast<double>(ReadLong(payload.data())) / FPS_RATE_SCALE).empty()) {
+				return false;
+			}
+			for (size_t i = 8; i < payload.size(); ++i) {
+				if (payload[i] & ~LIGHT_ALL) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void Tick() {
+			if (!this->recording) {
+				return;
+			}
+			this->GenerateEdges();
+			size_t pending = this->pendingEdges.size();
+			if (pending >= TELEMETRY_BATCH_SIZE ||
+				(pending > 0 && this->Seconds(Clock::now()) - this->pendingEdges.front().seconds >= TELEMETRY_MAX_AGE_S)) {
+				this->SendTelemetry();
+			}
+		}
+
+		/// <summary>
+		/// Start a recording <c>delayUs</c> from now (emulated CPU clock); until then, no edges
+		/// are due.
+		/// </summary>
+		void StartRecording(uint32_t fpsScaled, uint32_t delayUs) {
+			this->recording = true;
+			this->fpsScaled = fpsScaled;
+			this->periodTicks = static_cast<uint32_t>(ARDUINO_CPU_CLOCK_HZ * FPS_RATE_SCALE / this->fpsScaled);
+			this->recordingStart = Clock::now() + std::chrono::nanoseconds(
+				static_cast<Clock::rep>(delayUs * 1000.0 * ARDUINO_CPU_CLOCK_HZ / this->cpuClockHz));
+			this->previousPeriodTicks = this->periodTicks;
+			this->stimulusLights = 0;
+			this->rateStartIndex = 0;
+			this->rateStartTime = this->recordingStart;
+			this->frameCounter = 0;
+			this->lastEdgeTicks = 0;
+			this->pendingEdges.clear();
+			this->sentEdges = 0;
+			this->GenerateEdges();
+		}
+
+		/// <summary>
+		/// Change the rate from the next trigger edge on, which still ends a frame at the
+		/// previous rate; replaces a change not yet reached.
+		/// </summary>
+		void SetRate(uint32_t fpsScaled) {
+			this->GenerateEdges();
+			if (this->frameCounter > this->rateStartIndex) {
+				this->rateStartTime = this->EdgeTime(this->frameCounter);
+				this->rateStartIndex = this->frameCounter;
+				this->previousPeriodTicks = this->periodTicks;
+			}
+			this->fpsScaled = fpsScaled;
+			this->periodTicks = static_cast<uint32_t>(ARDUINO_CPU_CLOCK_HZ * FPS_RATE_SCALE / this->fpsScaled);
+		}
+
+		double Seconds(Clock::time_point time) const {
+			return std::chrono::duration<double>(time - this->recordingStart).count();
+		}
+
+		/// <summary>
+		/// Emulated CPU cycles since recording start (wrapping around like on the Arduino).
+		/// </summary>
+		uint32_t Ticks(Clock::time_point time) const {
+			return static_cast<uint32_t>(static_cast<uint64_t>(this->Seconds(time) * this->cpuClockHz));
+		}
+
+		/// <summary>
+		/// Emit all trigger edges due by now, timestamped with the actual (host) time.
+		/// </summary>
+		void GenerateEdges() {
+			Clock::time_point now = Clock::now();
+			while (this->EdgeTime(this->frameCounter) <= now) {
+				double seconds = this->Seconds(now);
+				this->lastEdgeTicks = this->Ticks(now);
+				uint32_t nominalTicks = this->frameCounter > this->rateStartIndex ? this->periodTicks : this->previousPeriodTicks;
+				this->pendingEdges.push_back({ this->lastEdgeTicks, seconds, nominalTicks });
+				++this->frameCounter;
+			}
+		}
+
+		/// <summary>
+		/// Send one batch of trigger edges, encoded like the Arduino does; a batch ends at a
+		/// rate change.
+		/// </summary>
+		void SendTelemetry() {
+			uint32_t nominalTicks = this->pendingEdges[0].nominalTicks;
+			size_t count = 1;
+			while (count < std::min(TELEMETRY_BATCH_SIZE, this->pendingEdges.size()) &&
+				this->pendingEdges[count].nominalTicks == nominalTicks) {
+				++count;
+			}
+			std::vector<uint8_t> payload;
+			payload.push_back(static_cast<uint8_t>(count));
+			AppendLong(payload, static_cast<uint32_t>(this->sentEdges));
+			AppendLong(payload, this->pendingEdges[0].ticks);
+			AppendLong(payload, nominalTicks);
+			for (size_t i = 1; i < count; ++i) {
+				uint32_t ticks = this->pendingEdges[i].ticks;
+				int32_t deviation = static_cast<int32_t>(ticks - this->pendingEdges[i - 1].ticks - nominalTicks);
+				uint32_t zigzag = (static_cast<uint32_t>(deviation) << 1) ^ static_cast<uint32_t>(deviation >> 31);
+				while (zigzag >= 0x80) {
+					payload.push_back(static_cast<uint8_t>(zigzag | 0x80));
+					zigzag >>= 7;
+				}
+				payload.push_back(static_cast<uint8_t>(zigzag));
+			}
+			this->SendEvent(EVT_TELEMETRY, payload);
+			this->pendingEdges.erase(this->pendingEdges.begin(), this->pendingEdges.begin() + count);
+			this->sentEdges += count;
+		}
+
+		void Reply(const Frame& command, uint8_t type) {
+			this->Write(type, command.seq, std::vector<uint8_t>());
+		}
+
+		void Reply(const Frame& command, uint8_t type, uint8_t value) {
+			this->Write(type, command.seq, std::vector<uint8_t>(1, value));
+		}
+
+		void SendEvent(uint8_t type, const std::vector<uint8_t>& payload = std::vector<uint8_t>()) {
+			this->Write(type, this->eventSeq++, payload);
+		}
+
+		void Write(uint8_t type, uint8_t seq, const std::vector<uint8_t>& payload) {
+			std::vector<uint8_t> msg;
+			AppendFrame(msg, type, seq, payload.data(), payload.size());
+			const uint8_t* buf = msg.data();
+			size_t size = msg.size();
+			while (size > 0) {
+				ssize_t count = ::write(this->fd, buf, size);
+				if (count <= 0) {
+					return;  // Client gone; drop data like a disconnected UART.
+				}
+				buf += count;
+				size -= static_cast<size_t>(count);
+			}
+		}
+
+		int fd;
+		uint32_t deviceId;              // Reported by CMD_IDENTIFY.
+		double cpuClockHz;              // Emulated CPU clock, including its drift.
+		Clock::duration latency;        // Delay of the execution of a command after its receipt.
+		FrameDecoder decoder;
+		Frame frame;
+		struct ReceivedCommand {
+			Clock::time_point due;     // Time to execute the command.
+			Frame command;
+		};
+		std::deque<ReceivedCommand> received;  // Commands waiting for their execution.
+		bool recording;
+		uint32_t fpsScaled;
+		uint32_t periodTicks;           // Nominal period of the edges after `rateStartIndex`.
+		uint32_t previousPeriodTicks;   // Nominal period of the edges up to `rateStartIndex`.
+		Strobe strobe;
+		uint8_t stimulusLights;         // LIGHT_... mask of CMD_SET_STIMULUS; not emulated otherwise.
+		TriggerPhases auxTriggers;
+		Clock::time_point recordingStart;
+		uint64_t rateStartIndex;        // Edge at which the current rate took effect...
+		Clock::time_point rateStartTime;  // ... and its time.
+		uint64_t frameCounter;
+		uint32_t lastEdgeTicks;
+		struct PendingEdge {
+			uint32_t ticks;   // Timestamp in Arduino CPU cycles (wraps around like on the Arduino).
+			double seconds;   // Timestamp in seconds since recording start.
+			uint32_t nominalTicks;  // Nominal period of the frame ending at this edge.
+		};
+		std::deque<PendingEdge> pendingEdges;  // Edges not yet sent as telemetry.
+		uint64_t sentEdges;                    // Number of edges sent as telemetry.
+		uint8_t eventSeq;                      // Sequence number of the next event frame.
+	};
+}
+
+
+int main(int argc, char* argv[]) {
+	std::string linkPath;
+	double driftPpm = 0.0;
+	uint32_t deviceId = 0;
+	int latencyUs = 0;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--link" && i + 1 < argc) {
+			linkPath = argv[++i];
+		}
+		else if (arg == "--drift-ppm" && i + 1 < argc) {
+			driftPpm = std::atof(argv[++i]);
+		}
+		else if (arg == "--id" && i + 1 < argc && ParseDeviceId(argv[i + 1], deviceId)) {
+			++i;
+		}
+		else if (arg == "--latency-us" && i + 1 < argc) {
+			latencyUs = std::max(0, std::atoi(argv[++i]));
+		}
+		else {
+			std::fprintf(stderr, "Usage: kwa-emulator [--link <path>] [--drift-ppm <ppm>] [--id <device ID>] [--latency-us <us>]\n");
+			return 2;
+		}
+	}
+	// Like the Arduino on its first startup, draw a device ID; 0 is reserved.
+	std::random_device random;
+	while (deviceId == 0) {
+		deviceId = random();
+	}
+
+	int master = ::posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || ::grantpt(master) != 0 || ::unlockpt(master) != 0) {
+		std::perror("Could not create pseudo-terminal");
+		return 1;
+	}
+	const char* slaveName = ::ptsname(master);
+
+	// Keep the slave side open, so that the master side stays readable while no client
+	// is connected, and put it in raw mode, like a serial port.
+	int slave = ::open(slaveName, O_RDWR | O_NOCTTY);
+	termios tio;
+	if (slave < 0 || ::tcgetattr(slave, &tio) != 0) {
+		std::perror("Could not open pseudo-terminal");
+		return 1;
+	}
+	::cfmakeraw(&tio);
+	::tcsetattr(slave, TCSANOW, &tio);
+
+	if (!linkPath.empty()) {
+		::unlink(linkPath.c_str());
+		if (::symlink(slaveName, linkPath.c_str()) != 0) {
+			std::perror("Could not create link");
+			return 1;
+		}
+	}
+	std::printf("%s\n", linkPath.empty() ? slaveName : linkPath.c_str());
+	std::fflush(stdout);
+
+	std::signal(SIGINT, OnInterrupt);
+	std::signal(SIGTERM, OnInterrupt);
+
+	Emulator emulator(master, driftPpm, deviceId, latencyUs);
+	emulator.Run();
+
+	if (!linkPath.empty()) {
+		::unlink(linkPath.c_str());
+	}
+	::close(slave);
+	::close(master);
+	return 0;
+}
@@ -0,0 +1,1070 @@
+#include "ArduinoController.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "Framing.h"
+#include "SpscRingBuffer.h"
+
+
+namespace KwaController {
+
+	namespace {
+		typedef std::chrono::steady_clock Clock;
+
+		// Capacity of the queue of decoded trigger edges. At 725 FPS, the consumer may fall
+		// behind by more than a minute before edges are dropped (and counted as lost).
+		const size_t EDGE_QUEUE_CAPACITY = 1 << 16;
+		// Max. time the I/O thread blocks in a read while no command is pending. New commands
+		// interrupt the read, so this only bounds the latency if a wake-up is lost.
+		const int IO_IDLE_READ_MS = 100;
+		// Time to wait for the reply to a ping while probing for the Arduino.
+		const int PROBE_TIMEOUT_MS = 200;
+		// Capacity of the queue of clock samples (more than a minute of samples).
+		const size_t CLOCK_QUEUE_CAPACITY = 1024;
+
+		std::string NakError(const Frame& reply) {
+			switch (reply.payload.empty() ? 0 : reply.payload[0]) {
+			case NAK_UNKNOWN_COMMAND:
+				return "The Arduino does not support this command; check that the latest sketch is uploaded.";
+			case NAK_BAD_PAYLOAD:
+				return "The Arduino rejected the parameters of the command.";
+			case NAK_INVALID_STATE:
+				return "The Arduino cannot execute the command in its current state.";
+			default:
+				return "The Arduino rejected the command.";
+			}
+		}
+
+		/// <summary>
+		/// Check that a timer event <c>endUs</c> after the trigger edge falls into the first timer
+		/// segment of a frame at <c>fps</c> Hz, less a margin, with the same integer arithmetic
+		/// as the Arduino (see <c>fitsFirstSegment()</c> in the sketch).
+		/// </summary>
+		/// <param name="maxEndUs">Receives the latest valid time of the event.</param>
+		bool FitsFirstSegment(uint64_t endUs, double fps, uint64_t& maxEndUs) {
+			const uint64_t cpuClock = static_cast<uint64_t>(ARDUINO_CPU_CLOCK_HZ);
+			uint64_t rate = static_cast<uint64_t>(std::lround(fps * FPS_RATE_SCALE));
+			uint64_t periodTicks = cpuClock * FPS_RATE_SCALE / rate;
+			uint64_t segments = (periodTicks + ARDUINO_MAX_SEGMENT_TICKS - 1) / ARDUINO_MAX_SEGMENT_TICKS;
+			uint64_t firstSegmentTicks = periodTicks / segments;
+			uint64_t ticksPerUs = cpuClock / 1000000;
+			maxEndUs = (firstSegmentTicks - ARDUINO_TIMER_EVENT_MARGIN - 1) / ticksPerUs;
+			return endUs * ticksPerUs + ARDUINO_TIMER_EVENT_MARGIN < firstSegmentTicks;
+		}
+
+		int64_t ToHostClockUs(Clock::time_point time) {
+			return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+		}
+
+		int MillisecondsLeft(Clock::time_point deadline) {
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+			return left > 0 ? static_cast<int>(left) : 0;
+		}
+	}
+
+	bool ParseLightPattern(const std::string& text, LightPattern& pattern) {
+		static const struct {
+			const char* name;
+			uint8_t mask;
+		} LIGHT_NAMES[] = {
+			{ "white", LIGHT_WHITE }, { "uv", LIGHT_UV },
+			{ "white-top", LIGHT_WHITE_FRONT_TOP }, { "white-bottom", LIGHT_WHITE_FRONT_BOTTOM },
+			{ "uv-top", LIGHT_UV_FRONT_TOP }, { "uv-wheel", LIGHT_UV_WHEEL }, { "off", 0 },
+		};
+
+		LightPattern result;
+		uint8_t mask = 0;
+		std::string name;
+		for (size_t i = 0; i <= text.size(); ++i) {
+			char c = i < text.size() ? static_cast<char>(std::tolower(static_cast<unsigned char>(text[i]))) : ',';
+			if (c == ' ' || c == '\t') {
+				continue;
+			}
+			if (c != '+' && c != ',') {
+				name += c;
+				continue;
+			}
+			bool found = false;
+			for (const auto& light : LIGHT_NAMES) {
+				if (name == light.name) {
+					mask |= light.mask;
+					found = true;
+				}
+			}
+			if (!found) {
+				return false;
+			}
+			name.clear();
+			if (c == ',') {
+				result.push_back(mask);
+				mask = 0;
+			}
+		}
+		if (result.size() > MAX_LIGHT_PATTERN) {
+			return false;
+		}
+		pattern.swap(result);
+		return true;
+	}
+
+	bool ParseStrobe(const std::string& text, Strobe& strobe) {
+		std::string value;
+		for (char c : text) {
+			if (c != ' ' && c != '\t') {
+				value += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+			}
+		}
+		if (value.empty() || value == "off") {
+			strobe = Strobe();
+			return true;
+		}
+
+		// Two numbers separated by ":", each fitting into the 16-bit field of CMD_START_REC.
+		int numbers[2] = { 0, 0 };
+		int count = 0;
+		size_t digits = 0;
+		for (size_t i = 0; i <= value.size(); ++i) {
+			char c = i < value.size() ? value[i] : ':';
+			if (c >= '0' && c <= '9') {
+				numbers[count] = numbers[count] * 10 + (c - '0');
+				if (numbers[count] > 0xFFFF) {
+					return false;
+				}
+				++digits;
+			}
+			else if (c != ':' || digits == 0 || ++count > 2) {
+				return false;
+			}
+			else {
+				digits = 0;
+			}
+		}
+		if (count != 2) {
+			return false;
+		}
+		strobe.offsetUs = numbers[0];
+		strobe.widthUs = numbers[1];
+		return true;
+	}
+
+	std::string CheckFps(double fps) {
+		// Compare the rate as sent, in 1/FPS_RATE_SCALE Hz (NaN fails both comparisons).
+		double rate = std::round(fps * FPS_RATE_SCALE);
+		if (!(rate >= ARDUINO_MIN_FPS * FPS_RATE_SCALE && rate <= ARDUINO_MAX_FPS * FPS_RATE_SCALE)) {
+			return "The frame rate must be from " + std::to_string(static_cast<int>(ARDUINO_MIN_FPS)) + " to " +
+				std::to_string(static_cast<int>(ARDUINO_MAX_FPS)) + " FPS.";
+		}
+		uint64_t maxEndUs = 0;
+		if (!FitsFirstSegment(ARDUINO_TRIGGER_PULSE_US, fps, maxEndUs)) {
+			return "The frame rate is too high for the trigger pulse of " + std::to_string(ARDUINO_TRIGGER_PULSE_US) + " us.";
+		}
+		return std::string();
+	}
+
+	std::string CheckStrobe(const Strobe& strobe, double fps) {
+		if (strobe.widthUs == 0) {
+			return std::string();
+		}
+		if (strobe.offsetUs < 0 || strobe.widthUs < 0 || strobe.offsetUs > 0xFFFF || strobe.widthUs > 0xFFFF) {
+			return "Invalid strobe offset or width.";
+		}
+		std::string fpsError = CheckFps(fps);
+		if (!fpsError.empty()) {
+			return fpsError;
+		}
+		// The strobe must end within the first timer segment of a frame, less a margin.
+		uint64_t maxEndUs = 0;
+		if (!FitsFirstSegment(static_cast<uint64_t>(strobe.offsetUs + strobe.widthUs), fps, maxEndUs)) {
+			return "The strobe must end within " + std::to_string(maxEndUs) + " us after the trigger edge at this frame rate.";
+		}
+		return std::string();
+	}
+
+	bool ParseTriggerPhases(const std::string& text, TriggerPhases& phases) {
+		std::string value;
+		for (char c : text) {
+			if (c != ' ' && c != '\t') {
+				value += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+			}
+		}
+		TriggerPhases result;
+		if (!value.empty() && value != "off") {
+			int number = 0;
+			size_t digits = 0;
+			for (size_t i = 0; i <= value.size(); ++i) {
+				char c = i < value.size() ? value[i] : ',';
+				if (c >= '0' && c <= '9') {
+					number = number * 10 + (c - '0');
+					if (number > 0xFFFF) {
+						return false;
+					}
+					++digits;
+				}
+				else if (c != ',' || digits == 0) {
+					return false;
+				}
+				else {
+					result.push_back(number);
+					number = 0;
+					digits = 0;
+				}
+			}
+		}
+		if (result.size() > MAX_AUX_TRIGGERS) {
+			return false;
+		}
+		phases.swap(result);
+		return true;
+	}
+
+	std::string CheckTriggerPhases(const TriggerPhases& phases, double fps) {
+		if (phases.size() > MAX_AUX_TRIGGERS) {
+			return "The Arduino has " + std::to_string(MAX_AUX_TRIGGERS) + " auxiliary trigger output(s).";
+		}
+		std::string fpsError = CheckFps(fps);
+		if (!fpsError.empty()) {
+			return fpsError;
+		}
+		for (int phaseUs : phases) {
+			if (phaseUs < 0 || phaseUs > 0xFFFF) {
+				return "Invalid trigger phase.";
+			}
+			// A pulse at phase 0 starts with the trigger edge and is not a timer event.
+			uint64_t maxEndUs = 0;
+			if (phaseUs != 0 && !FitsFirstSegment(static_cast<uint64_t>(phaseUs + ARDUINO_TRIGGER_PULSE_US), fps, maxEndUs)) {
+				return "The auxiliary trigger pulse must end within " + std::to_string(maxEndUs) +
+					" us after the trigger edge at this frame rate.";
+			}
+		}
+		return std::string();
+	}
+
+
+	/// <summary>
+	/// Command queue and I/O thread of <c>ArduinoController</c>. All members not guarded by
+	/// <c>mutex</c> (or atomic) are only accessed by the I/O thread.
+	/// </summary>
+	class ArduinoController::Impl {
+	public:
+		enum class CommandType { Connect, Disconnect, StartRecording, StopRecording, SetFps, SetStimulus, Ping };
+
+		struct Command {
+			CommandType type;
+			std::string portName;  // For `Connect`.
+			int baudrate;          // For `Connect`.
+			double fps;            // For `StartRecording` and `SetFps`.
+			LightPattern lights;   // For `StartRecording`; the stimulus lights as single entry for `SetStimulus`.
+			Strobe strobe;         // For `StartRecording`.
+			TriggerPhases auxTriggers;  // For `StartRecording`.
+			int64_t startHostUs;   // For `StartRecording`.
+			CommandCallback done;
+		};
+
+		explicit Impl(std::unique_ptr<SerialTransport> transport)
+			: transport(std::move(transport)), recordingStrobe(), edgeQueue(EDGE_QUEUE_CAPACITY),
+			clockQueue(CLOCK_QUEUE_CAPACITY), isClockSyncSupported(false), stimulusTiming(), nextSeq(0), rxPos(0), rxLen(0), ioFailed(false), state(ArduinoState::Disconnected), baudrate(0), quit(false), triggerSummary() {
+			this->thread = std::thread(&Impl::Run, this);
+		}
+
+		~Impl() {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->quit = true;
+			}
+			this->wakeUp.notify_one();
+			this->transport->Interrupt();
+			this->thread.join();
+		}
+
+		void Submit(Command command) {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->commands.push_back(std::move(command));
+			}
+			this->wakeUp.notify_one();
+			this->transport->Interrupt();
+		}
+
+		bool IsIoThread() const {
+			return std::this_thread::get_id() == this->thread.get_id();
+		}
+
+		void SetConnectionLostHandler(ConnectionLostHandler handler) {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->connectionLost = std::move(handler);
+		}
+
+		void TakeEdges(std::vector<TriggerEdge>& edges) {
+			edges.clear();
+			TriggerEdge edge;
+			while (this->edgeQueue.TryPop(edge)) {
+				edges.push_back(edge);
+			}
+		}
+
+		void TakeClockSamples(std::vector<ClockSample>& samples) {
+			samples.clear();
+			ClockSample sample;
+			while (this->clockQueue.TryPop(sample)) {
+				samples.push_back(sample);
+			}
+		}
+
+		ArduinoState State() const {
+			return this->state.load();
+		}
+
+		int Baudrate() const {
+			return this->baudrate.load();
+		}
+
+		TriggerSummary LastTriggerSummary() const {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			return this->triggerSummary;
+		}
+
+		std::string PortName() const {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			return this->portName;
+		}
+
+		DeviceInfo Device() const {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			return this->device;
+		}
+
+		/// <summary>
+		/// Timing of the last successful stimulus command; I/O thread only (i.e., in the
+		/// command's callback).
+		/// </summary>
+		const StimulusTiming& LastStimulus() const {
+			return this->stimulusTiming;
+		}
+
+	private:
+		/// <summary>
+		/// Main loop of the I/O thread: execute queued commands; in between, decode all data
+		/// received from the Arduino.
+		/// </summary>
+		void Run() {
+			while (true) {
+				Command command;
+				bool hasCommand = false;
+				{
+					std::unique_lock<std::mutex> lock(this->mutex);
+					if (this->state == ArduinoState::Disconnected) {
+						this->wakeUp.wait(lock, [this]() { return this->quit || !this->commands.empty(); });
+					}
+					if (this->quit) {
+						break;
+					}
+					if (!this->commands.empty()) {
+						command = std::move(this->commands.front());
+						this->commands.pop_front();
+						hasCommand = true;
+					}
+				}
+
+				if (hasCommand) {
+					CommandResult result = this->Execute(command);
+					if (command.done) {
+						command.done(result);
+					}
+				}
+				else if (!(this->IsClockSyncDue() ? this->SyncClock() : this->ReadInput())) {
+					ConnectionLostHandler handler;
+					{
+						std::lock_guard<std::mutex> lock(this->mutex);
+						handler = this->connectionLost;
+					}
+					if (handler) {
+						handler(this->error);
+					}
+				}
+			}
+
+			if (this->state != ArduinoState::Disconnected) {
+				this->DoDisconnect();
+			}
+		}
+
+		CommandResult Execute(const Command& command) {
+			Clock::time_point start = Clock::now();
+			bool success = false;
+			switch (command.type) {
+			case CommandType::Connect:
+				success = this->DoConnect(command.portName, command.baudrate);
+				break;
+			case CommandType::Disconnect:
+				success = this->DoDisconnect();
+				break;
+			case CommandType::StartRecording:
+				success = this->DoStartRecording(command.fps, command.lights, command.strobe, command.auxTriggers, command.startHostUs);
+				break;
+			case CommandType::StopRecording:
+				success = this->DoStopRecording();
+				break;
+			case CommandType::SetFps:
+				success = this->DoSetFps(command.fps);
+				break;
+			case CommandType::SetStimulus:
+				success = this->DoSetStimulus(command.lights.empty() ? 0 : command.lights[0]);
+				break;
+			case CommandType::Ping:
+				success = this->DoPing();
+				break;
+			}
+			CommandResult result;
+			result.success = success;
+			result.error = success ? std::string() : this->error;
+			result.roundTripUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+			this->CloseIfFailed();
+			return result;
+		}
+
+		/// <summary>
+		/// Wait for and handle frames received while no command is executed. Replies to
+		/// earlier (e.g., timed out) commands are ignored.
+		/// </summary>
+		/// <returns><c>false</c> if the serial port failed; it is closed then.</returns>
+		bool ReadInput() {
+			if (this->rxPos == this->rxLen) {
+				int timeoutMs = IO_IDLE_READ_MS;
+				if (this->state == ArduinoState::Recording && this->isClockSyncSupported) {
+					timeoutMs = std::min(timeoutMs, MillisecondsLeft(this->nextClockSync));
+				}
+				int count = this->transport->Read(this->rxBuf, sizeof(this->rxBuf), timeoutMs);
+				if (count < 0) {
+					this->FailIo();
+					this->CloseIfFailed();
+					return false;
+				}
+				this->rxPos = 0;
+				this->rxLen = static_cast<size_t>(count);
+				this->rxTime = Clock::now();
+			}
+			// Also handles bytes left over from the last reply.
+			while (this->rxPos < this->rxLen) {
+				if (this->frameDecoder.Feed(this->rxBuf[this->rxPos++], this->frame)) {
+					this->HandleEvent(this->frame);
+				}
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// Handle a frame sent by the Arduino on its own (i.e., not a reply).
+		/// </summary>
+		void HandleEvent(const Frame& frame) {
+			// Telemetry received outside of a recording (e.g., while stopping a recording
+			// left running by another client) is not passed on.
+			if (frame.type == EVT_TELEMETRY && this->state == ArduinoState::Recording) {
+				this->telemetryDecoder.Decode(frame.payload.data(), frame.payload.size());
+				this->ForwardEdges();
+			}
+		}
+
+		/// <summary>
+		/// Pass decoded trigger edges to the consumer. If the consumer fell behind, edges are
+		/// dropped, which shows up as lost edges in the trigger statistics.
+		/// </summary>
+		void ForwardEdges() {
+			this->telemetryDecoder.TakeEdges(this->decodedEdges);
+			for (const TriggerEdge& edge : this->decodedEdges) {
+				this->edgeQueue.TryPush(edge);
+			}
+		}
+
+		bool IsClockSyncDue() const {
+			return this->state == ArduinoState::Recording && this->isClockSyncSupported && Clock::now() >= this->nextClockSync;
+		}
+
+		/// <summary>
+		/// Sample the Arduino's trigger clock and pass the sample to the consumer. A missing
+		/// reply only skips the sample.
+		/// </summary>
+		/// <returns><c>false</c> if the serial port failed; it is closed then.</returns>
+		bool SyncClock() {
+			this->nextClockSync = Clock::now() + std::chrono::milliseconds(CLOCK_SYNC_INTERVAL_MS);
+			Frame reply = Frame();
+			Clock::time_point sent = Clock::now();
+			if (this->Request(CMD_SYNC, std::vector<uint8_t>(), ARDUINO_RESPONSE_TIMEOUT_MS, reply)) {
+				if (reply.payload.size() >= 4) {
+					// The reply arrived with the last read; frames decoded after it in the
+					// same read do not delay its timestamp.
+					ClockSample sample;
+					sample.ticks = this->telemetryDecoder.Unwrap(ReadLong(reply.payload.data()));
+					sample.hostSendUs = ToHostClockUs(sent);
+					sample.hostReceiveUs = ToHostClockUs(this->rxTime);
+					this->clockQueue.TryPush(sample);
+				}
+			}
+			else if (reply.type == RSP_NAK && !reply.payload.empty() && reply.payload[0] == NAK_UNKNOWN_COMMAND) {
+				this->isClockSyncSupported = false;  // Older sketch; recording works without.
+			}
+			bool failed = this->ioFailed;
+			this->CloseIfFailed();
+			return !failed;
+		}
+
+		bool DoConnect(const std::string& requestedPort, int baudrate) {
+			if (this->state != ArduinoState::Disconnected) {
+				this->DoDisconnect();
+			}
+			DeviceDiscovery discovery;
+			std::string portName = requestedPort;
+			if (portName.empty()) {
+				DeviceInfo found;
+				if (!discovery.Find(found)) {
+					return this->Fail(discovery.LastError());
+				}
+				portName = found.portName;
+			}
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->portName = portName;
+				this->device = DeviceInfo();
+			}
+
+			if (!this->transport->Open(portName, ARDUINO_BAUDRATE)) {
+				return this->Fail("Could not open serial port " + portName + ".");
+			}
+			this->baudrate = ARDUINO_BAUDRATE;
+			this->rxPos = this->rxLen = 0;
+			this->ioFailed = false;
+			this->frameDecoder.Reset();
+			this->telemetryDecoder.Reset();
+			this->state = ArduinoState::Idle;
+
+			/**
+			 * Opening a port only tells us that some device exists. Therefore, we need to test
+			 * whether the Arduino responds on the opened port. Ping it until it responds, as
+			 * opening the port may have reset it (see ARDUINO_RESET_TIMEOUT_MS). Its baudrate
+			 * is unknown: it runs at ARDUINO_BAUDRATE after a reset, but may still run at a
+			 * negotiated rate (e.g., after a client crash).
+			 */
+			Frame reply;
+			bool found = false;
+			Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(ARDUINO_RESET_TIMEOUT_MS);
+			while (!found && !this->ioFailed && Clock::now() < deadline) {
+				found = this->Request(CMD_PING, std::vector<uint8_t>(), PROBE_TIMEOUT_MS, reply);
+				if (!found && baudrate != ARDUINO_BAUDRATE && !this->ioFailed) {
+					found = this->SwitchBaudrate(baudrate) && this->Request(CMD_PING, std::vector<uint8_t>(), PROBE_TIMEOUT_MS, reply);
+					if (!found) {
+						this->SwitchBaudrate(ARDUINO_BAUDRATE);
+					}
+				}
+			}
+			if (!found) {
+				this->transport->Close();
+				this->state = ArduinoState::Disconnected;
+				return this->Fail("Could not communicate with Arduino on port " + portName + ".\n"
+					"Check that the Arduino is connected to the computer and the selected port is correct.");
+			}
+
+			// Stop a recording still running on the Arduino; its telemetry is discarded.
+			if (!reply.payload.empty() && reply.payload[0] == PING_STATE_RECORDING &&
+				!this->Request(CMD_STOP_REC, std::vector<uint8_t>(), ARDUINO_RESPONSE_TIMEOUT_MS, reply)) {
+				return false;
+			}
+
+			if (this->baudrate != baudrate) {
+				this->NegotiateBaudrate(baudrate);
+			}
+			if (!this->ioFailed && this->Identify()) {
+				discovery.Remember(this->Device());
+			}
+			return !this->ioFailed;
+		}
+
+		/// <summary>
+		/// Query the identity of the Arduino. A sketch that predates CMD_IDENTIFY stays
+		/// unidentified; this is not an error.
+		/// </summary>
+		/// <returns><c>true</c> if the Arduino identified itself.</returns>
+		bool Identify() {
+			Frame reply = Frame();
+			DeviceInfo identity;
+			if (!this->Request(CMD_IDENTIFY, std::vector<uint8_t>(), ARDUINO_RESPONSE_TIMEOUT_MS, reply) ||
+				!DecodeIdentifyReply(reply.payload, identity)) {
+				return false;
+			}
+			identity.portName = this->portName;
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->device = identity;
+			return true;
+		}
+
+		/// <summary>
+		/// Switch the link to <c>baudrate</c>. If the Arduino does not respond at the new rate,
+		/// it falls back to its default rate, and so does the link; this is not an error.
+		/// </summary>
+		void NegotiateBaudrate(int baudrate) {
+			std::vector<uint8_t> payload;
+			AppendLong(payload, static_cast<uint32_t>(baudrate));
+			Frame reply;
+			if (!this->Request(CMD_SET_BAUDRATE, payload, ARDUINO_RESPONSE_TIMEOUT_MS, reply)) {
+				return;  // E.g., rate not supported by the Arduino; keep current rate.
+			}
+			// The Arduino switches right after its reply was sent. Any frame it receives at the
+			// new rate confirms the switch; otherwise, it falls back to ARDUINO_BAUDRATE.
+			Clock::time_point fallback = Clock::now() + std::chrono::milliseconds(ARDUINO_BAUDRATE_CONFIRM_TIMEOUT_MS);
+			if (this->SwitchBaudrate(baudrate)) {
+				for (int attempt = 0; attempt < 3 && !this->ioFailed; ++attempt) {
+					if (this->Request(CMD_PING, std::vector<uint8_t>(), PROBE_TIMEOUT_MS, reply)) {
+						return;
+					}
+				}
+			}
+			std::this_thread::sleep_until(fallback);
+			this->SwitchBaudrate(ARDUINO_BAUDRATE);
+			this->Request(CMD_PING, std::vector<uint8_t>(), ARDUINO_RESPONSE_TIMEOUT_MS, reply);
+		}
+
+		bool SwitchBaudrate(int baudrate) {
+			if (!this->transport->SetBaudrate(baudrate)) {
+				return false;
+			}
+			this->baudrate = baudrate;
+			this->rxPos = this->rxLen = 0;
+			this->frameDecoder.Reset();
+			return true;
+		}
+
+		bool DoDisconnect() {
+			if (this->state == ArduinoState::Recording) {
+				this->DoStopRecording();
+			}
+			this->transport->Close();
+			this->state = ArduinoState::Disconnected;
+			this->baudrate = 0;
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->device = DeviceInfo();
+			return true;
+		}
+
+		bool DoStartRecording(double fps, const LightPattern& lights, const Strobe& strobe, const TriggerPhases& auxTriggers,
+			int64_t startHostUs) {
+			if (this->state != ArduinoState::Idle) {
+				return this->Fail(this->state == ArduinoState::Recording ? "Recording is already running." : "Not connected.");
+			}
+			std::string fpsError = CheckFps(fps);
+			if (!fpsError.empty()) {
+				return this->Fail(fpsError);
+			}
+			if (lights.empty() || lights.size() > MAX_LIGHT_PATTERN) {
+				return this->Fail("The light pattern must have 1 to " + std::to_string(MAX_LIGHT_PATTERN) + " frames.");
+			}
+			for (uint8_t mask : lights) {
+				if (mask & ~LIGHT_ALL) {
+					return this->Fail("Invalid lights in light pattern.");
+				}
+			}
+			std::string strobeError = CheckStrobe(strobe, fps);
+			if (!strobeError.empty()) {
+				return this->Fail(strobeError);
+			}
+			std::string triggerError = CheckTriggerPhases(auxTriggers, fps);
+			if (!triggerError.empty()) {
+				return this->Fail(triggerError);
+			}
+
+			// Auxiliary trigger outputs; also measures the round trip for a scheduled start.
+			std::vector<uint8_t> payload;
+			for (int phaseUs : auxTriggers) {
+				AppendShort(payload, static_cast<uint16_t>(phaseUs));
+			}
+			Frame reply = Frame();
+			Clock::time_point sent = Clock::now();
+			if (!this->Request(CMD_SET_TRIGGERS, payload, ARDUINO_RESPONSE_TIMEOUT_MS, reply)) {
+				bool isOldSketch = reply.type == RSP_NAK && !reply.payload.empty() && reply.payload[0] == NAK_UNKNOWN_COMMAND;
+				if (!isOldSketch || !auxTriggers.empty() || startHostUs != 0) {
+					return false;
+				}
+			}
+			double oneWayUs = 0.5 * std::chrono::duration<double, std::micro>(this->rxTime - sent).count();
+
+			// Start delay in us (32-bit word; scheduled start only)
+			payload.clear();
+			if (startHostUs != 0) {
+				double delayUs = startHostUs - HostClockUs() - oneWayUs;
+				if (delayUs < 0.0) {
+					return this->Fail("The start time has passed before the start command could be sent.");
+				}
+				if (delayUs > ARDUINO_MAX_START_DELAY_US) {
+					return this->Fail("The start time is too far ahead.");
+				}
+				AppendLong(payload, static_cast<uint32_t>(delayUs + 0.5));
+			}
+			// FPS value in mHz (32-bit word, network byte order)
+			AppendLong(payload, static_cast<uint32_t>(std::lround(fps * FPS_RATE_SCALE)));
+			// Strobe offset and width in us (16-bit words)
+			AppendShort(payload, static_cast<uint16_t>(strobe.widthUs != 0 ? strobe.offsetUs : 0));
+			AppendShort(payload, static_cast<uint16_t>(strobe.widthUs));
+			payload.insert(payload.end(), lights.begin(), lights.end());
+			this->telemetryDecoder.Reset();
+			// The Arduino may send telemetry right after its reply, so expect it beforehand.
+			this->state = ArduinoState::Recording;
+			if (!this->Request(startHostUs != 0 ? CMD_START_REC_AT : CMD_START_REC, payload, ARDUINO_RESPONSE_TIMEOUT_MS, reply)) {
+				this->state = ArduinoState::Idle;
+				return false;
+			}
+			this->recordingStrobe = strobe;
+			this->recordingAuxTriggers = auxTriggers;
+			this->isClockSyncSupported = true;
+			this->nextClockSync = Clock::now();
+			return true;
+		}
+
+		bool DoSetFps(double fps) {
+			if (this->state != ArduinoState::Recording) {
+				return this->Fail(this->state == ArduinoState::Idle ? "No recording is running." : "Not connected.");
+			}
+			std::string fpsError = CheckFps(fps);
+			if (!fpsError.empty()) {
+				return this->Fail(fpsError);
+			}
+			std::string strobeError = CheckStrobe(this->recordingStrobe, fps);
+			if (!strobeError.empty()) {
+				return this->Fail(strobeError);
+			}
+			std::string triggerError = CheckTriggerPhases(this->recordingAuxTriggers, fps);
+			if (!triggerError.empty()) {
+				return this->Fail(triggerError);
+			}
+
+			std::vector<uint8_t> payload;
+			AppendLong(payload, static_cast<uint32_t>(std::lround(fps * FPS_RATE_SCALE)));
+			Frame reply;
+			return this->Request(CMD_SET_RATE, payload, ARDUINO_RESPONSE_TIMEOUT_MS, reply);
+		}
+
+		bool DoSetStimulus(uint8_t lights) {
+			if (this->state != ArduinoState::Recording) {
+				return this->Fail(this->state == ArduinoState::Idle ? "No recording is running." : "Not connected.");
+			}
+			if (lights & ~LIGHT_ALL) {
+				return this->Fail("Invalid stimulus lights.");
+			}
+
+			Frame reply;
+			if (!this->Request(CMD_SET_STIMULUS, std::vector<uint8_t>(1, lights), ARDUINO_RESPONSE_TIMEOUT_MS, reply)) {
+				return false;
+			}
+			if (reply.payload.size() < 8) {
+				return this->Fail("Invalid reply of the Arduino to the stimulus command.");
+			}
+			this->stimulusTiming.firstFrame = ReadLong(reply.payload.data());
+			this->stimulusTiming.receivedTicks = this->telemetryDecoder.Unwrap(ReadLong(reply.payload.data() + 4));
+			return true;
+		}
+
+		bool DoStopRecording() {
+			if (this->state == ArduinoState::Disconnected) {
+				return this->Fail("Not connected.");
+			}
+			// The Arduino sends its remaining trigger telemetry before the reply.
+			Frame reply;
+			bool stopped = this->Request(CMD_STOP_REC, std::vector<uint8_t>(), ARDUINO_RESPONSE_TIMEOUT_MS, reply);
+			this->state = ArduinoState::Idle;
+			if (stopped && reply.payload.size() >= 8) {
+				TriggerSummary summary;
+				summary.pulseCount = ReadLong(reply.payload.data());
+				summary.lastPulseTicks = this->telemetryDecoder.Unwrap(ReadLong(reply.payload.data() + 4));
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->triggerSummary = summary;
+			}
+			return stopped;
+		}
+
+		bool DoPing() {
+			if (this->state != ArduinoState::Idle) {
+				return this->Fail(this->state == ArduinoState::Recording ? "Cannot ping while recording." : "Not connected.");
+			}
+			Frame reply;
+			return this->Request(CMD_PING, std::vector<uint8_t>(), ARDUINO_RESPONSE_TIMEOUT_MS, reply);
+		}
+
+		/// <summary>
+		/// Append a command frame to the transmit buffer, which is sent by <c>Flush()</c>.
+		/// Several commands may be queued to send them in one write.
+		/// </summary>
+		/// <returns>The sequence number of the command, identifying its reply.</returns>
+		uint8_t QueueCommand(uint8_t type, const std::vector<uint8_t>& payload) {
+			uint8_t seq = this->nextSeq++;
+			AppendFrame(this->txBuf, type, seq, payload.data(), payload.size());
+			return seq;
+		}
+
+		bool Flush() {
+			bool written = this->transport->Write(this->txBuf.data(), this->txBuf.size());
+			this->txBuf.clear();
+			if (!written) {
+				this->ioFailed = true;
+				return this->Fail("Could not write to serial port " + this->portName + ".");
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// Send a command and wait for its reply.
+		/// </summary>
+		/// <returns><c>true</c> if the Arduino acknowledged the command.</returns>
+		bool Request(uint8_t type, const std::vector<uint8_t>& payload, int timeoutMs, Frame& reply) {
+			uint8_t seq = this->QueueCommand(type, payload);
+			if (!this->Flush() ||
+				!this->AwaitReply(seq, Clock::now() + std::chrono::milliseconds(timeoutMs), reply)) {
+				return false;
+			}
+			if (reply.type != RSP_ACK) {
+				return this->Fail(NakError(reply));
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// Wait for the reply to the command with sequence number <c>seq</c>, handling all
+		/// other frames received before it.
+		/// </summary>
+		bool AwaitReply(uint8_t seq, Clock::time_point deadline, Frame& reply) {
+			while (true) {
+				while (this->rxPos < this->rxLen) {
+					if (!this->frameDecoder.Feed(this->rxBuf[this->rxPos++], reply)) {
+						continue;
+					}
+					if (reply.type == RSP_ACK || reply.type == RSP_NAK) {
+						if (reply.seq == seq) {
+							return true;
+						}
+						// Reply to an earlier command that timed out; ignore.
+					}
+					else {
+						this->HandleEvent(reply);
+					}
+				}
+				int left = MillisecondsLeft(deadline);
+				int count = this->transport->Read(this->rxBuf, sizeof(this->rxBuf), left);
+				if (count < 0) {
+					return this->FailIo();
+				}
+				if (count == 0) {
+					if (left == 0) {
+						return this->Fail("No response from Arduino on port " + this->portName + ".");
+					}
+					continue;  // Interrupted by a new command; keep waiting.
+				}
+				this->rxPos = 0;
+				this->rxLen = static_cast<size_t>(count);
+				this->rxTime = Clock::now();
+			}
+		}
+
+		bool Fail(const std::string& error) {
+			this->error = error;
+			return false;
+		}
+
+		bool FailIo() {
+			this->ioFailed = true;
+			return this->Fail("Could not read from serial port " + this->portName + ".");
+		}
+
+		/// <summary>
+		/// Close the serial port after an I/O error (e.g., the Arduino was unplugged).
+		/// </summary>
+		void CloseIfFailed() {
+			if (this->ioFailed) {
+				this->ioFailed = false;
+				this->transport->Close();
+				this->state = ArduinoState::Disconnected;
+			}
+		}
+
+		// Owned by the I/O thread.
+		std::unique_ptr<SerialTransport> transport;
+		FrameDecoder frameDecoder;
+		Frame frame;
+		TelemetryDecoder telemetryDecoder;
+		Strobe recordingStrobe;  // Strobe of the running recording.
+		TriggerPhases recordingAuxTriggers;  // Auxiliary trigger outputs of the running recording.
+		std::vector<TriggerEdge> decodedEdges;
+		SpscRingBuffer<TriggerEdge> edgeQueue;  // Decoded edges; I/O thread => consumer.
+		SpscRingBuffer<ClockSample> clockQueue;  // Clock samples; I/O thread => consumer.
+		bool isClockSyncSupported;        // `false` if the Arduino rejected CMD_SYNC during this recording.
+		Clock::time_point nextClockSync;  // Time of the next clock sample while recording.
+		StimulusTiming stimulusTiming;    // Reply to the last successful stimulus command.
+		std::vector<uint8_t> txBuf;
+		uint8_t nextSeq;
+		uint8_t rxBuf[256];
+		size_t rxPos;
+		size_t rxLen;
+		Clock::time_point rxTime;  // Time the last read returned.
+		std::string error;
+		bool ioFailed;
+
+		// Shared between threads.
+		std::atomic<ArduinoState> state;
+		std::atomic<int> baudrate;         // Current baudrate of the link; 0 if disconnected.
+		mutable std::mutex mutex;
+		std::condition_variable wakeUp;    // Signaled on new commands and on shutdown.
+		std::deque<Command> commands;      // Guarded by `mutex`.
+		bool quit;                         // Guarded by `mutex`.
+		std::string portName;              // Written by the I/O thread; guarded by `mutex`.
+		DeviceInfo device;                 // Written by the I/O thread; guarded by `mutex`.
+		TriggerSummary triggerSummary;     // Written by the I/O thread; guarded by `mutex`.
+		ConnectionLostHandler connectionLost;  // Guarded by `mutex`.
+		std::thread thread;
+	};
+
+
+	ArduinoController::ArduinoController(std::unique_ptr<SerialTransport> transport)
+		: impl(new Impl(std::move(transport))) {
+	}
+
+	ArduinoController::~ArduinoController() {
+	}
+
+	void ArduinoController::ConnectAsync(const std::string& portName, CommandCallback done, int baudrate) {
+		this->impl->Submit({ Impl::CommandType::Connect, portName, baudrate, 0.0, LightPattern(), Strobe(), TriggerPhases(), 0, std::move(done) });
+	}
+
+	void ArduinoController::DisconnectAsync(CommandCallback done) {
+		this->impl->Submit({ Impl::CommandType::Disconnect, std::string(), 0, 0.0, LightPattern(), Strobe(), TriggerPhases(), 0, std::move(done) });
+	}
+
+	void ArduinoController::StartRecordingAsync(double fps, CommandCallback done, const LightPattern& lights, const Strobe& strobe,
+		const TriggerPhases& auxTriggers, int64_t startHostUs) {
+		this->impl->Submit({ Impl::CommandType::StartRecording, std::string(), 0, fps, lights, strobe, auxTriggers, startHostUs,
+			std::move(done) });
+	}
+
+	void ArduinoController::StopRecordingAsync(CommandCallback done) {
+		this->impl->Submit({ Impl::CommandType::StopRecording, std::string(), 0, 0.0, LightPattern(), Strobe(), TriggerPhases(), 0, std::move(done) });
+	}
+
+	void ArduinoController::SetFpsAsync(double fps, CommandCallback done) {
+		this->impl->Submit({ Impl::CommandType::SetFps, std::string(), 0, fps, LightPattern(), Strobe(), TriggerPhases(), 0, std::move(done) });
+	}
+
+	void ArduinoController::SetStimulusAsync(uint8_t lights, StimulusCallback done) {
+		// The callback runs right after the command on the I/O thread, which owns the timing.
+		Impl* impl = this->impl.get();
+		CommandCallback commandDone = [impl, done](const CommandResult& result) {
+			if (done) {
+				done(result, impl->LastStimulus());
+			}
+		};
+		this->impl->Submit({ Impl::CommandType::SetStimulus, std::string(), 0, 0.0, LightPattern(1, lights), Strobe(), TriggerPhases(), 0,
+			std::move(commandDone) });
+	}
+
+	void ArduinoController::PingAsync(CommandCallback done) {
+		this->impl->Submit({ Impl::CommandType::Ping, std::string(), 0, 0.0, LightPattern(), Strobe(), TriggerPhases(), 0, std::move(done) });
+	}
+
+	bool ArduinoController::Connect(const std::string& portName, int baudrate) {
+		CommandResult result;
+		return this->Wait([&](CommandCallback done) { this->ConnectAsync(portName, std::move(done), baudrate); }, result);
+	}
+
+	void ArduinoController::Disconnect() {
+		CommandResult result;
+		this->Wait([&](CommandCallback done) { this->DisconnectAsync(std::move(done)); }, result);
+	}
+
+	bool ArduinoController::StartRecording(double fps, const LightPattern& lights, const Strobe& strobe,
+		const TriggerPhases& auxTriggers, int64_t startHostUs) {
+		CommandResult result;
+		return this->Wait([&](CommandCallback done) {
+			this->StartRecordingAsync(fps, std::move(done), lights, strobe, auxTriggers, startHostUs);
+		}, result);
+	}
+
+	bool ArduinoController::StopRecording() {
+		CommandResult result;
+		return this->Wait([&](CommandCallback done) { this->StopRecordingAsync(std::move(done)); }, result);
+	}
+
+	bool ArduinoController::SetFps(double fps) {
+		CommandResult result;
+		return this->Wait([&](CommandCallback done) { this->SetFpsAsync(fps, std::move(done)); }, result);
+	}
+
+	bool ArduinoController::SetStimulus(uint8_t lights, StimulusTiming& timing) {
+		CommandResult result;
+		return this->Wait([&](CommandCallback done) {
+			this->SetStimulusAsync(lights, [done, &timing](const CommandResult& r, const StimulusTiming& t) {
+				if (r.success) {
+					timing = t;
+				}
+				done(r);
+			});
+		}, result);
+	}
+
+	bool ArduinoController::Ping(double& roundTripUs) {
+		CommandResult result;
+		if (!this->Wait([&](CommandCallback done) { this->PingAsync(std::move(done)); }, result)) {
+			return false;
+		}
+		roundTripUs = result.roundTripUs;
+		return true;
+	}
+
+	bool ArduinoController::Wait(const std::function<void(CommandCallback)>& submit, CommandResult& result) {
+		if (this->impl->IsIoThread()) {
+			// The command could never complete, as it would be queued behind the current one.
+			this->lastError = "Blocking command called from a command callback.";
+			return false;
+		}
+		std::promise<CommandResult> promise;
+		std::future<CommandResult> future = promise.get_future();
+		submit([&promise](const CommandResult& r) { promise.set_value(r); });
+		result = future.get();
+		if (!result.success) {
+			this->lastError = result.error;
+		}
+		return result.success;
+	}
+
+	void ArduinoController::SetConnectionLostHandler(ConnectionLostHandler handler) {
+		this->impl->SetConnectionLostHandler(std::move(handler));
+	}
+
+	void ArduinoController::TakeEdges(std::vector<TriggerEdge>& edges) {
+		this->impl->TakeEdges(edges);
+	}
+
+	void ArduinoController::TakeClockSamples(std::vector<ClockSample>& samples) {
+		this->impl->TakeClockSamples(samples);
+	}
+
+	ArduinoState ArduinoController::State() const {
+		return this->impl->State();
+	}
+
+	int ArduinoController::Baudrate() const {
+		return this->impl->Baudrate();
+	}
+
+	TriggerSummary ArduinoController::LastTriggerSummary() const {
+		return this->impl->LastTriggerSummary();
+	}
+
+	std::string ArduinoController::PortName() const {
+		return this->impl->PortName();
+	}
+
+	DeviceInfo ArduinoController::Device() const {
+		return this->impl->Device();
+	}
+}
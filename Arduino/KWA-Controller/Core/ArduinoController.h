@@ -0,0 +1,274 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ArduinoProtocol.h"
+#include "ClockSync.h"
+#include "Discovery.h"
+#include "SerialTransport.h"
+#include "TriggerTelemetry.h"
+
+// NOTE: This header is included by the (/clr) main form and therefore must not include
+// <atomic>, <mutex>, <thread>, or <future>; these are used by the implementation only.
+
+
+namespace KwaController {
+
+	/// <summary>
+	/// State of the communication with the Arduino, as tracked by <c>ArduinoController</c>.
+	/// </summary>
+	enum class ArduinoState {
+		Disconnected,  // Serial port closed.
+		Idle,          // Arduino waits for a client to start a recording.
+		Recording      // Lights are on and camera is triggered.
+	};
+
+	/// <summary>
+	/// Result of a command sent to the Arduino.
+	/// </summary>
+	struct CommandResult {
+		bool success;
+		std::string error;   // Describes the error if `success` is `false`.
+		double roundTripUs;  // Execution time on the I/O thread, i.e., from the first request to the last response.
+	};
+
+	/// <summary>
+	/// Lights switched on for consecutive frames of a recording (<c>LIGHT_...</c> masks, at
+	/// most <c>MAX_LIGHT_PATTERN</c>); the pattern repeats after its last entry.
+	/// </summary>
+	typedef std::vector<uint8_t> LightPattern;
+
+	/// <summary>
+	/// Parse a light pattern given as comma-separated list of frames, each naming the lights
+	/// switched on, joined by "+": "white", "uv", "white-top", "white-bottom", "uv-top",
+	/// "uv-wheel", or "off" (e.g., "white,white,uv" or "white+uv-wheel,off").
+	/// </summary>
+	/// <returns><c>false</c> if <c>text</c> is not a valid pattern.</returns>
+	bool ParseLightPattern(const std::string& text, LightPattern& pattern);
+
+	/// <summary>
+	/// Timing of the lights of each frame relative to its trigger edge, in microseconds: the
+	/// lights are on from <c>offsetUs</c> to <c>offsetUs + widthUs</c>. With a width of 0
+	/// (no strobe), they are on for the whole frame.
+	/// </summary>
+	struct Strobe {
+		int offsetUs;
+		int widthUs;
+	};
+
+	/// <summary>
+	/// Parse a strobe given as "offset:width" in microseconds (e.g., "0:300"), or "off".
+	/// </summary>
+	/// <returns><c>false</c> if <c>text</c> is not a valid strobe.</returns>
+	bool ParseStrobe(const std::string& text, Strobe& strobe);
+
+	/// <summary>
+	/// Check that the Arduino can trigger at <c>fps</c> Hz: from <c>ARDUINO_MIN_FPS</c> to
+	/// <c>ARDUINO_MAX_FPS</c>, with the trigger pulse ending within the first timer segment of a
+	/// frame.
+	/// </summary>
+	/// <returns>An error message, or an empty string if <c>fps</c> is valid.</returns>
+	std::string CheckFps(double fps);
+
+	/// <summary>
+	/// Check that <c>strobe</c> ends early enough within a frame at <c>fps</c> Hz for the
+	/// Arduino to accept it (slightly less than the frame period, or 4 ms at most).
+	/// </summary>
+	/// <returns>An error message, or an empty string if <c>strobe</c> is valid.</returns>
+	std::string CheckStrobe(const Strobe& strobe, double fps);
+
+	/// <summary>
+	/// Phase offsets in microseconds of the Arduino's auxiliary trigger outputs (at most
+	/// <c>MAX_AUX_TRIGGERS</c>) after each trigger edge; outputs not listed stay low.
+	/// </summary>
+	typedef std::vector<int> TriggerPhases;
+
+	/// <summary>
+	/// Parse the phases of the auxiliary trigger outputs given as comma-separated list of
+	/// microseconds (e.g., "700"), or "off".
+	/// </summary>
+	/// <returns><c>false</c> if <c>text</c> is not a valid list.</returns>
+	bool ParseTriggerPhases(const std::string& text, TriggerPhases& phases);
+
+	/// <summary>
+	/// Check that the pulses of the auxiliary trigger outputs end early enough within a frame
+	/// at <c>fps</c> Hz for the Arduino to accept them (like a strobe, see <c>CheckStrobe()</c>).
+	/// </summary>
+	/// <returns>An error message, or an empty string if <c>phases</c> are valid.</returns>
+	std::string CheckTriggerPhases(const TriggerPhases& phases, double fps);
+
+	/// <summary>
+	/// Called on the I/O thread when a command completed. Must not block and must not call
+	/// the blocking methods of the controller.
+	/// </summary>
+	typedef std::function<void(const CommandResult& result)> CommandCallback;
+
+	/// <summary>
+	/// When the Arduino switched the stimulus lights, as replied to <c>CMD_SET_STIMULUS</c>.
+	/// </summary>
+	struct StimulusTiming {
+		uint32_t firstFrame;     // Index of the first trigger edge (frame) lit with the new stimulus lights.
+		uint64_t receivedTicks;  // Arduino CPU cycles since recording start when the command was received.
+	};
+
+	/// <summary>
+	/// Called on the I/O thread when a stimulus command completed; <c>timing</c> is only valid
+	/// if the command succeeded. Same restrictions as <c>CommandCallback</c>.
+	/// </summary>
+	typedef std::function<void(const CommandResult& result, const StimulusTiming& timing)> StimulusCallback;
+
+	/// <summary>
+	/// Called on the I/O thread when the serial port failed (e.g., the Arduino was
+	/// unplugged) outside of a command; the controller is disconnected afterwards.
+	/// </summary>
+	typedef std::function<void(const std::string& error)> ConnectionLostHandler;
+
+	/// <summary>
+	/// Client side of the serial protocol implemented by the Arduino sketch
+	/// *cam_and_light_sync.ino*: connects to the Arduino, starts and stops recordings,
+	/// and decodes the trigger telemetry sent while recording.
+	///
+	/// While recording, the I/O thread also samples the Arduino's trigger clock every
+	/// <c>CLOCK_SYNC_INTERVAL_MS</c>, to convert the timestamps of trigger edges to host time
+	/// (see <c>TakeClockSamples()</c> and <c>ClockSync</c>).
+	///
+	/// All serial I/O runs on a dedicated I/O thread, which continuously reads from the
+	/// port, decodes telemetry, and executes commands one after another in the order they
+	/// were submitted. The <c>...Async()</c> methods only queue a command and return
+	/// immediately; its callback is invoked on the I/O thread on completion. The blocking
+	/// methods wait for the completion and report errors by their return value and
+	/// <c>LastError()</c>. Decoded trigger edges are passed to the (single) consumer
+	/// thread through a lock-free queue, see <c>TakeEdges()</c>.
+	/// </summary>
+	class ArduinoController {
+	public:
+		explicit ArduinoController(std::unique_ptr<SerialTransport> transport = CreateSerialTransport());
+		/// <summary>
+		/// Stop a running recording, close the serial port, and stop the I/O thread.
+		/// Callbacks of commands still queued are not invoked.
+		/// </summary>
+		~ArduinoController();
+
+		/// <summary>
+		/// Open serial port <c>portName</c> and check that the Arduino responds on it; with an
+		/// empty <c>portName</c>, the port is found by a <c>DeviceDiscovery</c>, and its name is
+		/// returned by <c>PortName()</c> afterwards. A recording still running on the Arduino
+		/// (e.g., after a client crash) is stopped. Then, the link is switched to <c>baudrate</c>,
+		/// if the Arduino supports it, and the Arduino's port is cached for the next discovery.
+		/// </summary>
+		void ConnectAsync(const std::string& portName, CommandCallback done, int baudrate = ARDUINO_FAST_BAUDRATE);
+
+		/// <summary>
+		/// Stop a running recording and close the serial port.
+		/// </summary>
+		void DisconnectAsync(CommandCallback done);
+
+		/// <summary>
+		/// Start triggering the camera at <c>fps</c> Hz (may be fractional; rounded to mHz),
+		/// switching the lights for each frame as given by <c>lights</c> and <c>strobe</c>, and
+		/// the auxiliary trigger outputs as given by <c>auxTriggers</c>. Clears all trigger
+		/// telemetry of previous recordings.
+		/// With <c>startHostUs</c> (see <c>HostClockUs()</c>; 0: now), the Arduino starts the
+		/// recording at that time, compensating the one-way delay of the link as estimated from
+		/// a round trip right before, e.g., to start several Arduinos simultaneously. The
+		/// command completes before the recording starts.
+		/// </summary>
+		void StartRecordingAsync(double fps, CommandCallback done, const LightPattern& lights = LightPattern(1, LIGHT_WHITE),
+			const Strobe& strobe = Strobe(), const TriggerPhases& auxTriggers = TriggerPhases(), int64_t startHostUs = 0);
+
+		/// <summary>
+		/// Stop triggering the camera and turn off lights. All remaining trigger telemetry
+		/// is received before the command completes; then, <c>LastTriggerSummary()</c>
+		/// returns the number of trigger pulses of the recording.
+		/// </summary>
+		void StopRecordingAsync(CommandCallback done);
+
+		/// <summary>
+		/// Change the frame rate of the running recording to <c>fps</c> Hz. The Arduino
+		/// applies it at the next trigger edge, without dropping or doubling an edge; the
+		/// strobe and auxiliary trigger pulses of the recording must fit into the new frame period.
+		/// </summary>
+		void SetFpsAsync(double fps, CommandCallback done);
+
+		/// <summary>
+		/// Switch <c>lights</c> (<c>LIGHT_...</c> mask; 0: off) on in addition to the light
+		/// pattern of the running recording, e.g., the UV LEDs as a stimulus in a closed loop.
+		/// The Arduino applies them from the next trigger edge on (strobed like the pattern) and
+		/// replies which frame that is (see <c>StimulusTiming</c>); needs <c>CAP_STIMULUS</c>.
+		/// Queued behind a clock synchronization exchange in flight at most.
+		/// </summary>
+		void SetStimulusAsync(uint8_t lights, StimulusCallback done);
+
+		/// <summary>
+		/// Send a ping command while idle and wait for the Arduino's reply; the result's
+		/// <c>roundTripUs</c> is measured on the I/O thread.
+		/// </summary>
+		void PingAsync(CommandCallback done);
+
+		// Blocking versions of the commands above.
+		bool Connect(const std::string& portName, int baudrate = ARDUINO_FAST_BAUDRATE);
+		void Disconnect();
+		bool StartRecording(double fps, const LightPattern& lights = LightPattern(1, LIGHT_WHITE), const Strobe& strobe = Strobe(),
+			const TriggerPhases& auxTriggers = TriggerPhases(), int64_t startHostUs = 0);
+		bool StopRecording();
+		bool SetFps(double fps);
+		bool SetStimulus(uint8_t lights, StimulusTiming& timing);
+		/// <param name="roundTripUs">Receives the round-trip time in microseconds.</param>
+		bool Ping(double& roundTripUs);
+
+		/// <summary>
+		/// Set the handler called when the connection is lost outside of a command.
+		/// </summary>
+		void SetConnectionLostHandler(ConnectionLostHandler handler);
+
+		/// <summary>
+		/// Move all trigger edges decoded since the last call into <c>edges</c> (which is
+		/// cleared first). Never blocks; must always be called from the same thread.
+		/// </summary>
+		void TakeEdges(std::vector<TriggerEdge>& edges);
+
+		/// <summary>
+		/// Move all clock samples taken since the last call into <c>samples</c> (which is
+		/// cleared first), e.g., to feed a <c>ClockSync</c>. Never blocks; must always be
+		/// called from the same thread.
+		/// </summary>
+		void TakeClockSamples(std::vector<ClockSample>& samples);
+
+		ArduinoState State() const;
+		bool IsConnected() const { return this->State() != ArduinoState::Disconnected; }
+		/// <summary>
+		/// Baudrate of the link to the Arduino; 0 if disconnected.
+		/// </summary>
+		int Baudrate() const;
+		/// <summary>
+		/// Trigger pulses of the last recording stopped by a stop command, as reported by
+		/// the Arduino; all zero if none.
+		/// </summary>
+		TriggerSummary LastTriggerSummary() const;
+		std::string PortName() const;
+		/// <summary>
+		/// Identity of the connected Arduino (see <c>DeviceInfo</c>); unidentified if its sketch
+		/// predates <c>CMD_IDENTIFY</c> or if disconnected.
+		/// </summary>
+		DeviceInfo Device() const;
+		/// <summary>
+		/// Error of the last failed blocking command.
+		/// </summary>
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		class Impl;
+
+		ArduinoController(const ArduinoController&) = delete;
+		ArduinoController& operator=(const ArduinoController&) = delete;
+
+		bool Wait(const std::function<void(CommandCallback)>& submit, CommandResult& result);
+
+		std::unique_ptr<Impl> impl;
+		std::string lastError;
+	};
+}
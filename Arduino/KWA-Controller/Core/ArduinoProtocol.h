@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace KwaController {
+
+	// Baudrate of the Arduino after a reset. Must match `baudrate` in Arduino Sketch.
+	const int ARDUINO_BAUDRATE = 115200;
+	// Baudrate negotiated after connecting; exact at 16 MHz (unlike 115200 baud, which is
+	// off by 2 %). Must be one of the rates accepted by the Arduino sketch.
+	const int ARDUINO_FAST_BAUDRATE = 1000000;
+
+	/**
+	 * Frame format of all messages exchanged with the Arduino (must match defs. in
+	 * Arduino sketch!):
+	 *
+	 *   FRAME_START | LEN | SEQ | TYPE | PAYLOAD (LEN bytes) | CRC (2 bytes)
+	 *
+	 * The CRC is a CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) over LEN,
+	 * SEQ, TYPE, and PAYLOAD. Multi-byte values are in network byte order.
+	 */
+	const uint8_t FRAME_START = 0xA5;
+	const size_t FRAME_MAX_PAYLOAD = 120;
+	const size_t FRAME_OVERHEAD = 6;  // Bytes of a frame besides its payload.
+
+	// Frame types of commands (client => Arduino; SEQ chosen by client) ...
+	const uint8_t CMD_PING = 0x01;          // Reply payload: PING_STATE_...
+	const uint8_t CMD_START_REC = 0x02;     // Payload: frame rate in 1/FPS_RATE_SCALE Hz (4 bytes), optionally
+	                                        // followed by LED strobe offset and width in us (2 bytes each;
+	                                        // width 0: no strobe) and the light pattern (LIGHT_... mask per frame)
+	const uint8_t CMD_STOP_REC = 0x03;      // Replied after all trigger telemetry was sent; reply payload:
+	                                        // number of trigger pulses and timestamp of the last one
+	                                        // (in CPU cycles since recording start, 4 bytes each)
+	const uint8_t CMD_SET_BAUDRATE = 0x04;  // Payload: baudrate (4 bytes); switched after reply
+	const uint8_t CMD_SET_RATE = 0x05;      // Payload: frame rate in 1/FPS_RATE_SCALE Hz (4 bytes); only while
+	                                        // recording, applied from the next trigger edge on
+	const uint8_t CMD_SYNC = 0x06;          // Only while recording; reply payload: trigger clock (CPU cycles since
+	                                        // recording start, 4 bytes) when the command was received
+	const uint8_t CMD_SET_TRIGGERS = 0x07;  // Payload: phase of the auxiliary trigger output in us (2 bytes), or
+	                                        // none to turn it off; only while idle, kept for later recordings
+	const uint8_t CMD_START_REC_AT = 0x08;  // Payload: start delay in us after receipt (4 bytes), followed by the
+	                                        // payload of CMD_START_REC
+	const uint8_t CMD_IDENTIFY = 0x09;      // Reply payload: IDENTIFY_MAGIC (3 bytes), firmware version (major,
+	                                        // minor; 1 byte each), device ID (4 bytes), CAP_... mask (2 bytes)
+	const uint8_t CMD_SET_STIMULUS = 0x0A;  // Payload: LIGHT_... mask lit in addition to the light pattern (1 byte); only
+	                                        // while recording, applied from the next trigger edge on; reply payload:
+	                                        // index of the first frame lit with it and trigger clock at receipt (4 bytes each)
+	// ... of replies (Arduino => client; SEQ of the command) ...
+	const uint8_t RSP_ACK = 0x80;
+	const uint8_t RSP_NAK = 0x81;           // Payload: NAK_... error code (1 byte)
+	// ... and of events (Arduino => client; SEQ counts events).
+	const uint8_t EVT_READY = 0x90;         // Sent after (re)start of the Arduino
+	const uint8_t EVT_TELEMETRY = 0x91;     // Batch of trigger edge timestamps
+
+	// Payload of the reply to CMD_PING.
+	const uint8_t PING_STATE_IDLE = 0;
+	const uint8_t PING_STATE_RECORDING = 1;
+
+	// Start of the reply to CMD_IDENTIFY, telling the Arduino sketch from other serial devices.
+	const uint8_t IDENTIFY_MAGIC[3] = { 'K', 'W', 'A' };
+	const size_t IDENTIFY_REPLY_SIZE = 11;
+	// Capabilities in the reply to CMD_IDENTIFY (bit mask). Must match `cap...` in Arduino sketch!
+	const uint16_t CAP_LIGHT_PATTERN = 0x0001;
+	const uint16_t CAP_STROBE = 0x0002;
+	const uint16_t CAP_SET_RATE = 0x0004;
+	const uint16_t CAP_CLOCK_SYNC = 0x0008;
+	const uint16_t CAP_AUX_TRIGGER = 0x0010;
+	const uint16_t CAP_START_AT = 0x0020;
+	const uint16_t CAP_STIMULUS = 0x0040;
+
+	// Lights of a frame in the light pattern of CMD_START_REC (bit mask). Frame N is lit as
+	// given by entry N mod (pattern length); without a pattern, all frames are lit white.
+	const uint8_t LIGHT_WHITE_FRONT_TOP = 0x01;
+	const uint8_t LIGHT_WHITE_FRONT_BOTTOM = 0x02;
+	const uint8_t LIGHT_UV_FRONT_TOP = 0x04;
+	const uint8_t LIGHT_UV_WHEEL = 0x08;
+	const uint8_t LIGHT_WHITE = LIGHT_WHITE_FRONT_TOP | LIGHT_WHITE_FRONT_BOTTOM;
+	const uint8_t LIGHT_UV = LIGHT_UV_FRONT_TOP | LIGHT_UV_WHEEL;
+	const uint8_t LIGHT_ALL = LIGHT_WHITE | LIGHT_UV;
+	// Max. number of frames of a light pattern. Must match `maxLightPattern` in Arduino sketch!
+	const size_t MAX_LIGHT_PATTERN = 16;
+
+	// Max. length of one cycle ("segment") of the Arduino's trigger timer in CPU cycles; longer
+	// frame periods are split into equal segments. Must match `maxSegmentTicks` in Arduino sketch!
+	const uint32_t ARDUINO_MAX_SEGMENT_TICKS = 65000;
+	// The LED strobe must end this number of CPU cycles before the end of the first segment of
+	// a frame. Must match `timerEventMargin` in Arduino sketch!
+	const uint32_t ARDUINO_TIMER_EVENT_MARGIN = 32;
+
+	// Number of auxiliary trigger outputs of the Arduino, e.g., for a second camera. Each sends a
+	// pulse of ARDUINO_TRIGGER_PULSE_US at a phase offset after every trigger edge; the pulse must
+	// end within the first timer segment of a frame, less ARDUINO_TIMER_EVENT_MARGIN.
+	const size_t MAX_AUX_TRIGGERS = 1;
+	// Length of a trigger pulse. Must match `triggerSignalLen` in Arduino sketch!
+	const int ARDUINO_TRIGGER_PULSE_US = 10;
+	// Max. delay of CMD_START_REC_AT. Must match `maxStartDelay` in Arduino sketch!
+	const uint32_t ARDUINO_MAX_START_DELAY_US = 60000000;
+
+	// Error codes of RSP_NAK.
+	const uint8_t NAK_UNKNOWN_COMMAND = 1;
+	const uint8_t NAK_BAD_PAYLOAD = 2;
+	const uint8_t NAK_INVALID_STATE = 3;
+
+	// FPS values are sent to the Arduino in units of 1/FPS_RATE_SCALE Hz (i.e., mHz).
+	const int FPS_RATE_SCALE = 1000;  // Must match `rateScale` in Arduino sketch!
+	// Range of frame rates the Arduino accepts. Must match `minFrameRate` and `maxFrameRate`
+	// (in mHz) in Arduino sketch!
+	const double ARDUINO_MIN_FPS = 1.0;
+	const double ARDUINO_MAX_FPS = 1000.0;
+
+	// Arduino CPU clock; trigger telemetry timestamps are given in CPU cycles.
+	const double ARDUINO_CPU_CLOCK_HZ = 16000000.0;  // Must match `F_CPU` of the Arduino board!
+
+	// Max. time to wait for a response from the Arduino.
+	const int ARDUINO_RESPONSE_TIMEOUT_MS = 500;
+	// Max. time to wait for the Arduino after opening the port, which may reset the
+	// Arduino (e.g., on Linux, where DTR is raised on open) and run its boot loader.
+	const int ARDUINO_RESET_TIMEOUT_MS = 3000;
+	// Time after which the Arduino falls back to ARDUINO_BAUDRATE if it received no valid
+	// frame at a newly set baudrate. Must match `baudrateConfirmTimeout` in Arduino sketch!
+	const int ARDUINO_BAUDRATE_CONFIRM_TIMEOUT_MS = 1000;
+	// Max. time to wait for the reply to an identify command while probing a port on which the
+	// Arduino is expected (i.e., that was opened before, so that opening it did not reset the Arduino).
+	const int ARDUINO_PROBE_TIMEOUT_MS = 300;
+	// Interval of the clock synchronization exchanges (CMD_SYNC) while recording.
+	const int CLOCK_SYNC_INTERVAL_MS = 100;
+}
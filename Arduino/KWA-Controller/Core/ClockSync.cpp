@@ -0,0 +1,184 @@
+#include "ClockSync.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "ArduinoProtocol.h"
+#include "TriggerTelemetry.h"
+
+
+namespace KwaController {
+
+	namespace {
+		// Nominal length of an Arduino CPU cycle in microseconds.
+		const double NOMINAL_US_PER_TICK = 1e6 / ARDUINO_CPU_CLOCK_HZ;
+		// Min. time span of the samples to estimate the drift from; before, the nominal
+		// clock frequency is assumed.
+		const double MIN_DRIFT_SPAN_TICKS = ARDUINO_CPU_CLOCK_HZ;
+		// Max. plausible drift of the Arduino's clock; its ceramic resonator is specified to 0.5 %.
+		const double MAX_DRIFT_PPM = 10000.0;
+		// Samples with a residual larger than this multiple of the residuals' robust standard
+		// deviation (or the minimum below) are rejected from the fit.
+		const double RESIDUAL_REJECTION = 3.0;
+		const double MIN_RESIDUAL_LIMIT_US = 20.0;
+	}
+
+	int64_t HostClockUs() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	ClockModel::ClockModel()
+		: valid(false), referenceTicks(0), referenceHostUs(0.0), usPerTick(NOMINAL_US_PER_TICK), residualUs(0.0),
+		sampleCount(0) {
+	}
+
+	double ClockModel::ToHostUs(uint64_t ticks) const {
+		// Signed difference, so that timestamps before the reference are converted, too.
+		return this->referenceHostUs + this->usPerTick * static_cast<double>(static_cast<int64_t>(ticks - this->referenceTicks));
+	}
+
+	double ClockModel::DriftPpm() const {
+		// A fast Arduino clock has shorter cycles.
+		return (NOMINAL_US_PER_TICK / this->usPerTick - 1.0) * 1e6;
+	}
+
+
+	ClockSync::ClockSync(size_t windowSize, double acceptedFraction)
+		: windowSize(std::max<size_t>(windowSize, 1)), acceptedFraction(acceptedFraction) {
+	}
+
+	void ClockSync::Reset() {
+		this->samples.clear();
+		this->accepted.clear();
+		this->model = ClockModel();
+	}
+
+	void ClockSync::Add(const ClockSample& sample) {
+		this->samples.push_back(sample);
+		this->accepted.push_back(false);
+		this->Fit();
+	}
+
+	void ClockSync::Fit() {
+		size_t first = this->samples.size() > this->windowSize ? this->samples.size() - this->windowSize : 0;
+		size_t count = this->samples.size() - first;
+
+		// Keep the samples with the shortest round trips; their midpoint is closest to the
+		// time the Arduino sampled its clock.
+		this->scratch.clear();
+		for (size_t i = first; i < this->samples.size(); ++i) {
+			this->scratch.push_back(static_cast<double>(this->samples[i].RoundTripUs()));
+		}
+		size_t k = std::min(count - 1, static_cast<size_t>(this->acceptedFraction * count));
+		std::nth_element(this->scratch.begin(), this->scratch.begin() + k, this->scratch.end());
+		double maxRoundTripUs = this->scratch[k];
+		this->indices.clear();
+		for (size_t i = first; i < this->samples.size(); ++i) {
+			if (this->samples[i].RoundTripUs() <= maxRoundTripUs) {
+				this->indices.push_back(i);
+			}
+		}
+		ClockModel fit;
+		if (!this->FitLine(this->indices, fit)) {
+			return;
+		}
+
+		// Reject samples far off the line (e.g., delayed in both directions alike) and refit.
+		this->scratch.clear();
+		for (size_t i : this->indices) {
+			this->scratch.push_back(std::fabs(this->samples[i].HostMidpointUs() - fit.ToHostUs(this->samples[i].ticks)));
+		}
+		std::nth_element(this->scratch.begin(), this->scratch.begin() + this->scratch.size() / 2, this->scratch.end());
+		double limitUs = std::max(RESIDUAL_REJECTION * 1.4826 * this->scratch[this->scratch.size() / 2], MIN_RESIDUAL_LIMIT_US);
+		size_t kept = 0;
+		for (size_t i : this->indices) {
+			if (std::fabs(this->samples[i].HostMidpointUs() - fit.ToHostUs(this->samples[i].ticks)) <= limitUs) {
+				this->indices[kept++] = i;
+			}
+		}
+		if (kept < this->indices.size()) {
+			this->indices.resize(kept);
+			this->FitLine(this->indices, fit);
+		}
+
+		for (size_t i = first; i < this->samples.size(); ++i) {
+			this->accepted[i] = false;
+		}
+		for (size_t i : this->indices) {
+			this->accepted[i] = true;
+		}
+		this->model = fit;
+	}
+
+	bool ClockSync::FitLine(const std::vector<size_t>& indices, ClockModel& result) const {
+		if (indices.empty()) {
+			return false;
+		}
+		// Least squares relative to the first sample and the means, to keep the precision of
+		// the large timestamps.
+		const ClockSample& base = this->samples[indices[0]];
+		double meanX = 0.0;
+		double meanY = 0.0;
+		double minX = 0.0;
+		double maxX = 0.0;
+		for (size_t i : indices) {
+			double x = static_cast<double>(static_cast<int64_t>(this->samples[i].ticks - base.ticks));
+			meanX += x;
+			meanY += this->samples[i].HostMidpointUs() - base.hostSendUs;
+			minX = std::min(minX, x);
+			maxX = std::max(maxX, x);
+		}
+		meanX /= indices.size();
+		meanY /= indices.size();
+		double sxx = 0.0;
+		double sxy = 0.0;
+		for (size_t i : indices) {
+			double x = static_cast<double>(static_cast<int64_t>(this->samples[i].ticks - base.ticks)) - meanX;
+			double y = this->samples[i].HostMidpointUs() - base.hostSendUs - meanY;
+			sxx += x * x;
+			sxy += x * y;
+		}
+		double slope = NOMINAL_US_PER_TICK;
+		if (maxX - minX >= MIN_DRIFT_SPAN_TICKS && std::fabs(sxy / sxx / NOMINAL_US_PER_TICK - 1.0) * 1e6 <= MAX_DRIFT_PPM) {
+			slope = sxy / sxx;
+		}
+
+		double referenceX = std::floor(meanX + 0.5);
+		result.valid = true;
+		result.referenceTicks = base.ticks + static_cast<int64_t>(referenceX);
+		result.referenceHostUs = base.hostSendUs + meanY + slope * (referenceX - meanX);
+		result.usPerTick = slope;
+		result.sampleCount = indices.size();
+		double sum = 0.0;
+		for (size_t i : indices) {
+			double residual = this->samples[i].HostMidpointUs() - result.ToHostUs(this->samples[i].ticks);
+			sum += residual * residual;
+		}
+		result.residualUs = std::sqrt(sum / indices.size());
+		return true;
+	}
+
+	bool ClockSync::WriteTable(const std::string& path) const {
+		std::FILE* file = CreateLogFile(path);
+		if (!file) {
+			return false;
+		}
+		const ClockModel& m = this->model;
+		std::fprintf(file, "# host_us = %.3f + %.12f * (ticks - %llu); drift: %.3f ppm, residual: %.3f us, samples: %lu\n",
+			m.referenceHostUs, m.usPerTick, static_cast<unsigned long long>(m.referenceTicks), m.DriftPpm(), m.residualUs,
+			static_cast<unsigned long>(m.sampleCount));
+		std::fputs("ticks,host_send_us,host_receive_us,round_trip_us,accepted\n", file);
+		for (size_t i = 0; i < this->samples.size(); ++i) {
+			const ClockSample& sample = this->samples[i];
+			std::fprintf(file, "%llu,%lld,%lld,%lld,%d\n",
+				static_cast<unsigned long long>(sample.ticks), static_cast<long long>(sample.hostSendUs),
+				static_cast<long long>(sample.hostReceiveUs), static_cast<long long>(sample.RoundTripUs()),
+				this->accepted[i] ? 1 : 0);
+		}
+		bool ok = !std::ferror(file);
+		return std::fclose(file) == 0 && ok;
+	}
+}
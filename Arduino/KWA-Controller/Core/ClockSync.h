@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace KwaController {
+
+	/// <summary>
+	/// Current time of the host's monotonic clock (<c>std::chrono::steady_clock</c>) in
+	/// microseconds, the time base of host timestamps of trigger edges.
+	/// </summary>
+	int64_t HostClockUs();
+
+	/// <summary>
+	/// One clock synchronization exchange with the Arduino (<c>CMD_SYNC</c>): the Arduino's
+	/// trigger clock when it received the command, and the host times when the command was
+	/// sent and its reply received.
+	/// </summary>
+	struct ClockSample {
+		uint64_t ticks;         // Arduino CPU cycles since recording start (unwrapped).
+		int64_t hostSendUs;     // See `HostClockUs()`.
+		int64_t hostReceiveUs;
+
+		int64_t RoundTripUs() const { return this->hostReceiveUs - this->hostSendUs; }
+		/// <summary>
+		/// Host time assumed for <c>ticks</c>: the midpoint of the exchange.
+		/// </summary>
+		double HostMidpointUs() const { return 0.5 * (this->hostSendUs + this->hostReceiveUs); }
+	};
+
+	/// <summary>
+	/// Linear mapping from the Arduino's trigger clock to host time:
+	/// host time = <c>referenceHostUs + usPerTick * (ticks - referenceTicks)</c>.
+	/// </summary>
+	struct ClockModel {
+		bool valid;               // `false` until the first sample was accepted.
+		uint64_t referenceTicks;
+		double referenceHostUs;
+		double usPerTick;         // Actual length of an Arduino CPU cycle in host microseconds.
+		double residualUs;        // RMS residual of the accepted samples.
+		size_t sampleCount;       // Number of samples the model was fitted to.
+
+		ClockModel();
+
+		/// <summary>
+		/// Convert a timestamp in Arduino CPU cycles (e.g., of a trigger edge) to host time
+		/// in microseconds (see <c>HostClockUs()</c>).
+		/// </summary>
+		double ToHostUs(uint64_t ticks) const;
+		/// <summary>
+		/// Deviation of the Arduino's CPU clock from its nominal frequency in ppm (positive
+		/// if it runs fast).
+		/// </summary>
+		double DriftPpm() const;
+	};
+
+	/// <summary>
+	/// Estimates the offset and drift between the Arduino's trigger clock and the host clock
+	/// from the clock samples of a recording. The model is a least-squares line fitted to the
+	/// most recent samples, after rejecting samples with a long round trip (delayed by the
+	/// serial link or the host's scheduler) and then samples far off the first fit. Adding a
+	/// sample costs O(window size); converting a timestamp is O(1).
+	/// </summary>
+	class ClockSync {
+	public:
+		/// <param name="windowSize">Number of most recent samples the model is fitted to.</param>
+		/// <param name="acceptedFraction">Fraction of the samples in the window with the shortest
+		/// round trips used for the fit.</param>
+		explicit ClockSync(size_t windowSize = 512, double acceptedFraction = 0.25);
+
+		/// <summary>
+		/// Discard all samples at the start of a new recording.
+		/// </summary>
+		void Reset();
+		/// <summary>
+		/// Add a sample and update the model.
+		/// </summary>
+		void Add(const ClockSample& sample);
+
+		const ClockModel& Model() const { return this->model; }
+		size_t SampleCount() const { return this->samples.size(); }
+
+		/// <summary>
+		/// Write all samples of the recording to a CSV file at <c>path</c> (UTF-8) with columns
+		/// <c>ticks</c>, <c>host_send_us</c>, <c>host_receive_us</c>, <c>round_trip_us</c>, and
+		/// <c>accepted</c> (whether the sample was used by its last fit), preceded by a comment
+		/// line giving the current model.
+		/// </summary>
+		/// <returns><c>true</c> if the file was written.</returns>
+		bool WriteTable(const std::string& path) const;
+
+	private:
+		void Fit();
+		bool FitLine(const std::vector<size_t>& indices, ClockModel& result) const;
+
+		size_t windowSize;
+		double acceptedFraction;
+		std::vector<ClockSample> samples;
+		std::vector<bool> accepted;
+		std::vector<size_t> indices;      // Scratch buffers of `Fit()`.
+		std::vector<double> scratch;
+		ClockModel model;
+	};
+}
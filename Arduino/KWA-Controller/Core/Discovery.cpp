@@ -0,0 +1,412 @@
+#include "Discovery.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "Framing.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+
+namespace KwaController {
+
+	namespace {
+		typedef std::chrono::steady_clock Clock;
+
+		// Time to wait for the reply to one identify command before it is repeated, at the
+		// other baudrate.
+		const int PROBE_ATTEMPT_MS = 50;
+		// Max. number of entries of the cache file.
+		const size_t MAX_CACHE_ENTRIES = 32;
+
+		// Guards the cache file against concurrent updates, e.g., by the controllers of a rig.
+		std::mutex cacheMutex;
+
+		int MillisecondsLeft(Clock::time_point deadline) {
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+			return left > 0 ? static_cast<int>(left) : 0;
+		}
+
+#ifdef _WIN32
+		std::wstring ToWide(const std::string& text) {
+			int length = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, nullptr, 0);
+			std::wstring wide(length, L'\0');
+			MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, &wide[0], length);
+			wide.resize(length > 0 ? length - 1 : 0);
+			return wide;
+		}
+
+		std::string ToUtf8(const std::wstring& wide) {
+			int length = WideCharToMultiByte(CP_UTF8, 0, wide.c_str(), -1, nullptr, 0, nullptr, nullptr);
+			std::string text(length, '\0');
+			WideCharToMultiByte(CP_UTF8, 0, wide.c_str(), -1, &text[0], length, nullptr, nullptr);
+			text.resize(length > 0 ? length - 1 : 0);
+			return text;
+		}
+#endif
+
+		/// <summary>
+		/// Open a text file at <c>path</c> (UTF-8, also on Windows) with <c>fopen()</c> mode "r" or "w".
+		/// </summary>
+		std::FILE* OpenFile(const std::string& path, const char* mode) {
+#ifdef _WIN32
+			std::FILE* file = nullptr;
+			std::wstring wideMode(mode, mode + std::strlen(mode));
+			return _wfopen_s(&file, ToWide(path).c_str(), wideMode.c_str()) == 0 ? file : nullptr;
+#else
+			return std::fopen(path.c_str(), mode);
+#endif
+		}
+
+		/// <summary>
+		/// Send identify commands to the port <c>portName</c> until the Arduino replies or
+		/// <c>timeoutMs</c> passed. The commands are sent alternately at the default baudrate
+		/// and at the fast one, as the Arduino may still run at a rate negotiated by an earlier
+		/// client (e.g., after a crash).
+		/// </summary>
+		bool ProbePort(const std::string& portName, int timeoutMs, DeviceInfo& device) {
+			static const int BAUDRATES[] = { ARDUINO_BAUDRATE, ARDUINO_FAST_BAUDRATE };
+
+			Clock::time_point start = Clock::now();
+			Clock::time_point deadline = start + std::chrono::milliseconds(timeoutMs);
+			std::unique_ptr<SerialTransport> transport = CreateSerialTransport();
+			if (!transport->Open(portName, ARDUINO_BAUDRATE)) {
+				return false;
+			}
+			FrameDecoder decoder;
+			Frame reply = Frame();
+			std::vector<uint8_t> command;
+			uint8_t buf[64];
+			for (uint8_t attempt = 0; Clock::now() < deadline; ++attempt) {
+				if (attempt > 0 && !transport->SetBaudrate(BAUDRATES[attempt % 2])) {
+					continue;  // Rate not supported by the port; stay at the current one.
+				}
+				decoder.Reset();
+				command.clear();
+				AppendFrame(command, CMD_IDENTIFY, attempt);
+				if (!transport->Write(command.data(), command.size())) {
+					return false;
+				}
+				Clock::time_point attemptEnd = std::min(deadline, Clock::now() + std::chrono::milliseconds(PROBE_ATTEMPT_MS));
+				while (Clock::now() < attemptEnd) {
+					int count = transport->Read(buf, sizeof(buf), MillisecondsLeft(attemptEnd));
+					if (count < 0) {
+						return false;
+					}
+					for (int i = 0; i < count; ++i) {
+						if (!decoder.Feed(buf[i], reply) || reply.seq != attempt ||
+							(reply.type != RSP_ACK && reply.type != RSP_NAK)) {
+							continue;  // E.g., telemetry of a recording left running.
+						}
+						device = DeviceInfo();
+						// A NAK comes from a sketch that predates CMD_IDENTIFY.
+						if (reply.type == RSP_ACK && !DecodeIdentifyReply(reply.payload, device)) {
+							return false;
+						}
+						device.portName = portName;
+						device.probeMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// Ports being probed, also by the probes of scans that returned before they ended
+		/// (see <c>DeviceDiscovery::Find()</c>). Leaked, as such probes may still run at exit.
+		/// </summary>
+		struct BusyPorts {
+			std::mutex mutex;
+			std::condition_variable released;
+			std::set<std::string> names;
+		};
+
+		BusyPorts& Busy() {
+			static BusyPorts* busy = new BusyPorts();
+			return *busy;
+		}
+
+		/// <summary>
+		/// <c>ProbePort()</c>, after waiting (within <c>timeoutMs</c>) for a probe of the port
+		/// still running, as a port cannot be opened twice.
+		/// </summary>
+		bool ProbeFreePort(const std::string& portName, int timeoutMs, DeviceInfo& device) {
+			Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+			BusyPorts& busy = Busy();
+			{
+				std::unique_lock<std::mutex> lock(busy.mutex);
+				if (!busy.released.wait_until(lock, deadline, [&]() { return busy.names.count(portName) == 0; })) {
+					return false;
+				}
+				busy.names.insert(portName);
+			}
+			bool found = ProbePort(portName, MillisecondsLeft(deadline), device);
+			{
+				std::lock_guard<std::mutex> lock(busy.mutex);
+				busy.names.erase(portName);
+			}
+			busy.released.notify_all();
+			return found;
+		}
+
+		/// <summary>
+		/// Results of the probes of a scan, shared with their threads, which may outlive it.
+		/// </summary>
+		struct ScanState {
+			std::mutex mutex;
+			std::condition_variable probed;
+			std::vector<DeviceInfo> results;
+			std::vector<char> found;
+			size_t pending;
+		};
+
+		std::string JoinPorts(const std::vector<std::string>& ports) {
+			std::string text;
+			for (const std::string& port : ports) {
+				text += (text.empty() ? "" : ", ") + port;
+			}
+			return text;
+		}
+	}
+
+	DeviceInfo::DeviceInfo()
+		: deviceId(0), firmwareMajor(0), firmwareMinor(0), capabilities(0), probeMs(0.0) {
+	}
+
+	std::string FormatDeviceId(uint32_t deviceId) {
+		char text[9];
+		std::snprintf(text, sizeof(text), "%08lX", static_cast<unsigned long>(deviceId));
+		return text;
+	}
+
+	bool ParseDeviceId(const std::string& text, uint32_t& deviceId) {
+		if (text.empty() || text.size() > 8) {
+			return false;
+		}
+		uint32_t value = 0;
+		for (char c : text) {
+			int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+			if (digit < 0) {
+				return false;
+			}
+			value = value << 4 | static_cast<uint32_t>(digit);
+		}
+		if (value == 0) {
+			return false;
+		}
+		deviceId = value;
+		return true;
+	}
+
+	bool DecodeIdentifyReply(const std::vector<uint8_t>& payload, DeviceInfo& device) {
+		if (payload.size() < IDENTIFY_REPLY_SIZE || !std::equal(IDENTIFY_MAGIC, IDENTIFY_MAGIC + 3, payload.begin())) {
+			return false;
+		}
+		device.firmwareMajor = payload[3];
+		device.firmwareMinor = payload[4];
+		device.deviceId = ReadLong(payload.data() + 5);
+		device.capabilities = ReadShort(payload.data() + 9);
+		return true;
+	}
+
+
+	std::string DeviceDiscovery::DefaultCachePath() {
+#ifdef _WIN32
+		wchar_t buf[MAX_PATH];
+		DWORD length = ::GetEnvironmentVariableW(L"LOCALAPPDATA", buf, MAX_PATH);
+		if (length == 0 || length >= MAX_PATH) {
+			return std::string();
+		}
+		std::wstring directory = std::wstring(buf) + L"\\KWA-Controller";
+		::CreateDirectoryW(directory.c_str(), nullptr);
+		return ToUtf8(directory) + "\\devices.txt";
+#else
+		std::string directory;
+		if (const char* cacheHome = std::getenv("XDG_CACHE_HOME")) {
+			directory = cacheHome;
+		}
+		else if (const char* home = std::getenv("HOME")) {
+			directory = std::string(home) + "/.cache";
+			::mkdir(directory.c_str(), 0700);
+		}
+		if (directory.empty()) {
+			return std::string();
+		}
+		directory += "/kwa-controller";
+		::mkdir(directory.c_str(), 0700);
+		return directory + "/devices";
+#endif
+	}
+
+	DeviceDiscovery::DeviceDiscovery(const std::string& cachePath) : cachePath(cachePath) {
+	}
+
+	std::vector<DeviceInfo> DeviceDiscovery::Scan(const std::vector<std::string>& ports, int timeoutMs) const {
+		return this->Scan(ports, timeoutMs, nullptr);
+	}
+
+	std::vector<DeviceInfo> DeviceDiscovery::Scan(const std::vector<std::string>& ports, int timeoutMs,
+		const std::function<bool(const DeviceInfo& device)>& isWanted) const {
+		std::shared_ptr<ScanState> state = std::make_shared<ScanState>();
+		state->results.resize(ports.size());
+		// `std::vector<bool>` elements cannot be written concurrently.
+		state->found.resize(ports.size(), 0);
+		state->pending = ports.size();
+		for (size_t i = 0; i < ports.size(); ++i) {
+			// Detached, so that the scan can return before slow ports timed out.
+			std::thread([state, i, portName = ports[i], timeoutMs]() {
+				DeviceInfo device;
+				bool found = ProbeFreePort(portName, timeoutMs, device);
+				{
+					std::lock_guard<std::mutex> lock(state->mutex);
+					state->results[i] = device;
+					state->found[i] = found;
+					--state->pending;
+				}
+				state->probed.notify_all();
+			}).detach();
+		}
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->probed.wait(lock, [&]() {
+			if (state->pending == 0) {
+				return true;
+			}
+			for (size_t i = 0; isWanted && i < ports.size(); ++i) {
+				if (state->found[i] && isWanted(state->results[i])) {
+					return true;
+				}
+			}
+			return false;
+		});
+		std::vector<DeviceInfo> devices;
+		for (size_t i = 0; i < ports.size(); ++i) {
+			if (state->found[i]) {
+				devices.push_back(state->results[i]);
+			}
+		}
+		return devices;
+	}
+
+	bool DeviceDiscovery::Find(DeviceInfo& device, uint32_t deviceId, const std::vector<std::string>& ports) {
+		if (ports.empty()) {
+			this->lastError = "No serial ports found; check that the Arduino is connected to the computer.";
+			return false;
+		}
+		std::vector<CacheEntry> cache = this->LoadCache();
+
+		// Probe the cached ports of the Arduino first; most likely, it is still attached there.
+		std::vector<std::string> cachedPorts;
+		for (const CacheEntry& entry : cache) {
+			if ((deviceId == 0 || entry.deviceId == deviceId) &&
+				std::find(ports.begin(), ports.end(), entry.portName) != ports.end()) {
+				cachedPorts.push_back(entry.portName);
+			}
+		}
+		auto pick = [&](const std::vector<DeviceInfo>& devices) {
+			// The most recently used Arduino (or the requested one) ...
+			for (const CacheEntry& entry : cache) {
+				for (const DeviceInfo& candidate : devices) {
+					if (candidate.deviceId == entry.deviceId && (deviceId == 0 || candidate.deviceId == deviceId)) {
+						device = candidate;
+						return true;
+					}
+				}
+			}
+			// ... or else the first one found.
+			for (const DeviceInfo& candidate : devices) {
+				if (deviceId == 0 || candidate.deviceId == deviceId) {
+					device = candidate;
+					return true;
+				}
+			}
+			return false;
+		};
+		// Stop waiting for the other ports once the Arduino that `pick` prefers to all others
+		// replied: the requested one, or else the most recently used one.
+		auto isWanted = [&](const DeviceInfo& candidate) {
+			return deviceId != 0 ? candidate.deviceId == deviceId : !cache.empty() && candidate.deviceId == cache[0].deviceId;
+		};
+		if (!cachedPorts.empty() && pick(this->Scan(cachedPorts, ARDUINO_PROBE_TIMEOUT_MS, isWanted))) {
+			return true;
+		}
+
+		// Scan all ports, incl. the cached ones again, in case the Arduino was reset by opening
+		// its port (i.e., it was plugged in again) and did not reply in time.
+		if (pick(this->Scan(ports, ARDUINO_RESET_TIMEOUT_MS, isWanted))) {
+			return true;
+		}
+		this->lastError = (deviceId == 0 ? std::string("No Arduino") : "Arduino " + FormatDeviceId(deviceId)) +
+			" found on serial ports " + JoinPorts(ports) + ".\n"
+			"Check that the Arduino is connected to the computer and runs the latest sketch.";
+		return false;
+	}
+
+	void DeviceDiscovery::Remember(const DeviceInfo& device) const {
+		if (!device.IsIdentified() || this->cachePath.empty()) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		std::vector<CacheEntry> entries = this->LoadCache();
+		if (!entries.empty() && entries[0].deviceId == device.deviceId && entries[0].portName == device.portName) {
+			return;  // Unchanged; spare the write.
+		}
+		// A port is attached to one device, and a device to one port.
+		entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const CacheEntry& entry) {
+			return entry.deviceId == device.deviceId || entry.portName == device.portName;
+		}), entries.end());
+		entries.insert(entries.begin(), CacheEntry{ device.deviceId, device.portName });
+		if (entries.size() > MAX_CACHE_ENTRIES) {
+			entries.resize(MAX_CACHE_ENTRIES);
+		}
+		this->SaveCache(entries);
+	}
+
+	std::vector<DeviceDiscovery::CacheEntry> DeviceDiscovery::LoadCache() const {
+		// One line per entry: device ID (hex.) and port name, separated by a space.
+		std::vector<CacheEntry> entries;
+		std::FILE* file = this->cachePath.empty() ? nullptr : OpenFile(this->cachePath, "r");
+		if (!file) {
+			return entries;
+		}
+		char line[512];
+		while (std::fgets(line, sizeof(line), file)) {
+			std::string text(line);
+			while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) {
+				text.pop_back();
+			}
+			size_t space = text.find(' ');
+			CacheEntry entry;
+			if (space != std::string::npos && space + 1 < text.size() && ParseDeviceId(text.substr(0, space), entry.deviceId)) {
+				entry.portName = text.substr(space + 1);
+				entries.push_back(entry);
+			}
+		}
+		std::fclose(file);
+		return entries;
+	}
+
+	void DeviceDiscovery::SaveCache(const std::vector<CacheEntry>& entries) const {
+		std::FILE* file = OpenFile(this->cachePath, "w");
+		if (!file) {
+			return;  // The cache only speeds up finding the Arduino.
+		}
+		for (const CacheEntry& entry : entries) {
+			std::fprintf(file, "%s %s\n", FormatDeviceId(entry.deviceId).c_str(), entry.portName.c_str());
+		}
+		std::fclose(file);
+	}
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ArduinoProtocol.h"
+#include "SerialTransport.h"
+
+
+namespace KwaController {
+
+	/// <summary>
+	/// An Arduino running the sketch *cam_and_light_sync.ino*, as reported by its reply to
+	/// <c>CMD_IDENTIFY</c>.
+	/// </summary>
+	struct DeviceInfo {
+		std::string portName;
+		uint32_t deviceId;       // Kept in the Arduino's EEPROM; 0 if the sketch predates CMD_IDENTIFY.
+		int firmwareMajor;       // Firmware version; 0.0 if unknown.
+		int firmwareMinor;
+		uint16_t capabilities;   // CAP_... mask; 0 if unknown.
+		double probeMs;          // Time from opening the port until the Arduino replied.
+
+		DeviceInfo();
+
+		bool IsIdentified() const { return this->deviceId != 0; }
+		bool Has(uint16_t capability) const { return (this->capabilities & capability) == capability; }
+	};
+
+	/// <summary>
+	/// Format a device ID as 8 hexadecimal digits (e.g., "3F09A2C1").
+	/// </summary>
+	std::string FormatDeviceId(uint32_t deviceId);
+
+	/// <summary>
+	/// Parse a device ID given as (up to 8) hexadecimal digits.
+	/// </summary>
+	/// <returns><c>false</c> if <c>text</c> is not a valid, non-zero device ID.</returns>
+	bool ParseDeviceId(const std::string& text, uint32_t& deviceId);
+
+	/// <summary>
+	/// Decode the payload of the Arduino's reply to <c>CMD_IDENTIFY</c> into <c>device</c>
+	/// (except for its port name).
+	/// </summary>
+	/// <returns><c>false</c> if the payload is not a reply of the Arduino sketch.</returns>
+	bool DecodeIdentifyReply(const std::vector<uint8_t>& payload, DeviceInfo& device);
+
+	/// <summary>
+	/// Finds the Arduino among the serial ports of the computer, so that the user need not
+	/// know its port name. All ports are probed concurrently, each on its own thread, by an
+	/// identify command, which tells the Arduino from other devices and yields its device ID;
+	/// hence, a scan takes as long as the slowest port, not the sum of all ports, and finding
+	/// a given Arduino only as long as its own port: the other probes are left to end in the
+	/// background (a port still probed is probed again once that ended). The port of
+	/// each Arduino connected to is kept in a cache file, which is probed first (with a short
+	/// timeout, as the Arduino is not reset by opening a port again), so that reconnecting
+	/// takes a single round trip in the common case.
+	///
+	/// NOTE: Probing writes a command frame to every candidate port, which other serial
+	/// devices may not expect; restrict the candidates if such devices are attached.
+	/// </summary>
+	class DeviceDiscovery {
+	public:
+		/// <summary>
+		/// Path of the cache file in the user's cache directory (%LOCALAPPDATA% on Windows,
+		/// $XDG_CACHE_HOME or ~/.cache otherwise); empty if unknown.
+		/// </summary>
+		static std::string DefaultCachePath();
+
+		/// <param name="cachePath">Cache file of the last known ports of the Arduinos; empty:
+		/// no cache.</param>
+		explicit DeviceDiscovery(const std::string& cachePath = DefaultCachePath());
+
+		/// <summary>
+		/// Probe all <c>ports</c> concurrently and wait until each replied or <c>timeoutMs</c>
+		/// passed. The default timeout covers the reset of an Arduino by opening its port.
+		/// </summary>
+		/// <returns>The Arduinos found, in the order of <c>ports</c>.</returns>
+		std::vector<DeviceInfo> Scan(const std::vector<std::string>& ports, int timeoutMs = ARDUINO_RESET_TIMEOUT_MS) const;
+
+		/// <summary>
+		/// Find the Arduino with <c>deviceId</c> (0: any) among <c>ports</c>: probe its cached
+		/// ports first; if it is not found there, scan all ports. Without a device ID, the most
+		/// recently used Arduino is preferred, and then the first one found.
+		/// </summary>
+		/// <returns><c>false</c> if no such Arduino was found; see <c>LastError()</c>.</returns>
+		bool Find(DeviceInfo& device, uint32_t deviceId = 0, const std::vector<std::string>& ports = ListSerialPorts());
+
+		/// <summary>
+		/// Record in the cache that <c>device</c> is attached to its port, e.g., after connecting
+		/// to it. Unidentified devices are not cached.
+		/// </summary>
+		void Remember(const DeviceInfo& device) const;
+
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		struct CacheEntry {
+			uint32_t deviceId;
+			std::string portName;
+		};
+
+		/// <summary>
+		/// Entries of the cache file, most recently used first.
+		/// </summary>
+		std::vector<CacheEntry> LoadCache() const;
+		void SaveCache(const std::vector<CacheEntry>& entries) const;
+
+		/// <summary>
+		/// <c>Scan()</c>, but return as soon as a device for which <c>isWanted</c> (if set)
+		/// returns <c>true</c> replied, without the devices of the ports still probed.
+		/// </summary>
+		std::vector<DeviceInfo> Scan(const std::vector<std::string>& ports, int timeoutMs,
+			const std::function<bool(const DeviceInfo& device)>& isWanted) const;
+
+		std::string cachePath;
+		std::string lastError;
+	};
+}
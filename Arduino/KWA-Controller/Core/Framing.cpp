@@ -0,0 +1,124 @@
+#include "Framing.h"
+
+
+namespace KwaController {
+
+	uint16_t Crc16Update(uint16_t crc, uint8_t value) {
+		crc ^= static_cast<uint16_t>(value) << 8;
+		for (int i = 0; i < 8; ++i) {
+			crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+		}
+		return crc;
+	}
+
+	void AppendFrame(std::vector<uint8_t>& out, uint8_t type, uint8_t seq, const uint8_t* payload, size_t size) {
+		uint8_t header[3] = { static_cast<uint8_t>(size), seq, type };
+		uint16_t crc = 0xFFFF;
+		out.push_back(FRAME_START);
+		for (uint8_t value : header) {
+			out.push_back(value);
+			crc = Crc16Update(crc, value);
+		}
+		for (size_t i = 0; i < size; ++i) {
+			out.push_back(payload[i]);
+			crc = Crc16Update(crc, payload[i]);
+		}
+		out.push_back(static_cast<uint8_t>(crc >> 8));
+		out.push_back(static_cast<uint8_t>(crc));
+	}
+
+	void AppendLong(std::vector<uint8_t>& out, uint32_t value) {
+		out.push_back(static_cast<uint8_t>(value >> 24));
+		out.push_back(static_cast<uint8_t>(value >> 16));
+		out.push_back(static_cast<uint8_t>(value >> 8));
+		out.push_back(static_cast<uint8_t>(value));
+	}
+
+	void AppendShort(std::vector<uint8_t>& out, uint16_t value) {
+		out.push_back(static_cast<uint8_t>(value >> 8));
+		out.push_back(static_cast<uint8_t>(value));
+	}
+
+	uint32_t ReadLong(const uint8_t* p) {
+		return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+			(static_cast<uint32_t>(p[2]) << 8) | p[3];
+	}
+
+	uint16_t ReadShort(const uint8_t* p) {
+		return static_cast<uint16_t>((p[0] << 8) | p[1]);
+	}
+
+
+	FrameDecoder::FrameDecoder() : droppedFrames(0) {
+		this->Reset();
+	}
+
+	void FrameDecoder::Reset() {
+		this->state = State::Start;
+		this->crc = 0xFFFF;
+		this->length = 0;
+		this->receivedCrc = 0;
+		this->current.payload.clear();
+	}
+
+	bool FrameDecoder::Feed(uint8_t value, Frame& frame) {
+		switch (this->state) {
+		case State::Start:
+			if (value == FRAME_START) {
+				this->crc = 0xFFFF;
+				this->current.payload.clear();
+				this->state = State::Length;
+			}
+			return false;
+
+		case State::Length:
+			if (value > FRAME_MAX_PAYLOAD) {
+				++this->droppedFrames;
+				// The byte may be the start of the next frame.
+				this->state = State::Start;
+				return this->Feed(value, frame);
+			}
+			this->length = value;
+			this->crc = Crc16Update(this->crc, value);
+			this->state = State::Seq;
+			return false;
+
+		case State::Seq:
+			this->current.seq = value;
+			this->crc = Crc16Update(this->crc, value);
+			this->state = State::Type;
+			return false;
+
+		case State::Type:
+			this->current.type = value;
+			this->crc = Crc16Update(this->crc, value);
+			this->state = this->length > 0 ? State::Payload : State::CrcHigh;
+			return false;
+
+		case State::Payload:
+			this->current.payload.push_back(value);
+			this->crc = Crc16Update(this->crc, value);
+			if (this->current.payload.size() == this->length) {
+				this->state = State::CrcHigh;
+			}
+			return false;
+
+		case State::CrcHigh:
+			this->receivedCrc = static_cast<uint16_t>(value << 8);
+			this->state = State::CrcLow;
+			return false;
+
+		case State::CrcLow:
+			this->state = State::Start;
+			if ((this->receivedCrc | value) != this->crc) {
+				++this->droppedFrames;
+				return false;
+			}
+			frame.type = this->current.type;
+			frame.seq = this->current.seq;
+			frame.payload.swap(this->current.payload);
+			return true;
+		}
+		return false;
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ArduinoProtocol.h"
+
+
+namespace KwaController {
+
+	/// <summary>
+	/// Update CRC-16/CCITT-FALSE <c>crc</c> with one byte (same as avr-libc's
+	/// <c>_crc_xmodem_update()</c>, but started at 0xFFFF).
+	/// </summary>
+	uint16_t Crc16Update(uint16_t crc, uint8_t value);
+
+	/// <summary>
+	/// Message exchanged with the Arduino; see <c>FRAME_START</c> for the frame format.
+	/// </summary>
+	struct Frame {
+		uint8_t type;
+		uint8_t seq;
+		std::vector<uint8_t> payload;
+	};
+
+	/// <summary>
+	/// Append a frame with the given type, sequence number and payload (at most
+	/// <c>FRAME_MAX_PAYLOAD</c> bytes) to <c>out</c>.
+	/// </summary>
+	void AppendFrame(std::vector<uint8_t>& out, uint8_t type, uint8_t seq, const uint8_t* payload = nullptr, size_t size = 0);
+
+	/// <summary>
+	/// Append <c>value</c> to <c>out</c> as 32-bit word in network byte order.
+	/// </summary>
+	void AppendLong(std::vector<uint8_t>& out, uint32_t value);
+
+	/// <summary>
+	/// Append <c>value</c> to <c>out</c> as 16-bit word in network byte order.
+	/// </summary>
+	void AppendShort(std::vector<uint8_t>& out, uint16_t value);
+
+	/// <summary>
+	/// Read a 32-bit word in network byte order.
+	/// </summary>
+	uint32_t ReadLong(const uint8_t* p);
+
+	/// <summary>
+	/// Read a 16-bit word in network byte order.
+	/// </summary>
+	uint16_t ReadShort(const uint8_t* p);
+
+	/// <summary>
+	/// Extracts frames from a byte stream. Bytes outside of frames and frames with a bad
+	/// length or CRC are skipped; decoding resumes at the next <c>FRAME_START</c>.
+	/// </summary>
+	class FrameDecoder {
+	public:
+		FrameDecoder();
+
+		void Reset();
+
+		/// <summary>
+		/// Decode one received byte.
+		/// </summary>
+		/// <returns><c>true</c> if the byte completed a valid frame, which is stored in <c>frame</c>.</returns>
+		bool Feed(uint8_t value, Frame& frame);
+
+		/// <summary>
+		/// Number of frames dropped because of a bad length or CRC since construction.
+		/// </summary>
+		uint64_t DroppedFrames() const { return this->droppedFrames; }
+
+	private:
+		enum class State { Start, Length, Seq, Type, Payload, CrcHigh, CrcLow };
+
+		State state;
+		uint16_t crc;
+		uint8_t length;
+		uint16_t receivedCrc;
+		Frame current;
+		uint64_t droppedFrames;
+	};
+}
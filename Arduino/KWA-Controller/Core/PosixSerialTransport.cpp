@@ -0,0 +1,227 @@
+#include "SerialTransport.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+namespace KwaController {
+
+	namespace {
+
+		/// <summary>
+		/// Map a baudrate to its termios speed constant; returns B0 if unsupported.
+		/// </summary>
+		speed_t ToSpeed(int baudrate) {
+			switch (baudrate) {
+			case 9600: return B9600;
+			case 19200: return B19200;
+			case 38400: return B38400;
+			case 57600: return B57600;
+			case 115200: return B115200;
+			case 230400: return B230400;
+#ifdef B500000
+			case 500000: return B500000;
+#endif
+#ifdef B1000000
+			case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+			case 2000000: return B2000000;
+#endif
+			default: return B0;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Serial transport based on POSIX termios. The file descriptor is non-blocking;
+	/// timeouts are implemented with <c>poll()</c>, which also watches a self-pipe
+	/// written by <c>Interrupt()</c>.
+	/// </summary>
+	class PosixSerialTransport : public SerialTransport {
+	public:
+		PosixSerialTransport() : fd(-1) {
+			if (::pipe(this->wakeFds) == 0) {
+				::fcntl(this->wakeFds[0], F_SETFL, O_NONBLOCK);
+				::fcntl(this->wakeFds[1], F_SETFL, O_NONBLOCK);
+			}
+			else {
+				this->wakeFds[0] = this->wakeFds[1] = -1;
+			}
+		}
+
+		~PosixSerialTransport() override {
+			this->Close();
+			if (this->wakeFds[0] >= 0) {
+				::close(this->wakeFds[0]);
+				::close(this->wakeFds[1]);
+			}
+		}
+
+		bool Open(const std::string& portName, int baudrate) override {
+			this->Close();
+
+			speed_t speed = ToSpeed(baudrate);
+			if (speed == B0) {
+				return false;
+			}
+			this->fd = ::open(portName.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+			if (this->fd < 0) {
+				return false;
+			}
+
+			termios tio;
+			if (::tcgetattr(this->fd, &tio) != 0) {
+				this->Close();
+				return false;
+			}
+			::cfmakeraw(&tio);
+			tio.c_cflag |= CLOCAL | CREAD;
+			// Keep DTR raised when the port is closed, so that opening it again does not reset
+			// the Arduino (as on Windows); only the first open after plugging it in does.
+			tio.c_cflag &= ~(CSTOPB | CRTSCTS | HUPCL);
+			tio.c_cc[VMIN] = 0;
+			tio.c_cc[VTIME] = 0;
+			::cfsetispeed(&tio, speed);
+			::cfsetospeed(&tio, speed);
+			if (::tcsetattr(this->fd, TCSANOW, &tio) != 0) {
+				this->Close();
+				return false;
+			}
+			return true;
+		}
+
+		bool SetBaudrate(int baudrate) override {
+			speed_t speed = ToSpeed(baudrate);
+			termios tio;
+			if (this->fd < 0 || speed == B0 || ::tcdrain(this->fd) != 0 || ::tcgetattr(this->fd, &tio) != 0) {
+				return false;
+			}
+			::cfsetispeed(&tio, speed);
+			::cfsetospeed(&tio, speed);
+			return ::tcsetattr(this->fd, TCSANOW, &tio) == 0;
+		}
+
+		void Close() override {
+			if (this->fd >= 0) {
+				::close(this->fd);
+				this->fd = -1;
+			}
+		}
+
+		bool IsOpen() const override {
+			return this->fd >= 0;
+		}
+
+		int Read(uint8_t* buf, size_t size, int timeoutMs) override {
+			if (this->fd < 0) {
+				return -1;
+			}
+			pollfd pfds[2] = { { this->fd, POLLIN, 0 }, { this->wakeFds[0], POLLIN, 0 } };
+			int ready;
+			do {
+				ready = ::poll(pfds, this->wakeFds[0] >= 0 ? 2 : 1, timeoutMs);
+			} while (ready < 0 && errno == EINTR);
+			if (ready < 0) {
+				return -1;
+			}
+			if (pfds[1].revents & POLLIN) {
+				uint8_t drain[64];
+				while (::read(this->wakeFds[0], drain, sizeof(drain)) > 0) {
+				}
+				return 0;
+			}
+			if (ready == 0) {
+				return 0;
+			}
+			ssize_t count = ::read(this->fd, buf, size);
+			if (count < 0) {
+				return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+			}
+			if (count == 0 && (pfds[0].revents & (POLLHUP | POLLERR))) {
+				return -1;  // Device disconnected.
+			}
+			return static_cast<int>(count);
+		}
+
+		void Interrupt() override {
+			if (this->wakeFds[1] >= 0) {
+				uint8_t value = 0;
+				// If the pipe is full, a wake-up is pending anyway.
+				ssize_t ignored = ::write(this->wakeFds[1], &value, 1);
+				(void)ignored;
+			}
+		}
+
+		bool Write(const uint8_t* buf, size_t size) override {
+			if (this->fd < 0) {
+				return false;
+			}
+			while (size > 0) {
+				ssize_t count = ::write(this->fd, buf, size);
+				if (count < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					if (errno != EAGAIN) {
+						return false;
+					}
+					// Output buffer full; wait until it drains.
+					pollfd pfd = { this->fd, POLLOUT, 0 };
+					if (::poll(&pfd, 1, WRITE_TIMEOUT_MS) <= 0) {
+						return false;
+					}
+					continue;
+				}
+				buf += count;
+				size -= static_cast<size_t>(count);
+			}
+			return true;
+		}
+
+		void DiscardInput() override {
+			if (this->fd >= 0) {
+				::tcflush(this->fd, TCIFLUSH);
+			}
+		}
+
+	private:
+		static const int WRITE_TIMEOUT_MS = 500;
+
+		int fd;
+		int wakeFds[2];  // Self-pipe for `Interrupt()` (read end, write end).
+	};
+
+	std::unique_ptr<SerialTransport> CreateSerialTransport() {
+		return std::unique_ptr<SerialTransport>(new PosixSerialTransport());
+	}
+
+	std::vector<std::string> ListSerialPorts() {
+		// USB serial adapters of Arduinos: CDC ACM (UNO R3) and FTDI/CH340 (Nano) on Linux;
+		// their call-out devices on macOS.
+		static const char* const PREFIXES[] = { "ttyACM", "ttyUSB", "cu.usbmodem", "cu.usbserial", "cu.wchusbserial" };
+		std::vector<std::string> ports;
+		DIR* dir = ::opendir("/dev");
+		if (!dir) {
+			return ports;
+		}
+		while (dirent* entry = ::readdir(dir)) {
+			for (const char* prefix : PREFIXES) {
+				if (std::strncmp(entry->d_name, prefix, std::strlen(prefix)) == 0) {
+					ports.push_back(std::string("/dev/") + entry->d_name);
+					break;
+				}
+			}
+		}
+		::closedir(dir);
+		std::sort(ports.begin(), ports.end());
+		return ports;
+	}
+}
@@ -0,0 +1,223 @@
+#include "RigGroup.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <limits>
+
+
+namespace KwaController {
+
+	BoardConfig::BoardConfig(const std::string& portName)
+		: portName(portName), lights(1, LIGHT_WHITE), strobe(), startOffsetUs(0) {
+	}
+
+
+	/// <summary>
+	/// Controller and telemetry state of one board.
+	/// </summary>
+	struct RigGroup::Board {
+		BoardConfig config;
+		ArduinoController controller;
+		TriggerStats stats;
+		ClockSync clock;
+		TriggerLogWriter log;
+		std::vector<TriggerEdge> edges;
+		std::vector<ClockSample> clockSamples;
+		double startSkewUs;   // See `StartSkewUs()`; NaN until the clock model is valid.
+
+		explicit Board(const BoardConfig& config)
+			: config(config), startSkewUs(std::numeric_limits<double>::quiet_NaN()) {
+		}
+	};
+
+	namespace {
+		// The start skew is measured by the clock models of the first samples of a recording,
+		// which cover its start; later models extrapolate back from their window of samples.
+		const size_t START_SKEW_SAMPLES = 32;
+
+		/// <summary>
+		/// Submit a command to each board by <c>submit(board, done)</c>, so that all boards
+		/// execute it concurrently on their I/O threads, and wait for all results.
+		/// </summary>
+		template <typename Board, typename Submit>
+		std::vector<CommandResult> RunOnAll(const std::vector<std::unique_ptr<Board>>& boards, Submit submit) {
+			std::vector<std::promise<CommandResult>> promises(boards.size());
+			std::vector<std::future<CommandResult>> futures;
+			for (size_t i = 0; i < boards.size(); ++i) {
+				futures.push_back(promises[i].get_future());
+				std::promise<CommandResult>* promise = &promises[i];
+				submit(*boards[i], [promise](const CommandResult& result) { promise->set_value(result); });
+			}
+			std::vector<CommandResult> results;
+			for (std::future<CommandResult>& future : futures) {
+				results.push_back(future.get());
+			}
+			return results;
+		}
+	}
+
+	RigGroup::RigGroup() : scheduledStartUs(0) {
+	}
+
+	RigGroup::~RigGroup() {
+		// Each controller stops its recording and disconnects on destruction.
+	}
+
+	bool RigGroup::Connect(const std::vector<BoardConfig>& boards, int baudrate) {
+		this->Disconnect();
+		this->boards.clear();
+		for (const BoardConfig& config : boards) {
+			this->boards.emplace_back(new Board(config));
+		}
+		std::vector<CommandResult> results = RunOnAll(this->boards, [baudrate](Board& board, CommandCallback done) {
+			board.controller.ConnectAsync(board.config.portName, std::move(done), baudrate);
+		});
+		for (size_t i = 0; i < results.size(); ++i) {
+			if (!results[i].success) {
+				this->Disconnect();
+				return this->Fail(*this->boards[i], results[i].error);
+			}
+		}
+		return true;
+	}
+
+	void RigGroup::Disconnect() {
+		RunOnAll(this->boards, [](Board& board, CommandCallback done) {
+			board.controller.DisconnectAsync(std::move(done));
+		});
+		for (const std::unique_ptr<Board>& board : this->boards) {
+			board->log.Close();
+		}
+	}
+
+	bool RigGroup::StartRecording(double fps, int leadTimeMs) {
+		for (const std::unique_ptr<Board>& board : this->boards) {
+			board->stats.Reset();
+			board->clock.Reset();
+			board->startSkewUs = std::numeric_limits<double>::quiet_NaN();
+		}
+		int64_t start = HostClockUs() + static_cast<int64_t>(leadTimeMs) * 1000;
+		this->scheduledStartUs = start;
+		std::vector<CommandResult> results = RunOnAll(this->boards, [fps, start](Board& board, CommandCallback done) {
+			const BoardConfig& config = board.config;
+			board.controller.StartRecordingAsync(fps, std::move(done), config.lights, config.strobe, config.auxTriggers,
+				start + config.startOffsetUs);
+		});
+		for (size_t i = 0; i < results.size(); ++i) {
+			if (!results[i].success) {
+				// Stop the boards that started; the error of the first failed board is reported.
+				RunOnAll(this->boards, [](Board& board, CommandCallback done) {
+					board.controller.StopRecordingAsync(std::move(done));
+				});
+				return this->Fail(*this->boards[i], results[i].error);
+			}
+		}
+		return true;
+	}
+
+	bool RigGroup::StopRecording() {
+		std::vector<CommandResult> results = RunOnAll(this->boards, [](Board& board, CommandCallback done) {
+			board.controller.StopRecordingAsync(std::move(done));
+		});
+		this->Poll();
+		for (size_t i = 0; i < this->boards.size(); ++i) {
+			Board& board = *this->boards[i];
+			if (board.log.IsOpen()) {
+				board.log.Close();
+				board.clock.WriteTable(this->logPrefix + "-" + std::to_string(i + 1) + ".clock.csv");
+			}
+		}
+		for (size_t i = 0; i < results.size(); ++i) {
+			if (!results[i].success) {
+				return this->Fail(*this->boards[i], results[i].error);
+			}
+		}
+		return true;
+	}
+
+	bool RigGroup::SetFps(double fps) {
+		std::vector<CommandResult> results = RunOnAll(this->boards, [fps](Board& board, CommandCallback done) {
+			board.controller.SetFpsAsync(fps, std::move(done));
+		});
+		for (size_t i = 0; i < results.size(); ++i) {
+			if (!results[i].success) {
+				return this->Fail(*this->boards[i], results[i].error);
+			}
+		}
+		return true;
+	}
+
+	bool RigGroup::OpenLogs(const std::string& prefix) {
+		this->logPrefix = prefix;
+		for (size_t i = 0; i < this->boards.size(); ++i) {
+			std::string path = prefix + "-" + std::to_string(i + 1) + ".csv";
+			if (!this->boards[i]->log.Open(path)) {
+				return this->Fail(*this->boards[i], "Could not create trigger log file " + path + ".");
+			}
+		}
+		return true;
+	}
+
+	void RigGroup::Poll() {
+		for (const std::unique_ptr<Board>& board : this->boards) {
+			board->controller.TakeClockSamples(board->clockSamples);
+			for (const ClockSample& sample : board->clockSamples) {
+				board->clock.Add(sample);
+				const ClockModel& model = board->clock.Model();
+				if (model.valid && board->clock.SampleCount() <= START_SKEW_SAMPLES) {
+					// The trigger clock is 0 at the first trigger edge.
+					board->startSkewUs = model.ToHostUs(0) -
+						static_cast<double>(this->scheduledStartUs + board->config.startOffsetUs);
+				}
+			}
+			board->controller.TakeEdges(board->edges);
+			for (const TriggerEdge& edge : board->edges) {
+				board->stats.Add(edge);
+			}
+			board->log.Write(board->edges, board->clock.Model());
+		}
+	}
+
+	const BoardConfig& RigGroup::Config(size_t board) const {
+		return this->boards[board]->config;
+	}
+
+	ArduinoController& RigGroup::Controller(size_t board) {
+		return this->boards[board]->controller;
+	}
+
+	const TriggerStats& RigGroup::Stats(size_t board) const {
+		return this->boards[board]->stats;
+	}
+
+	const ClockModel& RigGroup::Clock(size_t board) const {
+		return this->boards[board]->clock.Model();
+	}
+
+	double RigGroup::StartSkewUs(size_t board) const {
+		return this->boards[board]->startSkewUs;
+	}
+
+	double RigGroup::StartSpreadUs() const {
+		if (this->boards.empty()) {
+			return std::numeric_limits<double>::quiet_NaN();
+		}
+		double minSkew = std::numeric_limits<double>::infinity();
+		double maxSkew = -std::numeric_limits<double>::infinity();
+		for (size_t i = 0; i < this->boards.size(); ++i) {
+			double skew = this->StartSkewUs(i);
+			if (std::isnan(skew)) {
+				return skew;
+			}
+			minSkew = std::min(minSkew, skew);
+			maxSkew = std::max(maxSkew, skew);
+		}
+		return maxSkew - minSkew;
+	}
+
+	bool RigGroup::Fail(const Board& board, const std::string& error) {
+		this->lastError = board.config.portName + ": " + error;
+		return false;
+	}
+}
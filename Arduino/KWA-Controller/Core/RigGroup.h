@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ArduinoController.h"
+#include "ClockSync.h"
+#include "TriggerTelemetry.h"
+
+
+namespace KwaController {
+
+	/// <summary>
+	/// One Arduino of a <c>RigGroup</c> and the outputs it drives.
+	/// </summary>
+	struct BoardConfig {
+		std::string portName;
+		LightPattern lights;
+		Strobe strobe;
+		TriggerPhases auxTriggers;
+		int startOffsetUs;  // Phase of this board's trigger edges on the common timeline.
+
+		explicit BoardConfig(const std::string& portName = std::string());
+	};
+
+	/// <summary>
+	/// Runs several Arduinos (e.g., of several arenas or cameras) as one rig: all boards are
+	/// connected, started, and stopped concurrently, each on its own <c>ArduinoController</c>.
+	/// A recording starts at a common scheduled time plus each board's start offset, so that
+	/// all cameras fire on a common timeline; the actual start of each board is measured by
+	/// synchronizing its clock with the host (see <c>ClockSync</c>) and reported as start
+	/// skew. The blocking methods must be called from one thread, which also calls
+	/// <c>Poll()</c> regularly while recording.
+	/// </summary>
+	class RigGroup {
+	public:
+		// Time from the start command to the scheduled start, which covers the commands
+		// sent to each board before.
+		static const int DEFAULT_START_LEAD_MS = 300;
+
+		RigGroup();
+		~RigGroup();
+
+		/// <summary>
+		/// Connect to all <c>boards</c>, replacing the boards of an earlier call. If a board
+		/// fails, all are disconnected.
+		/// </summary>
+		bool Connect(const std::vector<BoardConfig>& boards, int baudrate = ARDUINO_FAST_BAUDRATE);
+		void Disconnect();
+
+		/// <summary>
+		/// Start recording at <c>fps</c> Hz on all boards, <c>leadTimeMs</c> from now. Resets
+		/// the statistics and clock models; if a board fails, the others are stopped again.
+		/// </summary>
+		bool StartRecording(double fps, int leadTimeMs = DEFAULT_START_LEAD_MS);
+		/// <summary>
+		/// Stop recording on all boards; then, <c>Poll()</c> is called a last time.
+		/// </summary>
+		bool StopRecording();
+		/// <summary>
+		/// Change the frame rate of all boards (at their next trigger edge each).
+		/// </summary>
+		bool SetFps(double fps);
+
+		/// <summary>
+		/// Write the trigger edges of each board to a CSV file <c>prefix</c>-<i>N</i>.csv
+		/// (N = 1, 2, ... in the order of the boards; see <c>TriggerLogWriter</c>), and its
+		/// clock samples to <c>prefix</c>-<i>N</i>.clock.csv when the recording stops.
+		/// </summary>
+		bool OpenLogs(const std::string& prefix);
+		/// <summary>
+		/// Take the trigger edges and clock samples received from all boards, updating the
+		/// statistics, clock models, start skews, and logs.
+		/// </summary>
+		void Poll();
+
+		size_t BoardCount() const { return this->boards.size(); }
+		const BoardConfig& Config(size_t board) const;
+		ArduinoController& Controller(size_t board);
+		const TriggerStats& Stats(size_t board) const;
+		const ClockModel& Clock(size_t board) const;
+		/// <summary>
+		/// Scheduled start of the last recording in host time (see <c>HostClockUs()</c>).
+		/// </summary>
+		int64_t ScheduledStartUs() const { return this->scheduledStartUs; }
+		/// <summary>
+		/// Actual minus scheduled start (incl. the board's start offset) of the last recording
+		/// on <c>board</c> in microseconds, as measured by the clock synchronization over the
+		/// first seconds of the recording (see <c>Poll()</c>); NaN until the board's clock
+		/// model is valid. Kept after the recording stopped.
+		/// </summary>
+		double StartSkewUs(size_t board) const;
+		/// <summary>
+		/// Largest difference between the start skews of any two boards; NaN if unknown.
+		/// </summary>
+		double StartSpreadUs() const;
+		/// <summary>
+		/// Error of the last failed blocking method; names the board that failed.
+		/// </summary>
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		struct Board;
+
+		RigGroup(const RigGroup&) = delete;
+		RigGroup& operator=(const RigGroup&) = delete;
+
+		bool Fail(const Board& board, const std::string& error);
+
+		std::vector<std::unique_ptr<Board>> boards;
+		std::string logPrefix;
+		int64_t scheduledStartUs;
+		std::string lastError;
+	};
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace KwaController {
+
+	/// <summary>
+	/// Byte stream to the Arduino over a serial port. Implemented per platform by
+	/// <c>PosixSerialTransport</c> (termios; also works with pseudo-terminals) and
+	/// <c>Win32SerialTransport</c>; use <c>CreateSerialTransport()</c> to get the one
+	/// for the current platform. All methods report errors by their return value.
+	///
+	/// A transport is used by a single (I/O) thread, except for <c>Interrupt()</c>.
+	/// </summary>
+	class SerialTransport {
+	public:
+		virtual ~SerialTransport() = default;
+
+		/// <summary>
+		/// Open serial port <c>portName</c> (e.g., "COM4" or "/dev/ttyUSB0") in raw 8N1 mode.
+		/// </summary>
+		/// <returns><c>true</c> if the port was opened and configured.</returns>
+		virtual bool Open(const std::string& portName, int baudrate) = 0;
+		virtual void Close() = 0;
+
+		/// <summary>
+		/// Change the baudrate of the open port after all pending output was sent.
+		/// </summary>
+		virtual bool SetBaudrate(int baudrate) = 0;
+
+		virtual bool IsOpen() const = 0;
+
+		/// <summary>
+		/// Read up to <c>size</c> bytes. Waits at most <c>timeoutMs</c> milliseconds for the
+		/// first byte, but returns as soon as any bytes are available.
+		/// </summary>
+		/// <returns>Number of bytes read; 0 on timeout; -1 on error (e.g., port not open).</returns>
+		virtual int Read(uint8_t* buf, size_t size, int timeoutMs) = 0;
+
+		/// <summary>
+		/// Make the current (or, if none, the next) <c>Read()</c> return 0 immediately.
+		/// May be called from any thread, e.g., to wake up the I/O thread for a new command.
+		/// </summary>
+		virtual void Interrupt() = 0;
+
+		/// <summary>
+		/// Write all <c>size</c> bytes from <c>buf</c>.
+		/// </summary>
+		/// <returns><c>true</c> if all bytes were written.</returns>
+		virtual bool Write(const uint8_t* buf, size_t size) = 0;
+
+		/// <summary>
+		/// Discard all bytes received but not yet read.
+		/// </summary>
+		virtual void DiscardInput() = 0;
+	};
+
+	/// <summary>
+	/// Create the serial transport implementation for the current platform.
+	/// </summary>
+	std::unique_ptr<SerialTransport> CreateSerialTransport();
+
+	/// <summary>
+	/// Names of the serial ports of this computer that may have an Arduino attached (e.g.,
+	/// "COM3" or "/dev/ttyACM0"), sorted by name (COM ports by number); see <c>DeviceDiscovery</c>.
+	/// </summary>
+	std::vector<std::string> ListSerialPorts();
+}
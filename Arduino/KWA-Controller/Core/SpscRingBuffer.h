@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// NOTE: <atomic> cannot be compiled with /clr; only include this header from native
+// translation units.
+
+
+namespace KwaController {
+
+	/// <summary>
+	/// Lock-free, bounded single-producer/single-consumer queue. <c>TryPush()</c> must only
+	/// be called by one (producer) thread and <c>TryPop()</c> by one (consumer) thread;
+	/// neither ever blocks.
+	/// </summary>
+	template <typename T>
+	class SpscRingBuffer {
+	public:
+		/// <param name="capacity">Max. number of elements; rounded up to a power of two.</param>
+		explicit SpscRingBuffer(size_t capacity) : head(0), tail(0) {
+			size_t size = 1;
+			while (size < capacity) {
+				size <<= 1;
+			}
+			this->mask = size - 1;
+			this->buffer.reset(new T[size]);
+		}
+
+		/// <summary>
+		/// Append <c>value</c> (producer thread only).
+		/// </summary>
+		/// <returns><c>false</c> if the queue is full.</returns>
+		bool TryPush(const T& value) {
+			size_t h = this->head.load(std::memory_order_relaxed);
+			if (h - this->tail.load(std::memory_order_acquire) > this->mask) {
+				return false;
+			}
+			this->buffer[h & this->mask] = value;
+			this->head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		/// <summary>
+		/// Remove the oldest element into <c>value</c> (consumer thread only).
+		/// </summary>
+		/// <returns><c>false</c> if the queue is empty.</returns>
+		bool TryPop(T& value) {
+			size_t t = this->tail.load(std::memory_order_relaxed);
+			if (t == this->head.load(std::memory_order_acquire)) {
+				return false;
+			}
+			value = this->buffer[t & this->mask];
+			this->tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+	private:
+		SpscRingBuffer(const SpscRingBuffer&) = delete;
+		SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+		// Producer and consumer index on separate cache lines to avoid false sharing.
+		alignas(64) std::atomic<size_t> head;  // Next slot to write; only written by producer.
+		alignas(64) std::atomic<size_t> tail;  // Next slot to read; only written by consumer.
+		size_t mask;
+		std::unique_ptr<T[]> buffer;
+	};
+}
@@ -0,0 +1,204 @@
+#include "TriggerTelemetry.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include "Framing.h"
+
+
+namespace KwaController {
+
+	TelemetryDecoder::TelemetryDecoder() {
+		this->Reset();
+	}
+
+	void TelemetryDecoder::Reset() {
+		this->hasLastTicks = false;
+		this->lastTicks = 0;
+		this->edges.clear();
+	}
+
+	bool TelemetryDecoder::Decode(const uint8_t* payload, size_t size) {
+		// Count (1 byte), index, timestamp, and nominal period of the first edge (4 bytes each),
+		// followed by the deviations of the remaining edges' periods.
+		const size_t headerSize = 13;
+		if (size < headerSize || payload[0] == 0) {
+			return false;
+		}
+		uint8_t count = payload[0];
+		uint32_t index = ReadLong(payload + 1);
+		uint32_t ticks = ReadLong(payload + 5);
+		uint32_t nominalTicks = ReadLong(payload + 9);
+		this->AddEdge(index, ticks, nominalTicks);
+
+		size_t pos = headerSize;
+		for (uint8_t i = 1; i < count; ++i) {
+			// Zig-zag encoded deviation from the nominal period, 7 bits per byte, LSB first.
+			uint32_t zigzag = 0;
+			int shift = 0;
+			uint8_t value;
+			do {
+				if (pos == size || shift > 28) {
+					return false;
+				}
+				value = payload[pos++];
+				zigzag |= static_cast<uint32_t>(value & 0x7F) << shift;
+				shift += 7;
+			} while (value & 0x80);
+			int32_t deviation = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+			ticks += nominalTicks + static_cast<uint32_t>(deviation);
+			this->AddEdge(index + i, ticks, nominalTicks);
+		}
+		return pos == size;
+	}
+
+	uint64_t TelemetryDecoder::Unwrap(uint32_t ticks) const {
+		if (!this->hasLastTicks) {
+			return ticks;
+		}
+		// Signed, as the timestamp may precede the last edge.
+		return this->lastTicks + static_cast<int32_t>(ticks - static_cast<uint32_t>(this->lastTicks));
+	}
+
+	void TelemetryDecoder::AddEdge(uint32_t index, uint32_t ticks, uint32_t nominalTicks) {
+		// Timestamps are sent as 32-bit values, which wrap around after ~268 s at 16 MHz.
+		// Unwrap them based on the previous edge, as edges are never that far apart.
+		if (this->hasLastTicks) {
+			this->lastTicks += static_cast<uint32_t>(ticks - static_cast<uint32_t>(this->lastTicks));
+		}
+		else {
+			this->lastTicks = ticks;
+			this->hasLastTicks = true;
+		}
+		this->edges.push_back({ index, this->lastTicks, nominalTicks });
+	}
+
+	void TelemetryDecoder::TakeEdges(std::vector<TriggerEdge>& edges) {
+		edges.clear();
+		edges.swap(this->edges);
+	}
+
+
+	TriggerStats::TriggerStats(double binWidthUs, int binCount, double deadlineUs)
+		: binWidthUs(binWidthUs), deadlineUs(deadlineUs), histogram(binCount, 0) {
+		this->Reset();
+	}
+
+	void TriggerStats::Reset() {
+		std::fill(this->histogram.begin(), this->histogram.end(), 0);
+		this->edgeCount = 0;
+		this->lostEdges = 0;
+		this->missedDeadlines = 0;
+		this->hasLastEdge = false;
+		this->lastEdge = {};
+		this->deviationCount = 0;
+		this->deviationMean = 0.0;
+		this->deviationM2 = 0.0;
+		this->nominalPeriodUs = 0.0;
+	}
+
+	void TriggerStats::Add(const TriggerEdge& edge) {
+		++this->edgeCount;
+
+		if (this->hasLastEdge && edge.index > this->lastEdge.index) {
+			uint32_t frames = edge.index - this->lastEdge.index;
+			this->lostEdges += frames - 1;
+
+			// Only consecutive edges yield a period sample.
+			if (frames == 1) {
+				const double usPerTick = 1e6 / ARDUINO_CPU_CLOCK_HZ;
+				double periodUs = (edge.ticks - this->lastEdge.ticks) * usPerTick;
+				this->nominalPeriodUs = edge.nominalTicks * usPerTick;
+				double deviationUs = periodUs - this->nominalPeriodUs;
+
+				++this->deviationCount;
+				double delta = deviationUs - this->deviationMean;
+				this->deviationMean += delta / this->deviationCount;
+				this->deviationM2 += delta * (deviationUs - this->deviationMean);
+
+				int bins = static_cast<int>(this->histogram.size());
+				int bin = static_cast<int>(std::floor(deviationUs / this->binWidthUs + 0.5)) + bins / 2;
+				bin = bin < 0 ? 0 : (bin >= bins ? bins - 1 : bin);
+				++this->histogram[bin];
+
+				if (deviationUs > this->deadlineUs) {
+					++this->missedDeadlines;
+				}
+			}
+		}
+
+		this->lastEdge = edge;
+		this->hasLastEdge = true;
+	}
+
+	double TriggerStats::MeanPeriodUs() const {
+		// The current nominal period, as the nominal period may have changed with the rate.
+		return this->deviationCount > 0 ? this->nominalPeriodUs + this->deviationMean : 0.0;
+	}
+
+	double TriggerStats::JitterUs() const {
+		return this->deviationCount > 1 ? std::sqrt(this->deviationM2 / (this->deviationCount - 1)) : 0.0;
+	}
+
+
+	TriggerLogWriter::TriggerLogWriter() : file(nullptr) {
+	}
+
+	TriggerLogWriter::~TriggerLogWriter() {
+		this->Close();
+	}
+
+	std::FILE* CreateLogFile(const std::string& path) {
+		std::FILE* file = nullptr;
+#ifdef _WIN32
+		// Convert UTF-8 path to UTF-16 to support non-ASCII paths on Windows.
+		int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+		std::wstring widePath(length, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &widePath[0], length);
+		if (_wfopen_s(&file, widePath.c_str(), L"w") != 0) {
+			file = nullptr;
+		}
+#else
+		file = std::fopen(path.c_str(), "w");
+#endif
+		return file;
+	}
+
+	bool TriggerLogWriter::Open(const std::string& path) {
+		this->Close();
+		this->file = CreateLogFile(path);
+		if (!this->file) {
+			return false;
+		}
+		std::fputs("index,ticks,time_us,host_time_us\n", this->file);
+		return true;
+	}
+
+	void TriggerLogWriter::Write(const std::vector<TriggerEdge>& edges, const ClockModel& clock) {
+		if (!this->file) {
+			return;
+		}
+		const double usPerTick = 1e6 / ARDUINO_CPU_CLOCK_HZ;
+		for (const TriggerEdge& edge : edges) {
+			std::fprintf(this->file, "%lu,%llu,%.4f,",
+				static_cast<unsigned long>(edge.index),
+				static_cast<unsigned long long>(edge.ticks),
+				edge.ticks * usPerTick);
+			if (clock.valid) {
+				std::fprintf(this->file, "%.1f", clock.ToHostUs(edge.ticks));
+			}
+			std::fputc('\n', this->file);
+		}
+	}
+
+	void TriggerLogWriter::Close() {
+		if (this->file) {
+			std::fclose(this->file);
+			this->file = nullptr;
+		}
+	}
+}
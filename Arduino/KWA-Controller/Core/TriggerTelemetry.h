@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "ArduinoProtocol.h"
+#include "ClockSync.h"
+
+
+namespace KwaController {
+
+	/// <summary>
+	/// Camera trigger edge reported by the Arduino.
+	/// </summary>
+	struct TriggerEdge {
+		uint32_t index;          // Index of the trigger pulse since recording start.
+		uint64_t ticks;          // Time of the edge in Arduino CPU cycles since recording start.
+		uint32_t nominalTicks;   // Nominal (integral) frame period in CPU cycles.
+	};
+
+	/// <summary>
+	/// Trigger pulses of a recording as counted by the Arduino, which reports them when the
+	/// recording is stopped, e.g., to reconcile them with the number of recorded video frames.
+	/// </summary>
+	struct TriggerSummary {
+		uint32_t pulseCount;      // Number of trigger pulses sent to the camera.
+		uint64_t lastPulseTicks;  // Time of the last pulse in CPU cycles since recording start.
+	};
+
+	/// <summary>
+	/// Decodes the trigger telemetry frames (<c>EVT_TELEMETRY</c>) sent by the Arduino while
+	/// recording. Each frame's payload is passed to <c>Decode()</c>; decoded edges are
+	/// collected until they are taken with <c>TakeEdges()</c>.
+	/// </summary>
+	class TelemetryDecoder {
+	public:
+		TelemetryDecoder();
+
+		/// <summary>
+		/// Reset the decoder state at the start of a new recording.
+		/// </summary>
+		void Reset();
+
+		/// <summary>
+		/// Decode the payload of one telemetry frame.
+		/// </summary>
+		/// <returns><c>false</c> if the payload is malformed; edges decoded before the
+		/// error are kept.</returns>
+		bool Decode(const uint8_t* payload, size_t size);
+
+		/// <summary>
+		/// Move all edges decoded since the last call into <c>edges</c> (which is cleared first).
+		/// </summary>
+		void TakeEdges(std::vector<TriggerEdge>& edges);
+
+		/// <summary>
+		/// Unwrap a 32-bit timestamp of the current recording taken within half a wrap-around
+		/// (~134 s) before or after the last decoded edge (e.g., in the reply to a stop command,
+		/// or the receipt of a command, which later edges may have overtaken in telemetry).
+		/// </summary>
+		uint64_t Unwrap(uint32_t ticks) const;
+
+	private:
+		void AddEdge(uint32_t index, uint32_t ticks, uint32_t nominalTicks);
+
+		bool hasLastTicks;
+		uint64_t lastTicks;        // Unwrapped timestamp of the previous edge.
+		std::vector<TriggerEdge> edges;
+	};
+
+	/// <summary>
+	/// Live statistics of the trigger edges of a recording: frame period mean and jitter
+	/// (standard deviation), both of the periods' deviation from their nominal period so that
+	/// rate changes do not count as jitter, a histogram of that deviation,
+	/// the number of edges lost in telemetry, and the number of missed deadlines, i.e.,
+	/// edges arriving more than the deadline later than nominal after their predecessor.
+	/// </summary>
+	class TriggerStats {
+	public:
+		/// <param name="binWidthUs">Width of a histogram bin in microseconds.</param>
+		/// <param name="binCount">Number of histogram bins, centered on the nominal period.
+		/// The first and last bin also count all smaller and larger deviations, respectively.</param>
+		/// <param name="deadlineUs">Max. delay of an edge in microseconds.</param>
+		TriggerStats(double binWidthUs = 0.25, int binCount = 41, double deadlineUs = 10.0);
+
+		void Reset();
+		void Add(const TriggerEdge& edge);
+
+		uint64_t EdgeCount() const { return edgeCount; }
+		uint64_t LostEdges() const { return lostEdges; }
+		uint64_t MissedDeadlines() const { return missedDeadlines; }
+		double MeanPeriodUs() const;
+		double JitterUs() const;
+		double BinWidthUs() const { return binWidthUs; }
+		const std::vector<uint64_t>& Histogram() const { return histogram; }
+
+	private:
+		double binWidthUs;
+		double deadlineUs;
+		std::vector<uint64_t> histogram;
+		uint64_t edgeCount;
+		uint64_t lostEdges;
+		uint64_t missedDeadlines;
+		bool hasLastEdge;
+		TriggerEdge lastEdge;
+		// Running mean and sum of squared differences of the periods' deviation from their
+		// nominal period (Welford's algorithm).
+		uint64_t deviationCount;
+		double deviationMean;
+		double deviationM2;
+		double nominalPeriodUs;    // Of the last period.
+	};
+
+	/// <summary>
+	/// Create a text file at <c>path</c> (UTF-8, also on Windows) for writing.
+	/// </summary>
+	/// <returns>The file, or <c>nullptr</c> on failure.</returns>
+	std::FILE* CreateLogFile(const std::string& path);
+
+	/// <summary>
+	/// Writes the trigger edges of a recording session to a CSV file with columns
+	/// <c>index</c>, <c>ticks</c> (Arduino CPU cycles), <c>time_us</c>, and <c>host_time_us</c>
+	/// (see <c>HostClockUs()</c>; empty until the clock model is valid).
+	/// </summary>
+	class TriggerLogWriter {
+	public:
+		TriggerLogWriter();
+		~TriggerLogWriter();
+
+		/// <summary>
+		/// Create the log file at <c>path</c> (UTF-8) and write the CSV header.
+		/// </summary>
+		/// <returns><c>true</c> if the file was created.</returns>
+		bool Open(const std::string& path);
+		/// <param name="clock">Converts the edges' timestamps to host time.</param>
+		void Write(const std::vector<TriggerEdge>& edges, const ClockModel& clock = ClockModel());
+		void Close();
+		bool IsOpen() const { return file != nullptr; }
+
+	private:
+		TriggerLogWriter(const TriggerLogWriter&) = delete;
+		TriggerLogWriter& operator=(const TriggerLogWriter&) = delete;
+
+		std::FILE* file;
+	};
+}
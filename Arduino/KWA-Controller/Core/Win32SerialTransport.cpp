@@ -0,0 +1,205 @@
+#include "SerialTransport.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <Windows.h>
+
+
+namespace KwaController {
+
+	/// <summary>
+	/// Serial transport based on the Win32 communications API. The port is opened for
+	/// overlapped I/O, so that a pending read can wait for both received bytes and the
+	/// event signaled by <c>Interrupt()</c>.
+	/// </summary>
+	class Win32SerialTransport : public SerialTransport {
+	public:
+		Win32SerialTransport() : handle(INVALID_HANDLE_VALUE) {
+			this->readEvent = ::CreateEventA(nullptr, TRUE, FALSE, nullptr);
+			this->writeEvent = ::CreateEventA(nullptr, TRUE, FALSE, nullptr);
+			this->wakeEvent = ::CreateEventA(nullptr, FALSE, FALSE, nullptr);
+		}
+
+		~Win32SerialTransport() override {
+			this->Close();
+			::CloseHandle(this->readEvent);
+			::CloseHandle(this->writeEvent);
+			::CloseHandle(this->wakeEvent);
+		}
+
+		bool Open(const std::string& portName, int baudrate) override {
+			this->Close();
+
+			// The "\\.\" prefix is required for ports COM10 and above.
+			std::string path = "\\\\.\\" + portName;
+			this->handle = ::CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+				OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+			if (this->handle == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+
+			DCB dcb = {};
+			dcb.DCBlength = sizeof(dcb);
+			if (!::GetCommState(this->handle, &dcb)) {
+				this->Close();
+				return false;
+			}
+			dcb.BaudRate = static_cast<DWORD>(baudrate);
+			dcb.ByteSize = 8;
+			dcb.Parity = NOPARITY;
+			dcb.StopBits = ONESTOPBIT;
+			dcb.fBinary = TRUE;
+			dcb.fParity = FALSE;
+			dcb.fOutxCtsFlow = FALSE;
+			dcb.fOutxDsrFlow = FALSE;
+			// Keep DTR/RTS low (as `System::IO::Ports::SerialPort` does by default), so that
+			// opening the port does not reset the Arduino.
+			dcb.fDtrControl = DTR_CONTROL_DISABLE;
+			dcb.fRtsControl = RTS_CONTROL_DISABLE;
+			dcb.fOutX = FALSE;
+			dcb.fInX = FALSE;
+			dcb.fAbortOnError = FALSE;
+			if (!::SetCommState(this->handle, &dcb)) {
+				this->Close();
+				return false;
+			}
+
+			// Make `ReadFile()` complete as soon as any bytes are available; the read
+			// timeout is implemented by waiting for the overlapped operation.
+			COMMTIMEOUTS timeouts = {};
+			timeouts.ReadIntervalTimeout = MAXDWORD;
+			timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+			timeouts.ReadTotalTimeoutConstant = MAXDWORD - 1;
+			timeouts.WriteTotalTimeoutConstant = WRITE_TIMEOUT_MS;
+			if (!::SetCommTimeouts(this->handle, &timeouts)) {
+				this->Close();
+				return false;
+			}
+			return true;
+		}
+
+		bool SetBaudrate(int baudrate) override {
+			DCB dcb = {};
+			dcb.DCBlength = sizeof(dcb);
+			if (this->handle == INVALID_HANDLE_VALUE || !::FlushFileBuffers(this->handle) ||
+				!::GetCommState(this->handle, &dcb)) {
+				return false;
+			}
+			dcb.BaudRate = static_cast<DWORD>(baudrate);
+			return ::SetCommState(this->handle, &dcb) != FALSE;
+		}
+
+		void Close() override {
+			if (this->handle != INVALID_HANDLE_VALUE) {
+				::CloseHandle(this->handle);
+				this->handle = INVALID_HANDLE_VALUE;
+			}
+		}
+
+		bool IsOpen() const override {
+			return this->handle != INVALID_HANDLE_VALUE;
+		}
+
+		int Read(uint8_t* buf, size_t size, int timeoutMs) override {
+			if (this->handle == INVALID_HANDLE_VALUE) {
+				return -1;
+			}
+			// Bytes already received are returned without waiting, even if interrupted.
+			DWORD errors = 0;
+			COMSTAT status = {};
+			if (!::ClearCommError(this->handle, &errors, &status)) {
+				return -1;
+			}
+			if (status.cbInQue == 0 && ::WaitForSingleObject(this->wakeEvent, 0) == WAIT_OBJECT_0) {
+				return 0;
+			}
+
+			OVERLAPPED overlapped = {};
+			overlapped.hEvent = this->readEvent;
+			DWORD count = 0;
+			if (::ReadFile(this->handle, buf, static_cast<DWORD>(size), &count, &overlapped)) {
+				return static_cast<int>(count);
+			}
+			if (::GetLastError() != ERROR_IO_PENDING) {
+				return -1;
+			}
+
+			HANDLE events[2] = { this->readEvent, this->wakeEvent };
+			DWORD result = ::WaitForMultipleObjects(2, events, FALSE, static_cast<DWORD>(timeoutMs));
+			if (result != WAIT_OBJECT_0) {
+				// Timed out or interrupted; cancel the read, but keep any bytes it received.
+				::CancelIoEx(this->handle, &overlapped);
+			}
+			if (!::GetOverlappedResult(this->handle, &overlapped, &count, TRUE)) {
+				return ::GetLastError() == ERROR_OPERATION_ABORTED ? 0 : -1;
+			}
+			return static_cast<int>(count);
+		}
+
+		void Interrupt() override {
+			::SetEvent(this->wakeEvent);
+		}
+
+		bool Write(const uint8_t* buf, size_t size) override {
+			if (this->handle == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+			OVERLAPPED overlapped = {};
+			overlapped.hEvent = this->writeEvent;
+			DWORD count = 0;
+			if (!::WriteFile(this->handle, buf, static_cast<DWORD>(size), &count, &overlapped)) {
+				if (::GetLastError() != ERROR_IO_PENDING) {
+					return false;
+				}
+				// Completes within the write timeout set in `Open()`.
+				if (!::GetOverlappedResult(this->handle, &overlapped, &count, TRUE)) {
+					return false;
+				}
+			}
+			return count == size;
+		}
+
+		void DiscardInput() override {
+			if (this->handle != INVALID_HANDLE_VALUE) {
+				::PurgeComm(this->handle, PURGE_RXCLEAR);
+			}
+		}
+
+	private:
+		static const DWORD WRITE_TIMEOUT_MS = 500;
+
+		HANDLE handle;
+		HANDLE readEvent;    // Signaled when an overlapped read completes.
+		HANDLE writeEvent;   // Signaled when an overlapped write completes.
+		HANDLE wakeEvent;    // Auto-reset event signaled by `Interrupt()`.
+	};
+
+	std::unique_ptr<SerialTransport> CreateSerialTransport() {
+		return std::unique_ptr<SerialTransport>(new Win32SerialTransport());
+	}
+
+	std::vector<std::string> ListSerialPorts() {
+		// All DOS device names as a list of null-terminated strings; the buffer is grown
+		// until it fits.
+		std::vector<char> names(16 * 1024);
+		DWORD length;
+		while ((length = ::QueryDosDeviceA(nullptr, names.data(), static_cast<DWORD>(names.size()))) == 0 &&
+			::GetLastError() == ERROR_INSUFFICIENT_BUFFER && names.size() < 1024 * 1024) {
+			names.resize(names.size() * 2);
+		}
+		std::vector<std::string> ports;
+		for (const char* name = names.data(); length > 0 && name < names.data() + length && *name; name += std::strlen(name) + 1) {
+			if (std::strncmp(name, "COM", 3) == 0 && name[3] >= '1' && name[3] <= '9') {
+				ports.push_back(name);
+			}
+		}
+		// By number, i.e., COM2 before COM10.
+		std::sort(ports.begin(), ports.end(), [](const std::string& a, const std::string& b) {
+			return std::atoi(a.c_str() + 3) < std::atoi(b.c_str() + 3);
+		});
+		return ports;
+	}
+}
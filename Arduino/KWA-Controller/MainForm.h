@@ -1,5 +1,11 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
+#include <vcclr.h>
+
+#include "Core/ArduinoController.h"
 
 namespace KwaController {
 
@@ -11,22 +17,50 @@ namespace KwaController {
 	using namespace System::Drawing;
 
 
+	/// <summary>
+	/// Forwards a callback of the Arduino controller, which is invoked on the controller's
+	/// I/O thread, to <c>handler</c> on the UI thread of <c>control</c>, passing the success
+	/// and (on failure) the error message.
+	/// </summary>
+	struct UiCallback {
+		UiCallback(Control^ control, Action<bool, String^>^ handler) : control(control), handler(handler) {
+		}
+
+		void operator()(const CommandResult& result) const {
+			this->Post(result.success, result.error);
+		}
+
+		void operator()(const std::string& error) const {
+			this->Post(false, error);
+		}
+
+	private:
+		void Post(bool success, const std::string& error) const {
+			String^ message = gcnew String(reinterpret_cast<signed char*>(const_cast<char*>(error.data())), 0,
+				static_cast<int>(error.size()), Text::Encoding::UTF8);
+			try {
+				this->control->BeginInvoke(static_cast<Action<bool, String^>^>(this->handler), success, message);
+			}
+			catch (const System::InvalidOperationException^ ex) {
+				// Window handle already destroyed, i.e., the application is closing.
+			}
+		}
+
+		gcroot<Control^> control;
+		gcroot<Action<bool, String^>^> handler;
+	};
+
+
 	/// <summary>
 	/// Summary for MainForm
 	/// </summary>
 	public ref class MainForm : public System::Windows::Forms::Form
 	{
 	private:
-        // Baudrate used for serial communication with Arduino.
-        // Must match rate defined in Arduino Sketch.
-        const int BAUDRATE = 115200;
-        // Arduino operation byte codes.
-        const int ARDUINO_STOP_REC = 0;
-        const int ARDUINO_START_REC = 1;
-        const int ARDUINO_SEND_FPS = 2;  // Must match def. in Arduino sketch!
-
 		const int FPS_MIN_VAL = 1;    // Minimum FPS value.
-		const int FPS_MAX_VAL = 720;  // Maximum FPS value.
+		// Maximum FPS value; limited by the camera's max. frame rate with the reduced ROI
+		// in `acA720-520uc-inference.pfs`, not by the (timer-driven) Arduino trigger.
+		const int FPS_MAX_VAL = 725;
 		const int FPS_DEFAULT = 720;  // FPS value set on app startup.
 
 		// Titles, texts, captions of form components.
@@ -35,19 +69,44 @@ namespace KwaController {
 		static String^ BTN_TEXT_SYSTEM_START = "Turn lights/cam on";
         static String^ BTN_TEXT_SYSTEM_STOP = "Turn lights/cam off";
 
-		System::UInt16 fps;  // FPS value for triggering camera.
+		System::Double fps;  // FPS value for triggering camera; may be fractional (e.g., 29.97).
 	private: System::Windows::Forms::TrackBar^ trackBarFps;
 	private: System::Windows::Forms::Label^ labelFps;
 	private: System::Windows::Forms::TextBox^ textBoxFps;
 	private: System::Windows::Forms::Label^ labelMinFpsVal;
 	private: System::Windows::Forms::Label^ labelMaxFpsVal;
+	private: System::Windows::Forms::Label^ labelLights;
+	private: System::Windows::Forms::TextBox^ textBoxLights;
+	private: System::Windows::Forms::Label^ labelStrobe;
+	private: System::Windows::Forms::TextBox^ textBoxStrobe;
 
 
 	private: System::Windows::Forms::ErrorProvider^ errorProvider;
+	private: System::Windows::Forms::Label^ labelTelemetry;
+	private: System::Windows::Forms::Panel^ panelHistogram;
+	private: System::Windows::Forms::Timer^ timerTelemetry;
 
 
 	private:
 		bool isSystemRunning;  // `true` if lights are on and cam is triggered; otherwise `false`
+		bool isCommandPending; // `true` while a command sent to the Arduino has not completed yet
+		bool isFpsChangePending;  // `true` while a frame rate change of the running recording has not completed yet
+		System::Double sentFps;   // FPS value of the last frame rate change sent to the Arduino
+		String^ portName;      // Serial port selected by the user.
+		// Entry of the serial port list to find the Arduino on all serial ports (see `DeviceDiscovery`).
+		literal String^ AUTO_DETECT_PORT = "Auto-detect";
+
+		// Serial communication with the Arduino (native object, shared with `kwa-cli`).
+		ArduinoController* controller;
+		// Trigger telemetry sent by the Arduino while recording (native objects).
+		TriggerStats* triggerStats;
+		TriggerLogWriter* triggerLog;       // Per-session log of all trigger edges.
+		String^ triggerLogPath;
+		ClockSync* clockSync;               // Converts trigger edge timestamps to host time.
+		std::vector<ClockSample>* clockSamples;  // Clock samples taken but not yet processed.
+		std::vector<TriggerEdge>* triggerEdges;  // Edges decoded but not yet processed.
+		LightPattern* lightPattern;  // Lights of consecutive frames of a recording (native object).
+		Strobe* strobe;              // Timing of the lights within each frame (native object).
 	public:
 		MainForm(void)
 		{
@@ -55,9 +114,23 @@ namespace KwaController {
 			//
 			// Constructor code: custom initialization of components/vars, etc.
 			//
-			this->comboBoxSerialPort->Items->AddRange(this->serialPort->GetPortNames());
-			this->serialPort->BaudRate = BAUDRATE;
+			this->comboBoxSerialPort->Items->Add(AUTO_DETECT_PORT);
+			this->comboBoxSerialPort->Items->AddRange(System::IO::Ports::SerialPort::GetPortNames());
+			this->comboBoxSerialPort->SelectedIndex = 0;
 			this->isSystemRunning = false;
+			this->isCommandPending = false;
+			this->isFpsChangePending = false;
+
+			this->controller = new ArduinoController();
+			this->controller->SetConnectionLostHandler(
+				UiCallback(this, gcnew Action<bool, String^>(this, &MainForm::OnConnectionLost)));
+			this->triggerStats = new TriggerStats();
+			this->triggerLog = new TriggerLogWriter();
+			this->triggerEdges = new std::vector<TriggerEdge>();
+			this->clockSync = new ClockSync();
+			this->clockSamples = new std::vector<ClockSample>();
+			this->lightPattern = new LightPattern(1, LIGHT_WHITE);
+			this->strobe = new Strobe();
 
 			// Init GUI elements for setting FPS with default value.
 			this->textBoxFps->Text = "" + FPS_DEFAULT;
@@ -78,8 +151,15 @@ namespace KwaController {
 			{
 				delete components;
 			}
+			delete this->controller;
+			delete this->triggerStats;
+			delete this->triggerLog;
+			delete this->triggerEdges;
+			delete this->clockSync;
+			delete this->clockSamples;
+			delete this->lightPattern;
+			delete this->strobe;
 		}
-	private: System::IO::Ports::SerialPort^ serialPort;
 	protected:
 
 	private: System::Windows::Forms::TableLayoutPanel^ tableLayoutPanel1;
@@ -101,7 +181,7 @@ namespace KwaController {
 		/// communication state with Arduino.
 		/// </summary>
 		void UpdateGui() {
-			if (this->serialPort->IsOpen) {
+			if (this->controller->IsConnected()) {
 				this->buttonSerialConnection->Text = BTN_TEXT_ARDUINO_DISCONNECT;
 				this->buttonLightsAndCam->Enabled = true;
 				// Port cannot be changed after communication with Arduino established.
@@ -116,15 +196,24 @@ namespace KwaController {
 
 			if (this->isSystemRunning) {
 				this->buttonLightsAndCam->Text = BTN_TEXT_SYSTEM_STOP;
-				// Cannot change FPS value while system is running (recording).
-				this->trackBarFps->Enabled = false;
-				this->textBoxFps->Enabled = false;
+				// Cannot change lights while system is running (recording); FPS value changes
+				// are sent to the Arduino once entered (see `SendFpsChange()`).
+				this->textBoxLights->Enabled = false;
+				this->textBoxStrobe->Enabled = false;
 			}
 			else {
 				this->buttonLightsAndCam->Text = BTN_TEXT_SYSTEM_START;
-				// Can only change FPS value while system is not running (recording).
-				this->trackBarFps->Enabled = true;
-				this->textBoxFps->Enabled = true;
+				this->textBoxLights->Enabled = true;
+				this->textBoxStrobe->Enabled = true;
+			}
+
+			if (this->isCommandPending) {
+				// Wait for the Arduino's response before accepting the next request.
+				this->buttonSerialConnection->Enabled = false;
+				this->buttonLightsAndCam->Enabled = false;
+			}
+			else {
+				this->buttonSerialConnection->Enabled = true;
 			}
 		}
 
@@ -142,7 +231,6 @@ namespace KwaController {
 		void InitializeComponent(void)
 		{
 			this->components = (gcnew System::ComponentModel::Container());
-			this->serialPort = (gcnew System::IO::Ports::SerialPort(this->components));
 			this->tableLayoutPanel1 = (gcnew System::Windows::Forms::TableLayoutPanel());
 			this->buttonSerialConnection = (gcnew System::Windows::Forms::Button());
 			this->buttonLightsAndCam = (gcnew System::Windows::Forms::Button());
@@ -153,18 +241,19 @@ namespace KwaController {
 			this->textBoxFps = (gcnew System::Windows::Forms::TextBox());
 			this->labelMinFpsVal = (gcnew System::Windows::Forms::Label());
 			this->labelMaxFpsVal = (gcnew System::Windows::Forms::Label());
+			this->labelLights = (gcnew System::Windows::Forms::Label());
+			this->textBoxLights = (gcnew System::Windows::Forms::TextBox());
+			this->labelStrobe = (gcnew System::Windows::Forms::Label());
+			this->textBoxStrobe = (gcnew System::Windows::Forms::TextBox());
 			this->errorProvider = (gcnew System::Windows::Forms::ErrorProvider(this->components));
+			this->labelTelemetry = (gcnew System::Windows::Forms::Label());
+			this->panelHistogram = (gcnew System::Windows::Forms::Panel());
+			this->timerTelemetry = (gcnew System::Windows::Forms::Timer(this->components));
 			this->tableLayoutPanel1->SuspendLayout();
 			(cli::safe_cast<System::ComponentModel::ISupportInitialize^>(this->trackBarFps))->BeginInit();
 			(cli::safe_cast<System::ComponentModel::ISupportInitialize^>(this->errorProvider))->BeginInit();
 			this->SuspendLayout();
 			// 
-			// serialPort
-			// 
-			this->serialPort->BaudRate = 115200;
-			this->serialPort->ReadTimeout = 500;
-			this->serialPort->WriteTimeout = 500;
-			// 
 			// tableLayoutPanel1
 			// 
 			this->tableLayoutPanel1->Anchor = static_cast<System::Windows::Forms::AnchorStyles>((((System::Windows::Forms::AnchorStyles::Top | System::Windows::Forms::AnchorStyles::Bottom)
@@ -178,7 +267,7 @@ namespace KwaController {
 				49.8F)));
 			this->tableLayoutPanel1->Controls->Add(this->buttonSerialConnection, 0, 1);
 			this->tableLayoutPanel1->Controls->Add(this->buttonLightsAndCam, 1, 1);
-			this->tableLayoutPanel1->Location = System::Drawing::Point(15, 122);
+			this->tableLayoutPanel1->Location = System::Drawing::Point(15, 148);
 			this->tableLayoutPanel1->Name = L"tableLayoutPanel1";
 			this->tableLayoutPanel1->RowCount = 2;
 			this->tableLayoutPanel1->RowStyles->Add((gcnew System::Windows::Forms::RowStyle(System::Windows::Forms::SizeType::Percent, 50)));
@@ -235,7 +324,7 @@ namespace KwaController {
 			// 
 			this->trackBarFps->LargeChange = 10;
 			this->trackBarFps->Location = System::Drawing::Point(100, 43);
-			this->trackBarFps->Maximum = 720;
+			this->trackBarFps->Maximum = 725;
 			this->trackBarFps->Minimum = 1;
 			this->trackBarFps->Name = L"trackBarFps";
 			this->trackBarFps->Size = System::Drawing::Size(185, 45);
@@ -256,13 +345,14 @@ namespace KwaController {
 			// textBoxFps
 			// 
 			this->textBoxFps->Location = System::Drawing::Point(47, 43);
-			this->textBoxFps->MaxLength = 3;
+			this->textBoxFps->MaxLength = 7;
 			this->textBoxFps->Name = L"textBoxFps";
-			this->textBoxFps->Size = System::Drawing::Size(35, 20);
+			this->textBoxFps->Size = System::Drawing::Size(50, 20);
 			this->textBoxFps->TabIndex = 6;
 			this->textBoxFps->TextChanged += gcnew System::EventHandler(this, &MainForm::textBoxFps_TextChanged);
 			this->textBoxFps->Validating += gcnew System::ComponentModel::CancelEventHandler(this, &MainForm::textBoxFps_Validating);
 			this->textBoxFps->Validated += gcnew System::EventHandler(this, &MainForm::textBoxFps_Validated);
+			this->textBoxFps->KeyDown += gcnew System::Windows::Forms::KeyEventHandler(this, &MainForm::textBoxFps_KeyDown);
 			// 
 			// labelMinFpsVal
 			// 
@@ -282,19 +372,86 @@ namespace KwaController {
 			this->labelMaxFpsVal->Name = L"labelMaxFpsVal";
 			this->labelMaxFpsVal->Size = System::Drawing::Size(25, 13);
 			this->labelMaxFpsVal->TabIndex = 8;
-			this->labelMaxFpsVal->Text = L"720";
+			this->labelMaxFpsVal->Text = L"725";
+			// 
+			// labelLights
+			// 
+			this->labelLights->AutoSize = true;
+			this->labelLights->Location = System::Drawing::Point(12, 98);
+			this->labelLights->Name = L"labelLights";
+			this->labelLights->Size = System::Drawing::Size(38, 13);
+			this->labelLights->TabIndex = 11;
+			this->labelLights->Text = L"Lights:";
+			// 
+			// textBoxLights
+			// 
+			this->textBoxLights->Location = System::Drawing::Point(56, 95);
+			this->textBoxLights->Name = L"textBoxLights";
+			this->textBoxLights->Size = System::Drawing::Size(229, 20);
+			this->textBoxLights->TabIndex = 12;
+			this->textBoxLights->Text = L"white";
+			this->textBoxLights->Validating += gcnew System::ComponentModel::CancelEventHandler(this, &MainForm::textBoxLights_Validating);
+			this->textBoxLights->Validated += gcnew System::EventHandler(this, &MainForm::textBoxLights_Validated);
+			// 
+			// labelStrobe
+			// 
+			this->labelStrobe->AutoSize = true;
+			this->labelStrobe->Location = System::Drawing::Point(12, 124);
+			this->labelStrobe->Name = L"labelStrobe";
+			this->labelStrobe->Size = System::Drawing::Size(41, 13);
+			this->labelStrobe->TabIndex = 13;
+			this->labelStrobe->Text = L"Strobe:";
+			// 
+			// textBoxStrobe
+			// 
+			this->textBoxStrobe->Location = System::Drawing::Point(56, 121);
+			this->textBoxStrobe->Name = L"textBoxStrobe";
+			this->textBoxStrobe->Size = System::Drawing::Size(229, 20);
+			this->textBoxStrobe->TabIndex = 14;
+			this->textBoxStrobe->Text = L"off";
+			this->textBoxStrobe->Validating += gcnew System::ComponentModel::CancelEventHandler(this, &MainForm::textBoxStrobe_Validating);
+			this->textBoxStrobe->Validated += gcnew System::EventHandler(this, &MainForm::textBoxStrobe_Validated);
 			// 
 			// errorProvider
 			// 
 			this->errorProvider->ContainerControl = this;
 			// 
+			// labelTelemetry
+			// 
+			this->labelTelemetry->AutoSize = true;
+			this->labelTelemetry->ForeColor = System::Drawing::SystemColors::ControlDarkDark;
+			this->labelTelemetry->Location = System::Drawing::Point(12, 184);
+			this->labelTelemetry->Name = L"labelTelemetry";
+			this->labelTelemetry->Size = System::Drawing::Size(101, 13);
+			this->labelTelemetry->TabIndex = 9;
+			this->labelTelemetry->Text = L"No trigger telemetry";
+			// 
+			// panelHistogram
+			// 
+			this->panelHistogram->BorderStyle = System::Windows::Forms::BorderStyle::FixedSingle;
+			this->panelHistogram->Location = System::Drawing::Point(15, 216);
+			this->panelHistogram->Name = L"panelHistogram";
+			this->panelHistogram->Size = System::Drawing::Size(277, 60);
+			this->panelHistogram->TabIndex = 10;
+			this->panelHistogram->Paint += gcnew System::Windows::Forms::PaintEventHandler(this, &MainForm::panelHistogram_Paint);
+			// 
+			// timerTelemetry
+			// 
+			this->timerTelemetry->Tick += gcnew System::EventHandler(this, &MainForm::timerTelemetry_Tick);
+			// 
 			// MainForm
 			// 
 			this->AutoScaleDimensions = System::Drawing::SizeF(6, 13);
 			this->AutoScaleMode = System::Windows::Forms::AutoScaleMode::Font;
 			this->AutoValidate = System::Windows::Forms::AutoValidate::Disable;
 			this->CausesValidation = false;
-			this->ClientSize = System::Drawing::Size(304, 161);
+			this->ClientSize = System::Drawing::Size(304, 288);
+			this->Controls->Add(this->panelHistogram);
+			this->Controls->Add(this->labelTelemetry);
+			this->Controls->Add(this->textBoxStrobe);
+			this->Controls->Add(this->labelStrobe);
+			this->Controls->Add(this->textBoxLights);
+			this->Controls->Add(this->labelLights);
 			this->Controls->Add(this->labelMaxFpsVal);
 			this->Controls->Add(this->labelMinFpsVal);
 			this->Controls->Add(this->textBoxFps);
@@ -303,7 +460,7 @@ namespace KwaController {
 			this->Controls->Add(this->labelSerialPort);
 			this->Controls->Add(this->tableLayoutPanel1);
 			this->Controls->Add(this->comboBoxSerialPort);
-			this->MaximumSize = System::Drawing::Size(320, 200);
+			this->MaximumSize = System::Drawing::Size(320, 327);
 			this->MinimumSize = System::Drawing::Size(320, 0);
 			this->Name = L"MainForm";
 			this->Text = L"Kine Wheel Arena  DLC";
@@ -316,161 +473,234 @@ namespace KwaController {
 
 		}
 #pragma endregion
-	private: System::Boolean ReadByteAndCatchError(System::Byte^ val) {
-        try {
-			System::Int32 result = this->serialPort->ReadByte();
-			*val = result;  // If read succeeded, return byte value.
-        }
-		catch (const System::TimeoutException^ ex) {
-			// The operation did not complete before the time-out period ended. 
-			return false;
+	/// <summary>
+	/// Add decoded trigger edges to the statistics and the session log, with their host
+	/// time as estimated from the clock samples taken so far.
+	/// </summary>
+	private: System::Void ProcessTelemetry() {
+		this->controller->TakeClockSamples(*this->clockSamples);
+		for (const ClockSample& sample : *this->clockSamples) {
+			this->clockSync->Add(sample);
 		}
-        catch (const System::InvalidOperationException^ ex) {
-			// The specified port is not open.
-			return false;
+		this->controller->TakeEdges(*this->triggerEdges);
+		for (const TriggerEdge& edge : *this->triggerEdges) {
+			this->triggerStats->Add(edge);
 		}
+		this->triggerLog->Write(*this->triggerEdges, this->clockSync->Model());
+	}
 
-		// -1 indicates *end of stream*
-		return *val > -1 ? true : false;  // Return true if no error ocurred
+	/// <summary>
+	/// Reset trigger statistics and create a new session log file named after the
+	/// current time in folder *Documents\KWA-Controller*.
+	/// </summary>
+	private: System::Void StartTelemetrySession() {
+		this->triggerStats->Reset();
+		this->clockSync->Reset();
+
+		String^ folder = IO::Path::Combine(
+			Environment::GetFolderPath(Environment::SpecialFolder::MyDocuments), "KWA-Controller");
+		String^ path = IO::Path::Combine(folder, "trigger-log-" + DateTime::Now.ToString("yyyyMMdd-HHmmss") + ".csv");
+		try {
+			IO::Directory::CreateDirectory(folder);
+		}
+		catch (const System::IO::IOException^ ex) {
+			// Handled below, as the log file cannot be opened.
+		}
+		catch (const System::UnauthorizedAccessException^ ex) {
+			// Handled below, as the log file cannot be opened.
+		}
+		this->triggerLogPath = path;
+		if (!this->triggerLog->Open(ToUtf8(path))) {
+			this->triggerLogPath = nullptr;
+			this->errorProvider->SetError(this->labelTelemetry, "Could not create trigger log file " + path + ".");
+		}
+		else {
+			this->errorProvider->SetError(this->labelTelemetry, "");
+		}
+		this->timerTelemetry->Start();
 	}
 
-	private: System::Boolean WriteAndCatchError(cli::array<unsigned char>^ buf, int offset, int count) {
-        try {
-            this->serialPort->Write(buf, offset, count);
-        }
-		catch (const System::TimeoutException^ ex) {
-			// The operation did not complete before the time-out period ended. 
-			return false;
+	private: System::Void StopTelemetrySession() {
+		this->timerTelemetry->Stop();
+		this->ProcessTelemetry();
+		this->triggerLog->Close();
+		// Clock samples of the session, to convert trigger edges to host time afterwards.
+		if (this->triggerLogPath != nullptr) {
+			String^ path = IO::Path::ChangeExtension(this->triggerLogPath, ".clock.csv");
+			if (!this->clockSync->WriteTable(ToUtf8(path))) {
+				this->errorProvider->SetError(this->labelTelemetry, "Could not write clock table " + path + ".");
+			}
 		}
-        catch (const System::InvalidOperationException^ ex) {
-			// The specified port is not open.
-			return false;
+		this->UpdateTelemetryGui();
+	}
+
+	/// <summary>
+	/// Show trigger statistics of the current (or last) recording.
+	/// </summary>
+	private: System::Void UpdateTelemetryGui() {
+		TriggerStats& stats = *this->triggerStats;
+		String^ text = String::Format("Edges: {0}  Lost: {1}  Missed: {2}",
+			stats.EdgeCount(), stats.LostEdges(), stats.MissedDeadlines());
+		if (!this->isSystemRunning) {
+			// Pulses counted by the Arduino, to compare with the number of recorded frames.
+			TriggerSummary summary = this->controller->LastTriggerSummary();
+			if (summary.pulseCount > 0) {
+				text += String::Format("  Pulses: {0}", summary.pulseCount);
+			}
 		}
+		this->labelTelemetry->Text = text + String::Format("\nPeriod: {0:F3} us  Jitter: {1:F3} us",
+			stats.MeanPeriodUs(), stats.JitterUs());
+		this->panelHistogram->Invalidate();
+	}
 
-		return true;  // Return true if no error ocurred
+	private: static std::string ToUtf8(String^ s) {
+		cli::array<unsigned char>^ bytes = Text::Encoding::UTF8->GetBytes(s);
+		if (bytes->Length == 0) {
+			return std::string();
+		}
+		pin_ptr<unsigned char> p = &bytes[0];
+		return std::string(reinterpret_cast<const char*>(p), bytes->Length);
 	}
 
+	/// <summary>
+	/// Stop a running recording and close the serial port; blocks until done.
+	/// </summary>
 	private: System::Void CloseSerialPort() {
-        // Stop system if running.
-        if (this->isSystemRunning) {
-            this->buttonLightsAndCam_Click(nullptr, nullptr);
-        }
-        this->serialPort->Close();
+		this->controller->Disconnect();
+		if (this->isSystemRunning) {
+			this->isSystemRunning = false;
+			this->StopTelemetrySession();
+		}
 	}
 
     /// <summary>
-    /// Opens serial communication with the Arduino.
+    /// Opens serial communication with the Arduino. All requests to the Arduino are sent
+    /// asynchronously; their responses are handled by the `On...Completed()` methods.
     /// </summary>
 	private: System::Void buttonSerialConnection_Click(System::Object^ sender, System::EventArgs^ e) {
-        cli::array<unsigned char>^ buf = { 0 };
-
-		if (!this->serialPort->IsOpen) {
+		if (!this->controller->IsConnected()) {
 			// Explicitly validate form fields; `AutoValidation` property of the main form must be disabled.
 			// When closing a serial port, this check is unnecessary.
 			if (!ValidateChildren()) {
 				return;
 			}
 
-			this->serialPort->Open();
-			/**
-			 * The IsOpen property tracks whether the port is open for use by the caller,
-			 * not whether the port is open by any application on the machine.
-			 * C.f. https://learn.microsoft.com/en-us/dotnet/api/system.io.ports.serialport.isopen?view=dotnet-plat-ext-7.0#remarks
-			 *
-			 * Therefore, we need to test whether the Arduino responds on the opened port.
-			 * Write the first byte from `buf`, which contains op code to stop any running recording.
-			 * C.f. https://learn.microsoft.com/en-us/dotnet/api/system.io.ports.serialport.write?view=dotnet-plat-ext-7.0#system-io-ports-serialport-write(system-byte()-system-int32-system-int32)
-			 */
-			buf[0] = ARDUINO_STOP_REC;
-			String^ s;
-			// NOTE: `ReadExisting()` returns the empty string if reading from an existing port, but
-			// without an application on the other side (e.g., port where Arduino is not connected to).
-			// Therefore, we need to test for the empty string and fail in that case, as we should
-			// always get a *Waiting* response from the Arduino in response to our previously sent
-			// *Stop* request.
-			// C.f. https://learn.microsoft.com/en-us/dotnet/api/system.string?view=net-7.0#null-strings-and-empty-strings
-			Byte b = 0;
-			if (!this->WriteAndCatchError(buf, 0, 1) || !this->ReadByteAndCatchError(b)) {
-				this->serialPort->Close();
-
-				String^ errorMsg = "Could not communicate with Arduino on port " + this->serialPort->PortName + ".\n"
-					"Check that the Arduino is connected to the computer and the selected port is correct.";
-
-                // Set the ErrorProvider error with the text to display.
-                this->errorProvider->SetError( this->comboBoxSerialPort, errorMsg );
-			} else {
-                // Clear 'received buffer', as the Arduino can send data on serial reset,
-                // which is not relevant and might interfere with the program logic.
-                s = this->serialPort->ReadExisting();
-            }
-
+			// Opens the port and checks that the Arduino responds on it (see `ArduinoController`);
+			// an empty port name makes the controller find the port.
+			this->controller->ConnectAsync(this->portName == AUTO_DETECT_PORT ? std::string() : ToUtf8(this->portName),
+				UiCallback(this, gcnew Action<bool, String^>(this, &MainForm::OnConnectCompleted)));
 		}
 		else {
-			this->CloseSerialPort();
+			// Stops a running recording first.
+			this->controller->DisconnectAsync(
+				UiCallback(this, gcnew Action<bool, String^>(this, &MainForm::OnDisconnectCompleted)));
 		}
+		this->isCommandPending = true;
         this->UpdateGui();
 	}
 
     private: System::Void buttonLightsAndCam_Click(System::Object^ sender, System::EventArgs^ e) {
-		cli::array<unsigned char>^ buf = { 0, 0, 0 };
-
 		// Explicitly validate form fields; `AutoValidation` property of the main form must be disabled.
 		if (!ValidateChildren()) {
 			// If invalid FPS value, don't proceed.
 			return;
 		}
 
-		// TODO: Maybe first read everything from receive buffer, ensures that
-		// we get responses corresponding to our requests sent below.
-		this->serialPort->ReadExisting();
-
-        buf[0] = ARDUINO_STOP_REC;
-		// TODO: if error, show msg, set isSysRunning=False, disconnect, return
-		WriteAndCatchError(buf, 0, 1);
-
-		// Read response from Arduino; possible responses:
-		//   (a) pre: sys running => post: sys waiting
-		//   (b) pre: sys waiting => post: sys waiting
-		//       * b/c 'stop' request won't change sys state when 'waiting'
-		//   (c) pre: no communicaton => read timeout
-		int responseCode = this->serialPort->ReadByte();
-		// TODO: (?) Response code should be 'waiting', but not really necessary to test
-
 		if (this->isSystemRunning) {  // lights on, cam triggered
-			this->isSystemRunning = false;
-            // Already sent *stop* request, nothing more to do.
+			this->controller->StopRecordingAsync(
+				UiCallback(this, gcnew Action<bool, String^>(this, &MainForm::OnStopCompleted)));
 		}
 		else {  // light off, cam not triggered
-            buf[0] = ARDUINO_START_REC;
-			// TODO: Set frames dynamically; this is just a test!
-            // FPS value (16-bit word, network byte order)
-			buf[1] = static_cast<unsigned char>((this->fps >> 8) & 0xFF);  // Higher-order byte
-            buf[2] = static_cast<unsigned char>(this->fps & 0xFF);         // Lower-order byte
-
-			// Send 'start' and 'FPS' request in one write operation.
-			if (!this->WriteAndCatchError(buf, 0, 3)) {
-                this->isSystemRunning = false;
-				// TODO: show err msg, close serial con, reset button, etc. states, return
+			this->sentFps = this->fps;
+			this->controller->StartRecordingAsync(this->fps,
+				UiCallback(this, gcnew Action<bool, String^>(this, &MainForm::OnStartCompleted)), *this->lightPattern,
+				*this->strobe);
+		}
+		this->isCommandPending = true;
+        UpdateGui();
+    }
+
+	private: System::Void OnConnectCompleted(bool success, String^ error) {
+		this->isCommandPending = false;
+		if (success && this->portName == AUTO_DETECT_PORT) {
+			// Show the port the Arduino was found on, which is used when reconnecting.
+			String^ found = gcnew String(this->controller->PortName().c_str());
+			if (!this->comboBoxSerialPort->Items->Contains(found)) {
+				this->comboBoxSerialPort->Items->Add(found);
 			}
+			this->comboBoxSerialPort->SelectedItem = found;
+		}
+		// Set the ErrorProvider error with the text to display (or clear it).
+		this->errorProvider->SetError(this->comboBoxSerialPort, error);
+		this->UpdateGui();
+	}
 
-			// TODO: Do read error handling; on error, show msg and disconnect
-            // Read response from Arduino.
-            int responseCode = this->serialPort->ReadByte();
+	private: System::Void OnDisconnectCompleted(bool success, String^ error) {
+		this->isCommandPending = false;
+		if (this->isSystemRunning) {
+			this->isSystemRunning = false;
+			this->StopTelemetrySession();
+		}
+		this->UpdateGui();
+	}
 
-			if (responseCode == ARDUINO_SEND_FPS) {
-                responseCode += 1;
-                this->isSystemRunning = true;
-				// Already sent FPS in request above, nothing more to do.
-			}
-			else {
-                this->isSystemRunning = false;
-				// TODO: Show err msg.
-			}
+	private: System::Void OnStartCompleted(bool success, String^ error) {
+		this->isCommandPending = false;
+		this->isSystemRunning = success;
+		this->errorProvider->SetError(this->buttonLightsAndCam, error);
+		if (success) {
+			this->StartTelemetrySession();
+		}
+		this->UpdateGui();
+		// FPS value changed while starting.
+		this->SendFpsChange();
+	}
 
+	/// <summary>
+	/// Change the frame rate of the running recording to the current FPS value. While a
+	/// change is pending, further changes (e.g., while dragging the track bar) are merged
+	/// and sent once it completed.
+	/// </summary>
+	private: System::Void SendFpsChange() {
+		if (!this->isSystemRunning || this->isCommandPending || this->isFpsChangePending || this->fps == this->sentFps) {
+			return;
 		}
+		this->sentFps = this->fps;
+		this->isFpsChangePending = true;
+		this->controller->SetFpsAsync(this->fps,
+			UiCallback(this, gcnew Action<bool, String^>(this, &MainForm::OnFpsChangeCompleted)));
+	}
 
-        UpdateGui();
-    }
+	private: System::Void OnFpsChangeCompleted(bool success, String^ error) {
+		this->isFpsChangePending = false;
+		this->errorProvider->SetError(this->textBoxFps, error);
+		if (success) {
+			this->SendFpsChange();
+		}
+	}
+
+	private: System::Void OnStopCompleted(bool success, String^ error) {
+		this->isCommandPending = false;
+		// Consider the recording stopped even if the Arduino did not confirm it in time;
+		// the next start request stops any recording still running first.
+		this->isSystemRunning = false;
+		this->errorProvider->SetError(this->buttonLightsAndCam, error);
+		this->StopTelemetrySession();
+		this->UpdateGui();
+	}
+
+	/// <summary>
+	/// Called if the serial port failed while no request was pending (e.g., the Arduino
+	/// was unplugged); the controller already closed the port.
+	/// </summary>
+	private: System::Void OnConnectionLost(bool success, String^ error) {
+		this->errorProvider->SetError(this->comboBoxSerialPort, error);
+		if (this->isSystemRunning) {
+			this->isSystemRunning = false;
+			this->StopTelemetrySession();
+		}
+		this->UpdateGui();
+	}
 
     /// <summary>
     /// Set selected serial COM port as serial communication port.
@@ -479,21 +709,34 @@ namespace KwaController {
     /// <param name="e"></param>
     /// <returns></returns>
     private: System::Void comboBoxSerialPort_SelectedValueChanged(System::Object^ sender, System::EventArgs^ e) {
-        this->serialPort->PortName = comboBoxSerialPort->Text;
+        this->portName = comboBoxSerialPort->Text;
     }
 
+    /// <summary>
+    /// Parse a (possibly fractional) FPS value. Both the current culture's decimal
+    /// separator and the invariant "." are accepted, e.g., "29,97" and "29.97".
+    /// The value is rounded to the resolution used in the Arduino protocol (mHz).
+    /// </summary>
+    private: bool TryParseFps(String^ text, System::Double% fps) {
+		Globalization::NumberStyles style = Globalization::NumberStyles::Float;
+		if (!System::Double::TryParse(text, style, Globalization::CultureInfo::CurrentCulture, fps) &&
+			!System::Double::TryParse(text, style, Globalization::CultureInfo::InvariantCulture, fps)) {
+			return false;
+		}
+		fps = Math::Round(fps * FPS_RATE_SCALE) / FPS_RATE_SCALE;
+		return true;
+	}
+
     private: System::Void textBoxFps_TextChanged(System::Object^ sender, System::EventArgs^ e) {
-		/*
-		 * When this method returns, contains the 16 - bit unsigned integer value that is equivalent
-		 * to the number contained in s, if the conversion succeeded, or zero if the conversion failed.
-		 *
-		 * C.f. https://learn.microsoft.com/en-us/dotnet/api/system.uint16.tryparse?view=net-7.0#system-uint16-tryparse(system-string-system-uint16@)
-		 */
-		System::UInt16 fps;
-		bool success = System::UInt16::TryParse(this->textBoxFps->Text, fps);
+		System::Double fps;
+		bool success = this->TryParseFps(this->textBoxFps->Text, fps);
         if (success && fps >= FPS_MIN_VAL && fps <= FPS_MAX_VAL)
         {
-			this->trackBarFps->Value = fps;
+			// The track bar only supports integer values; show the closest one.
+			this->trackBarFps->Value = Math::Max(FPS_MIN_VAL, Math::Min(FPS_MAX_VAL,
+				static_cast<int>(Math::Round(fps))));
+			// Sent to a running recording only once entered (see `textBoxFps_Validated()`), not
+			// for every keystroke.
 			this->fps = fps;
         }
 
@@ -507,6 +750,7 @@ namespace KwaController {
     private: System::Void trackBarFps_Scroll(System::Object^ sender, System::EventArgs^ e) {
 		this->textBoxFps->Text = "" + this->trackBarFps->Value;
 		this->fps = this->trackBarFps->Value;
+		this->SendFpsChange();
 		// Explicityly trigger validation; otherwise, validation will only occur if the main form's
 		// `AutoValidation` property is not disabled and after the user changes focus to another
 		// element with property `CausesValidation=true`.
@@ -515,8 +759,8 @@ namespace KwaController {
     }
 
 	private: bool IsFpsValueValid(String^ fps, interior_ptr<String^> errorMessage) {
-		System::UInt16 iFps;
-		if (System::UInt16::TryParse(fps, iFps) && iFps >= FPS_MIN_VAL && iFps <= FPS_MAX_VAL) {
+		System::Double dFps;
+		if (this->TryParseFps(fps, dFps) && dFps >= FPS_MIN_VAL && dFps <= FPS_MAX_VAL) {
 			*errorMessage = "";
 			return true;
 		}
@@ -540,8 +784,70 @@ namespace KwaController {
     private: System::Void textBoxFps_Validated(System::Object^ sender, System::EventArgs^ e) {
         // If all conditions have been met, clear the ErrorProvider of errors.
         this->errorProvider->SetError( textBoxFps, "" );
+		this->SendFpsChange();
+    }
+
+    /// <summary>
+    /// Enter validates the FPS value, which sends it to a running recording.
+    /// </summary>
+    private: System::Void textBoxFps_KeyDown(System::Object^ sender, System::Windows::Forms::KeyEventArgs^ e) {
+		if (e->KeyCode == Keys::Enter) {
+			e->SuppressKeyPress = true;
+			this->Validate();
+		}
     }
 
+    /// <summary>
+    /// The light pattern is given as comma-separated list of the lights of consecutive
+    /// frames, e.g., "white,white,uv" (see `ParseLightPattern()`).
+    /// </summary>
+    private: System::Void textBoxLights_Validating(System::Object^ sender, System::ComponentModel::CancelEventArgs^ e) {
+		LightPattern pattern;
+		if (!ParseLightPattern(ToUtf8(this->textBoxLights->Text), pattern)) {
+			e->Cancel = true;
+			this->textBoxLights->SelectAll();
+			this->errorProvider->SetError(this->textBoxLights,
+				String::Format("Light pattern must be a comma-separated list of up to {0} frames, each combining "
+					"\"white\", \"uv\", \"white-top\", \"white-bottom\", \"uv-top\", \"uv-wheel\" with \"+\", or \"off\".",
+					static_cast<int>(MAX_LIGHT_PATTERN)));
+			return;
+		}
+		this->lightPattern->swap(pattern);
+	}
+
+    private: System::Void textBoxLights_Validated(System::Object^ sender, System::EventArgs^ e) {
+		this->errorProvider->SetError(this->textBoxLights, "");
+	}
+
+    /// <summary>
+    /// The strobe is given as "offset:width" in microseconds after each trigger edge, or
+    /// "off"; it must end within the frame period at the current FPS value.
+    /// </summary>
+    private: System::Void textBoxStrobe_Validating(System::Object^ sender, System::ComponentModel::CancelEventArgs^ e) {
+		Strobe strobe;
+		String^ error = nullptr;
+		if (!ParseStrobe(ToUtf8(this->textBoxStrobe->Text), strobe)) {
+			error = "Strobe must be \"off\" or \"offset:width\" in microseconds, e.g., \"0:300\".";
+		}
+		else {
+			std::string strobeError = CheckStrobe(strobe, this->fps);
+			if (!strobeError.empty()) {
+				error = gcnew String(strobeError.c_str());
+			}
+		}
+		if (error != nullptr) {
+			e->Cancel = true;
+			this->textBoxStrobe->SelectAll();
+			this->errorProvider->SetError(this->textBoxStrobe, error);
+			return;
+		}
+		*this->strobe = strobe;
+	}
+
+    private: System::Void textBoxStrobe_Validated(System::Object^ sender, System::EventArgs^ e) {
+		this->errorProvider->SetError(this->textBoxStrobe, "");
+	}
+
     private: System::Void comboBoxSerialPort_Validating(System::Object^ sender, System::ComponentModel::CancelEventArgs^ e) {
 		String^ errorMsg = "Select a valid serial port from the drop-down list.";
 		// NOTE: `Validating` won't get called if the user never clicked(?) on the
@@ -567,6 +873,38 @@ namespace KwaController {
         this->errorProvider->SetError( this->comboBoxSerialPort, "");
     }
 
+    private: System::Void timerTelemetry_Tick(System::Object^ sender, System::EventArgs^ e) {
+		this->ProcessTelemetry();
+		this->UpdateTelemetryGui();
+    }
+
+    /// <summary>
+    /// Draw histogram of the trigger periods' deviation from the nominal period. The
+    /// center bar corresponds to the nominal period; outer bars also count outliers.
+    /// </summary>
+    private: System::Void panelHistogram_Paint(System::Object^ sender, System::Windows::Forms::PaintEventArgs^ e) {
+		const std::vector<uint64_t>& histogram = this->triggerStats->Histogram();
+		int bins = static_cast<int>(histogram.size());
+		uint64_t maxCount = 0;
+		for (uint64_t count : histogram) {
+			maxCount = count > maxCount ? count : maxCount;
+		}
+
+		Drawing::Rectangle area = this->panelHistogram->ClientRectangle;
+		float barWidth = static_cast<float>(area.Width) / bins;
+		// Mark nominal period.
+		float center = (bins / 2 + 0.5f) * barWidth;
+		e->Graphics->DrawLine(Pens::LightGray, center, 0.0f, center, static_cast<float>(area.Height));
+		if (maxCount == 0) {
+			return;
+		}
+		for (int i = 0; i < bins; ++i) {
+			// Use log scale, so that rare outliers remain visible.
+			float height = static_cast<float>(area.Height * Math::Log(1.0 + histogram[i]) / Math::Log(1.0 + maxCount));
+			e->Graphics->FillRectangle(Brushes::SteelBlue, i * barWidth, area.Height - height, Math::Max(1.0f, barWidth - 1), height);
+		}
+    }
+
     private: System::Void MainForm_FormClosing(System::Object^ sender, System::Windows::Forms::FormClosingEventArgs^ e) {
 		// NOTE: Closing the program using the 'X' button on the top-right
 		// of the GUI won't work if any form element has an error value set
@@ -1,18 +1,25 @@
 /**
  * Arduino UNO R3 (Nano) script to start and stop recordings when the system is operated in *Basic Mode* (inference only).
- * A *recording* is defined as the process of triggering the image capture of a connected Basler camera and switching white light LEDs.
+ * A *recording* is defined as the process of triggering the image capture of a connected Basler camera and switching white light and UV LEDs.
  * 
  * This script bi-directionally communicates with a client program connected on a serial port.
  * 
  * A client can send
- *   - a "start recording",
- *   - a "stop recording", and
- *   - a "camera trigger rate"
- * message.
+ *   - a "ping" command, to check that the Arduino responds and query whether it is recording,
+ *   - a "start recording" command with the camera trigger rate and the light pattern, to start
+ *     right away or after a delay (e.g., simultaneously with other Arduinos),
+ *   - a "set triggers" command with the phase offset of the auxiliary trigger output,
+ *   - a "set stimulus" command while recording, to switch stimulus lights (e.g., the UV LEDs) on
+ *     or off from the next frame on, e.g., in a closed loop with the pose estimation,
+ *   - a "stop recording" command,
+ *   - a "set baudrate" command, to switch the serial link to a faster baudrate, and
+ *   - an "identify" command, to tell this script from other devices on the serial ports and
+ *     query the board's device ID, the firmware version, and its capabilities.
  * 
  * This script can send
- *   - "OK" messages to confirm commands sent by a client and
- *   - "keep alive" messages, while a recording is running.
+ *   - replies acknowledging (ACK) or rejecting (NAK) each command of a client,
+ *   - a "ready" event after startup, and
+ *   - "telemetry" events with the timestamps of all trigger edges, while a recording is running.
  * 
  * 
  * High-level operation of this script:
@@ -24,60 +31,336 @@
  *   - enters the main loop.
  *   
  * (2) After startup (i.e., in the main loop), this script
- *   - waits for a client to start a recording.
+ *   - polls the serial port for commands of a client, which never blocks the main loop.
  *   
- * (3) When recording, this script
- *   - turns on all white light LEDs (UV LEDs stay off),
- *   - triggers the camera periodically to take an image, and
- *   - checks every N iterations whether the client stopped the recording, in which case
- *      - all white LEDs are turned off,
- *      - the camera stops recording, and
- *      - code execution returns to step (2).
+ * (3) When a client starts a recording, this script
+ *   - starts Timer1, whose compare-match interrupt triggers the camera periodically to take an image
+ *     and switches (or strobes) the LEDs for each image as given by the light pattern (see below), and
+ *   - sends trigger telemetry, until the client stops the recording, in which case
+ *      - the camera stops recording and all LEDs are turned off (right in the UART receive
+ *        interrupt, see below),
+ *      - the timestamps of all remaining trigger edges are sent, and
+ *      - the stop command is acknowledged with the number of trigger pulses sent to the
+ *        camera and the timestamp of the last one.
+ *
+ * Serial protocol:
+ *  - All messages are sent in frames (must match defs. in `ArduinoProtocol.h` of the client):
+ *
+ *      frameStart | LEN | SEQ | TYPE | PAYLOAD (LEN bytes) | CRC (2 bytes)
+ *
+ *    The CRC is a CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) over LEN, SEQ,
+ *    TYPE, and PAYLOAD. Multi-byte values are in network byte order.
+ *  - Frames with a bad length or CRC are dropped; the receiver resynchronizes at the next
+ *    `frameStart` byte. A dropped command is never replied, so the client times out.
+ *  - Each command frame is replied by exactly one ACK or NAK frame with the command's SEQ
+ *    value, so the client can match replies to commands (and ignore late replies).
+ *  - Event frames are numbered by their own SEQ counter.
+ *  - The serial port is driven by this script's own UART interrupt routines instead of
+ *    `Serial`, whose receive interrupt cannot be extended: command frames are parsed in the
+ *    receive interrupt, which stops triggering as soon as a stop command is complete. Hence,
+ *    the stop latency is independent of the frame rate and of the main loop (e.g., while it
+ *    waits for space in the transmit buffer). A trigger pulse already started is completed.
+ *    The command itself (incl. its reply) is executed by the main loop; a stop command
+ *    received while it still executes a previous command is replied after that one.
  *
  * Client implementation notes:
- *  - The baudrate used in the client program must match that defined in this script.
- *  - The "recording start" sequence consists of three bytes:
- *    - The first byte should be set to zero. This ensures that the state of this script
- *      will be reset to the beginning of the *main loop* whenever a new client ... TODO.
- * 
+ *  - After a reset, the baudrate is `baudrate`. The client may then switch to one of the
+ *    rates accepted by `isValidBaudrate()` with the "set baudrate" command, which is
+ *    acknowledged at the old rate. If no valid frame is received at the new rate within
+ *    `baudrateConfirmTimeout` ms, this script falls back to `baudrate`.
+ *  - A client should ping the Arduino after connecting and stop a recording still running
+ *    (e.g., after a crash of the previous client).
+ *
+ * Identification:
+ *  - The reply to the "identify" command starts with the bytes "KWA", so a client can probe
+ *    all serial ports of a computer concurrently and pick the ones running this script. It
+ *    continues with the firmware version (major, minor; 1 byte each), the device ID (4 bytes),
+ *    and the `cap...` flags of the commands and features this version supports (2 bytes).
+ *  - The device ID identifies the board across reconnects, independent of the port name
+ *    assigned by the OS, e.g., to find the Arduino of an arena in a rig. It is drawn from
+ *    ADC noise on the first startup and kept in the EEPROM (see `loadDeviceId()`).
+ *
+ * Camera trigger timing:
+ *  - The trigger period is generated in hardware by Timer1 running in CTC mode at the full
+ *    CPU clock (no prescaler), i.e., with a resolution of one CPU cycle (62.5 ns at 16 MHz).
+ *  - The compare-match A interrupt raises the trigger pin at the start of every frame by a
+ *    single port register write (see `FastPin`), so the delay of the edge after its compare
+ *    match is the interrupt entry latency plus two cycles, for any pin.
+ *  - All later pin changes within a frame (lowering the trigger pin after `triggerSignalLen`
+ *    microseconds, LED strobe) are "timer events", which are run in order of their time by
+ *    the compare-match B interrupt, `OCR1B` being moved to the next event by each run.
+ *  - Periods longer than the 16-bit timer range (i.e., frame rates below ~245 Hz) are split
+ *    into several equally long timer cycles ("segments"); only the first segment of a frame
+ *    raises the trigger pin.
+ *  - Hence, code running in the main loop (e.g., serial polling) cannot shift the trigger
+ *    edges; only the (constant) interrupt entry latency is added to each edge.
+ *  - The compare-match A interrupt also timestamps each trigger edge (in CPU cycles since the
+ *    start of the recording) and stores it in a ring buffer, which the main loop sends to the
+ *    client in batches (see *Trigger telemetry* below).
+ *  - While recording, the client may change the frame rate with the "set rate" command. The
+ *    new rate is prepared by the main loop and applied by the compare-match A interrupt at
+ *    the start of the next frame, right after its trigger edge, so the frame started there
+ *    is the first one with the new period: no trigger edge is dropped or doubled, and the
+ *    trigger pulses continue without a gap. A rate not yet applied is replaced by a later
+ *    one. The telemetry batch in progress is ended at the change, as all edges of a batch
+ *    share its nominal period.
+ *  - The auxiliary trigger output (e.g., for a second camera) sends a pulse of the same length
+ *    in every frame, `auxTriggerPhase` microseconds after the trigger edge (set by the "set
+ *    triggers" command while idle; off after reset). With a phase of 0, it is raised in the same
+ *    port register write as the trigger pin; otherwise, its edges are timer events, so the
+ *    pulse must end within the first segment of a frame, like the LED strobe (see below).
+ *    Stopping the recording completes a running auxiliary pulse, but skips one not yet started.
+ *  - The "start recording at" command starts the recording the given number of microseconds
+ *    after the command was received (measured with `micros()`, i.e., with a resolution of
+ *    4 us), so that a client can start several Arduinos on a common timeline. Meanwhile, the
+ *    Arduino counts as recording: the recording can be stopped, and a rate change replaces the
+ *    frame rate to start with.
+ *  - Frame rates are sent by the client in millihertz, so fractional rates (e.g., 29.97 Hz)
+ *    can be requested. A frame period of F_CPU / rate cycles generally is not a whole number
+ *    of cycles; its fractional part is carried over from frame to frame by a phase accumulator,
+ *    which lengthens individual frames by one cycle, such that the average frame rate exactly
+ *    matches the requested rate (relative to the Arduino's clock) over any recording length.
+ *  - Frame rates from `minFrameRate` to `maxFrameRate` are accepted (see `isValidFrameRate()`);
+ *    others are rejected with `nakBadPayload`. Far above that range, the compare-match
+ *    interrupts starve the main loop, and once the trigger pulse no longer ends within the
+ *    first segment of a frame, the pin would stay high.
+ *
+ * Light pattern:
+ *  - The "start recording" command may contain a pattern of up to `maxLightPattern` bytes, one
+ *    per frame, each being a mask of the `light...` flags below, e.g., white/white/UV. Frame
+ *    N is lit as given by byte N mod (pattern length), so one camera can capture interleaved
+ *    illumination conditions. Without a pattern, all white LEDs are on for all frames.
+ *  - The compare-match A interrupt switches the LEDs in the same port register write that
+ *    raises the trigger pin, i.e., in lockstep with the camera trigger. Hence, all LED pins
+ *    must be on the same port as the trigger pin. The lights of a frame stay on until the
+ *    next frame starts, so the exposure time must not exceed the frame period.
+ *
+ * LED strobe:
+ *  - The "start recording" command may also set a strobe offset and width (in us). With a
+ *    non-zero width, the lights of each frame are only on from offset to offset + width after
+ *    the trigger edge, e.g., to overdrive the LEDs briefly during a short exposure, which
+ *    reduces motion blur and heat. An offset of 0 switches them on with the trigger edge.
+ *  - The strobe is made of timer events (see *Camera trigger timing*), so it must end within
+ *    the first segment of a frame, less `timerEventMargin` cycles; otherwise the command is
+ *    rejected with `nakBadPayload`.
+ *  - Events due within `timerEventMargin` cycles of each other are run together, so an edge
+ *    may be early by up to that margin. Otherwise, LED edges lag their nominal time by the
+ *    (constant) interrupt latency of ~2 us, plus up to a few us while the UART interrupts
+ *    run.
+ *  - Stopping the recording turns all LEDs off immediately, also within a strobe.
+ *
+ * Stimulus:
+ *  - While recording, the client may switch lights on in addition to the light pattern with the
+ *    "set stimulus" command (a mask of `light...` flags; 0 switches them off again), e.g., the
+ *    UV LEDs as a stimulus in a closed loop, in which the client estimates the pose of the
+ *    animal in each frame and decides on the stimulus while the recording runs.
+ *  - The command is executed right in the UART receive interrupt (like a stop), so that its
+ *    latency does not depend on the main loop: the stimulus lights are switched together with
+ *    the pattern's lights by the compare-match A interrupt at the next trigger edge (or strobed
+ *    with them), and kept until the next "set stimulus" command or the end of the recording.
+ *  - The reply contains the index of the first frame lit with the new stimulus lights and the
+ *    trigger clock at the receipt of the command, so that the client can measure the latency
+ *    from the trigger edge of the frame it decided on to the stimulus in trigger clock cycles.
+ *
+ * Clock synchronization:
+ *  - While recording, the client may send "sync" commands, whose reply contains the trigger
+ *    clock (the time base of the trigger telemetry) sampled in the receive interrupt of the
+ *    command's last byte. From the send and receive times of many such exchanges, the
+ *    client estimates the offset and drift between the trigger clock and its own clock, to
+ *    timestamp trigger edges in host time. `micros()` cannot be used, as Timer0 is disabled
+ *    while recording (see *Camera trigger timing*).
+ *  - Sampling the clock costs a few cycles in the receive interrupt; trigger edges are
+ *    delayed by that at most, like by any other receive interrupt.
+ *
+ * Trigger telemetry:
+ *  - While recording, the script sends batches of trigger edge timestamps, each in an
+ *    `evtTelemetry` frame, whose payload consists of
+ *      - the number N of edges in the batch (1 byte),
+ *      - the index of the first edge (4 bytes),
+ *      - the timestamp of the first edge in CPU cycles (4 bytes, wraps around after 2^32 cycles),
+ *      - the nominal frame period in CPU cycles (4 bytes), and
+ *      - N - 1 variable-length values, one per remaining edge, each being the deviation of the
+ *        edge's period from the nominal period (zig-zag encoded, 7 bits per byte, LSB first).
+ *    Multi-byte fixed-length values are in network byte order.
+ *  - Deviations are typically 0 or 1 cycle(s), so one edge costs one byte (plus the framing
+ *    overhead per batch): at 720 Hz, telemetry uses ~15 % of the link's capacity at 115200 baud.
+ *  - Gaps in the edge indices between batches indicate edges whose timestamps were dropped
+ *    because the ring buffer was full; the edges themselves were still sent to the camera.
+ *
  * ## TODO
- * 
- * - Idea:
- * Allow client to send fps, b/c in *inference mode*, a high frame rate and thus delay between
- * subsequent frames is not required, only a short exposure time to keep motion blur at a minimum.
- * (FPS range should be limited to match specs of cam. E.g., 30 -- 720 FPS)
- * 
  *
  * - Test script!
  *
  * Date: Nov 11, 2022
  */
 
-const unsigned long baudrate = 115200;   // Must match baudrate in Arduino Control App on PC
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+const unsigned long baudrate = 115200;   // Baudrate after reset; must match ARDUINO_BAUDRATE in Arduino Control App on PC
+const unsigned long baudrateConfirmTimeout = 1000;  // ms to wait for a valid frame after a baudrate change
 
 // Assignment of Arduino digital I/O pins to LED modules and Basler cam I/O connector
 const int uvWheelLedsPin = 12;      // Pin to control 8x 3W UV LED, located below the wheel surface
 const int uvFrontTopLedsPin = 11;   // Pin to control 5x 3W UV LED, located in front-top LED housing
 const int whiteFrontTopLedPin = 10; // Pin to control 10x 1W white light LED, located in front-top LED housing
 const int whiteFrontBotLedPin = 9;  // Pin to control 1x 50W white light LED, located in front-bottom LED housing
-//const int baslerGpioInPin = 8;      // Pin to trigger Basler cam (GPIO In on Line 3)
-const int baslerGpioInPin = 13;     // Pin to trigger Basler cam (GPIO In on Line 3)  // TODO: Switch back to pin 8
+const int baslerGpioInPin = 13;     // Pin to trigger Basler cam (GPIO In on Line 3)
+const int auxTriggerPin = 8;        // Pin to trigger a second cam at a phase offset (see *Camera trigger timing*)
 
 /**
- * Processing delay of Arduino recording WHILE-loop in microseconds.
- * Value determined by checking frame rate in Pylon Viewer GUI and adjusting delay 
- * value accordingly.  This delay will be subtracted from the delay between 
- * subsequent frames, so that the desired frame rate is achieved and not lowered.
+ * Digital pin of the Arduino UNO (0..19, A0..A5 being 14..19) resolved to its port register
+ * and bit at compile time. Unlike `digitalWrite()`, which looks up the port of a pin at run
+ * time (several microseconds), `high()` and `low()` compile to a single `sbi`/`cbi`
+ * instruction (2 cycles), which is also atomic with respect to interrupts. Hence, the
+ * overhead of a pin change is the same for all pins.
  */
-const unsigned long recLoopDelay = 53;  // 53 us allows for a maximum (stable) trigger rate of 720 Hz (fix FPS range in client app)
+template <byte pin>
+struct FastPin {
+  static_assert(pin < 20, "Not a digital pin of the Arduino UNO");
+  static const byte portIndex = pin < 8 ? 0 : pin < 14 ? 1 : 2;  // Port D, B, or C
+  static const byte mask = 1 << (pin < 8 ? pin : pin < 14 ? pin - 8 : pin - 14);
+
+  static volatile byte& port() { return pin < 8 ? PORTD : pin < 14 ? PORTB : PORTC; }
+  static volatile byte& ddr() { return pin < 8 ? DDRD : pin < 14 ? DDRB : DDRC; }
+  static volatile byte& input() { return pin < 8 ? PIND : pin < 14 ? PINB : PINC; }
+
+  static void high() { port() |= mask; }
+  static void low() { port() &= ~mask; }
+  static bool isHigh() { return input() & mask; }
+  static void output() { ddr() |= mask; }
+};
+
+/**
+ * Several pins on the same port, which are switched in the same cycle by one write to
+ * the port register.
+ */
+template <byte pin, byte... pins>
+struct FastPinGroup {
+  static_assert(FastPin<pin>::portIndex == FastPinGroup<pins...>::portIndex, "All pins of a group must be on the same port");
+  static const byte portIndex = FastPin<pin>::portIndex;
+  static const byte mask = FastPin<pin>::mask | FastPinGroup<pins...>::mask;
+
+  static volatile byte& port() { return FastPin<pin>::port(); }
+
+  // The read-modify-write of several bits is not atomic; block interrupts, so that pin
+  // changes of interrupt routines on the same port (e.g., the camera trigger) are not lost.
+  static void high() {
+    byte sreg = SREG;
+    cli();
+    port() |= mask;
+    SREG = sreg;
+  }
+  static void low() {
+    byte sreg = SREG;
+    cli();
+    port() &= ~mask;
+    SREG = sreg;
+  }
+  static void output() {
+    byte sreg = SREG;
+    cli();
+    FastPin<pin>::ddr() |= mask;
+    SREG = sreg;
+  }
+};
+
+template <byte pin>
+struct FastPinGroup<pin> : FastPin<pin> {
+};
+
+typedef FastPin<baslerGpioInPin> TriggerPin;
+typedef FastPin<auxTriggerPin> AuxTriggerPin;
+typedef FastPinGroup<whiteFrontTopLedPin, whiteFrontBotLedPin> WhiteLeds;
+typedef FastPinGroup<whiteFrontTopLedPin, whiteFrontBotLedPin, uvFrontTopLedsPin, uvWheelLedsPin> AllLeds;
+static_assert(AllLeds::portIndex == TriggerPin::portIndex, "LEDs are switched together with the trigger pin, see *Light pattern*");
+static_assert(AuxTriggerPin::portIndex == TriggerPin::portIndex, "Both trigger outputs are switched by the same timer events");
+
 const int triggerSignalLen = 10;    // Length of HW-trigger signal (in us) sent to the Basler cam
-const int stopCheckFrameCount = 3;  // Num of frames between checking if user stopped recording
 
-// Operation codes (byte values) used for communication between Arduino and client
-const byte msgStopRec = 0;  // Client request code to stop recording WHILE-loop
-const byte msgStartRec = 1; // Client request code to start recording
-const byte msgSendFps = 2;  // Arduino signal for client to send FPS
-const byte msgWaiting = 3;  // Arduino signal for client to start recording
+/**
+ * Maximum number of timer ticks (CPU cycles) of one Timer1 cycle ("segment").
+ * Kept below the 16-bit limit of 65536, so that distributing the remainder of a
+ * frame period over the last segment of a frame can never overflow `OCR1A`.
+ */
+const unsigned long maxSegmentTicks = 65000;
+
+/**
+ * Timer events due within this number of cycles from now are run right away rather than
+ * by a separate compare match, which could be missed while an interrupt routine runs.
+ */
+const unsigned int timerEventMargin = 32;
+
+// Actions of a timer event (bit mask)
+const byte actionTriggerLow = 0x01;
+const byte actionLightsOn = 0x02;   // Switch on the lights of the current frame
+const byte actionLightsOff = 0x04;
+const byte actionAuxTriggerHigh = 0x08;
+const byte actionAuxTriggerLow = 0x10;
+
+const unsigned long maxStartDelay = 60000000;  // Max. delay (in us) of a "start recording at" command
+
+const unsigned long rateScale = 1000;  // Frame rates are sent by the client in units of 1/rateScale Hz (mHz)
+// Range of frame rates (in mHz); must match ARDUINO_MIN_FPS and ARDUINO_MAX_FPS of the client
+const unsigned long minFrameRate = 1000;     // 1 Hz
+const unsigned long maxFrameRate = 1000000;  // 1 kHz, the highest rate of the firmware benchmark
+
+// Frame format and frame types used for communication between Arduino and client (see
+// *Serial protocol* above); must match `ArduinoProtocol.h` of the Arduino Control App on PC.
+const byte frameStart = 0xA5;
+const byte cmdPing = 0x01;          // Reply payload: state (0: idle, 1: recording)
+const byte cmdStartRec = 0x02;      // Payload: frame rate in mHz (4 bytes), optionally followed by strobe offset and
+                                    // width in us (2 bytes each) and the light pattern
+const byte cmdStopRec = 0x03;       // Replied after all telemetry; reply payload: pulse count, last pulse timestamp (4 bytes each)
+const byte cmdSetBaudrate = 0x04;   // Payload: baudrate (4 bytes); switched after the reply
+const byte cmdSetRate = 0x05;       // Payload: frame rate in mHz (4 bytes); applied at the next frame while recording
+const byte cmdSync = 0x06;          // Reply payload: trigger clock at the receipt of the command (4 bytes); while recording
+const byte cmdSetTriggers = 0x07;   // Payload: phase of the aux trigger output in us (2 bytes), or none to turn it off; while idle
+const byte cmdStartRecAt = 0x08;    // Payload: start delay in us (4 bytes), followed by the payload of `cmdStartRec`
+const byte cmdIdentify = 0x09;      // Reply payload: "KWA", firmware version, device ID, capabilities (see *Identification*)
+const byte cmdSetStimulus = 0x0A;   // Payload: stimulus lights (`light...` mask, 1 byte); reply payload: index of the first
+                                    // frame lit with them, trigger clock at the receipt (4 bytes each); while recording
+const byte rspAck = 0x80;
+const byte rspNak = 0x81;           // Payload: error code (1 byte)
+const byte evtReady = 0x90;         // Sent on startup
+const byte evtTelemetry = 0x91;     // Batch of trigger edge timestamps
+// Error codes of NAK replies
+const byte nakUnknownCommand = 1;
+const byte nakBadPayload = 2;
+const byte nakInvalidState = 3;
+
+// Firmware version and capabilities reported by the "identify" command; must match defs. in
+// `ArduinoProtocol.h` of the client.
+const byte firmwareVersionMajor = 1;
+const byte firmwareVersionMinor = 1;
+const unsigned int capLightPattern = 0x0001;
+const unsigned int capStrobe = 0x0002;
+const unsigned int capSetRate = 0x0004;
+const unsigned int capClockSync = 0x0008;
+const unsigned int capAuxTrigger = 0x0010;
+const unsigned int capStartAt = 0x0020;
+const unsigned int capStimulus = 0x0040;
+const unsigned int capabilities = capLightPattern | capStrobe | capSetRate | capClockSync | capAuxTrigger | capStartAt |
+                                  capStimulus;
+
+uint32_t* const deviceIdAddress = 0;  // EEPROM address of the device ID (4 bytes)
+
+// Lights of a frame in the light pattern (bit mask); must match `LIGHT_...` in `ArduinoProtocol.h`.
+const byte lightWhiteFrontTop = 0x01;
+const byte lightWhiteFrontBot = 0x02;
+const byte lightUvFrontTop = 0x04;
+const byte lightUvWheel = 0x08;
+const byte lightAll = lightWhiteFrontTop | lightWhiteFrontBot | lightUvFrontTop | lightUvWheel;
+const byte maxLightPattern = 16;    // Max. number of frames of a light pattern
+
+const byte maxCommandPayload = 4 + 8 + maxLightPattern;  // Longer command frames are dropped
+const byte txBufferSize = 64;       // Capacity of the UART transmit buffer; must be a power of two
+
+const byte telemetryBufferSize = 64;  // Capacity of the trigger edge ring buffer; must be a power of two
+const byte telemetryBatchSize = 16;   // Number of edges sent per telemetry message
+const unsigned long telemetryMaxAge = F_CPU / 4;  // Max. age (in CPU cycles) of an edge before it is sent
+// Max. size of a telemetry payload: header plus up to 5 bytes per deviation
+const byte maxTelemetryPayload = 13 + 5 * (telemetryBatchSize - 1);
 
 /*
  * Remove BEGIN
@@ -90,135 +373,1116 @@ const byte msgWaiting = 3;  // Arduino signal for client to start recording
  * Remove END
  */
 
-// The setup function runs once when the board is powered on or reset
-void setup() {
-  // Initialize serial communication at `baudrate` bits per second
-  Serial.begin(baudrate);
-  // Set the max. number of ms to wait for serial data.
-  Serial.setTimeout(500);
+// Timer1 settings for a frame rate (see `triggerRateOf()`)
+struct TriggerRate {
+  unsigned int segments;          // Number of timer cycles making up one frame period
+  unsigned int segmentTicks;      // Length of all but the last segment of a frame
+  unsigned int lastSegmentTicks;  // Length of the last segment of a frame
+  unsigned long phaseStep;        // Fractional cycles per frame (numerator)
+  unsigned long phaseModulus;     // Fractional cycles per frame (denominator), i.e., the rate in mHz
+  unsigned long periodTicks;      // Integral part of the frame period
+};
+
+// State of the Timer1 trigger engine; written by `startTrigger()` before the timer is
+// started and only read (or updated) by the compare-match interrupts afterwards.
+volatile unsigned int segmentsPerFrame = 1;  // Number of timer cycles making up one frame period
+volatile unsigned int segmentTicks = 0;      // Length of all but the last segment of a frame
+volatile unsigned int lastSegmentTicks = 0;  // Length of the last segment of a frame
+volatile unsigned int segmentsLeft = 0;      // Segments left in the current frame (incl. the running one)
+// Phase accumulator: the exact frame period is `periodTicks + phaseStep / phaseModulus` cycles.
+volatile unsigned long phaseStep = 0;        // Fractional cycles per frame (numerator)
+volatile unsigned long phaseModulus = 1;     // Fractional cycles per frame (denominator), i.e., the rate in mHz
+volatile unsigned long phaseAcc = 0;         // Accumulated fractional cycles, always < phaseModulus
+// NOTE: An overflow of the frame counter can be ignored, as values up to 2^32 - 1
+// can be stored, allowing run times of more than 1.000 h whren recording at 1.000 Hz.
+volatile unsigned long frameCounter = 0;     // Number of trigger pulses sent since recording start
+unsigned long framePeriodTicks = 0;          // Nominal (integral) frame period in CPU cycles
+volatile unsigned long segmentStartTicks = 0;  // CPU cycles since recording start at the start of the running segment
+volatile unsigned long lastEdgeTicks = 0;    // Timestamp of the last trigger pulse
+// Rate change while recording (see *Camera trigger timing*): `pendingRate` is written by the
+// main loop and applied by the compare-match A interrupt while `rateUpdatePending` is set.
+TriggerRate pendingRate;
+volatile bool rateUpdatePending = false;
+volatile bool rateChanged = false;           // Set once applied, until telemetry switched to the new period
+volatile unsigned long rateChangeIndex = 0;  // Index of the first trigger edge ending a frame at the new rate
+unsigned long changedFramePeriodTicks = 0;   // Nominal frame period from `rateChangeIndex` on
+// Light pattern as masks of the LED pins in their port register (see `AllLeds`)
+byte lightPattern[maxLightPattern];
+byte lightPatternLength = 1;
+volatile byte lightIndex = 0;                // Index of the pattern entry of the next frame
+volatile byte frameLights = 0;               // Pattern entry of the current frame
+// Stimulus lights (see *Stimulus*) as mask of the LED pins, lit in addition to the pattern from
+// frame `stimulusFrame` on; written by the UART receive interrupt.
+volatile byte stimulusLights = 0;
+volatile unsigned long stimulusFrame = 0;
+// LED strobe, in timer ticks after the trigger edge; no strobe if `strobeOffTicks` is 0.
+unsigned int strobeOnTicks = 0;
+unsigned int strobeOffTicks = 0;
+// Auxiliary trigger output (see *Camera trigger timing*); set while idle.
+bool auxTriggerEnabled = false;
+unsigned int auxTriggerPhase = 0;            // Delay (in us) of its pulses after the trigger edge
+byte frameStartPins = 0;                     // Trigger pins raised at the start of each frame (port mask)
+// Pin changes within the first segment of each frame, sorted by time (see `runTimerEvents()`)
+struct TimerEvent {
+  unsigned int ticks;  // Timer value at which the event is due
+  byte actions;        // `action...` flags
+};
+TimerEvent timerEvents[5];
+byte timerEventCount = 0;
+volatile byte timerEventIndex = 0;           // Index of the next event; `timerEventCount` if none left in the frame
+
+bool isRecording = false;
+// Recording started by a "start recording at" command, waiting for its start time
+bool startScheduled = false;
+unsigned long scheduledStartMicros = 0;      // Receipt of the command
+unsigned long scheduledStartDelay = 0;       // Delay (in us) of the start after `scheduledStartMicros`
+unsigned long scheduledFrameRate = 0;
+
+// State of the command frame parser (see `receiveByte()`); only accessed by the UART
+// receive interrupt.
+enum RxState { awaitStart, awaitLength, awaitSeq, awaitType, awaitPayload, awaitCrcHigh, awaitCrcLow };
+RxState rxState = awaitStart;
+byte rxLength = 0;
+byte rxCount = 0;
+unsigned int rxCrc = 0;
+byte rxSeq = 0;
+byte rxType = 0;
+byte rxPayload[maxCommandPayload];
+
+// Last received command, passed from the UART receive interrupt to the main loop. While
+// `commandPending` is `true`, the command is owned by the main loop and further commands
+// are dropped, except for a stop command, which is executed next (`stopPending`).
+volatile bool commandPending = false;
+volatile bool stopPending = false;
+byte stopSeq = 0;
+byte cmdLength = 0;
+byte cmdSeq = 0;
+byte cmdType = 0;
+byte cmdPayload[maxCommandPayload];
+unsigned long cmdTicks = 0;          // Trigger clock at the receipt of a sync or stimulus command (see `triggerClock()`)
+bool cmdApplied = false;             // Whether a stimulus command was applied by the receive interrupt
+unsigned long cmdMicros = 0;         // `micros()` at the receipt of a "start recording at" command
+
+// UART transmit buffer; filled by the main loop (which only writes `txHead`) and drained
+// by the data-register-empty interrupt (which only writes `txTail`).
+volatile byte txBuffer[txBufferSize];
+volatile byte txHead = 0;
+volatile byte txTail = 0;
+bool txWritten = false;  // `true` once a byte was sent, as the transmit complete flag is unset before
 
-  // Initialize digital pins as output.
-  pinMode(uvWheelLedsPin, OUTPUT);
-  pinMode(uvFrontTopLedsPin, OUTPUT);
-  pinMode(whiteFrontTopLedPin, OUTPUT);
-  pinMode(whiteFrontBotLedPin, OUTPUT);
-  pinMode(baslerGpioInPin, OUTPUT);
+byte eventSeq = 0;  // SEQ of the next event frame
 
-  // Initialize LEDs and Basler HW-trigger pins to low (i.e., lights and cam trigger off).
-  digitalWrite(uvWheelLedsPin, LOW);
-  digitalWrite(uvFrontTopLedsPin, LOW);
-  digitalWrite(whiteFrontTopLedPin, LOW);
-  digitalWrite(whiteFrontBotLedPin, LOW);
-  digitalWrite(baslerGpioInPin, LOW);
+unsigned long deviceId = 0;  // See *Identification*; set by `loadDeviceId()`
+
+// Baudrate change waiting for confirmation by a valid frame (see `checkBaudrate()`)
+volatile bool baudrateUnconfirmed = false;
+unsigned long baudrateChangeMillis = 0;
+
+// Ring buffer of trigger edge timestamps; filled by the compare-match A interrupt
+// (which only writes `edgeHead`) and drained by the main loop (which only writes `edgeTail`).
+volatile unsigned long edgeTicks[telemetryBufferSize];
+volatile byte edgeHead = 0;
+volatile byte edgeTail = 0;
+volatile unsigned long edgeTailIndex = 0;  // Index of the edge at `edgeTail`
+volatile bool edgeResync = false;          // `true` after an edge was dropped, until the buffer ran empty
+
+/**
+ * Store the timestamp of the trigger edge with index `frameCounter` in the ring buffer.
+ * Called by interrupt routines only. If the buffer is full, the edge is dropped and all
+ * following edges until the buffer ran empty, so that the buffer's content stays contiguous.
+ */
+inline void recordTriggerEdge(unsigned long ticks) {
+  byte head = edgeHead;
+  byte next = (head + 1) & (telemetryBufferSize - 1);
+  if (next == edgeTail) {
+    edgeResync = true;
+    return;
+  }
+  if (edgeResync) {
+    if (head != edgeTail) {
+      return;
+    }
+    edgeTailIndex = frameCounter;
+    edgeResync = false;
+  }
+  edgeTicks[head] = ticks;
+  edgeHead = next;
 }
 
+/**
+ * Return the timer TOP value for the last segment of a frame, which absorbs the
+ * accumulated fractional cycles of the frame period. Call once per frame.
+ */
+inline unsigned int nextLastSegmentTop() {
+  unsigned int ticks = lastSegmentTicks;
+  unsigned long acc = phaseAcc + phaseStep;
+  if (acc >= phaseModulus) {
+    acc -= phaseModulus;
+    ++ticks;  // Carry one whole cycle into this frame.
+  }
+  phaseAcc = acc;
+  return ticks - 1;
+}
 
-// The loop function runs over and over again, forever
-void loop() {
+/**
+ * Return the mask of the LED pins in their port register for a mask of `light...` flags.
+ */
+inline byte lightMaskOf(byte lights) {
+  byte mask = 0;
+  if (lights & lightWhiteFrontTop) {
+    mask |= FastPin<whiteFrontTopLedPin>::mask;
+  }
+  if (lights & lightWhiteFrontBot) {
+    mask |= FastPin<whiteFrontBotLedPin>::mask;
+  }
+  if (lights & lightUvFrontTop) {
+    mask |= FastPin<uvFrontTopLedsPin>::mask;
+  }
+  if (lights & lightUvWheel) {
+    mask |= FastPin<uvWheelLedsPin>::mask;
+  }
+  return mask;
+}
+
+/**
+ * Start a new frame: switch the LEDs to the next entry of the light pattern plus the stimulus
+ * lights (unless strobed later) and raise the trigger pin in one write to their port register,
+ * then rearm the timer events of the frame. Called with interrupts disabled only.
+ */
+inline void startFrame() {
+  byte index = lightIndex;
+  byte lights = lightPattern[index] | stimulusLights;
+  if (++index == lightPatternLength) {
+    index = 0;
+  }
+  lightIndex = index;
+  frameLights = lights;
+  if (strobeOnTicks != 0) {
+    lights = 0;  // Switched on by a timer event.
+  }
+  volatile byte& port = AllLeds::port();
+  port = (port & ~AllLeds::mask) | lights | frameStartPins;
+  timerEventIndex = 0;
+}
+
+/**
+ * Run all timer events of the current frame which are due (see `timerEventMargin`) and
+ * set `OCR1B` to the next one. After the last event of a frame, `OCR1B` is set to the first
+ * one already, as it must not be changed close to its match at the start of the next
+ * frame; its compare matches in later segments run no events. Called with interrupts
+ * disabled only.
+ */
+inline void runTimerEvents() {
+  byte i = timerEventIndex;
+  while (i < timerEventCount && timerEvents[i].ticks <= TCNT1 + timerEventMargin) {
+    byte actions = timerEvents[i].actions;
+    volatile byte& port = AllLeds::port();
+    byte value = port;
+    if (actions & actionTriggerLow) {
+      value &= ~TriggerPin::mask;
+    }
+    if (actions & actionLightsOn) {
+      value |= frameLights;
+    }
+    if (actions & actionLightsOff) {
+      value &= ~AllLeds::mask;
+    }
+    if (actions & actionAuxTriggerHigh) {
+      value |= AuxTriggerPin::mask;
+    }
+    if (actions & actionAuxTriggerLow) {
+      value &= ~AuxTriggerPin::mask;
+    }
+    port = value;
+    ++i;
+  }
+  timerEventIndex = i;
+  OCR1B = timerEvents[i < timerEventCount ? i : 0].ticks;
+}
 
-  // Signal that Arduino is ready to start recording.
-  Serial.write(msgWaiting);
-  
-  // DEBUG
-  //Serial.print("Waiting");
-
-  // Wait for at least 1 byte in the serial receive buffer.
-  while (Serial.available() < 1);
-
-  byte buf[2] = { 0 };  // Clear buffer
-  Serial.readBytes(buf, 1);  // Read one byte from serial rcv buffer
-  
-  // Check if client sent msg to start recording.
-  if (buf[0] != msgStartRec) {
-    return;  // Start *main loop* from top again.
-  }
-
-  // Ask client for desired frame rate. (Send byte value.)
-  Serial.write(msgSendFps);
-
-  // Read frame rate from client
-  memset(buf, 0, 2);  // Clear buffer
-  size_t bytesRead = Serial.readBytes(buf, 2);  // Read two bytes from serial rcv buffer, w/ timeout
-  byte hi = buf[0];
-  byte lo = buf[1];
-  word frameRate = word(hi, lo);
-
-  // DEBUG: Remvoe me later
-  //Serial.print(frameRate);
-  
-  // If frame rate is 0 or read timed out, abort and jump back to top of main loop.
-  if (bytesRead != 2 || frameRate == 0) {
+/**
+ * Add a timer event with `actions` at `ticks`, keeping the events sorted by time and merging
+ * events due at the same time.
+ */
+void addTimerEvent(unsigned int ticks, byte actions) {
+  byte i = timerEventCount;
+  while (i > 0 && timerEvents[i - 1].ticks > ticks) {
+    timerEvents[i] = timerEvents[i - 1];
+    --i;
+  }
+  if (i > 0 && timerEvents[i - 1].ticks == ticks) {
+    // Close the gap opened above again.
+    for (byte j = i; j < timerEventCount; ++j) {
+      timerEvents[j] = timerEvents[j + 1];
+    }
+    timerEvents[i - 1].actions |= actions;
     return;
   }
+  timerEvents[i].ticks = ticks;
+  timerEvents[i].actions = actions;
+  ++timerEventCount;
+}
 
-  // Turn all white light LEDs on.
-  digitalWrite(whiteFrontTopLedPin, HIGH);
-  digitalWrite(whiteFrontBotLedPin, HIGH);
-
-  bool isRecording = true;
-  // NOTE: An overflow of the frame counter can be ignored, as values up to 2^32 - 1
-  // can be stored, allowing run times of more than 1.000 h whren recording at 1.000 Hz.
-  unsigned long frameCounter = 0;
-
-  // NOTE: For `delayMicroseconds()`, currently, the largest value that will produce an accurate
-  // delay is 16383; larger values can produce an extremely short delay. Therefore, split delay
-  // into milliseconds and microseconds.
-  unsigned long frameDelayUs = 1000000 / frameRate; // Delay between subsequent frames in microseconds
-      // Subtract the duration of the camera trigger signal and WHILE-loop
-      // iteration from the inter-frame delay to ensure the target frame rate
-      // is met.
-  frameDelayUs =  frameDelayUs - triggerSignalLen - recLoopDelay;
-  //Serial.print('\n');
-  //Serial.print(frameDelayUs);  // DEBUG: Remove
-  unsigned long frameDelayMs = frameDelayUs / 1000; // Delay between subsequent frames in milliseconds
-  //Serial.print('\n');          // DEBUG: Remove
-  //Serial.print(frameDelayMs);  // DEBUG: Remove
-  frameDelayUs =  frameDelayUs - frameDelayMs * 1000; // Delay between subsequent frames in microseconds
-  //Serial.print('\n');          // DEBUG: Remove
-  //Serial.print(frameDelayMs);  // DEBUG: Remove
-  //Serial.print('\n');          // DEBUG: Remove
-  //Serial.print(frameDelayUs);  // DEBUG: Remove
-  //Serial.print('\n');          // DEBUG: Remove
-  Serial.setTimeout(1);  // Set short timeout to not delay camera trigger, when checking for client msgs.
-
-  // Recording loop switches lights and triggers camera until client stops recording
-  while (isRecording) {
-    // Trigger camera
-    digitalWrite(baslerGpioInPin, HIGH);
-    // Keep the HW-trigger signal sent to the Basler cam high for at
-    // least `triggerSignalLen` microseconds to be registered by the cam.
-    delayMicroseconds(triggerSignalLen);
-    digitalWrite(baslerGpioInPin, LOW);
-
-    delay(frameDelayMs);
-    delayMicroseconds(frameDelayUs);
-
-    if (frameCounter % stopCheckFrameCount) {
-      // Every n-th frame, check whether client requested recording stop.
-      if (Serial.available() > 0) {
-        // If client has sent 0-byte, recording will be stopped.
-        isRecording = (bool)Serial.read();
-      }
+/**
+ * Return the integral part of the frame period at `frameRateMilliHz` / `rateScale` Hz in
+ * CPU cycles.
+ */
+unsigned long framePeriodOf(unsigned long frameRateMilliHz) {
+  return (unsigned long long)F_CPU * rateScale / frameRateMilliHz;
+}
+
+/**
+ * Return the number of segments a frame period of `periodTicks` cycles is split into.
+ */
+unsigned int segmentsOf(unsigned long periodTicks) {
+  return (periodTicks + maxSegmentTicks - 1) / maxSegmentTicks;
+}
+
+/**
+ * Return whether a timer event `ticks` cycles after the trigger edge falls into the first
+ * segment of a frame at `frameRateMilliHz` / `rateScale` Hz (see `timerEventMargin`).
+ */
+bool fitsFirstSegment(unsigned long ticks, unsigned long frameRateMilliHz) {
+  unsigned long periodTicks = framePeriodOf(frameRateMilliHz);
+  return ticks + timerEventMargin < periodTicks / segmentsOf(periodTicks);
+}
+
+/**
+ * Return whether the trigger engine can run at `frameRateMilliHz` / `rateScale` Hz: within
+ * `minFrameRate` and `maxFrameRate`, and with the trigger pulse ending within the first segment
+ * of a frame, as the event lowering the trigger pin would not run otherwise.
+ */
+bool isValidFrameRate(unsigned long frameRateMilliHz) {
+  return frameRateMilliHz >= minFrameRate && frameRateMilliHz <= maxFrameRate &&
+         fitsFirstSegment((unsigned long)triggerSignalLen * (F_CPU / 1000000), frameRateMilliHz);
+}
+
+/**
+ * Return the Timer1 settings for triggering at `frameRateMilliHz` / `rateScale` Hz.
+ */
+TriggerRate triggerRateOf(unsigned long frameRateMilliHz) {
+  TriggerRate rate;
+  // Split the frame period (in CPU cycles) into its integral part and the fractional
+  // remainder, which is handled by the phase accumulator.
+  rate.periodTicks = framePeriodOf(frameRateMilliHz);
+  rate.phaseStep = (unsigned long long)F_CPU * rateScale % frameRateMilliHz;
+  rate.phaseModulus = frameRateMilliHz;
+
+  // Split the frame period into segments that fit into the 16-bit timer.
+  rate.segments = segmentsOf(rate.periodTicks);
+  rate.segmentTicks = rate.periodTicks / rate.segments;
+  rate.lastSegmentTicks = rate.periodTicks - (unsigned long)rate.segmentTicks * (rate.segments - 1);
+  return rate;
+}
+
+/**
+ * Make `rate` the rate of the trigger engine from the next segment on, restarting the
+ * phase accumulator. Called with interrupts disabled only.
+ */
+inline void applyTriggerRate(const TriggerRate& rate) {
+  segmentsPerFrame = rate.segments;
+  segmentTicks = rate.segmentTicks;
+  lastSegmentTicks = rate.lastSegmentTicks;
+  phaseStep = rate.phaseStep;
+  phaseModulus = rate.phaseModulus;
+  phaseAcc = 0;
+}
+
+/**
+ * Start triggering the camera at `frameRateMilliHz` / `rateScale` Hz using Timer1.
+ * The first trigger pulse is sent immediately.
+ */
+void startTrigger(unsigned long frameRateMilliHz) {
+  TriggerRate rate = triggerRateOf(frameRateMilliHz);
+  applyTriggerRate(rate);
+  unsigned int segments = rate.segments;
+  segmentsLeft = segments;
+  framePeriodTicks = rate.periodTicks;
+  rateUpdatePending = false;
+  rateChanged = false;
+  frameCounter = 0;
+  segmentStartTicks = 0;
+  lastEdgeTicks = 0;
+  lightIndex = 0;
+  stimulusLights = 0;
+  edgeHead = 0;
+  edgeTail = 0;
+  edgeTailIndex = 0;
+  edgeResync = false;
+
+  // Pin changes within a frame; see *Camera trigger timing* and *LED strobe* above.
+  const unsigned int pulseTicks = triggerSignalLen * (F_CPU / 1000000);
+  timerEventCount = 0;
+  frameStartPins = TriggerPin::mask;
+  addTimerEvent(pulseTicks, actionTriggerLow);
+  if (auxTriggerEnabled) {
+    unsigned int auxTicks = auxTriggerPhase * (F_CPU / 1000000);
+    if (auxTicks == 0) {
+      frameStartPins |= AuxTriggerPin::mask;
+    }
+    else {
+      addTimerEvent(auxTicks, actionAuxTriggerHigh);
     }
-    
+    addTimerEvent(auxTicks + pulseTicks, actionAuxTriggerLow);
+  }
+  if (strobeOffTicks != 0) {
+    if (strobeOnTicks != 0) {
+      addTimerEvent(strobeOnTicks, actionLightsOn);
+    }
+    addTimerEvent(strobeOffTicks, actionLightsOff);
+  }
+
+  // Disable the Timer0 overflow interrupt (used by `millis()`, `delay()`, etc.) while
+  // triggering, because it would delay the trigger interrupts by several microseconds.
+  TIMSK0 &= ~_BV(TOIE0);
+
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12);  // CTC mode with TOP = OCR1A, timer stopped
+  TCNT1 = 0;
+  OCR1A = segments == 1 ? nextLastSegmentTop() : rate.segmentTicks - 1;
+  OCR1B = timerEvents[0].ticks;
+  TIFR1 = _BV(OCF1A) | _BV(OCF1B);     // Clear pending compare-match flags
+  TIMSK1 = _BV(OCIE1A) | _BV(OCIE1B);  // Enable compare-match A and B interrupts
+  // First trigger pulse of the recording; the following ones are sent by the ISR.
+  startFrame();
+  recordTriggerEdge(0);
+  ++frameCounter;
+  TCCR1B |= _BV(CS10);  // Start timer at F_CPU (no prescaler)
+  interrupts();
+}
+
+/**
+ * Stop triggering the camera, leave the trigger signals low, and turn all LEDs off. Running
+ * trigger pulses are completed first, so that all pulses counted by `frameCounter` reached the
+ * camera. May be called from interrupt routines, and more than once.
+ */
+void stopTrigger() {
+  byte sreg = SREG;
+  cli();
+  while (TCCR1B != 0 && (TriggerPin::isHigh() || AuxTriggerPin::isHigh())) {
+    // Run the timer events up to the end of the pulse (their interrupt cannot run now).
+    if (TIFR1 & _BV(OCF1B)) {
+      TIFR1 = _BV(OCF1B);
+      runTimerEvents();
+    }
+  }
+  TCCR1B = 0;  // Stop timer
+  TIMSK1 = 0;
+  TIFR1 = _BV(OCF1A) | _BV(OCF1B);
+  volatile byte& port = AllLeds::port();
+  port &= ~(AllLeds::mask | TriggerPin::mask | AuxTriggerPin::mask);
+  TIMSK0 |= _BV(TOIE0);  // Re-enable `millis()`
+  SREG = sreg;
+}
+
+/**
+ * Return the trigger clock, i.e., the CPU cycles since the start of the recording, which
+ * timestamps the trigger edges. A segment that ended while interrupts were disabled is
+ * taken into account. Called with interrupts disabled only.
+ */
+inline unsigned long triggerClock() {
+  unsigned long ticks = segmentStartTicks;
+  unsigned int count = TCNT1;
+  if (TIFR1 & _BV(OCF1A)) {
+    // The timer restarted, but the compare-match A interrupt did not run yet; the count
+    // is read again, as it may have been read before the restart.
+    count = TCNT1;
+    ticks += OCR1A + 1UL;
+  }
+  return ticks + count;
+}
+
+// Timer1 compare-match A: end of a segment; at the end of the last segment of a frame,
+// a new frame starts and the camera is triggered.
+ISR(TIMER1_COMPA_vect) {
+  unsigned int left = segmentsLeft - 1;
+  unsigned int latency = 0;
+  if (left == 0) {
+    // Trigger camera; the signal is set low again by a timer event.
+    startFrame();
+    // Cycles elapsed since the compare match, i.e., the delay of this edge.
+    latency = TCNT1;
+  }
+  // The segment that just ended was `OCR1A + 1` cycles long.
+  unsigned long segmentStart = segmentStartTicks + OCR1A + 1;
+  segmentStartTicks = segmentStart;
+  if (left == 0) {
+    recordTriggerEdge(segmentStart + latency);
+    lastEdgeTicks = segmentStart + latency;
     ++frameCounter;
+    if (rateUpdatePending) {
+      // The frame just started is the first one at the new rate.
+      applyTriggerRate(pendingRate);
+      rateUpdatePending = false;
+      rateChangeIndex = frameCounter;
+      rateChanged = true;
+    }
+    left = segmentsPerFrame;
+  }
+  // The timer has already restarted counting the segment that follows; set its length.
+  OCR1A = left == 1 ? nextLastSegmentTop() : segmentTicks - 1;
+  segmentsLeft = left;
+  if (left == segmentsPerFrame) {
+    // Events of the new frame which are due already (missed while this routine ran).
+    runTimerEvents();
   }
+}
 
-  // Turn all white light LEDs off.
-  digitalWrite(whiteFrontTopLedPin, LOW);
-  digitalWrite(whiteFrontBotLedPin, LOW);
+// Timer1 compare-match B: next timer event of the frame (see `runTimerEvents()`).
+ISR(TIMER1_COMPB_vect) {
+  runTimerEvents();
+}
 
-  // DEBUG
-  //Serial.print("Stopped");
+/**
+ * Wait until all queued bytes were sent.
+ */
+void uartFlush() {
+  if (!txWritten) {
+    return;
+  }
+  while ((UCSR0B & _BV(UDRIE0)) || !(UCSR0A & _BV(TXC0)));
+}
 
-  Serial.setTimeout(500);  // Set longer timeout for when waiting for client and FPS value.
+/**
+ * Initialize the UART at `rate` baud (8N1) with interrupt-driven reception and transmission.
+ * Bytes still in the transmit buffer are sent at the previous rate.
+ */
+void uartBegin(unsigned long rate) {
+  uartFlush();
+  byte sreg = SREG;
+  cli();
+  // Double-speed mode; same rounding as `HardwareSerial::begin()`, e.g., 115200 baud is
+  // generated with an error of 2.1 % and 1000000 baud exactly.
+  UCSR0A = _BV(U2X0);
+  UBRR0 = (F_CPU / 4 / rate - 1) / 2;
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+  rxState = awaitStart;  // Drop a frame partially received at the previous rate.
+  SREG = sreg;
+}
+
+/**
+ * Queue `value` for transmission; waits while the transmit buffer is full.
+ */
+void uartWrite(byte value) {
+  byte head = txHead;
+  byte next = (head + 1) & (txBufferSize - 1);
+  while (next == txTail);
+  txBuffer[head] = value;
+  txHead = next;
+  txWritten = true;
+  byte sreg = SREG;
+  cli();
+  UCSR0B |= _BV(UDRIE0);
+  SREG = sreg;
+}
 
-  // XXX: Remove lines below: don't report successful recording stop to client,
-  // instead, on the client side, assume that recording got stopped. This
-  // simplifies the logic and code on Arduino and client.
-  // Report to client that recording has been stopped.
-  //Serial.print(msgOk);
-  
-  return;  // Start *main loop* from top again.
- 
+// UART data register empty: send the next byte of the transmit buffer.
+ISR(USART_UDRE_vect) {
+  byte tail = txTail;
+  UDR0 = txBuffer[tail];
+  UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);  // Clear the transmit complete flag
+  tail = (tail + 1) & (txBufferSize - 1);
+  txTail = tail;
+  if (tail == txHead) {
+    UCSR0B &= ~_BV(UDRIE0);
+  }
+}
+
+/**
+ * Feed one received byte to the command frame parser (UART receive interrupt only).
+ * Returns `true` if the byte completed a valid frame.
+ */
+bool receiveByte(byte value) {
+  switch (rxState) {
+  case awaitStart:
+    if (value == frameStart) {
+      rxCrc = 0xFFFF;
+      rxState = awaitLength;
+    }
+    return false;
+  case awaitLength:
+    if (value > maxCommandPayload) {
+      rxState = awaitStart;
+      return receiveByte(value);  // The byte may start the next frame.
+    }
+    rxLength = value;
+    rxCount = 0;
+    rxCrc = _crc_xmodem_update(rxCrc, value);
+    rxState = awaitSeq;
+    return false;
+  case awaitSeq:
+    rxSeq = value;
+    rxCrc = _crc_xmodem_update(rxCrc, value);
+    rxState = awaitType;
+    return false;
+  case awaitType:
+    rxType = value;
+    rxCrc = _crc_xmodem_update(rxCrc, value);
+    rxState = rxLength > 0 ? awaitPayload : awaitCrcHigh;
+    return false;
+  case awaitPayload:
+    rxPayload[rxCount++] = value;
+    rxCrc = _crc_xmodem_update(rxCrc, value);
+    if (rxCount == rxLength) {
+      rxState = awaitCrcHigh;
+    }
+    return false;
+  case awaitCrcHigh:
+    rxCrc ^= (unsigned int)value << 8;
+    rxState = awaitCrcLow;
+    return false;
+  case awaitCrcLow:
+    rxState = awaitStart;
+    return (rxCrc ^ value) == 0;
+  }
+  return false;
+}
+
+// UART receive complete: parse command frames (see *Serial protocol* above).
+ISR(USART_RX_vect) {
+  if (!receiveByte(UDR0)) {
+    return;
+  }
+  baudrateUnconfirmed = false;
+  if (rxType == cmdStopRec) {
+    stopTrigger();
+    if (commandPending) {
+      // Replied once the main loop finished the previous command.
+      stopPending = true;
+      stopSeq = rxSeq;
+      return;
+    }
+  }
+  else if (commandPending) {
+    return;  // Main loop still busy with the previous command; the client will time out.
+  }
+  else if (rxType == cmdSync) {
+    cmdTicks = triggerClock();
+  }
+  else if (rxType == cmdSetStimulus) {
+    // Applied right here, so that the stimulus is switched at the next trigger edge (see
+    // *Stimulus*); the main loop only replies. Not while a scheduled recording waits.
+    cmdApplied = rxLength == 1 && !(rxPayload[0] & ~lightAll) && TCCR1B != 0;
+    if (cmdApplied) {
+      stimulusLights = lightMaskOf(rxPayload[0]);
+      stimulusFrame = frameCounter;
+      cmdTicks = triggerClock();
+    }
+  }
+  else if (rxType == cmdStartRecAt) {
+    cmdMicros = micros();
+  }
+  cmdLength = rxLength;
+  cmdSeq = rxSeq;
+  cmdType = rxType;
+  memcpy(cmdPayload, rxPayload, rxLength);
+  commandPending = true;
+}
+
+unsigned int txCrc = 0;
+
+void writeFrameByte(byte value) {
+  uartWrite(value);
+  txCrc = _crc_xmodem_update(txCrc, value);
+}
+
+/**
+ * Start sending a frame; continue with `writeFrameByte()` for the payload and finish
+ * with `endFrame()`.
+ */
+void beginFrame(byte type, byte seq, byte length) {
+  uartWrite(frameStart);
+  txCrc = 0xFFFF;
+  writeFrameByte(length);
+  writeFrameByte(seq);
+  writeFrameByte(type);
+}
+
+void endFrame() {
+  unsigned int crc = txCrc;
+  uartWrite((byte)(crc >> 8));
+  uartWrite((byte)crc);
+}
+
+void sendFrame(byte type, byte seq, const byte* payload, byte length) {
+  beginFrame(type, seq, length);
+  for (byte i = 0; i < length; ++i) {
+    writeFrameByte(payload[i]);
+  }
+  endFrame();
+}
+
+/**
+ * Reply to the pending command.
+ */
+void sendReply(byte type) {
+  sendFrame(type, cmdSeq, 0, 0);
+}
+
+void sendReply(byte type, byte value) {
+  sendFrame(type, cmdSeq, &value, 1);
+}
+
+/**
+ * Store `value` at `buf` as 32-bit word in network byte order.
+ */
+void putLong(byte* buf, unsigned long value) {
+  buf[0] = (byte)(value >> 24);
+  buf[1] = (byte)(value >> 16);
+  buf[2] = (byte)(value >> 8);
+  buf[3] = (byte)value;
+}
+
+/**
+ * Read a 32-bit word in network byte order from `buf`.
+ */
+unsigned long getLong(const byte* buf) {
+  return ((unsigned long)word(buf[0], buf[1]) << 16) | word(buf[2], buf[3]);
+}
+
+/**
+ * Send a batch of trigger edge timestamps from the ring buffer to the client (see
+ * *Trigger telemetry* above). Unless `force` is `true`, edges are only sent once a full
+ * batch is available or the oldest edge waited for more than `telemetryMaxAge` cycles.
+ */
+void sendTelemetry(bool force) {
+  byte tail = edgeTail;
+  byte count = (edgeHead - tail) & (telemetryBufferSize - 1);
+  noInterrupts();
+  unsigned long index = edgeTailIndex;
+  interrupts();
+  if (rateChanged && index >= rateChangeIndex) {
+    // All edges at the previous rate were sent.
+    framePeriodTicks = changedFramePeriodTicks;
+    rateChanged = false;
+  }
+  if (count == 0) {
+    return;
+  }
+  if (count < telemetryBatchSize && !force) {
+    noInterrupts();
+    unsigned long now = triggerClock();
+    interrupts();
+    if (now - edgeTicks[tail] < telemetryMaxAge) {
+      return;
+    }
+  }
+  if (count > telemetryBatchSize) {
+    count = telemetryBatchSize;
+  }
+
+  if (rateChanged && index + count > rateChangeIndex) {
+    count = rateChangeIndex - index;  // End the batch at the rate change.
+  }
+
+  // The payload is built first, as its length precedes it in the frame.
+  byte payload[maxTelemetryPayload];
+  byte length = 13;
+  unsigned long prevTicks = edgeTicks[tail];
+  payload[0] = count;
+  putLong(payload + 1, index);
+  putLong(payload + 5, prevTicks);
+  putLong(payload + 9, framePeriodTicks);
+  for (byte i = 1; i < count; ++i) {
+    unsigned long ticks = edgeTicks[(tail + i) & (telemetryBufferSize - 1)];
+    long deviation = (long)(ticks - prevTicks - framePeriodTicks);
+    unsigned long zigzag = ((unsigned long)deviation << 1) ^ (unsigned long)(deviation >> 31);
+    while (zigzag >= 0x80) {
+      payload[length++] = (byte)(zigzag | 0x80);
+      zigzag >>= 7;
+    }
+    payload[length++] = (byte)zigzag;
+    prevTicks = ticks;
+  }
+  sendFrame(evtTelemetry, eventSeq++, payload, length);
+
+  // Update the index before releasing the buffer entries to the interrupt routine,
+  // which may overwrite `edgeTailIndex` once the buffer ran empty.
+  noInterrupts();
+  edgeTailIndex = index + count;
+  interrupts();
+  edgeTail = (tail + count) & (telemetryBufferSize - 1);
+}
+
+/**
+ * Whether the client may switch the serial link to `rate` baud. Only rates that can be
+ * generated (almost) exactly from the 16 MHz CPU clock are accepted.
+ */
+bool isValidBaudrate(unsigned long rate) {
+  return rate == 115200 || rate == 500000 || rate == 1000000 || rate == 2000000;
+}
+
+/**
+ * Set the light pattern from the `length` masks of `light...` flags at `pattern`; without
+ * masks, all white LEDs are on for all frames.
+ * Returns `false` if the pattern is too long or contains unknown flags.
+ */
+bool setLightPattern(const byte* pattern, byte length) {
+  if (length == 0) {
+    lightPattern[0] = WhiteLeds::mask;
+    lightPatternLength = 1;
+    return true;
+  }
+  if (length > maxLightPattern) {
+    return false;
+  }
+  for (byte i = 0; i < length; ++i) {
+    if (pattern[i] & ~lightAll) {
+      return false;
+    }
+    lightPattern[i] = lightMaskOf(pattern[i]);
+  }
+  lightPatternLength = length;
+  return true;
+}
+
+/**
+ * Set the LED strobe to `widthUs` microseconds starting `offsetUs` microseconds after each
+ * trigger edge, or disable it if `widthUs` is 0.
+ * Returns `false` if the strobe does not end within the first segment of a frame at
+ * `frameRate` mHz (see *LED strobe* above).
+ */
+bool setStrobe(unsigned int offsetUs, unsigned int widthUs, unsigned long frameRate) {
+  if (widthUs == 0) {
+    strobeOnTicks = 0;
+    strobeOffTicks = 0;
+    return offsetUs == 0;
+  }
+  unsigned long offTicks = ((unsigned long)offsetUs + widthUs) * (F_CPU / 1000000);
+  if (!fitsFirstSegment(offTicks, frameRate)) {
+    return false;
+  }
+  strobeOnTicks = offsetUs * (F_CPU / 1000000);
+  strobeOffTicks = offTicks;
+  return true;
+}
+
+/**
+ * Set the phase of the auxiliary trigger output from the `length` bytes at `payload` (see
+ * `cmdSetTriggers`).
+ * Returns `false` if the payload is malformed.
+ */
+bool setTriggers(const byte* payload, byte length) {
+  if (length != 0 && length != 2) {
+    return false;
+  }
+  auxTriggerEnabled = length == 2;
+  auxTriggerPhase = auxTriggerEnabled ? word(payload[0], payload[1]) : 0;
+  return true;
+}
+
+/**
+ * Return whether the pulses of the auxiliary trigger output end within the first segment
+ * of a frame at `frameRate` mHz (see *Camera trigger timing* above).
+ */
+bool auxTriggerFits(unsigned long frameRate) {
+  return !auxTriggerEnabled || auxTriggerPhase == 0 ||
+         fitsFirstSegment(((unsigned long)auxTriggerPhase + triggerSignalLen) * (F_CPU / 1000000), frameRate);
+}
+
+/**
+ * Change the frame rate of the running recording to `frameRate` mHz at the next frame (see
+ * *Camera trigger timing* above).
+ * Returns `false` if the recording is being stopped, i.e., triggering was stopped by a stop
+ * command received meanwhile (see `ISR(USART_RX_vect)`), which is replied next.
+ */
+bool changeRate(unsigned long frameRate) {
+  // Send the telemetry of the previous change first, which still uses its old period.
+  while (rateChanged && TCCR1B != 0) {
+    sendTelemetry(true);
+  }
+  if (TCCR1B == 0) {
+    return false;
+  }
+  TriggerRate rate = triggerRateOf(frameRate);
+  noInterrupts();
+  pendingRate = rate;
+  changedFramePeriodTicks = rate.periodTicks;
+  rateUpdatePending = true;
+  interrupts();
+  return true;
+}
+
+/**
+ * Start a recording at `frameRate` mHz with the light pattern and strobe set before.
+ */
+void startRecording(unsigned long frameRate) {
+  isRecording = true;
+
+  // Trigger camera from Timer1 interrupts; see *Camera trigger timing* above.
+  startTrigger(frameRate);
+}
+
+/**
+ * Start a recording at `frameRate` mHz `delayUs` microseconds after `cmdMicros` (see
+ * *Camera trigger timing* above); the trigger is started by `checkScheduledStart()`.
+ */
+void scheduleRecording(unsigned long frameRate, unsigned long delayUs) {
+  isRecording = true;
+  startScheduled = true;
+  scheduledStartMicros = cmdMicros;
+  scheduledStartDelay = delayUs;
+  scheduledFrameRate = frameRate;
+  // Counters reported if the recording is stopped before it started.
+  frameCounter = 0;
+  lastEdgeTicks = 0;
+}
+
+/**
+ * Start the scheduled recording once its start time has come. A command received meanwhile
+ * (e.g., a stop command) is executed first.
+ */
+void checkScheduledStart() {
+  if (startScheduled && !commandPending && micros() - scheduledStartMicros >= scheduledStartDelay) {
+    startScheduled = false;
+    startTrigger(scheduledFrameRate);
+  }
+}
+
+/**
+ * Stop the running (or scheduled) recording and send the timestamps of all remaining
+ * trigger edges.
+ */
+void stopRecording() {
+  stopTrigger();
+  isRecording = false;
+  startScheduled = false;
+
+  while (edgeHead != edgeTail) {
+    sendTelemetry(true);
+  }
+}
+
+/**
+ * Execute the pending command and reply to it.
+ */
+void handleCommand() {
+  switch (cmdType) {
+  case cmdPing:
+    sendReply(rspAck, isRecording ? 1 : 0);
+    break;
+
+  case cmdStartRec:
+  case cmdStartRecAt: {
+    // The payload of `cmdStartRecAt` is that of `cmdStartRec` preceded by the delay.
+    byte skip = cmdType == cmdStartRecAt ? 4 : 0;
+    byte length = cmdLength - skip;
+    const byte* payload = cmdPayload + skip;
+    if (cmdLength < skip || (length != 4 && length < 8)) {
+      sendReply(rspNak, nakBadPayload);
+      break;
+    }
+    unsigned long delayUs = skip ? getLong(cmdPayload) : 0;
+    unsigned long frameRate = getLong(payload);
+    unsigned int strobeOffset = length > 4 ? word(payload[4], payload[5]) : 0;
+    unsigned int strobeWidth = length > 4 ? word(payload[6], payload[7]) : 0;
+    byte patternLength = length > 4 ? length - 8 : 0;
+    if (isRecording) {
+      sendReply(rspNak, nakInvalidState);
+    }
+    else if (!isValidFrameRate(frameRate) || delayUs > maxStartDelay || !auxTriggerFits(frameRate) ||
+             !setStrobe(strobeOffset, strobeWidth, frameRate) || !setLightPattern(payload + 8, patternLength)) {
+      sendReply(rspNak, nakBadPayload);
+    }
+    else {
+      // Reply first, so that the reply precedes all telemetry of the recording.
+      sendReply(rspAck);
+      if (skip) {
+        scheduleRecording(frameRate, delayUs);
+      }
+      else {
+        startRecording(frameRate);
+      }
+    }
+    break;
+  }
+
+  case cmdSetTriggers:
+    if (isRecording) {
+      sendReply(rspNak, nakInvalidState);
+    }
+    else if (!setTriggers(cmdPayload, cmdLength)) {
+      sendReply(rspNak, nakBadPayload);
+    }
+    else {
+      sendReply(rspAck);
+    }
+    break;
+
+  case cmdStopRec: {
+    // Triggering was already stopped by the receive interrupt.
+    if (isRecording) {
+      stopRecording();
+    }
+    // Counters of the last recording (zero if none since reset).
+    byte payload[8];
+    putLong(payload, frameCounter);
+    putLong(payload + 4, lastEdgeTicks);
+    sendFrame(rspAck, cmdSeq, payload, sizeof(payload));
+    break;
+  }
+
+  case cmdSetRate: {
+    unsigned long frameRate = cmdLength == 4 ? getLong(cmdPayload) : 0;
+    if (!isValidFrameRate(frameRate)) {
+      sendReply(rspNak, nakBadPayload);
+    }
+    else if (!isRecording) {
+      sendReply(rspNak, nakInvalidState);
+    }
+    else if ((strobeOffTicks != 0 && !fitsFirstSegment(strobeOffTicks, frameRate)) || !auxTriggerFits(frameRate)) {
+      sendReply(rspNak, nakBadPayload);
+    }
+    else if (startScheduled) {
+      scheduledFrameRate = frameRate;  // Not started yet; start at the new rate.
+      sendReply(rspAck);
+    }
+    else if (!changeRate(frameRate)) {
+      sendReply(rspNak, nakInvalidState);
+    }
+    else {
+      sendReply(rspAck);
+    }
+    break;
+  }
+
+  case cmdSync:
+    if (!isRecording || TCCR1B == 0) {
+      // The trigger clock only runs while recording (and was stopped by a stop command
+      // received meanwhile).
+      sendReply(rspNak, nakInvalidState);
+    }
+    else {
+      byte payload[4];
+      putLong(payload, cmdTicks);
+      sendFrame(rspAck, cmdSeq, payload, sizeof(payload));
+    }
+    break;
+
+  case cmdSetStimulus:
+    // Already applied by the receive interrupt, if valid.
+    if (cmdLength != 1 || (cmdPayload[0] & ~lightAll)) {
+      sendReply(rspNak, nakBadPayload);
+    }
+    else if (!cmdApplied) {
+      sendReply(rspNak, nakInvalidState);
+    }
+    else {
+      byte payload[8];
+      putLong(payload, stimulusFrame);
+      putLong(payload + 4, cmdTicks);
+      sendFrame(rspAck, cmdSeq, payload, sizeof(payload));
+    }
+    break;
+
+  case cmdIdentify: {
+    byte payload[11] = { 'K', 'W', 'A', firmwareVersionMajor, firmwareVersionMinor };
+    putLong(payload + 5, deviceId);
+    payload[9] = highByte(capabilities);
+    payload[10] = lowByte(capabilities);
+    sendFrame(rspAck, cmdSeq, payload, sizeof(payload));
+    break;
+  }
+
+  case cmdSetBaudrate: {
+    unsigned long rate = cmdLength == 4 ? getLong(cmdPayload) : 0;
+    if (!isValidBaudrate(rate)) {
+      sendReply(rspNak, nakBadPayload);
+    }
+    else if (isRecording) {
+      // The fallback timeout relies on `millis()`, which is disabled while recording.
+      sendReply(rspNak, nakInvalidState);
+    }
+    else {
+      sendReply(rspAck);  // Sent at the old baudrate.
+      uartBegin(rate);
+      baudrateUnconfirmed = rate != baudrate;
+      baudrateChangeMillis = millis();
+    }
+    break;
+  }
+
+  default:
+    sendReply(rspNak, nakUnknownCommand);
+    break;
+  }
+}
+
+/**
+ * Fall back to the default baudrate if the client did not send a valid frame at the
+ * baudrate it requested (e.g., because its serial port does not support it).
+ */
+void checkBaudrate() {
+  if (baudrateUnconfirmed && millis() - baudrateChangeMillis >= baudrateConfirmTimeout) {
+    uartBegin(baudrate);
+    baudrateUnconfirmed = false;
+  }
+}
+
+/**
+ * Read the device ID from the EEPROM. On the first startup (erased EEPROM), draw a new one
+ * from the least significant bits of the ADC on the (unconnected) analog pins, which are
+ * noisy, and store it.
+ */
+void loadDeviceId() {
+  deviceId = eeprom_read_dword(deviceIdAddress);
+  while (deviceId == 0 || deviceId == 0xFFFFFFFFUL) {
+    for (byte i = 0; i < 64; i++) {
+      deviceId = (deviceId << 1 | deviceId >> 31) ^ analogRead(A0 + i % 6) ^ micros();
+    }
+  }
+  if (eeprom_read_dword(deviceIdAddress) != deviceId) {
+    eeprom_write_dword(deviceIdAddress, deviceId);
+  }
+}
+
+// The setup function runs once when the board is powered on or reset
+void setup() {
+  loadDeviceId();
+
+  // Initialize serial communication at `baudrate` bits per second
+  uartBegin(baudrate);
+
+  // Initialize LEDs and Basler HW-trigger pins to low (i.e., lights and cam trigger off)
+  // before switching them to output, so that they never go high.
+  AllLeds::low();
+  TriggerPin::low();
+  AuxTriggerPin::low();
+  AllLeds::output();
+  TriggerPin::output();
+  AuxTriggerPin::output();
+
+  // Signal that Arduino is ready for commands.
+  sendFrame(evtReady, eventSeq++, 0, 0);
+}
+
+
+// The loop function runs over and over again, forever
+void loop() {
+  // Commands are received by the UART receive interrupt; execute them here.
+  if (commandPending) {
+    handleCommand();
+    noInterrupts();
+    if (stopPending) {
+      // Execute the stop command received meanwhile next.
+      stopPending = false;
+      cmdType = cmdStopRec;
+      cmdSeq = stopSeq;
+      cmdLength = 0;
+    }
+    else {
+      commandPending = false;
+    }
+    interrupts();
+  }
+
+  if (isRecording) {
+    checkScheduledStart();
+    sendTelemetry(false);
+  }
+  else {
+    checkBaudrate();
+  }
 }
@@ -0,0 +1,240 @@
+/**
+ * Streaming gait analysis of predicted poses: smooths the positions of each bodypart and
+ * fills short gaps (see `PoseFilter`), and finds the stance and swing phases and the strides
+ * of the paws (see `GaitDetector`). Poses are read frame by frame in constant memory, and
+ * recordings are analyzed in parallel. kwa-pose runs the same analysis while it predicts
+ * with --gait.
+ *
+ * Usage:
+ *
+ *   kwa-gait [options] <pose file or folder>...
+ *       Analyze each pose store (*.kwapose, written by kwa-pose) or DLC CSV file (*DLC*.csv,
+ *       e.g., of `inference.py predict`) and write the filtered poses to
+ *       <name>_filtered.kwapose and the strides of the paws to <name>_steps.csv (paw,
+ *       frames of touchdown, liftoff, and the next touchdown, stride and stance duration,
+ *       duty factor, cadence, and stride length in pixels), next to the file.
+ *
+ * Options:
+ *   -c, --config <config.yaml>  DLC project to take pcutoff from (default: 0.6)
+ *   --fps <rate>                Frame rate of recordings without trigger times (default: 720)
+ *   --direction <left|right>    Running direction in the side profile view (default: right)
+ *   --swing-speed <px/s>        Forward speed above which a paw swings (default: 50)
+ *   --max-gap <frames>          Longest gap to interpolate (default: 10)
+ *   -t, --threads <n>           Recordings analyzed at a time (default: one per hardware thread)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DlcConfig.h"
+#include "GaitAnalysis.h"
+#include "PoseCsv.h"
+#include "PoseStore.h"
+#include "ThreadPool.h"
+
+using namespace KwaInference;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+	// The camera's default frame rate (KWA-Controller).
+	const double DEFAULT_FPS = 720.0;
+	// Frames read from a pose store at a time.
+	const int64_t READ_FRAMES = 4096;
+
+	void PrintUsage() {
+		std::fprintf(stderr,
+			"Usage:\n"
+			"  kwa-gait [options] <pose file or folder>...\n"
+			"Options:\n"
+			"  -c, --config <config.yaml>  DLC project to take pcutoff from (default: 0.6)\n"
+			"  --fps <rate>                Frame rate of recordings without trigger times (default: 720)\n"
+			"  --direction <left|right>    Running direction in the side profile view (default: right)\n"
+			"  --swing-speed <px/s>        Forward speed above which a paw swings (default: 50)\n"
+			"  --max-gap <frames>          Longest gap to interpolate (default: 10)\n"
+			"  -t, --threads <n>           Recordings analyzed at a time (default: one per hardware thread)\n");
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/// <summary>
+	/// Pose files of kwa-pose or DLC; not the results of kwa-gait itself.
+	/// </summary>
+	bool IsPoseFile(const fs::path& path) {
+		std::string stem = path.stem().string();
+		if (stem.size() >= 9 && stem.compare(stem.size() - 9, 9, "_filtered") == 0) {
+			return false;
+		}
+		return path.extension() == ".kwapose" || (path.extension() == ".csv" && stem.find("DLC") != std::string::npos
+			&& !(stem.size() >= 6 && stem.compare(stem.size() - 6, 6, "_steps") == 0));
+	}
+
+	struct Result {
+		bool succeeded;
+		int64_t frameCount;
+		std::string message;
+	};
+
+	Result Analyze(const fs::path& path, double fps, const GaitSettings& settings) {
+		Result result = { false, 0, std::string() };
+		std::string basePath = (path.parent_path() / path.stem()).string();
+		GaitAnalyzer analyzer;
+		std::vector<float> poses;
+		bool ok = true;
+		if (path.extension() == ".kwapose") {
+			PoseStoreReader store;
+			if (!store.Open(path.string())) {
+				result.message = store.LastError();
+				return result;
+			}
+			if (!analyzer.Open(basePath, store.Scorer(), store.Bodyparts(), store.HasTimestamps(), fps, settings)) {
+				result.message = analyzer.LastError();
+				return result;
+			}
+			std::vector<double> times;
+			for (int64_t first = 0; first < store.FrameCount() && ok; first += READ_FRAMES) {
+				int64_t count = std::min(READ_FRAMES, store.FrameCount() - first);
+				store.ReadPoses(first, count, poses);
+				times.resize(static_cast<size_t>(count));
+				for (int64_t i = 0; i < count; i++) {
+					times[static_cast<size_t>(i)] = store.Timestamp(first + i);
+				}
+				ok = analyzer.Write(poses, count, 0.0f, 0.0f, times.data());
+				result.frameCount += count;
+			}
+		}
+		else {
+			PoseCsvReader csv;
+			if (!csv.Open(path.string())) {
+				result.message = "Cannot read " + path.string() + " as DLC CSV file.";
+				return result;
+			}
+			if (!analyzer.Open(basePath, csv.Scorer(), csv.Bodyparts(), false, fps, settings)) {
+				result.message = analyzer.LastError();
+				return result;
+			}
+			while (ok && csv.Read(poses)) {
+				ok = analyzer.Write(poses, 1);
+				result.frameCount++;
+			}
+		}
+		if (!analyzer.Close() || !ok) {
+			result.message = analyzer.LastError();
+			return result;
+		}
+		result.succeeded = true;
+		result.message = path.string() + ": " + std::to_string(result.frameCount) + " frames";
+		for (const GaitSummary& paw : analyzer.Summary()) {
+			char text[160];
+			std::snprintf(text, sizeof(text), "\n  %-8s %6lld strides, %5.2f Hz, %6.1f px, duty factor %.2f", paw.paw.c_str(),
+				static_cast<long long>(paw.strides), paw.cadence, paw.strideLength, paw.dutyFactor);
+			result.message += text;
+		}
+		return result;
+	}
+}
+
+
+int main(int argc, char* argv[]) {
+	std::string configPath;
+	std::vector<std::string> fileArgs;
+	GaitSettings settings;
+	double fps = DEFAULT_FPS;
+	size_t threads = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if ((arg == "-c" || arg == "--config") && hasValue) {
+			configPath = argv[++i];
+		}
+		else if (arg == "--fps" && hasValue) {
+			fps = std::atof(argv[++i]);
+		}
+		else if (arg == "--direction" && hasValue) {
+			std::string direction = argv[++i];
+			if (direction != "left" && direction != "right") {
+				PrintUsage();
+				return 2;
+			}
+			settings.direction = direction == "right" ? 1 : -1;
+		}
+		else if (arg == "--swing-speed" && hasValue) {
+			settings.swingSpeed = std::atof(argv[++i]);
+		}
+		else if (arg == "--max-gap" && hasValue) {
+			settings.maxGap = std::max(0, std::atoi(argv[++i]));
+		}
+		else if ((arg == "-t" || arg == "--threads") && hasValue) {
+			threads = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+		}
+		else if (!arg.empty() && arg[0] != '-') {
+			fileArgs.push_back(arg);
+		}
+		else {
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (fileArgs.empty() || fps <= 0.0) {
+		PrintUsage();
+		return 2;
+	}
+	if (!configPath.empty()) {
+		YamlFile config;
+		if (!config.Load(configPath)) {
+			std::fprintf(stderr, "Cannot read %s.\n", configPath.c_str());
+			return 1;
+		}
+		settings.pcutoff = config.GetNumber("pcutoff", settings.pcutoff);
+	}
+
+	std::vector<fs::path> files;
+	for (const std::string& arg : fileArgs) {
+		std::error_code error;
+		if (!fs::is_directory(arg, error)) {
+			files.push_back(arg);
+			continue;
+		}
+		std::vector<fs::path> found;
+		for (const fs::directory_entry& entry : fs::directory_iterator(arg, error)) {
+			if (IsPoseFile(entry.path())) {
+				found.push_back(entry.path());
+			}
+		}
+		std::sort(found.begin(), found.end());
+		files.insert(files.end(), found.begin(), found.end());
+	}
+	if (files.empty()) {
+		std::fprintf(stderr, "No pose files found.\n");
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	ThreadPool pool(std::min(threads > 0 ? threads : static_cast<size_t>(std::thread::hardware_concurrency()), files.size()));
+	std::vector<Result> results(files.size());
+	pool.ParallelFor(files.size(), [&](size_t index, size_t) {
+		results[index] = Analyze(files[index], fps, settings);
+		std::fprintf(results[index].succeeded ? stdout : stderr, "%s\n", results[index].message.c_str());
+		std::fflush(stdout);
+	});
+	int failures = 0;
+	int64_t frames = 0;
+	for (const Result& result : results) {
+		failures += result.succeeded ? 0 : 1;
+		frames += result.frameCount;
+	}
+	double elapsed = SecondsSince(start);
+	std::printf("%lld frames of %zu recordings in %.2f s (%.0f frames/s)\n", static_cast<long long>(frames), files.size(),
+		elapsed, elapsed > 0.0 ? frames / elapsed : 0.0);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+/**
+ * Native rendering of labeled videos: the counterpart of `inference.py label` (DLC's
+ * create_labeled_video) for the pose stores written by kwa-pose. Frames are decoded by
+ * ffmpeg on one thread, labeled on a pool of threads a group of frames at a time, and
+ * handed to ffmpeg for encoding in order on another thread, so that the three stages run
+ * concurrently.
+ *
+ * Usage:
+ *
+ *   kwa-label -c <config.yaml> [options] <video>...
+ *       Draw the bodyparts predicted for each video, read from its pose store
+ *       (<video name><scorer>.kwapose next to the video), as markers of dotsize, alphavalue,
+ *       and colormap in config.yaml, where the likelihood is at least pcutoff, and write
+ *       <video name><scorer>_labeled.mp4 next to the video.
+ *
+ * Options:
+ *   -s, --store <file.kwapose>  Pose store (default: the one next to the video); one video only
+ *   -o, --output <file.mp4>     Labeled video (default: see above); one video only
+ *   --start <frame>             First frame to render (default: 0)
+ *   --end <frame>               Frame to stop before (default: the end of the video)
+ *   --step <n>                  Render every n-th frame only, e.g., for a quick preview
+ *                               (default: 1); played at the video's frame rate / n
+ *   --fps <rate>                Frame rate of the labeled video
+ *   -t, --threads <n>           Threads drawing labels (default: one per hardware thread)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BatchQueue.h"
+#include "DlcConfig.h"
+#include "LabelRenderer.h"
+#include "PoseStore.h"
+#include "ThreadPool.h"
+#include "VideoReader.h"
+#include "VideoWriter.h"
+
+using namespace KwaInference;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+	// Groups of frames in flight between decoding, labeling, and encoding.
+	const size_t QUEUED_GROUPS = 3;
+	// Frames per group and thread, so that each loop over a group keeps all threads busy.
+	const size_t GROUP_FRAMES_PER_THREAD = 4;
+	const double PROGRESS_INTERVAL_S = 2.0;
+
+	void PrintUsage() {
+		std::fprintf(stderr,
+			"Usage:\n"
+			"  kwa-label -c <config.yaml> [options] <video>...\n"
+			"Options:\n"
+			"  -s, --store <file.kwapose>  Pose store (default: the one next to the video)\n"
+			"  -o, --output <file.mp4>     Labeled video (default: <video name><scorer>_labeled.mp4)\n"
+			"  --start <frame>             First frame to render (default: 0)\n"
+			"  --end <frame>               Frame to stop before (default: the end of the video)\n"
+			"  --step <n>                  Render every n-th frame only (default: 1)\n"
+			"  --fps <rate>                Frame rate of the labeled video (default: the video's / step)\n"
+			"  -t, --threads <n>           Threads drawing labels (default: one per hardware thread)\n");
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/// <summary>
+	/// Frames to render: [start, end) in steps of <c>step</c>, played at <c>fps</c>.
+	/// </summary>
+	struct RenderRange {
+		int64_t start;
+		int64_t end;   // -1: the end of the video.
+		int step;
+		double fps;    // 0: the video's frame rate / step.
+	};
+
+	/// <summary>
+	/// Consecutive rendered frames, the first of which is the <c>firstIndex</c>-th rendered one.
+	/// </summary>
+	struct FrameGroup {
+		std::vector<uint8_t> pixels;
+		int64_t firstIndex;
+		int64_t frameCount;  // 0: the end.
+
+		FrameGroup() : firstIndex(0), frameCount(0) {
+		}
+	};
+
+	/// <summary>
+	/// The pose store next to <c>videoPath</c>: &lt;video name&gt;&lt;scorer&gt;.kwapose.
+	/// </summary>
+	std::string FindStore(const fs::path& videoPath) {
+		std::string stem = videoPath.stem().string();
+		std::vector<fs::path> found;
+		std::error_code error;
+		for (const fs::directory_entry& entry : fs::directory_iterator(videoPath.parent_path().empty() ? "." : videoPath.parent_path(), error)) {
+			std::string name = entry.path().filename().string();
+			if (entry.path().extension() == ".kwapose" && name.compare(0, stem.size() + 3, stem + "DLC") == 0) {
+				found.push_back(entry.path());
+			}
+		}
+		if (found.size() != 1) {
+			std::fprintf(stderr, found.empty() ? "No pose store %s<scorer>.kwapose found; analyze the video with kwa-pose first.\n"
+				: "Several pose stores %s<scorer>.kwapose found; select one with -s.\n", (videoPath.parent_path() / stem).string().c_str());
+			return std::string();
+		}
+		return found[0].string();
+	}
+
+	bool RenderVideo(ThreadPool& pool, const YamlFile& config, const fs::path& videoPath, std::string storePath,
+		std::string outputPath, const RenderRange& range) {
+		if (storePath.empty() && (storePath = FindStore(videoPath)).empty()) {
+			return false;
+		}
+		PoseStoreReader store;
+		if (!store.Open(storePath)) {
+			std::fprintf(stderr, "%s\n", store.LastError().c_str());
+			return false;
+		}
+		LabelStyle style;
+		if (!style.Load(config, store.Bodyparts().size())) {
+			std::fprintf(stderr, "Colormap %s is not supported; using rainbow.\n", config.Get("colormap").c_str());
+		}
+		LabelRenderer renderer(style);
+
+		VideoReader reader;
+		if (!reader.Open(videoPath.string(), PixelFormat::Rgb8, range.start, range.step)) {
+			std::fprintf(stderr, "%s\n", reader.LastError().c_str());
+			return false;
+		}
+		const VideoInfo& info = reader.Info();
+		int64_t end = range.end >= 0 ? range.end : (info.frameCount >= 0 ? info.frameCount : INT64_MAX);
+		int64_t frameLimit = end > range.start ? (end - range.start + range.step - 1) / range.step : 0;
+		double fps = range.fps > 0.0 ? range.fps : info.fps / range.step;
+
+		if (outputPath.empty()) {
+			std::string name = videoPath.stem().string() + store.Scorer() + "_labeled";
+			if (range.start > 0 || range.end >= 0) {
+				name += "_" + std::to_string(range.start) + "-" + (range.end >= 0 ? std::to_string(range.end) : std::string());
+			}
+			if (range.step > 1) {
+				name += "_step" + std::to_string(range.step);
+			}
+			outputPath = (videoPath.parent_path() / (name + ".mp4")).string();
+		}
+		VideoWriter writer;
+		if (!writer.Open(outputPath, info.width, info.height, fps)) {
+			std::fprintf(stderr, "%s\n", writer.LastError().c_str());
+			return false;
+		}
+		std::printf("%s: %dx%d, %.2f fps, labels from %s\n", videoPath.string().c_str(), info.width, info.height, info.fps,
+			storePath.c_str());
+		std::fflush(stdout);
+
+		// Decoding thread -> decoded -> labeling (this thread) -> labeled -> encoding thread,
+		// which releases the groups back to decoded.
+		size_t groupFrames = GROUP_FRAMES_PER_THREAD * pool.Size();
+		BatchQueue<FrameGroup> decoded;
+		BatchQueue<FrameGroup> labeled;
+		for (size_t i = 0; i < QUEUED_GROUPS; i++) {
+			FrameGroup group;
+			group.pixels.resize(groupFrames * reader.FrameSize());
+			decoded.Release(std::move(group));
+		}
+		std::thread decoding([&] {
+			int64_t index = 0;
+			bool more = true;
+			while (more) {
+				FrameGroup group;
+				if (!decoded.Acquire(group)) {
+					decoded.Push(FrameGroup());
+					return;
+				}
+				group.firstIndex = index;
+				group.frameCount = 0;
+				while (group.frameCount < static_cast<int64_t>(groupFrames) && (more = index < frameLimit)
+					&& (more = reader.Read(group.pixels.data() + group.frameCount * reader.FrameSize()))) {
+					group.frameCount++;
+					index++;
+				}
+				bool last = group.frameCount == 0;
+				decoded.Push(std::move(group));
+				if (!last && !more) {
+					decoded.Push(FrameGroup());
+				}
+			}
+		});
+		bool encoded = true;
+		int64_t written = 0;
+		std::thread encoding([&] {
+			for (;;) {
+				FrameGroup group;
+				labeled.Pop(group);
+				if (group.frameCount == 0) {
+					return;
+				}
+				for (int64_t i = 0; i < group.frameCount && encoded; i++) {
+					encoded = writer.Write(group.pixels.data() + i * reader.FrameSize());
+				}
+				written += encoded ? group.frameCount : 0;
+				if (!encoded) {
+					decoded.Stop();
+				}
+				decoded.Release(std::move(group));
+			}
+		});
+
+		std::vector<std::vector<float>> poses(pool.Size());
+		auto start = std::chrono::steady_clock::now();
+		double lastProgress = 0.0;
+		int64_t labeledFrames = 0;
+		for (;;) {
+			FrameGroup group;
+			decoded.Pop(group);
+			if (group.frameCount == 0) {
+				labeled.Push(std::move(group));
+				break;
+			}
+			pool.ParallelFor(static_cast<size_t>(group.frameCount), [&](size_t i, size_t thread) {
+				int64_t frame = range.start + (group.firstIndex + static_cast<int64_t>(i)) * range.step;
+				if (store.ReadPoses(frame, 1, poses[thread])) {
+					renderer.Draw(group.pixels.data() + i * reader.FrameSize(), info.width, info.height, poses[thread].data());
+				}
+			});
+			labeledFrames += group.frameCount;
+			labeled.Push(std::move(group));
+			double elapsed = SecondsSince(start);
+			if (elapsed - lastProgress >= PROGRESS_INTERVAL_S) {
+				lastProgress = elapsed;
+				std::fprintf(stderr, "  %lld frames, %.1f fps\n", static_cast<long long>(labeledFrames), labeledFrames / elapsed);
+			}
+		}
+		decoding.join();
+		encoding.join();
+		reader.Close();
+		if (!writer.Close() || !encoded) {
+			std::fprintf(stderr, "%s\n", writer.LastError().c_str());
+			return false;
+		}
+		double elapsed = SecondsSince(start);
+		std::printf("  %lld frames in %.2f s (%.1f fps) -> %s\n", static_cast<long long>(written), elapsed,
+			elapsed > 0.0 ? written / elapsed : 0.0, outputPath.c_str());
+		std::fflush(stdout);
+		return true;
+	}
+}
+
+
+int main(int argc, char* argv[]) {
+	std::string configPath;
+	std::string storePath;
+	std::string outputPath;
+	std::vector<std::string> videos;
+	RenderRange range = { 0, -1, 1, 0.0 };
+	size_t threads = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if ((arg == "-c" || arg == "--config") && hasValue) {
+			configPath = argv[++i];
+		}
+		else if ((arg == "-s" || arg == "--store") && hasValue) {
+			storePath = argv[++i];
+		}
+		else if ((arg == "-o" || arg == "--output") && hasValue) {
+			outputPath = argv[++i];
+		}
+		else if (arg == "--start" && hasValue) {
+			range.start = std::max(0LL, std::atoll(argv[++i]));
+		}
+		else if (arg == "--end" && hasValue) {
+			range.end = std::max(0LL, std::atoll(argv[++i]));
+		}
+		else if (arg == "--step" && hasValue) {
+			range.step = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--fps" && hasValue) {
+			range.fps = std::atof(argv[++i]);
+		}
+		else if ((arg == "-t" || arg == "--threads") && hasValue) {
+			threads = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+		}
+		else if (!arg.empty() && arg[0] != '-') {
+			videos.push_back(arg);
+		}
+		else {
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (configPath.empty() || videos.empty()) {
+		PrintUsage();
+		return 2;
+	}
+	if (videos.size() > 1 && (!storePath.empty() || !outputPath.empty())) {
+		std::fprintf(stderr, "A pose store or output file belongs to a single video.\n");
+		return 2;
+	}
+	YamlFile config;
+	if (!config.Load(configPath)) {
+		std::fprintf(stderr, "Cannot read %s.\n", configPath.c_str());
+		return 1;
+	}
+#ifndef _WIN32
+	// A failing encoder closes its pipe; report it instead of being killed.
+	std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+	ThreadPool pool(threads);
+	int failures = 0;
+	for (const std::string& video : videos) {
+		if (!RenderVideo(pool, config, video, storePath, outputPath, range)) {
+			failures++;
+		}
+	}
+	return failures == 0 ? 0 : 1;
+}
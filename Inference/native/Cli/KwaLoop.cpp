@@ -0,0 +1,674 @@
+/**
+ * Closed-loop stimulation: estimates the pose in each frame as it arrives, evaluates a rule on
+ * it (e.g., a paw in a region, or in swing; see `StimulusRule`), and switches stimulus lights
+ * of the Arduino (e.g., the UV LEDs) whenever the rule's result changes. The Arduino switches
+ * them at the next trigger edge after the command (see CMD_SET_STIMULUS), and replies which
+ * frame that is; with the trigger telemetry, the latency of each event is measured on the
+ * Arduino's clock, from the trigger edge of the frame the rule changed in to the stimulus.
+ *
+ * Usage:
+ *
+ *   kwa-loop -c <config.yaml> -p <port> --rule <rule> [options] <video>
+ *       Play back a recorded video as camera: start a recording on the Arduino (or on
+ *       kwa-emulator, e.g., with --latency-us 1000 for the USB link) at the video's frame rate,
+ *       and deliver frame N of the video --camera-delay-us after trigger edge N, as the camera
+ *       would. The network runs on one frame at a time, always the newest: frames that arrive
+ *       while it runs are skipped, so that the latency stays bounded when the network is
+ *       slower than the camera. Each event (stimulus switched on or off) is printed with its
+ *       latency and written to <video name>_stimulus.csv next to the video (columns: event,
+ *       frame, lights, stimulus_frame, latency_frames, trigger_to_stimulus_us,
+ *       trigger_to_receipt_us, pose_us, round_trip_us); finally, the latencies are summarized
+ *       against the --budget.
+ *       <rule> is "region:<bodypart>:<x1>,<y1>,<x2>,<y2>" (pixels of the full frame),
+ *       "stance:<bodypart>", or "swing:<bodypart>" (e.g., "swing:SIDE_PROFILE_VIEW-HL").
+ *
+ * Options:
+ *   -m, --model <file.onnx>      Model to run (default: the exported snapshot selected by
+ *                                snapshotindex in config.yaml)
+ *   --shuffle <n>                Shuffle of the model (default: 1)
+ *   -t, --threads <n>            Threads of the network (default: one per hardware thread)
+ *   -p, --port <port>            Serial port of the Arduino or emulator, "auto", or "id:<device ID>"
+ *   --baud <rate>                Baudrate negotiated with the Arduino (default: 1000000)
+ *   --stimulus <lights>          Lights switched on while the rule holds (default: uv; see
+ *                                `ParseLightPattern()`)
+ *   --lights <pattern>           Light pattern of the recording (default: white)
+ *   --strobe <offset:width>      LED strobe of the recording (default: off)
+ *   --fps <rate>                 Trigger rate (default: the video's frame rate)
+ *   --camera-delay-us <us>       Time from a trigger edge to the frame's arrival, i.e.,
+ *                                exposure, readout, and transfer (default: 1000)
+ *   --frames <n>                 Stop after <n> frames (default: the whole video)
+ *   --budget <frames>            Latency budget in frames (default: 3)
+ *   --gait-direction <left|right>  Running direction for phase rules (default: right)
+ *   -o, --output <file.csv>      Event log (default: <video name>_stimulus.csv)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ArduinoController.h"
+#include "DlcConfig.h"
+#include "FrameConverter.h"
+#include "InferenceEngine.h"
+#include "PoseDecoder.h"
+#include "StimulusRule.h"
+#include "VideoReader.h"
+
+using namespace KwaInference;
+using namespace KwaController;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+	// Time from the start command to the first trigger edge, for the network to warm up.
+	const int64_t START_DELAY_US = 500000;
+	const int DEFAULT_CAMERA_DELAY_US = 1000;
+	const int DEFAULT_BUDGET_FRAMES = 3;
+	const uint64_t UNKNOWN_TICKS = std::numeric_limits<uint64_t>::max();
+
+	std::atomic<bool> interrupted(false);
+
+	void OnInterrupt(int) {
+		interrupted = true;
+	}
+
+	void PrintUsage() {
+		std::fprintf(stderr,
+			"Usage:\n"
+			"  kwa-loop -c <config.yaml> -p <port> --rule <rule> [options] <video>\n"
+			"Rules:\n"
+			"  region:<bodypart>:<x1>,<y1>,<x2>,<y2>, stance:<bodypart>, swing:<bodypart>\n"
+			"Options:\n"
+			"  -m, --model <file.onnx>      Model to run (default: exported snapshot selected by snapshotindex)\n"
+			"  --shuffle <n>                Shuffle of the model (default: 1)\n"
+			"  -t, --threads <n>            Threads of the network (default: one per hardware thread)\n"
+			"  -p, --port <port>            Serial port, \"auto\", or \"id:<device ID>\"\n"
+			"  --baud <rate>                Baudrate negotiated with the Arduino (default: 1000000)\n"
+			"  --stimulus <lights>          Lights switched on while the rule holds (default: uv)\n"
+			"  --lights <pattern>           Light pattern of the recording (default: white)\n"
+			"  --strobe <offset:width>      LED strobe of the recording (default: off)\n"
+			"  --fps <rate>                 Trigger rate (default: the video's frame rate)\n"
+			"  --camera-delay-us <us>       Time from a trigger edge to the frame's arrival (default: 1000)\n"
+			"  --frames <n>                 Stop after <n> frames (default: the whole video)\n"
+			"  --budget <frames>            Latency budget in frames (default: 3)\n"
+			"  --gait-direction <left|right>  Running direction for phase rules (default: right)\n"
+			"  -o, --output <file.csv>      Event log (default: <video name>_stimulus.csv)\n");
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/// <summary>
+	/// The newest frame of the camera, handed from the camera thread to the network: a frame
+	/// not taken before the next one arrives is skipped. Buffers are swapped, not copied.
+	/// </summary>
+	class FrameMailbox {
+	public:
+		FrameMailbox() : index(-1), arrivalUs(0), closed(false) {
+		}
+
+		/// <summary>
+		/// Replace the waiting frame by <c>frame</c>, which receives another buffer of its size.
+		/// </summary>
+		void Publish(int64_t frameIndex, std::vector<uint8_t>& frame, int64_t frameArrivalUs) {
+			size_t size = frame.size();
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->frame.swap(frame);
+				this->index = frameIndex;
+				this->arrivalUs = frameArrivalUs;
+			}
+			this->arrived.notify_one();
+			frame.resize(size);  // Allocates while the first buffers are handed around only.
+		}
+
+		void Close() {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->closed = true;
+			}
+			this->arrived.notify_one();
+		}
+
+		/// <summary>
+		/// Wait for a frame newer than <c>frameIndex</c> and swap it into <c>frame</c>.
+		/// </summary>
+		/// <returns><c>false</c> if no newer frame will arrive.</returns>
+		bool Take(int64_t& frameIndex, std::vector<uint8_t>& frame, int64_t& frameArrivalUs) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->arrived.wait(lock, [&] { return this->index > frameIndex || this->closed; });
+			if (this->index <= frameIndex) {
+				return false;
+			}
+			this->frame.swap(frame);
+			frameIndex = this->index;
+			frameArrivalUs = this->arrivalUs;
+			return true;
+		}
+
+	private:
+		std::mutex mutex;
+		std::condition_variable arrived;
+		std::vector<uint8_t> frame;
+		int64_t index;
+		int64_t arrivalUs;
+		bool closed;
+	};
+
+	/// <summary>
+	/// A switch of the stimulus lights and its latency.
+	/// </summary>
+	struct StimulusEvent {
+		int64_t frame;           // Frame whose pose changed the rule's result.
+		uint8_t lights;          // LIGHT_... mask switched to.
+		double poseUs;           // From the frame's arrival to the command, i.e., conversion, network, and rule.
+		bool replied;
+		bool succeeded;
+		std::string error;
+		StimulusTiming timing;
+		double roundTripUs;
+	};
+
+	/// <summary>
+	/// Replies to stimulus commands, passed from the controller's I/O thread.
+	/// </summary>
+	struct StimulusReplies {
+		std::mutex mutex;
+		std::condition_variable replied;
+		std::deque<StimulusEvent> events;  // In the order of the commands; reported ones are removed.
+		int64_t reported = 0;              // Events removed from `events`.
+		size_t pending = 0;                // Commands not yet replied.
+	};
+
+	/// <summary>
+	/// Layout of the network input (see kwa-pose); frames are run one at a time.
+	/// </summary>
+	struct InputLayout {
+		bool channelsLast;
+		int64_t batch;
+		int64_t height;
+		int64_t width;
+	};
+
+	bool GetInputLayout(const InferenceEngine& engine, InputLayout& layout) {
+		const Shape& shape = engine.Inputs()[0].shape;
+		if (shape.size() != 4 || (shape[3] != 3 && shape[1] != 3)) {
+			std::fprintf(stderr, "The model input %s is not a batch of RGB images.\n", FormatShape(shape).c_str());
+			return false;
+		}
+		layout.channelsLast = shape[3] == 3;
+		// A model exported with a fixed batch size runs full batches; the padding is ignored.
+		layout.batch = shape[0] > 0 ? shape[0] : 1;
+		layout.height = layout.channelsLast ? shape[1] : shape[2];
+		layout.width = layout.channelsLast ? shape[2] : shape[3];
+		return true;
+	}
+
+	/// <summary>
+	/// Connect to the Arduino on <c>port</c>, which may be "auto" or "id:&lt;device ID&gt;" (see kwa-cli).
+	/// </summary>
+	bool ConnectArduino(ArduinoController& controller, const std::string& port, int baudrate) {
+		std::string portName = port == "auto" ? std::string() : port;
+		if (port.compare(0, 3, "id:") == 0) {
+			uint32_t deviceId;
+			DeviceInfo device;
+			DeviceDiscovery discovery;
+			if (!ParseDeviceId(port.substr(3), deviceId) || !discovery.Find(device, deviceId)) {
+				std::fprintf(stderr, "Arduino %s not found.\n", port.c_str());
+				return false;
+			}
+			portName = device.portName;
+		}
+		if (!controller.Connect(portName, baudrate)) {
+			std::fprintf(stderr, "%s\n", controller.LastError().c_str());
+			return false;
+		}
+		if (!controller.Device().Has(CAP_STIMULUS)) {
+			std::fprintf(stderr, "The Arduino on %s does not support stimulus commands; upload the latest sketch.\n",
+				controller.PortName().c_str());
+			return false;
+		}
+		return true;
+	}
+
+	double TicksToUs(int64_t ticks) {
+		return ticks * 1e6 / ARDUINO_CPU_CLOCK_HZ;
+	}
+
+	/// <summary>
+	/// Percentile <c>p</c> (0..1) of <c>values</c>, which are sorted.
+	/// </summary>
+	double Percentile(std::vector<double>& values, double p) {
+		if (values.empty()) {
+			return std::numeric_limits<double>::quiet_NaN();
+		}
+		std::sort(values.begin(), values.end());
+		return values[static_cast<size_t>(p * (values.size() - 1) + 0.5)];
+	}
+}
+
+
+int main(int argc, char* argv[]) {
+	std::string configPath;
+	std::string modelPath;
+	std::string port;
+	std::string ruleText;
+	std::string outputPath;
+	std::string videoPath;
+	int shuffle = 1;
+	size_t threads = 0;
+	int baudrate = ARDUINO_FAST_BAUDRATE;
+	LightPattern stimulus;
+	ParseLightPattern("uv", stimulus);
+	LightPattern lights(1, LIGHT_WHITE);
+	Strobe strobe = Strobe();
+	double fps = 0.0;
+	int cameraDelayUs = DEFAULT_CAMERA_DELAY_US;
+	int64_t maxFrames = 0;
+	int budget = DEFAULT_BUDGET_FRAMES;
+	GaitSettings gaitSettings;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if ((arg == "-c" || arg == "--config") && hasValue) {
+			configPath = argv[++i];
+		}
+		else if ((arg == "-m" || arg == "--model") && hasValue) {
+			modelPath = argv[++i];
+		}
+		else if (arg == "--shuffle" && hasValue) {
+			shuffle = std::atoi(argv[++i]);
+		}
+		else if ((arg == "-t" || arg == "--threads") && hasValue) {
+			threads = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+		}
+		else if ((arg == "-p" || arg == "--port") && hasValue) {
+			port = argv[++i];
+		}
+		else if (arg == "--baud" && hasValue) {
+			baudrate = std::atoi(argv[++i]);
+		}
+		else if (arg == "--rule" && hasValue) {
+			ruleText = argv[++i];
+		}
+		else if (arg == "--stimulus" && hasValue) {
+			if (!ParseLightPattern(argv[++i], stimulus) || stimulus.size() != 1) {
+				std::fprintf(stderr, "Invalid stimulus lights %s.\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (arg == "--lights" && hasValue) {
+			if (!ParseLightPattern(argv[++i], lights)) {
+				std::fprintf(stderr, "Invalid light pattern %s.\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (arg == "--strobe" && hasValue) {
+			if (!ParseStrobe(argv[++i], strobe)) {
+				std::fprintf(stderr, "Invalid strobe %s.\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (arg == "--fps" && hasValue) {
+			fps = std::atof(argv[++i]);
+		}
+		else if (arg == "--camera-delay-us" && hasValue) {
+			cameraDelayUs = std::max(0, std::atoi(argv[++i]));
+		}
+		else if (arg == "--frames" && hasValue) {
+			maxFrames = std::atoll(argv[++i]);
+		}
+		else if (arg == "--budget" && hasValue) {
+			budget = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--gait-direction" && hasValue) {
+			std::string direction = argv[++i];
+			if (direction != "left" && direction != "right") {
+				PrintUsage();
+				return 2;
+			}
+			gaitSettings.direction = direction == "right" ? 1 : -1;
+		}
+		else if ((arg == "-o" || arg == "--output") && hasValue) {
+			outputPath = argv[++i];
+		}
+		else if (!arg.empty() && arg[0] != '-' && videoPath.empty()) {
+			videoPath = arg;
+		}
+		else {
+			PrintUsage();
+			return 2;
+		}
+	}
+	StimulusRule rule;
+	if (configPath.empty() || port.empty() || videoPath.empty() || ruleText.empty()) {
+		PrintUsage();
+		return 2;
+	}
+	if (!ParseStimulusRule(ruleText, rule)) {
+		std::fprintf(stderr, "Invalid rule %s.\n", ruleText.c_str());
+		return 2;
+	}
+
+	// Model and rule.
+	DlcProject project;
+	if (!project.Load(configPath, shuffle)) {
+		std::fprintf(stderr, "%s\n", project.LastError().c_str());
+		return 1;
+	}
+	if (modelPath.empty()) {
+		modelPath = project.FindModel();
+		if (modelPath.empty()) {
+			std::fprintf(stderr, "%s\n", project.LastError().c_str());
+			return 1;
+		}
+	}
+	InferenceEngine engine(threads);
+	if (!engine.Load(modelPath)) {
+		std::fprintf(stderr, "%s\n", engine.LastError().c_str());
+		return 1;
+	}
+	PoseDecoder decoder(project.Pose());
+	InputLayout layout;
+	if (!decoder.Bind(engine.Outputs()) || !GetInputLayout(engine, layout)) {
+		if (!decoder.LastError().empty()) {
+			std::fprintf(stderr, "%s\n", decoder.LastError().c_str());
+		}
+		return 1;
+	}
+	gaitSettings.pcutoff = project.PCutoff();
+	StimulusRuleEvaluator evaluator;
+	if (!evaluator.Configure(rule, project.Bodyparts(), gaitSettings)) {
+		std::fprintf(stderr, "%s\n", evaluator.LastError().c_str());
+		return 1;
+	}
+
+	// The video, as camera.
+	VideoReader reader;
+	if (!reader.Open(videoPath, PixelFormat::YCbCr422_8)) {
+		std::fprintf(stderr, "%s\n", reader.LastError().c_str());
+		return 1;
+	}
+	const VideoInfo& info = reader.Info();
+	int x1 = 0, y1 = 0;
+	int64_t width = info.width, height = info.height;
+	if (project.Cropping()) {
+		x1 = std::max(0, project.CropX1());
+		y1 = std::max(0, project.CropY1());
+		width = std::min(info.width, project.CropX2()) - x1;
+		height = std::min(info.height, project.CropY2()) - y1;
+		if (width <= 0 || height <= 0) {
+			std::fprintf(stderr, "The crop rectangle of the config lies outside the %dx%d frames of %s.\n", info.width,
+				info.height, videoPath.c_str());
+			return 1;
+		}
+	}
+	if ((layout.height > 0 && layout.height != height) || (layout.width > 0 && layout.width != width)) {
+		std::fprintf(stderr, "The model was exported for %lldx%lld frames, but the frames are %lldx%lld; "
+			"export it with --size %lldx%lld.\n", static_cast<long long>(layout.width), static_cast<long long>(layout.height),
+			static_cast<long long>(width), static_cast<long long>(height), static_cast<long long>(width),
+			static_cast<long long>(height));
+		return 1;
+	}
+	if (fps <= 0.0) {
+		fps = info.fps;
+	}
+	if (!(fps > 0.0)) {
+		std::fprintf(stderr, "The frame rate of %s is unknown; give it with --fps.\n", videoPath.c_str());
+		return 2;
+	}
+	std::string strobeError = CheckStrobe(strobe, fps);
+	if (!strobeError.empty()) {
+		std::fprintf(stderr, "%s\n", strobeError.c_str());
+		return 2;
+	}
+	if (outputPath.empty()) {
+		fs::path path(videoPath);
+		outputPath = (path.parent_path() / (path.stem().string() + "_stimulus.csv")).string();
+	}
+	FILE* log = std::fopen(outputPath.c_str(), "w");
+	if (log == nullptr) {
+		std::fprintf(stderr, "Cannot create %s.\n", outputPath.c_str());
+		return 1;
+	}
+	std::fprintf(log, "event,frame,lights,stimulus_frame,latency_frames,trigger_to_stimulus_us,trigger_to_receipt_us,pose_us,"
+		"round_trip_us\n");
+
+	ArduinoController controller;
+	if (!ConnectArduino(controller, port, baudrate)) {
+		std::fclose(log);
+		return 1;
+	}
+	std::printf("%s: %dx%d, %.2f fps; model %s; Arduino on %s; rule %s, budget %d frames (%.2f ms)\n", videoPath.c_str(),
+		info.width, info.height, fps, modelPath.c_str(), controller.PortName().c_str(), ruleText.c_str(), budget,
+		budget * 1000.0 / fps);
+	std::fflush(stdout);
+
+	FrameConverter converter;
+	converter.Configure(reader.Format(), info.width, info.height, x1, y1, static_cast<int>(width), static_cast<int>(height),
+		layout.channelsLast, YCbCrRange::Limited);
+	std::vector<float> input(static_cast<size_t>(layout.batch * width * height * 3));
+	Shape shape = layout.channelsLast ? Shape{ layout.batch, height, width, 3 } : Shape{ layout.batch, 3, height, width };
+	// The first run grows the network's buffers.
+	if (!engine.Run(input.data(), shape)) {
+		std::fprintf(stderr, "%s\n", engine.LastError().c_str());
+		std::fclose(log);
+		return 1;
+	}
+
+	// The recording starts at a known host time, so that frame N arrives at the time of trigger
+	// edge N (plus the camera delay).
+	std::signal(SIGINT, OnInterrupt);
+	int64_t startHostUs = HostClockUs() + START_DELAY_US;
+	if (!controller.StartRecording(fps, lights, strobe, TriggerPhases(), startHostUs)) {
+		std::fprintf(stderr, "%s\n", controller.LastError().c_str());
+		std::fclose(log);
+		return 1;
+	}
+
+	FrameMailbox mailbox;
+	std::atomic<int64_t> lateFrames(0);
+	std::thread camera([&] {
+		std::vector<uint8_t> frame(reader.FrameSize());
+		for (int64_t index = 0; !interrupted && (maxFrames <= 0 || index < maxFrames); index++) {
+			if (!reader.Read(frame.data())) {
+				break;
+			}
+			int64_t dueUs = startHostUs + static_cast<int64_t>(index * 1e6 / fps) + cameraDelayUs;
+			int64_t waitUs = dueUs - HostClockUs();
+			if (waitUs > 0) {
+				std::this_thread::sleep_for(std::chrono::microseconds(waitUs));
+			}
+			else if (waitUs < -1000000.0 / fps) {
+				lateFrames++;  // Decoding could not keep up.
+			}
+			mailbox.Publish(index, frame, std::max(dueUs, HostClockUs()));
+		}
+		mailbox.Close();
+	});
+
+	StimulusReplies replies;
+	std::vector<uint64_t> edgeTicks;
+	std::vector<TriggerEdge> edges;
+	auto takeEdges = [&]() {
+		controller.TakeEdges(edges);
+		for (const TriggerEdge& edge : edges) {
+			if (edge.index >= edgeTicks.size()) {
+				edgeTicks.resize(edge.index + 1, UNKNOWN_TICKS);
+			}
+			edgeTicks[edge.index] = edge.ticks;
+		}
+	};
+	auto ticksOf = [&](int64_t index) {
+		return index >= 0 && static_cast<size_t>(index) < edgeTicks.size() ? edgeTicks[static_cast<size_t>(index)] : UNKNOWN_TICKS;
+	};
+
+	// Report the events whose trigger edges are known, in order; with `all`, also the others.
+	std::vector<double> latencyFrames, latencyUs;
+	int64_t withinBudget = 0;
+	auto reportEvents = [&](bool all) {
+		std::lock_guard<std::mutex> lock(replies.mutex);
+		while (!replies.events.empty() && replies.events.front().replied) {
+			const StimulusEvent& event = replies.events.front();
+			uint64_t triggerTicks = ticksOf(event.frame);
+			uint64_t stimulusTicks = event.succeeded ? ticksOf(event.timing.firstFrame) : UNKNOWN_TICKS;
+			if (event.succeeded && (triggerTicks == UNKNOWN_TICKS || stimulusTicks == UNKNOWN_TICKS) && !all) {
+				break;  // Telemetry of its edges still to come.
+			}
+			int64_t eventCount = ++replies.reported;
+			const char* state = event.lights != 0 ? "on" : "off";
+			if (!event.succeeded) {
+				std::printf("  event %lld: frame %lld, stimulus %s failed: %s\n", static_cast<long long>(eventCount),
+					static_cast<long long>(event.frame), state, event.error.c_str());
+				std::fprintf(log, "%lld,%lld,%u,,,,,%.0f,%.0f\n", static_cast<long long>(eventCount), static_cast<long long>(event.frame),
+					event.lights, event.poseUs, event.roundTripUs);
+				replies.events.pop_front();
+				continue;
+			}
+			int64_t frames = static_cast<int64_t>(event.timing.firstFrame) - event.frame;
+			latencyFrames.push_back(static_cast<double>(frames));
+			withinBudget += frames <= budget ? 1 : 0;
+			std::string toStimulus, toReceipt;
+			if (triggerTicks != UNKNOWN_TICKS && stimulusTicks != UNKNOWN_TICKS) {
+				double us = TicksToUs(static_cast<int64_t>(stimulusTicks - triggerTicks));
+				double receiptUs = TicksToUs(static_cast<int64_t>(event.timing.receivedTicks - triggerTicks));
+				latencyUs.push_back(us);
+				toStimulus = std::to_string(static_cast<long long>(us + 0.5));
+				toReceipt = std::to_string(static_cast<long long>(receiptUs + 0.5));
+				std::printf("  event %lld: frame %lld, stimulus %s at frame %u: %+lld frames, %.2f ms (command received "
+					"%.2f ms after the trigger; pose %.2f ms, round trip %.2f ms)\n", static_cast<long long>(eventCount),
+					static_cast<long long>(event.frame), state, event.timing.firstFrame, static_cast<long long>(frames), us / 1000.0,
+					receiptUs / 1000.0, event.poseUs / 1000.0, event.roundTripUs / 1000.0);
+			}
+			else {
+				// Telemetry of the edges was lost.
+				std::printf("  event %lld: frame %lld, stimulus %s at frame %u: %+lld frames (pose %.2f ms, round trip %.2f ms)\n",
+					static_cast<long long>(eventCount), static_cast<long long>(event.frame), state, event.timing.firstFrame,
+					static_cast<long long>(frames), event.poseUs / 1000.0, event.roundTripUs / 1000.0);
+			}
+			std::fprintf(log, "%lld,%lld,%u,%u,%lld,%s,%s,%.0f,%.0f\n", static_cast<long long>(eventCount),
+				static_cast<long long>(event.frame), event.lights, event.timing.firstFrame, static_cast<long long>(frames),
+				toStimulus.c_str(), toReceipt.c_str(), event.poseUs, event.roundTripUs);
+			replies.events.pop_front();
+		}
+		std::fflush(stdout);
+	};
+
+	auto sendStimulus = [&](int64_t frame, uint8_t mask, double poseUs) {
+		int64_t id;  // Position of the event among all events.
+		{
+			std::lock_guard<std::mutex> lock(replies.mutex);
+			StimulusEvent event = StimulusEvent();
+			event.frame = frame;
+			event.lights = mask;
+			event.poseUs = poseUs;
+			id = replies.reported + static_cast<int64_t>(replies.events.size());
+			replies.events.push_back(event);
+			replies.pending++;
+		}
+		// Events are only removed once replied, so that the event is still queued.
+		controller.SetStimulusAsync(mask, [&replies, id](const CommandResult& result, const StimulusTiming& timing) {
+			std::lock_guard<std::mutex> lock(replies.mutex);
+			StimulusEvent& event = replies.events[static_cast<size_t>(id - replies.reported)];
+			event.replied = true;
+			event.succeeded = result.success;
+			event.error = result.error;
+			event.timing = timing;
+			event.roundTripUs = result.roundTripUs;
+			replies.pending--;
+			replies.replied.notify_one();
+		});
+	};
+
+	// The network runs on the newest frame at a time.
+	std::vector<uint8_t> frame;
+	std::vector<float> poses;
+	int64_t frameIndex = -1, arrivalUs = 0;
+	int64_t analyzed = 0, skipped = 0;
+	double poseSum = 0.0;
+	bool stimulusOn = false;
+	bool ok = true;
+	auto start = std::chrono::steady_clock::now();
+	while (ok && !interrupted) {
+		int64_t previous = frameIndex;
+		if (!mailbox.Take(frameIndex, frame, arrivalUs)) {
+			break;
+		}
+		skipped += frameIndex - previous - 1;
+		converter.Convert(frame.data(), input.data());
+		ok = engine.Run(input.data(), shape);
+		const float* locref = decoder.LocrefOutput() < engine.Outputs().size() ? engine.Output(decoder.LocrefOutput()) : nullptr;
+		ok = ok && decoder.Decode(engine.Output(decoder.ScoremapOutput()), engine.OutputShape(decoder.ScoremapOutput()), locref,
+			locref != nullptr ? engine.OutputShape(decoder.LocrefOutput()) : Shape(), poses);
+		if (!ok) {
+			break;
+		}
+		for (size_t j = 0; j < project.Bodyparts().size(); j++) {
+			poses[3 * j] += static_cast<float>(x1);
+			poses[3 * j + 1] += static_cast<float>(y1);
+		}
+		bool holds = evaluator.Update(frameIndex, frameIndex / fps, poses.data());
+		double poseUs = static_cast<double>(HostClockUs() - arrivalUs);
+		if (holds != stimulusOn) {
+			stimulusOn = holds;
+			sendStimulus(frameIndex, holds ? stimulus[0] : 0, poseUs);
+		}
+		analyzed++;
+		poseSum += poseUs;
+		takeEdges();
+		reportEvents(false);
+	}
+	interrupted = true;
+	camera.join();
+	if (!ok) {
+		std::fprintf(stderr, "%s\n", !engine.LastError().empty() ? engine.LastError().c_str() : decoder.LastError().c_str());
+	}
+
+	// Wait for all replies, switch the stimulus off, and stop, which delivers the remaining telemetry.
+	{
+		std::unique_lock<std::mutex> lock(replies.mutex);
+		replies.replied.wait(lock, [&] { return replies.pending == 0; });
+	}
+	StimulusTiming timing;
+	if (stimulusOn && !controller.SetStimulus(0, timing)) {
+		std::fprintf(stderr, "%s\n", controller.LastError().c_str());
+	}
+	if (!controller.StopRecording()) {
+		std::fprintf(stderr, "%s\n", controller.LastError().c_str());
+		ok = false;
+	}
+	takeEdges();
+	reportEvents(true);
+	controller.Disconnect();
+	std::fclose(log);
+
+	double elapsed = SecondsSince(start);
+	std::printf("%lld frames analyzed, %lld skipped, %lld late from the video in %.2f s; pose %.2f ms per frame on average\n",
+		static_cast<long long>(analyzed), static_cast<long long>(skipped), static_cast<long long>(lateFrames.load()), elapsed,
+		analyzed > 0 ? poseSum / analyzed / 1000.0 : 0.0);
+	if (!latencyFrames.empty()) {
+		double medianFrames = Percentile(latencyFrames, 0.5);
+		double maxFrames = latencyFrames.back();
+		double medianUs = Percentile(latencyUs, 0.5);
+		double maxUs = latencyUs.empty() ? std::numeric_limits<double>::quiet_NaN() : latencyUs.back();
+		std::printf("%lld events: latency median %.0f frames (%.2f ms), max %.0f frames (%.2f ms); %lld of %zu within %d frames\n",
+			static_cast<long long>(replies.reported), medianFrames, medianUs / 1000.0, maxFrames, maxUs / 1000.0,
+			static_cast<long long>(withinBudget), latencyFrames.size(), budget);
+	}
+	std::printf("Events: %s\n", outputPath.c_str());
+	return ok ? 0 : 1;
+}
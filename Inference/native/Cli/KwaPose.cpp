@@ -0,0 +1,552 @@
+/**
+ * Native analysis of recorded videos with the DLC paw-tracking network: the counterpart of
+ * `inference.py predict` without the Python/TensorFlow stack. The trained snapshot must be
+ * exported to ONNX once with export_onnx.py; kwa-pose then starts in milliseconds and runs
+ * the network on all CPU cores (see `InferenceEngine`).
+ *
+ * Usage:
+ *
+ *   kwa-pose -c <config.yaml> [options] <video or folder>...
+ *       Predict the paw locations in each video (in folders: *.avi, *.mp4, *.mov, *.mpeg,
+ *       *.mkv) and write them to the pose store <video name><scorer>.kwapose next to the
+ *       video (see `PoseStoreWriter`; Inference/posestore.py reads it and converts it to DLC's
+ *       HDF5 and CSV files). With --csv, they are also written to <video name><scorer>.csv in
+ *       the layout of DLC's CSV files (see "Inference Results" in the documentation).
+ *       Frames are decoded by ffmpeg to YCbCr 4:2:2 on a second thread while the network
+ *       runs, and cropped as set in config.yaml and converted to RGB network input in one
+ *       pass (see `FrameConverter`). With --gait, the poses are also filtered and the strides
+ *       of the paws found while they are predicted, as by kwa-gait.
+ *
+ *   kwa-pose -c <config.yaml> --benchmark <frames> [--size <width>x<height>]
+ *       Run the network on <frames> random frames (default size: the model's input size)
+ *       and print the throughput, e.g., to compare analysis computers.
+ *
+ * Options:
+ *   -m, --model <file.onnx>   Model to run (default: the exported snapshot selected by
+ *                             snapshotindex in config.yaml)
+ *   --shuffle <n>             Shuffle of the model (default: 1)
+ *   -b, --batch <n>           Frames per batch (default: batch_size in config.yaml, or the
+ *                             batch size the model was exported with)
+ *   -t, --threads <n>         Threads (default: one per hardware thread)
+ *   -o, --output <folder>     Folder of the result files (default: the video's folder)
+ *   --csv                     Also write DLC's CSV file
+ *   --trigger-log <file.csv>  Trigger log of the recording (as written by KWA-Controller), to
+ *                             store the trigger time of each frame (host time if the log
+ *                             has it, else Arduino time), taking frame N to be of trigger N;
+ *                             one video only
+ *   --frame-index <file.csv>  Frame index of the recording (see kwa-reconcile), to store the
+ *                             trigger time of each frame where frames were dropped; one video only
+ *   --gait                    Also write the filtered poses (<video name><scorer>_filtered.kwapose)
+ *                             and strides (<video name><scorer>_steps.csv); see `GaitAnalyzer`
+ *   --gait-direction <left|right>  Running direction in the side profile view (default: right)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BatchQueue.h"
+#include "DlcConfig.h"
+#include "FrameConverter.h"
+#include "FrameIndex.h"
+#include "GaitAnalysis.h"
+#include "InferenceEngine.h"
+#include "PoseCsv.h"
+#include "PoseDecoder.h"
+#include "PoseStore.h"
+#include "VideoReader.h"
+
+using namespace KwaInference;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+	const char* const VIDEO_EXTENSIONS[] = { ".avi", ".mp4", ".mov", ".mpeg", ".mkv" };
+	// Batches decoded ahead of the network.
+	const size_t QUEUED_BATCHES = 2;
+	const double PROGRESS_INTERVAL_S = 2.0;
+
+	void PrintUsage() {
+		std::fprintf(stderr,
+			"Usage:\n"
+			"  kwa-pose -c <config.yaml> [options] <video or folder>...\n"
+			"  kwa-pose -c <config.yaml> --benchmark <frames> [--size <width>x<height>]\n"
+			"Options:\n"
+			"  -m, --model <file.onnx>   Model to run (default: exported snapshot selected by snapshotindex)\n"
+			"  --shuffle <n>             Shuffle of the model (default: 1)\n"
+			"  -b, --batch <n>           Frames per batch (default: batch_size of the config)\n"
+			"  -t, --threads <n>         Threads (default: one per hardware thread)\n"
+			"  -o, --output <folder>     Folder of the result files (default: the video's folder)\n"
+			"  --csv                     Also write DLC's CSV file\n"
+			"  --trigger-log <file.csv>  Store the trigger time of each frame from a KWA-Controller trigger log\n"
+			"  --frame-index <file.csv>  Store the trigger time of each frame from a frame index of kwa-reconcile\n"
+			"  --gait                    Also filter the poses and find the strides of the paws\n"
+			"  --gait-direction <left|right>  Running direction in the side profile view (default: right)\n");
+	}
+
+	/// <summary>
+	/// Where and how results are written.
+	/// </summary>
+	struct OutputOptions {
+		std::string folder;                // Empty: the video's folder.
+		bool csv;
+		bool timestamps;
+		std::vector<double> frameTimes;    // Trigger time in microseconds by frame; NaN if unknown.
+		bool gait;
+		GaitSettings gaitSettings;
+	};
+
+	/// <summary>
+	/// Read the trigger time of each trigger index from a trigger log (columns index, ticks,
+	/// time_us, host_time_us): the host time if the log has it, else the Arduino's time.
+	/// </summary>
+	bool LoadTriggerTimes(const std::string& path, std::vector<double>& times) {
+		FILE* file = std::fopen(path.c_str(), "r");
+		if (file == nullptr) {
+			std::fprintf(stderr, "Cannot read %s.\n", path.c_str());
+			return false;
+		}
+		times.clear();
+		char line[256];
+		bool header = true;
+		while (std::fgets(line, sizeof(line), file)) {
+			if (header) {
+				header = false;
+				continue;
+			}
+			unsigned long index;
+			unsigned long long ticks;
+			double time, hostTime;
+			int fields = std::sscanf(line, "%lu,%llu,%lf,%lf", &index, &ticks, &time, &hostTime);
+			if (fields < 3) {
+				continue;
+			}
+			if (index >= times.size()) {
+				times.resize(index + 1, std::numeric_limits<double>::quiet_NaN());
+			}
+			times[index] = fields == 4 ? hostTime : time;
+		}
+		std::fclose(file);
+		if (times.empty()) {
+			std::fprintf(stderr, "%s has no trigger edges.\n", path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/// <summary>
+	/// Layout of the network input: a batch of float RGB images with values in [0, 255].
+	/// </summary>
+	struct InputLayout {
+		bool channelsLast;   // NHWC (as exported from TensorFlow), else NCHW.
+		int64_t batch;       // Frames per run; the model's batch size if it is fixed.
+		bool fixedBatch;     // Partial batches must be padded.
+		int64_t height;      // Fixed input size, or -1.
+		int64_t width;
+
+		Shape BatchShape(int64_t frames, int64_t frameHeight, int64_t frameWidth) const {
+			return this->channelsLast ? Shape{ frames, frameHeight, frameWidth, 3 } : Shape{ frames, 3, frameHeight, frameWidth };
+		}
+	};
+
+	bool GetInputLayout(const InferenceEngine& engine, int64_t requestedBatch, InputLayout& layout) {
+		const Shape& shape = engine.Inputs()[0].shape;
+		if (shape.size() != 4 || (shape[3] != 3 && shape[1] != 3)) {
+			std::fprintf(stderr, "The model input %s is not a batch of RGB images.\n", FormatShape(shape).c_str());
+			return false;
+		}
+		layout.channelsLast = shape[3] == 3;
+		layout.fixedBatch = shape[0] > 0;
+		layout.batch = layout.fixedBatch ? shape[0] : requestedBatch;
+		layout.height = layout.channelsLast ? shape[1] : shape[2];
+		layout.width = layout.channelsLast ? shape[2] : shape[3];
+		return true;
+	}
+
+	/// <summary>
+	/// A batch of frames converted to network input.
+	/// </summary>
+	struct Batch {
+		std::vector<float> input;
+		int64_t frameCount;  // 0: end of the video.
+	};
+
+	bool AnalyzeVideo(InferenceEngine& engine, PoseDecoder& decoder, const DlcProject& project, const InputLayout& layout,
+		const std::string& scorer, const fs::path& videoPath, const OutputOptions& output) {
+		VideoReader reader;
+		if (!reader.Open(videoPath.string(), PixelFormat::YCbCr422_8)) {
+			std::fprintf(stderr, "%s\n", reader.LastError().c_str());
+			return false;
+		}
+		const VideoInfo& info = reader.Info();
+		int x1 = 0, y1 = 0;
+		int64_t width = info.width, height = info.height;
+		if (project.Cropping()) {
+			x1 = std::max(0, project.CropX1());
+			y1 = std::max(0, project.CropY1());
+			width = std::min(info.width, project.CropX2()) - x1;
+			height = std::min(info.height, project.CropY2()) - y1;
+			if (width <= 0 || height <= 0) {
+				std::fprintf(stderr, "The crop rectangle of the config lies outside the %dx%d frames of %s.\n",
+					info.width, info.height, videoPath.string().c_str());
+				return false;
+			}
+		}
+		if ((layout.height > 0 && layout.height != height) || (layout.width > 0 && layout.width != width)) {
+			std::fprintf(stderr, "The model was exported for %lldx%lld frames, but %s has %lldx%lld frames; "
+				"export it with --size %lldx%lld.\n", static_cast<long long>(layout.width), static_cast<long long>(layout.height),
+				videoPath.string().c_str(), static_cast<long long>(width), static_cast<long long>(height),
+				static_cast<long long>(width), static_cast<long long>(height));
+			return false;
+		}
+
+		fs::path folder = output.folder.empty() ? videoPath.parent_path() : fs::path(output.folder);
+		fs::path storePath = folder / (videoPath.stem().string() + scorer + ".kwapose");
+		fs::path csvPath = folder / (videoPath.stem().string() + scorer + ".csv");
+		PoseStoreWriter writer;
+		if (!writer.Open(storePath.string(), scorer, project.Bodyparts(), output.timestamps)) {
+			std::fprintf(stderr, "Cannot create %s.\n", storePath.string().c_str());
+			return false;
+		}
+		PoseCsvWriter csvWriter;
+		if (output.csv && !csvWriter.Open(csvPath.string(), scorer, project.Bodyparts())) {
+			std::fprintf(stderr, "Cannot create %s.\n", csvPath.string().c_str());
+			return false;
+		}
+		GaitAnalyzer gait;
+		if (output.gait && !gait.Open((folder / (videoPath.stem().string() + scorer)).string(), scorer, project.Bodyparts(),
+			output.timestamps, info.fps, output.gaitSettings)) {
+			std::fprintf(stderr, "%s\n", gait.LastError().c_str());
+			return false;
+		}
+		std::printf("%s: %dx%d, %.2f fps, %lld frames\n", videoPath.string().c_str(), info.width, info.height, info.fps,
+			static_cast<long long>(info.frameCount));
+		std::fflush(stdout);
+
+		// Decode and convert frames on a second thread while the network runs.
+		BatchQueue<Batch> queue;
+		for (size_t i = 0; i < QUEUED_BATCHES; i++) {
+			Batch batch;
+			batch.input.resize(static_cast<size_t>(layout.batch * width * height * 3));
+			batch.frameCount = 0;
+			queue.Release(std::move(batch));
+		}
+		std::thread decoding([&] {
+			// Crop and convert each frame into its slot of the network input in one pass.
+			FrameConverter converter;
+			converter.Configure(reader.Format(), info.width, info.height, x1, y1, static_cast<int>(width),
+				static_cast<int>(height), layout.channelsLast, YCbCrRange::Limited);
+			std::vector<uint8_t> frame(reader.FrameSize());
+			bool more = true;
+			while (more) {
+				Batch batch;
+				if (!queue.Acquire(batch)) {
+					return;
+				}
+				batch.frameCount = 0;
+				while (batch.frameCount < layout.batch && (more = reader.Read(frame.data()))) {
+					converter.Convert(frame.data(), batch.input.data() + batch.frameCount++ * converter.OutputSize());
+				}
+				bool last = batch.frameCount == 0;
+				queue.Push(std::move(batch));
+				if (!last && !more) {
+					Batch end;
+					end.frameCount = 0;
+					queue.Push(std::move(end));
+				}
+			}
+		});
+
+		std::vector<float> poses;
+		std::vector<double> times;
+		bool ok = true;
+		auto start = std::chrono::steady_clock::now();
+		double lastProgress = 0.0;
+		for (;;) {
+			Batch batch;
+			queue.Pop(batch);
+			if (batch.frameCount == 0) {
+				break;
+			}
+			// A model exported with a fixed batch size runs full batches; the padding is ignored.
+			int64_t runFrames = layout.fixedBatch ? layout.batch : batch.frameCount;
+			ok = engine.Run(batch.input.data(), layout.BatchShape(runFrames, height, width));
+			const float* locref = decoder.LocrefOutput() < engine.Outputs().size() ? engine.Output(decoder.LocrefOutput()) : nullptr;
+			const Shape& locrefShape = locref != nullptr ? engine.OutputShape(decoder.LocrefOutput()) : Shape();
+			ok = ok && decoder.Decode(engine.Output(decoder.ScoremapOutput()), engine.OutputShape(decoder.ScoremapOutput()),
+				locref, locrefShape, poses);
+			if (output.timestamps) {
+				times.resize(static_cast<size_t>(batch.frameCount));
+				for (int64_t i = 0; i < batch.frameCount; i++) {
+					size_t frame = static_cast<size_t>(writer.FrameCount() + i);
+					times[i] = frame < output.frameTimes.size() ? output.frameTimes[frame] : std::numeric_limits<double>::quiet_NaN();
+				}
+			}
+			ok = ok && (!output.csv || csvWriter.Write(poses, batch.frameCount, static_cast<float>(x1), static_cast<float>(y1)));
+			ok = ok && writer.Write(poses, batch.frameCount, static_cast<float>(x1), static_cast<float>(y1), times.data());
+			ok = ok && (!output.gait || gait.Write(poses, batch.frameCount, static_cast<float>(x1), static_cast<float>(y1), times.data()));
+			queue.Release(std::move(batch));
+			if (!ok) {
+				break;
+			}
+			double elapsed = SecondsSince(start);
+			if (elapsed - lastProgress >= PROGRESS_INTERVAL_S) {
+				lastProgress = elapsed;
+				std::fprintf(stderr, "  %lld frames, %.1f fps\n", static_cast<long long>(writer.FrameCount()),
+					writer.FrameCount() / elapsed);
+			}
+		}
+		queue.Stop();
+		decoding.join();
+		reader.Close();
+		if (!ok) {
+			std::fprintf(stderr, "%s\n", !engine.LastError().empty() ? engine.LastError().c_str()
+				: (!decoder.LastError().empty() ? decoder.LastError().c_str() : "Cannot write the results."));
+			return false;
+		}
+		if (!writer.Close()) {
+			std::fprintf(stderr, "Cannot write %s.\n", storePath.string().c_str());
+			return false;
+		}
+		if (!csvWriter.Close()) {
+			std::fprintf(stderr, "Cannot write %s.\n", csvPath.string().c_str());
+			return false;
+		}
+		if (output.gait && !gait.Close()) {
+			std::fprintf(stderr, "%s\n", gait.LastError().c_str());
+			return false;
+		}
+		double elapsed = SecondsSince(start);
+		std::printf("  %lld frames in %.2f s (%.1f fps) -> %s\n", static_cast<long long>(writer.FrameCount()), elapsed,
+			elapsed > 0.0 ? writer.FrameCount() / elapsed : 0.0, storePath.string().c_str());
+		for (const GaitSummary& paw : gait.Summary()) {
+			std::printf("  %-8s %6lld strides, %5.2f Hz, %6.1f px, duty factor %.2f\n", paw.paw.c_str(),
+				static_cast<long long>(paw.strides), paw.cadence, paw.strideLength, paw.dutyFactor);
+		}
+		std::fflush(stdout);
+		return true;
+	}
+
+	bool Benchmark(InferenceEngine& engine, PoseDecoder& decoder, const InputLayout& layout, int64_t frames,
+		int64_t width, int64_t height) {
+		if (width <= 0 || height <= 0) {
+			std::fprintf(stderr, "The model has no fixed input size; give one with --size <width>x<height>.\n");
+			return false;
+		}
+		std::vector<float> input(static_cast<size_t>(layout.batch * width * height * 3));
+		std::mt19937 random(1);
+		std::uniform_real_distribution<float> pixel(0.0f, 255.0f);
+		for (float& value : input) {
+			value = pixel(random);
+		}
+		Shape shape = layout.BatchShape(layout.batch, height, width);
+		std::vector<float> poses;
+
+		// The first run grows the buffers; it is timed separately.
+		auto start = std::chrono::steady_clock::now();
+		if (!engine.Run(input.data(), shape)) {
+			std::fprintf(stderr, "%s\n", engine.LastError().c_str());
+			return false;
+		}
+		std::printf("First batch: %.1f ms\n", SecondsSince(start) * 1000.0);
+
+		int64_t batches = std::max<int64_t>(1, (frames + layout.batch - 1) / layout.batch);
+		start = std::chrono::steady_clock::now();
+		for (int64_t i = 0; i < batches; i++) {
+			engine.Run(input.data(), shape);
+			const float* locref = decoder.LocrefOutput() < engine.Outputs().size() ? engine.Output(decoder.LocrefOutput()) : nullptr;
+			decoder.Decode(engine.Output(decoder.ScoremapOutput()), engine.OutputShape(decoder.ScoremapOutput()), locref,
+				locref != nullptr ? engine.OutputShape(decoder.LocrefOutput()) : Shape(), poses);
+		}
+		double elapsed = SecondsSince(start);
+		std::printf("%lld batches of %lld %lldx%lld frames: %.1f ms per batch, %.1f fps\n", static_cast<long long>(batches),
+			static_cast<long long>(layout.batch), static_cast<long long>(width), static_cast<long long>(height),
+			elapsed * 1000.0 / batches, batches * layout.batch / elapsed);
+		return true;
+	}
+}
+
+
+int main(int argc, char* argv[]) {
+	std::string configPath;
+	std::string modelPath;
+	OutputOptions output;
+	output.csv = false;
+	output.gait = false;
+	output.timestamps = false;
+	std::string triggerLogPath;
+	std::string frameIndexPath;
+	std::vector<std::string> videoArgs;
+	int shuffle = 1;
+	int64_t batch = 0;
+	size_t threads = 0;
+	int64_t benchmarkFrames = 0;
+	int64_t benchmarkWidth = -1, benchmarkHeight = -1;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if ((arg == "-c" || arg == "--config") && hasValue) {
+			configPath = argv[++i];
+		}
+		else if ((arg == "-m" || arg == "--model") && hasValue) {
+			modelPath = argv[++i];
+		}
+		else if ((arg == "-o" || arg == "--output") && hasValue) {
+			output.folder = argv[++i];
+		}
+		else if (arg == "--csv") {
+			output.csv = true;
+		}
+		else if (arg == "--gait") {
+			output.gait = true;
+		}
+		else if (arg == "--gait-direction" && hasValue) {
+			std::string direction = argv[++i];
+			if (direction != "left" && direction != "right") {
+				PrintUsage();
+				return 2;
+			}
+			output.gaitSettings.direction = direction == "right" ? 1 : -1;
+		}
+		else if (arg == "--trigger-log" && hasValue) {
+			triggerLogPath = argv[++i];
+		}
+		else if (arg == "--frame-index" && hasValue) {
+			frameIndexPath = argv[++i];
+		}
+		else if (arg == "--shuffle" && hasValue) {
+			shuffle = std::atoi(argv[++i]);
+		}
+		else if ((arg == "-b" || arg == "--batch") && hasValue) {
+			batch = std::atoll(argv[++i]);
+		}
+		else if ((arg == "-t" || arg == "--threads") && hasValue) {
+			threads = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+		}
+		else if (arg == "--benchmark" && hasValue) {
+			benchmarkFrames = std::atoll(argv[++i]);
+		}
+		else if (arg == "--size" && hasValue) {
+			long long width, height;
+			char extra;
+			if (std::sscanf(argv[++i], "%lldx%lld%c", &width, &height, &extra) != 2 || width <= 0 || height <= 0) {
+				std::fprintf(stderr, "Invalid size %s.\n", argv[i]);
+				return 2;
+			}
+			benchmarkWidth = width;
+			benchmarkHeight = height;
+		}
+		else if (!arg.empty() && arg[0] != '-') {
+			videoArgs.push_back(arg);
+		}
+		else {
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (configPath.empty() || (videoArgs.empty() && benchmarkFrames <= 0)) {
+		PrintUsage();
+		return 2;
+	}
+
+	if (!triggerLogPath.empty() || !frameIndexPath.empty()) {
+		if (videoArgs.size() != 1 || fs::is_directory(videoArgs[0]) || (!triggerLogPath.empty() && !frameIndexPath.empty())) {
+			std::fprintf(stderr, "A trigger log or frame index belongs to a single video.\n");
+			return 2;
+		}
+		if (!frameIndexPath.empty() && !ReadFrameTimes(frameIndexPath, output.frameTimes)) {
+			std::fprintf(stderr, "Cannot read %s as frame index.\n", frameIndexPath.c_str());
+			return 1;
+		}
+		if (!triggerLogPath.empty() && !LoadTriggerTimes(triggerLogPath, output.frameTimes)) {
+			return 1;
+		}
+		output.timestamps = true;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	DlcProject project;
+	if (!project.Load(configPath, shuffle)) {
+		std::fprintf(stderr, "%s\n", project.LastError().c_str());
+		return 1;
+	}
+	if (modelPath.empty()) {
+		modelPath = project.FindModel();
+		if (modelPath.empty()) {
+			std::fprintf(stderr, "%s\n", project.LastError().c_str());
+			return 1;
+		}
+	}
+	InferenceEngine engine(threads);
+	if (!engine.Load(modelPath)) {
+		std::fprintf(stderr, "%s\n", engine.LastError().c_str());
+		return 1;
+	}
+	PoseDecoder decoder(project.Pose());
+	InputLayout layout;
+	if (!decoder.Bind(engine.Outputs()) || !GetInputLayout(engine, batch > 0 ? batch : project.BatchSize(), layout)) {
+		if (!decoder.LastError().empty()) {
+			std::fprintf(stderr, "%s\n", decoder.LastError().c_str());
+		}
+		return 1;
+	}
+	if (batch > 0 && layout.fixedBatch && batch != layout.batch) {
+		std::fprintf(stderr, "The model was exported with a batch size of %lld.\n", static_cast<long long>(layout.batch));
+		return 2;
+	}
+	std::printf("Loaded %s in %.1f ms: %s; %zu threads, %lld frames per batch\n", modelPath.c_str(),
+		SecondsSince(start) * 1000.0, engine.Summary().c_str(), engine.ThreadCount(), static_cast<long long>(layout.batch));
+	std::fflush(stdout);
+
+	if (benchmarkFrames > 0) {
+		int64_t width = benchmarkWidth > 0 ? benchmarkWidth : layout.width;
+		int64_t height = benchmarkHeight > 0 ? benchmarkHeight : layout.height;
+		return Benchmark(engine, decoder, layout, benchmarkFrames, width, height) ? 0 : 1;
+	}
+
+	std::vector<fs::path> videos;
+	for (const std::string& arg : videoArgs) {
+		std::error_code error;
+		if (!fs::is_directory(arg, error)) {
+			videos.push_back(arg);
+			continue;
+		}
+		std::vector<fs::path> found;
+		for (const fs::directory_entry& entry : fs::directory_iterator(arg, error)) {
+			std::string extension = entry.path().extension().string();
+			std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+			if (std::find(std::begin(VIDEO_EXTENSIONS), std::end(VIDEO_EXTENSIONS), extension) != std::end(VIDEO_EXTENSIONS)) {
+				found.push_back(entry.path());
+			}
+		}
+		std::sort(found.begin(), found.end());
+		videos.insert(videos.end(), found.begin(), found.end());
+	}
+	if (videos.empty()) {
+		std::fprintf(stderr, "No videos found.\n");
+		return 1;
+	}
+
+	std::string scorer = project.ScorerName(modelPath);
+	output.gaitSettings.pcutoff = project.PCutoff();
+	int failures = 0;
+	for (const fs::path& video : videos) {
+		if (!AnalyzeVideo(engine, decoder, project, layout, scorer, video, output)) {
+			failures++;
+		}
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+/**
+ * Reconciliation of a recorded video with the trigger log of its recording: finds the frames
+ * the camera or the recording software dropped (or repeated) and writes a frame index, which
+ * gives the trigger, and thus the time, of each recorded frame (see `FrameReconciler`). Only
+ * the frames' metadata is read, not their pixels, so that an hour at 720 Hz takes seconds.
+ *
+ * Usage:
+ *
+ *   kwa-reconcile [options] <video> <trigger log.csv>
+ *       Match the frames of the video to the trigger edges of the log (as written by
+ *       KWA-Controller or `kwa-cli record --log`) by the camera's frame counter or timestamps
+ *       (from --chunks), or by the presentation times of the video where they were taken per
+ *       frame. Writes <video name>.frames.csv next to the video (columns frame, trigger,
+ *       time_us, host_time_us, residual_us, exposure_us, flags; see `FrameIndexWriter`), for
+ *       `kwa-pose --frame-index`, and prints where frames were dropped or repeated.
+ *       Without frame metadata (e.g., pylon Viewer's videos of fixed playback speed), frames
+ *       are assigned by count, and only the numbers of frames and triggers are compared.
+ *
+ * Options:
+ *   --chunks <file.csv>      Chunk data of the camera, a row per recorded frame, with any of the
+ *                            columns frame_counter, timestamp_ns, and exposure_us
+ *   --first-trigger <n>      Trigger of the first frame, e.g., if the camera was recording
+ *                            after the Arduino started (default: 0)
+ *   --pulses <n>             Trigger pulses sent, as printed by kwa-cli at the end of the
+ *                            recording, if the last edges were lost in telemetry
+ *   -o, --output <file.csv>  Frame index (default: <video name>.frames.csv)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "FrameIndex.h"
+
+using namespace KwaInference;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+	// Places of dropped or repeated frames listed.
+	const size_t MAX_LISTED = 20;
+
+	void PrintUsage() {
+		std::fprintf(stderr,
+			"Usage:\n"
+			"  kwa-reconcile [options] <video> <trigger log.csv>\n"
+			"Options:\n"
+			"  --chunks <file.csv>      Chunk data of the camera (frame_counter, timestamp_ns, exposure_us)\n"
+			"  --first-trigger <n>      Trigger of the first frame (default: 0)\n"
+			"  --pulses <n>             Trigger pulses sent, if the last edges were lost in telemetry\n"
+			"  -o, --output <file.csv>  Frame index (default: <video name>.frames.csv)\n");
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/// <summary>
+	/// A frame after dropped triggers, or repeating the previous one.
+	/// </summary>
+	struct Gap {
+		int64_t frame;
+		int64_t trigger;
+		int64_t dropped;  // 0: repeated.
+	};
+}
+
+
+int main(int argc, char* argv[]) {
+	std::string chunkPath;
+	std::string outputPath;
+	std::vector<std::string> fileArgs;
+	int64_t firstTrigger = 0;
+	int64_t pulses = -1;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--chunks" && hasValue) {
+			chunkPath = argv[++i];
+		}
+		else if (arg == "--first-trigger" && hasValue) {
+			firstTrigger = std::atoll(argv[++i]);
+		}
+		else if (arg == "--pulses" && hasValue) {
+			pulses = std::atoll(argv[++i]);
+		}
+		else if ((arg == "-o" || arg == "--output") && hasValue) {
+			outputPath = argv[++i];
+		}
+		else if (!arg.empty() && arg[0] != '-') {
+			fileArgs.push_back(arg);
+		}
+		else {
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (fileArgs.size() != 2 || firstTrigger < 0) {
+		PrintUsage();
+		return 2;
+	}
+	fs::path videoPath = fileArgs[0];
+	if (outputPath.empty()) {
+		outputPath = (videoPath.parent_path() / (videoPath.stem().string() + ".frames.csv")).string();
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	FrameStampReader frames;
+	if (!frames.Open(videoPath.string(), chunkPath)) {
+		std::fprintf(stderr, "%s\n", frames.LastError().c_str());
+		return 1;
+	}
+	TriggerLogReader triggers;
+	if (!triggers.Open(fileArgs[1], pulses)) {
+		std::fprintf(stderr, "%s\n", triggers.LastError().c_str());
+		return 1;
+	}
+	FrameIndexWriter writer;
+	if (!writer.Open(outputPath)) {
+		std::fprintf(stderr, "Cannot create %s.\n", outputPath.c_str());
+		return 1;
+	}
+	std::printf("%s: %lld frames, matched by %s\n", videoPath.string().c_str(), static_cast<long long>(frames.FrameCount()),
+		FrameStampSourceName(frames.Source()));
+
+	FrameReconciler reconciler(triggers, frames.Source(), firstTrigger);
+	FrameStamp stamp;
+	FrameMatch match;
+	std::vector<Gap> gaps;
+	int64_t dropped = 0, duplicates = 0, gapCount = 0, withoutTrigger = 0, residuals = 0;
+	double maxResidualUs = 0.0, sumSquaredResidualUs = 0.0;
+	bool ok = true;
+	while (ok && frames.Next(stamp)) {
+		reconciler.Match(stamp, match);
+		ok = writer.Write(match);
+		dropped += match.dropped;
+		duplicates += (match.flags & FRAME_DUPLICATE) != 0 ? 1 : 0;
+		withoutTrigger += (match.flags & FRAME_NO_TRIGGER) != 0 ? 1 : 0;
+		if ((match.flags & (FRAME_DUPLICATE | FRAME_AFTER_DROP)) != 0 && gapCount++ < static_cast<int64_t>(MAX_LISTED)) {
+			gaps.push_back({ match.frame, match.trigger, match.dropped });
+		}
+		if (std::isfinite(match.residualUs)) {
+			residuals++;
+			maxResidualUs = std::max(maxResidualUs, std::fabs(match.residualUs));
+			sumSquaredResidualUs += match.residualUs * match.residualUs;
+		}
+	}
+	if (!frames.LastError().empty()) {
+		std::fprintf(stderr, "%s\n", frames.LastError().c_str());
+		return 1;
+	}
+	if (!writer.Close() || !ok) {
+		std::fprintf(stderr, "Cannot write %s.\n", outputPath.c_str());
+		return 1;
+	}
+	int64_t trailing = reconciler.Finish();
+
+	std::printf("  %lld triggers (%lld lost in telemetry)", static_cast<long long>(reconciler.TriggerCount()),
+		static_cast<long long>(triggers.InterpolatedCount()));
+	if (firstTrigger > 0) {
+		std::printf(", %lld before the first frame", static_cast<long long>(firstTrigger));
+	}
+	std::printf(", %lld after the last frame\n", static_cast<long long>(trailing));
+	if (frames.Source() == FrameStampSource::None) {
+		int64_t unmatched = reconciler.TriggerCount() - firstTrigger - frames.FrameCount();
+		if (unmatched == 0) {
+			std::printf("  As many frames as triggers; drops cannot be located without frame metadata\n");
+		}
+		else {
+			std::printf("  %lld %s than triggers; without frame metadata, the frames are assigned by count\n",
+				static_cast<long long>(std::llabs(unmatched)), unmatched > 0 ? "frames fewer" : "frames more");
+		}
+	}
+	else {
+		std::printf("  %lld dropped, %lld repeated", static_cast<long long>(dropped), static_cast<long long>(duplicates));
+		if (residuals > 0) {
+			std::printf("; timestamps within %.1f us of the triggers (RMS %.1f us)", maxResidualUs,
+				std::sqrt(sumSquaredResidualUs / residuals));
+		}
+		std::printf("\n");
+		for (const Gap& gap : gaps) {
+			if (gap.dropped > 0) {
+				std::printf("    frame %lld: %lld dropped before (trigger %lld)\n", static_cast<long long>(gap.frame),
+					static_cast<long long>(gap.dropped), static_cast<long long>(gap.trigger));
+			}
+			else {
+				std::printf("    frame %lld: repeats frame %lld\n", static_cast<long long>(gap.frame),
+					static_cast<long long>(gap.frame - 1));
+			}
+		}
+		if (gapCount > static_cast<int64_t>(gaps.size())) {
+			std::printf("    ... (see the flags in the frame index)\n");
+		}
+	}
+	if (withoutTrigger > 0) {
+		std::printf("  %lld frames after the last trigger\n", static_cast<long long>(withoutTrigger));
+	}
+	std::printf("  -> %s (%.2f s)\n", outputPath.c_str(), SecondsSince(start));
+	return 0;
+}
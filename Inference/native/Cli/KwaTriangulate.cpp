@@ -0,0 +1,349 @@
+/**
+ * 3D paw trajectories from the two views of the camera: the network predicts each paw in the
+ * side profile view (SIDE_PROFILE_VIEW-<paw>) and in the mirror (MIRROR_VIEW-<paw>), and a
+ * one-time calibration of the mirror makes the two views a stereo pair (see
+ * `MirrorCalibration`), from which each frame's pair of positions is triangulated (see
+ * `Triangulator`).
+ *
+ * Usage:
+ *
+ *   kwa-triangulate --calibrate <points.csv> -k <calibration.yaml>
+ *       Calibrate the views from points of known 3D position (at least 6, not in one plane,
+ *       e.g., the corners of a calibration block): one line "x,y,z,side_u,side_v,mirror_u,
+ *       mirror_v" per point, in the units of the trajectories (e.g., mm) and in pixels of the
+ *       uncropped frame; lines that are no numbers (e.g., a header) are skipped.
+ *
+ *   kwa-triangulate -k <calibration.yaml> [options] <pose store or folder>...
+ *       Triangulate the paws of each pose store (in folders: *.kwapose) written by kwa-pose
+ *       and write them to <store name>_3d.npy: a NumPy array with a record per frame of
+ *       time_us (if the store has trigger times), and x, y, z, error (RMS reprojection error
+ *       in pixels), and flags per paw (1: side profile view below pcutoff, 2: mirror view
+ *       below pcutoff). Stores are processed in parallel, in chunks of frames.
+ *
+ * Options:
+ *   -k, --calibration <file>    Mirror calibration
+ *   -c, --config <config.yaml>  DLC project to take pcutoff from
+ *   --pcutoff <p>               Likelihood below which a view is flagged (default: 0.6)
+ *   -o, --output <folder>       Folder of the trajectories (default: the store's folder)
+ *   -t, --threads <n>           Stores processed at a time (default: one per hardware thread)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DlcConfig.h"
+#include "PoseStore.h"
+#include "ThreadPool.h"
+#include "Triangulation.h"
+
+using namespace KwaInference;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+	const char* const SIDE_PREFIX = "SIDE_PROFILE_VIEW-";
+	const char* const MIRROR_PREFIX = "MIRROR_VIEW-";
+	const double DEFAULT_PCUTOFF = 0.6;
+	// Frames per chunk: 1.5 MB of columns and records for 4 paws.
+	const int64_t CHUNK_FRAMES = 16384;
+	// Bytes of a paw's record: x, y, z, error (float32), flags (uint8).
+	const size_t PAW_RECORD_BYTES = 4 * sizeof(float) + 1;
+
+	void PrintUsage() {
+		std::fprintf(stderr,
+			"Usage:\n"
+			"  kwa-triangulate --calibrate <points.csv> -k <calibration.yaml>\n"
+			"  kwa-triangulate -k <calibration.yaml> [options] <pose store or folder>...\n"
+			"Options:\n"
+			"  -k, --calibration <file>    Mirror calibration\n"
+			"  -c, --config <config.yaml>  DLC project to take pcutoff from\n"
+			"  --pcutoff <p>               Likelihood below which a view is flagged (default: 0.6)\n"
+			"  -o, --output <folder>       Folder of the trajectories (default: the store's folder)\n"
+			"  -t, --threads <n>           Stores processed at a time (default: one per hardware thread)\n");
+	}
+
+	double SecondsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	bool Calibrate(const std::string& pointsPath, const std::string& calibrationPath) {
+		std::ifstream file(pointsPath);
+		if (!file) {
+			std::fprintf(stderr, "Cannot read %s.\n", pointsPath.c_str());
+			return false;
+		}
+		std::vector<CalibrationPoint> points;
+		std::string line;
+		while (std::getline(file, line)) {
+			CalibrationPoint point;
+			if (std::sscanf(line.c_str(), "%lf ,%lf ,%lf ,%lf ,%lf ,%lf ,%lf", &point.x, &point.y, &point.z,
+				&point.sideU, &point.sideV, &point.mirrorU, &point.mirrorV) == 7) {
+				points.push_back(point);
+			}
+		}
+		MirrorCalibration calibration;
+		if (!calibration.Calibrate(points)) {
+			std::fprintf(stderr, "%s\n", calibration.LastError().c_str());
+			return false;
+		}
+		if (!calibration.Save(calibrationPath)) {
+			std::fprintf(stderr, "Cannot write %s.\n", calibrationPath.c_str());
+			return false;
+		}
+		std::printf("Calibrated from %zu points: RMS reprojection error %.3f pixels -> %s\n", points.size(),
+			calibration.RmsError(), calibrationPath.c_str());
+		return true;
+	}
+
+	/// <summary>
+	/// A paw seen in both views: the bodyparts SIDE_PROFILE_VIEW-&lt;name&gt; and
+	/// MIRROR_VIEW-&lt;name&gt; of a store.
+	/// </summary>
+	struct Paw {
+		std::string name;
+		size_t side;
+		size_t mirror;
+	};
+
+	std::vector<Paw> FindPaws(const std::vector<std::string>& bodyparts) {
+		std::vector<Paw> paws;
+		size_t sidePrefix = std::strlen(SIDE_PREFIX);
+		for (size_t side = 0; side < bodyparts.size(); side++) {
+			if (bodyparts[side].compare(0, sidePrefix, SIDE_PREFIX) != 0) {
+				continue;
+			}
+			std::string name = bodyparts[side].substr(sidePrefix);
+			auto mirror = std::find(bodyparts.begin(), bodyparts.end(), MIRROR_PREFIX + name);
+			if (mirror != bodyparts.end()) {
+				paws.push_back(Paw{ name, side, static_cast<size_t>(mirror - bodyparts.begin()) });
+			}
+		}
+		return paws;
+	}
+
+	/// <summary>
+	/// Header of a NumPy array file (.npy, version 1.0) of <c>frameCount</c> records: the
+	/// structured type of <c>Triangulate()</c>'s records, padded to a multiple of 64 bytes.
+	/// </summary>
+	std::string NpyHeader(const std::vector<Paw>& paws, bool timestamps, int64_t frameCount) {
+		std::string type = "[";
+		if (timestamps) {
+			type += "('time_us', '<f8'), ";
+		}
+		for (const Paw& paw : paws) {
+			type += "('" + paw.name + "', [('x', '<f4'), ('y', '<f4'), ('z', '<f4'), ('error', '<f4'), ('flags', 'u1')]), ";
+		}
+		type += "]";
+		std::string dictionary = "{'descr': " + type + ", 'fortran_order': False, 'shape': (" + std::to_string(frameCount) + ",), }";
+		// Magic, version, length of the dictionary (uint16), dictionary, spaces, and '\n'.
+		size_t length = 10 + dictionary.size() + 1;
+		dictionary.append((64 - length % 64) % 64, ' ');
+		dictionary += '\n';
+		std::string header("\x93NUMPY\x01\x00", 8);
+		header += static_cast<char>(dictionary.size() & 0xFF);
+		header += static_cast<char>(dictionary.size() >> 8);
+		return header + dictionary;
+	}
+
+	struct Result {
+		bool succeeded;
+		int64_t frameCount;
+		std::vector<int64_t> flagged;  // Frames with a flag, per paw.
+		std::string message;
+	};
+
+	Result Triangulate(const Triangulator& triangulator, const fs::path& storePath, const std::string& outputFolder) {
+		Result result = { false, 0, {}, std::string() };
+		PoseStoreReader store;
+		if (!store.Open(storePath.string())) {
+			result.message = store.LastError();
+			return result;
+		}
+		std::vector<Paw> paws = FindPaws(store.Bodyparts());
+		if (paws.empty()) {
+			result.message = storePath.string() + " has no paws in both views (" + SIDE_PREFIX + "<paw>, " + MIRROR_PREFIX + "<paw>).";
+			return result;
+		}
+		fs::path folder = outputFolder.empty() ? storePath.parent_path() : fs::path(outputFolder);
+		fs::path outputPath = folder / (storePath.stem().string() + "_3d.npy");
+		FILE* file = std::fopen(outputPath.string().c_str(), "wb");
+		if (file == nullptr) {
+			result.message = "Cannot create " + outputPath.string() + ".";
+			return result;
+		}
+
+		bool timestamps = store.HasTimestamps();
+		int64_t frameCount = store.FrameCount();
+		std::string header = NpyHeader(paws, timestamps, frameCount);
+		bool written = std::fwrite(header.data(), 1, header.size(), file) == header.size();
+		size_t recordBytes = (timestamps ? sizeof(double) : 0) + paws.size() * PAW_RECORD_BYTES;
+		std::vector<float> columns(static_cast<size_t>(CHUNK_FRAMES) * 10);
+		std::vector<uint8_t> flags(static_cast<size_t>(CHUNK_FRAMES));
+		std::vector<uint8_t> records(static_cast<size_t>(CHUNK_FRAMES) * recordBytes);
+		result.flagged.assign(paws.size(), 0);
+		for (int64_t first = 0; first < frameCount && written; first += CHUNK_FRAMES) {
+			int64_t count = std::min(CHUNK_FRAMES, frameCount - first);
+			size_t frames = static_cast<size_t>(count);
+			size_t offset = 0;
+			if (timestamps) {
+				for (size_t frame = 0; frame < frames; frame++) {
+					double time = store.Timestamp(first + static_cast<int64_t>(frame));
+					std::memcpy(records.data() + frame * recordBytes, &time, sizeof(double));
+				}
+				offset = sizeof(double);
+			}
+			for (size_t p = 0; p < paws.size(); p++, offset += PAW_RECORD_BYTES) {
+				float* column[10];
+				for (size_t c = 0; c < 10; c++) {
+					column[c] = columns.data() + c * static_cast<size_t>(CHUNK_FRAMES);
+				}
+				store.ReadColumn(first, count, paws[p].side, PoseCoordinate::X, column[0]);
+				store.ReadColumn(first, count, paws[p].side, PoseCoordinate::Y, column[1]);
+				store.ReadColumn(first, count, paws[p].side, PoseCoordinate::Likelihood, column[2]);
+				store.ReadColumn(first, count, paws[p].mirror, PoseCoordinate::X, column[3]);
+				store.ReadColumn(first, count, paws[p].mirror, PoseCoordinate::Y, column[4]);
+				store.ReadColumn(first, count, paws[p].mirror, PoseCoordinate::Likelihood, column[5]);
+				triangulator.Triangulate(ViewColumns{ column[0], column[1], column[2] }, ViewColumns{ column[3], column[4], column[5] },
+					frames, PointColumns{ column[6], column[7], column[8], column[9], flags.data() });
+				// Columns to records.
+				for (size_t frame = 0; frame < frames; frame++) {
+					uint8_t* record = records.data() + frame * recordBytes + offset;
+					for (size_t c = 0; c < 4; c++) {
+						std::memcpy(record + c * sizeof(float), column[6 + c] + frame, sizeof(float));
+					}
+					record[4 * sizeof(float)] = flags[frame];
+					result.flagged[p] += flags[frame] != 0;
+				}
+			}
+			written = std::fwrite(records.data(), recordBytes, frames, file) == frames;
+		}
+		written = std::fclose(file) == 0 && written;
+		if (!written) {
+			result.message = "Cannot write " + outputPath.string() + ".";
+			return result;
+		}
+		result.succeeded = true;
+		result.frameCount = frameCount;
+		result.message = storePath.string() + " -> " + outputPath.string() + ":";
+		for (size_t p = 0; p < paws.size(); p++) {
+			char text[64];
+			std::snprintf(text, sizeof(text), " %s %.1f%%", paws[p].name.c_str(),
+				frameCount > 0 ? 100.0 * result.flagged[p] / frameCount : 0.0);
+			result.message += text;
+		}
+		result.message += " flagged";
+		return result;
+	}
+}
+
+
+int main(int argc, char* argv[]) {
+	std::string calibrationPath;
+	std::string pointsPath;
+	std::string configPath;
+	std::string outputFolder;
+	std::vector<std::string> storeArgs;
+	double pcutoff = -1.0;
+	size_t threads = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if ((arg == "-k" || arg == "--calibration") && hasValue) {
+			calibrationPath = argv[++i];
+		}
+		else if (arg == "--calibrate" && hasValue) {
+			pointsPath = argv[++i];
+		}
+		else if ((arg == "-c" || arg == "--config") && hasValue) {
+			configPath = argv[++i];
+		}
+		else if (arg == "--pcutoff" && hasValue) {
+			pcutoff = std::atof(argv[++i]);
+		}
+		else if ((arg == "-o" || arg == "--output") && hasValue) {
+			outputFolder = argv[++i];
+		}
+		else if ((arg == "-t" || arg == "--threads") && hasValue) {
+			threads = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+		}
+		else if (!arg.empty() && arg[0] != '-') {
+			storeArgs.push_back(arg);
+		}
+		else {
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (calibrationPath.empty() || (pointsPath.empty() == storeArgs.empty())) {
+		PrintUsage();
+		return 2;
+	}
+	if (!pointsPath.empty()) {
+		return Calibrate(pointsPath, calibrationPath) ? 0 : 1;
+	}
+
+	MirrorCalibration calibration;
+	if (!calibration.Load(calibrationPath)) {
+		std::fprintf(stderr, "%s\n", calibration.LastError().c_str());
+		return 1;
+	}
+	if (pcutoff < 0.0) {
+		YamlFile config;
+		if (!configPath.empty() && !config.Load(configPath)) {
+			std::fprintf(stderr, "Cannot read %s.\n", configPath.c_str());
+			return 1;
+		}
+		pcutoff = config.GetNumber("pcutoff", DEFAULT_PCUTOFF);
+	}
+
+	std::vector<fs::path> stores;
+	for (const std::string& arg : storeArgs) {
+		std::error_code error;
+		if (!fs::is_directory(arg, error)) {
+			stores.push_back(arg);
+			continue;
+		}
+		std::vector<fs::path> found;
+		for (const fs::directory_entry& entry : fs::directory_iterator(arg, error)) {
+			if (entry.path().extension() == ".kwapose") {
+				found.push_back(entry.path());
+			}
+		}
+		std::sort(found.begin(), found.end());
+		stores.insert(stores.end(), found.begin(), found.end());
+	}
+	if (stores.empty()) {
+		std::fprintf(stderr, "No pose stores found.\n");
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	Triangulator triangulator(calibration, pcutoff);
+	ThreadPool pool(std::min(threads > 0 ? threads : static_cast<size_t>(std::thread::hardware_concurrency()), stores.size()));
+	std::vector<Result> results(stores.size());
+	pool.ParallelFor(stores.size(), [&](size_t index, size_t) {
+		results[index] = Triangulate(triangulator, stores[index], outputFolder);
+		std::fprintf(results[index].succeeded ? stdout : stderr, "%s\n", results[index].message.c_str());
+		std::fflush(stdout);
+	});
+	int failures = 0;
+	int64_t frames = 0;
+	for (const Result& result : results) {
+		failures += result.succeeded ? 0 : 1;
+		frames += result.frameCount;
+	}
+	double elapsed = SecondsSince(start);
+	std::printf("%lld frames of %zu stores in %.2f s (%.1f M frames/s); pcutoff %.2f\n", static_cast<long long>(frames),
+		stores.size(), elapsed, elapsed > 0.0 ? frames / elapsed / 1e6 : 0.0, pcutoff);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Hands batches (e.g., of frames) from one pipeline stage thread to the next in order,
+	/// and recycles their buffers: a stage takes an unused batch with <c>Acquire()</c>, fills
+	/// it, and <c>Push()</c>es it; the next stage <c>Pop()</c>s it and, when done,
+	/// <c>Release()</c>s it for reuse. The batches released up front bound the number of
+	/// batches in flight.
+	/// </summary>
+	template <typename T>
+	class BatchQueue {
+	public:
+		BatchQueue() : stopped(false) {
+		}
+
+		/// <summary>
+		/// Take an unused batch to fill; returns <c>false</c> once stopped.
+		/// </summary>
+		bool Acquire(T& batch) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->changed.wait(lock, [this] { return this->stopped || !this->free.empty(); });
+			if (this->stopped) {
+				return false;
+			}
+			batch = std::move(this->free.front());
+			this->free.pop_front();
+			return true;
+		}
+
+		void Push(T&& batch) {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->full.push_back(std::move(batch));
+			this->changed.notify_all();
+		}
+
+		void Pop(T& batch) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->changed.wait(lock, [this] { return !this->full.empty(); });
+			batch = std::move(this->full.front());
+			this->full.pop_front();
+		}
+
+		void Release(T&& batch) {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->free.push_back(std::move(batch));
+			this->changed.notify_all();
+		}
+
+		/// <summary>
+		/// Make <c>Acquire()</c> fail, e.g., when a later stage failed.
+		/// </summary>
+		void Stop() {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopped = true;
+			this->changed.notify_all();
+		}
+
+	private:
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::deque<T> free;
+		std::deque<T> full;
+		bool stopped;
+	};
+}
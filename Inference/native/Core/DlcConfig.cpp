@@ -0,0 +1,237 @@
+#include "DlcConfig.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+
+namespace KwaInference {
+
+	namespace {
+		namespace fs = std::filesystem;
+
+		std::string Trim(const std::string& text) {
+			size_t begin = text.find_first_not_of(" \t\r\n");
+			if (begin == std::string::npos) {
+				return "";
+			}
+			size_t end = text.find_last_not_of(" \t\r\n");
+			return text.substr(begin, end - begin + 1);
+		}
+
+		/// <summary>
+		/// Remove a comment (from a '#' at the start or after white space) and quotes.
+		/// </summary>
+		std::string ScalarValue(const std::string& text) {
+			std::string value = text;
+			if (value.empty() || (value[0] != '"' && value[0] != '\'')) {
+				size_t comment = value.find(" #");
+				if (comment != std::string::npos) {
+					value.erase(comment);
+				}
+				if (!value.empty() && value[0] == '#') {
+					value.clear();
+				}
+			}
+			value = Trim(value);
+			if (value.size() >= 2 && (value[0] == '"' || value[0] == '\'') && value.back() == value[0]) {
+				value = value.substr(1, value.size() - 2);
+			}
+			return value;
+		}
+
+		/// <summary>
+		/// Training iterations of a snapshot file named snapshot-&lt;iterations&gt;.&lt;ext&gt;;
+		/// -1 if the name does not match.
+		/// </summary>
+		long long SnapshotIterations(const fs::path& path) {
+			std::string stem = path.stem().string();
+			const std::string prefix = "snapshot-";
+			if (stem.compare(0, prefix.size(), prefix) != 0 || stem.size() == prefix.size()) {
+				return -1;
+			}
+			std::string digits = stem.substr(prefix.size());
+			if (digits.find_first_not_of("0123456789") != std::string::npos) {
+				return -1;
+			}
+			return std::atoll(digits.c_str());
+		}
+	}
+
+	bool YamlFile::Load(const std::string& path) {
+		std::ifstream file(path);
+		if (!file) {
+			return false;
+		}
+		this->scalars.clear();
+		this->lists.clear();
+		std::string line;
+		std::string listKey;  // Key of the block list being read.
+		while (std::getline(file, line)) {
+			std::string trimmed = Trim(line);
+			if (trimmed.empty() || trimmed[0] == '#') {
+				continue;
+			}
+			if (trimmed.compare(0, 2, "- ") == 0 || trimmed == "-") {
+				std::string item = Trim(trimmed.substr(1));
+				if (!listKey.empty() && item.compare(0, 1, "-") != 0) {
+					this->lists[listKey].push_back(ScalarValue(item));
+				}
+				continue;
+			}
+			size_t colon = line.find(':');
+			if (line[0] == ' ' || line[0] == '\t' || colon == std::string::npos) {
+				listKey.clear();  // Nested mapping.
+				continue;
+			}
+			std::string key = Trim(line.substr(0, colon));
+			std::string value = ScalarValue(line.substr(colon + 1));
+			if (value.empty()) {
+				listKey = key;
+				this->lists[key];
+			}
+			else {
+				listKey.clear();
+				this->scalars[key] = value;
+			}
+		}
+		return true;
+	}
+
+	bool YamlFile::Has(const std::string& key) const {
+		return this->scalars.count(key) > 0 || this->lists.count(key) > 0;
+	}
+
+	std::string YamlFile::Get(const std::string& key, const std::string& defaultValue) const {
+		auto found = this->scalars.find(key);
+		return found != this->scalars.end() ? found->second : defaultValue;
+	}
+
+	double YamlFile::GetNumber(const std::string& key, double defaultValue) const {
+		auto found = this->scalars.find(key);
+		if (found == this->scalars.end()) {
+			return defaultValue;
+		}
+		char* end;
+		double value = std::strtod(found->second.c_str(), &end);
+		return *end == '\0' ? value : defaultValue;
+	}
+
+	bool YamlFile::GetBool(const std::string& key, bool defaultValue) const {
+		std::string value = this->Get(key);
+		std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		if (value == "true" || value == "yes") {
+			return true;
+		}
+		if (value == "false" || value == "no") {
+			return false;
+		}
+		return defaultValue;
+	}
+
+	std::vector<std::string> YamlFile::GetList(const std::string& key) const {
+		auto found = this->lists.find(key);
+		return found != this->lists.end() ? found->second : std::vector<std::string>();
+	}
+
+	PoseConfig::PoseConfig() : stride(8.0), locrefStdev(7.2801), locationRefinement(true), netType("resnet_50") {
+	}
+
+	DlcProject::DlcProject()
+		: shuffle(1), snapshotIndex(-1), batchSize(1), pcutoff(0.6), cropping(false), x1(0), x2(0), y1(0), y2(0) {
+	}
+
+	bool DlcProject::Load(const std::string& configPath, int shuffle) {
+		YamlFile config;
+		if (!config.Load(configPath)) {
+			return this->Fail("Cannot read DLC config file " + configPath + ".");
+		}
+		this->task = config.Get("Task");
+		this->date = config.Get("date");
+		this->bodyparts = config.GetList("bodyparts");
+		this->shuffle = shuffle;
+		std::string snapshot = config.Get("snapshotindex", "-1");
+		this->snapshotIndex = snapshot == "all" ? -1 : std::atoi(snapshot.c_str());
+		this->batchSize = std::max(1, static_cast<int>(config.GetNumber("batch_size", 1)));
+		this->pcutoff = config.GetNumber("pcutoff", 0.6);
+		this->cropping = config.GetBool("cropping", false);
+		this->x1 = static_cast<int>(config.GetNumber("x1", 0));
+		this->x2 = static_cast<int>(config.GetNumber("x2", 0));
+		this->y1 = static_cast<int>(config.GetNumber("y1", 0));
+		this->y2 = static_cast<int>(config.GetNumber("y2", 0));
+		std::vector<std::string> fractions = config.GetList("TrainingFraction");
+		if (this->task.empty() || this->bodyparts.empty() || fractions.empty()) {
+			return this->Fail("DLC config file " + configPath + " lacks Task, bodyparts, or TrainingFraction.");
+		}
+
+		// Named as by DLC's get_model_folder(), truncating the training percentage.
+		int trainPercent = static_cast<int>(std::atof(fractions[0].c_str()) * 100);
+		fs::path folder = fs::path(configPath).parent_path() / "dlc-models"
+			/ ("iteration-" + config.Get("iteration", "0"))
+			/ (this->task + this->date + "-trainset" + std::to_string(trainPercent) + "shuffle" + std::to_string(shuffle));
+		this->modelFolder = folder.string();
+
+		YamlFile poseFile;
+		std::string posePath = (folder / "test" / "pose_cfg.yaml").string();
+		if (!poseFile.Load(posePath)) {
+			return this->Fail("Cannot read the model's configuration " + posePath + ".");
+		}
+		this->pose = PoseConfig();
+		this->pose.jointNames = poseFile.GetList("all_joints_names");
+		this->pose.stride = poseFile.GetNumber("stride", this->pose.stride);
+		this->pose.locrefStdev = poseFile.GetNumber("locref_stdev", this->pose.locrefStdev);
+		this->pose.locationRefinement = poseFile.GetBool("location_refinement", this->pose.locationRefinement);
+		this->pose.netType = poseFile.Get("net_type", this->pose.netType);
+		if (this->pose.jointNames.empty()) {
+			this->pose.jointNames = this->bodyparts;
+		}
+		return true;
+	}
+
+	std::string DlcProject::FindModel() {
+		fs::path train = fs::path(this->modelFolder) / "train";
+		std::error_code error;
+		std::vector<long long> checkpoints;
+		std::vector<long long> exports;
+		for (const fs::directory_entry& entry : fs::directory_iterator(train, error)) {
+			long long iterations = SnapshotIterations(entry.path());
+			if (iterations < 0) {
+				continue;
+			}
+			std::vector<long long>& list = entry.path().extension() == ".onnx" ? exports : checkpoints;
+			if (entry.path().extension() == ".onnx" || entry.path().extension() == ".index") {
+				list.push_back(iterations);
+			}
+		}
+		if (exports.empty()) {
+			this->Fail("No ONNX model in " + train.string() + "; export the trained snapshot with export_onnx.py.");
+			return "";
+		}
+		// Select like DLC among the TensorFlow checkpoints if they are present, else among the exports.
+		std::vector<long long>& candidates = checkpoints.empty() ? exports : checkpoints;
+		std::sort(candidates.begin(), candidates.end());
+		int count = static_cast<int>(candidates.size());
+		int index = this->snapshotIndex < 0 ? count + this->snapshotIndex : this->snapshotIndex;
+		if (index < 0 || index >= count) {
+			this->Fail("snapshotindex " + std::to_string(this->snapshotIndex) + " is out of range for the "
+				+ std::to_string(count) + " snapshots in " + train.string() + ".");
+			return "";
+		}
+		fs::path model = train / ("snapshot-" + std::to_string(candidates[index]) + ".onnx");
+		if (!fs::exists(model, error)) {
+			this->Fail("Snapshot " + std::to_string(candidates[index]) + " has not been exported to " + model.string() + ".");
+			return "";
+		}
+		return model.string();
+	}
+
+	std::string DlcProject::ScorerName(const std::string& modelPath) const {
+		std::string network = this->pose.netType;
+		network.erase(std::remove(network.begin(), network.end(), '_'), network.end());
+		long long iterations = SnapshotIterations(fs::path(modelPath));
+		return "DLC_" + network + "_" + this->task + this->date + "shuffle" + std::to_string(this->shuffle) + "_"
+			+ std::to_string(std::max(0LL, iterations));
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Reader of the YAML files of a DLC project (config.yaml, pose_cfg.yaml). Only what these
+	/// files use at the top level is understood: scalars (<c>key: value  # comment</c>) and
+	/// block lists of scalars (<c>- item</c>); nested items are skipped.
+	/// </summary>
+	class YamlFile {
+	public:
+		bool Load(const std::string& path);
+
+		bool Has(const std::string& key) const;
+		std::string Get(const std::string& key, const std::string& defaultValue = "") const;
+		double GetNumber(const std::string& key, double defaultValue) const;
+		bool GetBool(const std::string& key, bool defaultValue) const;
+		std::vector<std::string> GetList(const std::string& key) const;
+
+	private:
+		std::map<std::string, std::string> scalars;
+		std::map<std::string, std::vector<std::string>> lists;
+	};
+
+	/// <summary>
+	/// Parameters of the pose network's outputs (from the model's test/pose_cfg.yaml).
+	/// </summary>
+	struct PoseConfig {
+		std::vector<std::string> jointNames;
+		double stride;               // Pixels per scoremap cell.
+		double locrefStdev;          // Scale of the location refinement outputs in pixels.
+		bool locationRefinement;
+		std::string netType;         // E.g., "resnet_50".
+
+		PoseConfig();
+		size_t JointCount() const { return this->jointNames.size(); }
+	};
+
+	/// <summary>
+	/// The parts of a DLC project (config.yaml) needed to analyze videos, and the model
+	/// folder of one shuffle of its current iteration, laid out as by DLC:
+	/// dlc-models/iteration-&lt;i&gt;/&lt;Task&gt;&lt;date&gt;-trainset&lt;%&gt;shuffle&lt;n&gt;/{train,test}.
+	/// The project is located by the folder of config.yaml, not by its project_path.
+	/// </summary>
+	class DlcProject {
+	public:
+		DlcProject();
+
+		/// <returns><c>false</c> if config.yaml or the model's pose_cfg.yaml cannot be read;
+		/// see <c>LastError()</c>.</returns>
+		bool Load(const std::string& configPath, int shuffle = 1);
+
+		/// <summary>
+		/// The ONNX export of the snapshot selected by <c>snapshotindex</c> (-1: the last one):
+		/// train/snapshot-&lt;iterations&gt;.onnx, as written by export_onnx.py.
+		/// </summary>
+		/// <returns>Empty if there is no such file; see <c>LastError()</c>.</returns>
+		std::string FindModel();
+
+		/// <summary>
+		/// Scorer name of the results of <c>modelPath</c>, as DLC names them, e.g.,
+		/// "DLC_resnet50_sa-GA-Basler-acA720-520ucAug23shuffle1_1030000". Result files are named
+		/// &lt;video name&gt;&lt;scorer&gt;.csv.
+		/// </summary>
+		std::string ScorerName(const std::string& modelPath) const;
+
+		const std::string& ModelFolder() const { return this->modelFolder; }
+		const PoseConfig& Pose() const { return this->pose; }
+		const std::vector<std::string>& Bodyparts() const { return this->bodyparts; }
+		int BatchSize() const { return this->batchSize; }
+		double PCutoff() const { return this->pcutoff; }
+		/// <summary>
+		/// Crop rectangle [x1, x2) x [y1, y2) of frames before analysis, if cropping is enabled.
+		/// </summary>
+		bool Cropping() const { return this->cropping; }
+		int CropX1() const { return this->x1; }
+		int CropX2() const { return this->x2; }
+		int CropY1() const { return this->y1; }
+		int CropY2() const { return this->y2; }
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		bool Fail(const std::string& message) {
+			this->lastError = message;
+			return false;
+		}
+
+		std::string task;
+		std::string date;
+		int shuffle;
+		int snapshotIndex;
+		int batchSize;
+		double pcutoff;
+		bool cropping;
+		int x1, x2, y1, y2;
+		std::vector<std::string> bodyparts;
+		std::string modelFolder;
+		PoseConfig pose;
+		std::string lastError;
+	};
+}
@@ -0,0 +1,302 @@
+#include "FrameConverter.h"
+
+#include <algorithm>
+
+#include "Simd.h"
+
+
+namespace KwaInference {
+
+	namespace {
+
+		// BT.601 YCbCr to RGB: R = Y + 1.402 Cr', G = Y - 0.344136 Cb' - 0.714136 Cr',
+		// B = Y + 1.772 Cb' in full range; limited range stretches Y by 255 / 219 (from 16) and
+		// Cb/Cr by 255 / 224.
+		const float CR_TO_R = 1.402f;
+		const float CB_TO_G = -0.344136f;
+		const float CR_TO_G = -0.714136f;
+		const float CB_TO_B = 1.772f;
+		const float LIMITED_Y_OFFSET = -16.0f;
+		const float LIMITED_Y_SCALE = 255.0f / 219.0f;
+		const float LIMITED_C_SCALE = 255.0f / 224.0f;
+
+		struct Coefficients {
+			float yOffset, yScale;
+			float crToR, cbToG, crToG, cbToB;
+			float scale, offset;
+		};
+
+		inline float Normalize(float value, const Coefficients& c) {
+			return std::min(std::max(value, 0.0f), 255.0f) * c.scale + c.offset;
+		}
+
+		/// <summary>
+		/// Store pixel <c>i</c> of a row: interleaved at <c>r</c> (NHWC) or in the planes
+		/// <c>r</c>, <c>g</c>, <c>b</c> (NCHW).
+		/// </summary>
+		template <bool Interleaved>
+		inline void StorePixel(float red, float green, float blue, float* r, float* g, float* b, int i) {
+			if (Interleaved) {
+				r[i * 3] = red;
+				r[i * 3 + 1] = green;
+				r[i * 3 + 2] = blue;
+			}
+			else {
+				r[i] = red;
+				g[i] = green;
+				b[i] = blue;
+			}
+		}
+
+		/// <summary>
+		/// Convert pixels [x, x + count) of a YCbCr422 row into pixels [i, i + count) of the output row.
+		/// </summary>
+		template <bool Interleaved>
+		void YCbCrPixels(const uint8_t* row, int x, int count, const Coefficients& c, float* r, float* g, float* b, int i) {
+			for (int k = 0; k < count; k++) {
+				int px = x + k;
+				const uint8_t* pair = row + (px >> 1) * 4;
+				float luma = (row[px * 2] + c.yOffset) * c.yScale;
+				float cb = pair[1] - 128.0f;
+				float cr = pair[3] - 128.0f;
+				StorePixel<Interleaved>(Normalize(luma + c.crToR * cr, c), Normalize(luma + c.cbToG * cb + c.crToG * cr, c),
+					Normalize(luma + c.cbToB * cb, c), r, g, b, i + k);
+			}
+		}
+
+#ifdef KWA_SIMD_SSE2
+		/// <summary>
+		/// Interleave 4 pixels of planar R, G, B into 12 floats (r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3).
+		/// </summary>
+		inline void Interleave(__m128 red, __m128 green, __m128 blue, __m128& out0, __m128& out1, __m128& out2) {
+			__m128 rg01 = _mm_unpacklo_ps(red, green);                             // r0 g0 r1 g1
+			__m128 rg23 = _mm_unpackhi_ps(red, green);                             // r2 g2 r3 g3
+			__m128 b0r1 = _mm_shuffle_ps(blue, rg01, _MM_SHUFFLE(2, 2, 0, 0));    // b0 b0 r1 r1
+			__m128 g1b1 = _mm_shuffle_ps(rg01, blue, _MM_SHUFFLE(1, 1, 3, 3));    // g1 g1 b1 b1
+			__m128 b2r3 = _mm_shuffle_ps(blue, rg23, _MM_SHUFFLE(2, 2, 2, 2));    // b2 b2 r3 r3
+			__m128 g3b3 = _mm_shuffle_ps(rg23, blue, _MM_SHUFFLE(3, 3, 3, 3));    // g3 g3 b3 b3
+			out0 = _mm_shuffle_ps(rg01, b0r1, _MM_SHUFFLE(2, 0, 1, 0));
+			out1 = _mm_shuffle_ps(g1b1, rg23, _MM_SHUFFLE(1, 0, 2, 0));
+			out2 = _mm_shuffle_ps(b2r3, g3b3, _MM_SHUFFLE(2, 0, 2, 0));
+		}
+
+		inline __m128 Normalize(__m128 value, __m128 scale, __m128 offset) {
+			__m128 clamped = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+			return _mm_add_ps(_mm_mul_ps(clamped, scale), offset);
+		}
+
+		/// <summary>
+		/// Convert 4 pixels from <c>src</c> (8 bytes, starting at an even pixel).
+		/// </summary>
+		template <bool Interleaved>
+		inline void YCbCrPixelsSse2(const uint8_t* src, const Coefficients& c, float* r, float* g, float* b, int i) {
+			__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+			// 32-bit lanes of (Y, chroma) words: Y in the low and Cb, Cr, Cb, Cr in the high words.
+			__m128i words = _mm_unpacklo_epi8(bytes, _mm_setzero_si128());
+			__m128 luma = _mm_cvtepi32_ps(_mm_and_si128(words, _mm_set1_epi32(0xFFFF)));
+			__m128 chroma = _mm_sub_ps(_mm_cvtepi32_ps(_mm_srli_epi32(words, 16)), _mm_set1_ps(128.0f));
+			__m128 cb = _mm_shuffle_ps(chroma, chroma, _MM_SHUFFLE(2, 2, 0, 0));
+			__m128 cr = _mm_shuffle_ps(chroma, chroma, _MM_SHUFFLE(3, 3, 1, 1));
+			luma = _mm_mul_ps(_mm_add_ps(luma, _mm_set1_ps(c.yOffset)), _mm_set1_ps(c.yScale));
+
+			__m128 scale = _mm_set1_ps(c.scale);
+			__m128 offset = _mm_set1_ps(c.offset);
+			__m128 red = Normalize(_mm_add_ps(luma, _mm_mul_ps(_mm_set1_ps(c.crToR), cr)), scale, offset);
+			__m128 green = Normalize(_mm_add_ps(_mm_add_ps(luma, _mm_mul_ps(_mm_set1_ps(c.cbToG), cb)),
+				_mm_mul_ps(_mm_set1_ps(c.crToG), cr)), scale, offset);
+			__m128 blue = Normalize(_mm_add_ps(luma, _mm_mul_ps(_mm_set1_ps(c.cbToB), cb)), scale, offset);
+			if (Interleaved) {
+				__m128 out0, out1, out2;
+				Interleave(red, green, blue, out0, out1, out2);
+				_mm_storeu_ps(r + i * 3, out0);
+				_mm_storeu_ps(r + i * 3 + 4, out1);
+				_mm_storeu_ps(r + i * 3 + 8, out2);
+			}
+			else {
+				_mm_storeu_ps(r + i, red);
+				_mm_storeu_ps(g + i, green);
+				_mm_storeu_ps(b + i, blue);
+			}
+		}
+#endif
+
+#ifdef KWA_SIMD_AVX2
+		inline __m256 Normalize(__m256 value, __m256 scale, __m256 offset) {
+			__m256 clamped = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+			return _mm256_add_ps(_mm256_mul_ps(clamped, scale), offset);
+		}
+
+		/// <summary>
+		/// Convert 8 pixels from <c>src</c> (16 bytes, starting at an even pixel).
+		/// </summary>
+		template <bool Interleaved>
+		inline void YCbCrPixelsAvx2(const uint8_t* src, const Coefficients& c, float* r, float* g, float* b, int i) {
+			const __m128i Y_BYTES = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i CB_BYTES = _mm_setr_epi8(1, 1, 5, 5, 9, 9, 13, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i CR_BYTES = _mm_setr_epi8(3, 3, 7, 7, 11, 11, 15, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+			__m256 luma = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_shuffle_epi8(bytes, Y_BYTES)));
+			__m256 cb = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_shuffle_epi8(bytes, CB_BYTES)));
+			__m256 cr = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_shuffle_epi8(bytes, CR_BYTES)));
+			cb = _mm256_sub_ps(cb, _mm256_set1_ps(128.0f));
+			cr = _mm256_sub_ps(cr, _mm256_set1_ps(128.0f));
+			luma = _mm256_mul_ps(_mm256_add_ps(luma, _mm256_set1_ps(c.yOffset)), _mm256_set1_ps(c.yScale));
+
+			__m256 scale = _mm256_set1_ps(c.scale);
+			__m256 offset = _mm256_set1_ps(c.offset);
+			__m256 red = Normalize(_mm256_add_ps(luma, _mm256_mul_ps(_mm256_set1_ps(c.crToR), cr)), scale, offset);
+			__m256 green = Normalize(_mm256_add_ps(_mm256_add_ps(luma, _mm256_mul_ps(_mm256_set1_ps(c.cbToG), cb)),
+				_mm256_mul_ps(_mm256_set1_ps(c.crToG), cr)), scale, offset);
+			__m256 blue = Normalize(_mm256_add_ps(luma, _mm256_mul_ps(_mm256_set1_ps(c.cbToB), cb)), scale, offset);
+			if (Interleaved) {
+				// Interleave pixels 0-3 and 4-7 in the lower and upper lanes, then join the lanes.
+				__m256 rg01 = _mm256_unpacklo_ps(red, green);
+				__m256 rg23 = _mm256_unpackhi_ps(red, green);
+				__m256 b0r1 = _mm256_shuffle_ps(blue, rg01, _MM_SHUFFLE(2, 2, 0, 0));
+				__m256 g1b1 = _mm256_shuffle_ps(rg01, blue, _MM_SHUFFLE(1, 1, 3, 3));
+				__m256 b2r3 = _mm256_shuffle_ps(blue, rg23, _MM_SHUFFLE(2, 2, 2, 2));
+				__m256 g3b3 = _mm256_shuffle_ps(rg23, blue, _MM_SHUFFLE(3, 3, 3, 3));
+				__m256 out0 = _mm256_shuffle_ps(rg01, b0r1, _MM_SHUFFLE(2, 0, 1, 0));
+				__m256 out1 = _mm256_shuffle_ps(g1b1, rg23, _MM_SHUFFLE(1, 0, 2, 0));
+				__m256 out2 = _mm256_shuffle_ps(b2r3, g3b3, _MM_SHUFFLE(2, 0, 2, 0));
+				_mm256_storeu_ps(r + i * 3, _mm256_permute2f128_ps(out0, out1, 0x20));
+				_mm256_storeu_ps(r + i * 3 + 8, _mm256_permute2f128_ps(out2, out0, 0x30));
+				_mm256_storeu_ps(r + i * 3 + 16, _mm256_permute2f128_ps(out1, out2, 0x31));
+			}
+			else {
+				_mm256_storeu_ps(r + i, red);
+				_mm256_storeu_ps(g + i, green);
+				_mm256_storeu_ps(b + i, blue);
+			}
+		}
+#endif
+
+		template <bool Interleaved>
+		void YCbCrRow(SimdLevel level, const uint8_t* row, int x, int count, const Coefficients& c, float* r, float* g, float* b) {
+			int i = 0;
+			// Vector steps start at a pair of pixels.
+			if ((x & 1) != 0 && count > 0) {
+				YCbCrPixels<Interleaved>(row, x, 1, c, r, g, b, 0);
+				i = 1;
+			}
+#ifdef KWA_SIMD_AVX2
+			if (level >= SimdLevel::Avx2) {
+				for (; i + 8 <= count; i += 8) {
+					YCbCrPixelsAvx2<Interleaved>(row + (x + i) * 2, c, r, g, b, i);
+				}
+			}
+#endif
+#ifdef KWA_SIMD_SSE2
+			if (level >= SimdLevel::Sse2) {
+				for (; i + 4 <= count; i += 4) {
+					YCbCrPixelsSse2<Interleaved>(row + (x + i) * 2, c, r, g, b, i);
+				}
+			}
+#endif
+			(void)level;
+			YCbCrPixels<Interleaved>(row, x + i, count - i, c, r, g, b, i);
+		}
+
+		template <bool Interleaved>
+		void RgbRow(const uint8_t* row, int x, int count, const Coefficients& c, float* r, float* g, float* b) {
+			const uint8_t* src = row + x * 3;
+			for (int i = 0; i < count; i++) {
+				StorePixel<Interleaved>(src[i * 3] * c.scale + c.offset, src[i * 3 + 1] * c.scale + c.offset,
+					src[i * 3 + 2] * c.scale + c.offset, r, g, b, i);
+			}
+		}
+	}
+
+	SimdLevel MaxSimdLevel() {
+#if defined(KWA_SIMD_AVX2)
+		return SimdLevel::Avx2;
+#elif defined(KWA_SIMD_SSE2)
+		return SimdLevel::Sse2;
+#else
+		return SimdLevel::Scalar;
+#endif
+	}
+
+	const char* SimdLevelName(SimdLevel level) {
+		switch (level) {
+		case SimdLevel::Avx2: return "AVX2";
+		case SimdLevel::Sse2: return "SSE2";
+		default: return "scalar";
+		}
+	}
+
+	size_t FrameBytes(PixelFormat format, int width, int height) {
+		size_t bytesPerPixel = format == PixelFormat::Rgb8 ? 3 : 2;
+		return static_cast<size_t>(width) * height * bytesPerPixel;
+	}
+
+	FrameConverter::FrameConverter() : format(PixelFormat::Rgb8), frameWidth(0), frameHeight(0), x(0), y(0), width(0),
+		height(0), channelsLast(true), simdLevel(MaxSimdLevel()), yOffset(0.0f), yScale(1.0f), crToR(CR_TO_R),
+		cbToG(CB_TO_G), crToG(CR_TO_G), cbToB(CB_TO_B), scale(1.0f), offset(0.0f) {
+	}
+
+	bool FrameConverter::Configure(PixelFormat format, int frameWidth, int frameHeight, int x, int y, int width, int height,
+		bool channelsLast, YCbCrRange range) {
+		// YCbCr 4:2:2 rows consist of whole pairs of pixels.
+		if (x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > frameWidth || y + height > frameHeight
+			|| (format == PixelFormat::YCbCr422_8 && frameWidth % 2 != 0)) {
+			return false;
+		}
+		this->format = format;
+		this->frameWidth = frameWidth;
+		this->frameHeight = frameHeight;
+		this->x = x;
+		this->y = y;
+		this->width = width;
+		this->height = height;
+		this->channelsLast = channelsLast;
+		bool limited = range == YCbCrRange::Limited;
+		float chromaScale = limited ? LIMITED_C_SCALE : 1.0f;
+		this->yOffset = limited ? LIMITED_Y_OFFSET : 0.0f;
+		this->yScale = limited ? LIMITED_Y_SCALE : 1.0f;
+		this->crToR = CR_TO_R * chromaScale;
+		this->cbToG = CB_TO_G * chromaScale;
+		this->crToG = CR_TO_G * chromaScale;
+		this->cbToB = CB_TO_B * chromaScale;
+		return true;
+	}
+
+	void FrameConverter::SetNormalization(float scale, float offset) {
+		this->scale = scale;
+		this->offset = offset;
+	}
+
+	void FrameConverter::SetSimdLevel(SimdLevel level) {
+		this->simdLevel = std::min(level, MaxSimdLevel());
+	}
+
+	void FrameConverter::Convert(const uint8_t* frame, float* output) const {
+		Coefficients c = { this->yOffset, this->yScale, this->crToR, this->cbToG, this->crToG, this->cbToB, this->scale,
+			this->offset };
+		size_t rowBytes = FrameBytes(this->format, this->frameWidth, 1);
+		size_t pixels = static_cast<size_t>(this->width) * this->height;
+		for (int row = 0; row < this->height; row++) {
+			const uint8_t* src = frame + (this->y + row) * rowBytes;
+			if (this->channelsLast) {
+				float* dst = output + static_cast<size_t>(row) * this->width * 3;
+				if (this->format == PixelFormat::YCbCr422_8) {
+					YCbCrRow<true>(this->simdLevel, src, this->x, this->width, c, dst, nullptr, nullptr);
+				}
+				else {
+					RgbRow<true>(src, this->x, this->width, c, dst, nullptr, nullptr);
+				}
+			}
+			else {
+				float* r = output + static_cast<size_t>(row) * this->width;
+				float* g = r + pixels;
+				float* b = g + pixels;
+				if (this->format == PixelFormat::YCbCr422_8) {
+					YCbCrRow<false>(this->simdLevel, src, this->x, this->width, c, r, g, b);
+				}
+				else {
+					RgbRow<false>(src, this->x, this->width, c, r, g, b);
+				}
+			}
+		}
+	}
+}
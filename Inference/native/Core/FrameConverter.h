@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Pixel formats of frames to convert: packed RGB (as decoded by ffmpeg with -pix_fmt
+	/// rgb24) and YCbCr 4:2:2 (Y0 Cb Y1 Cr per pair of pixels), the camera's PixelFormat
+	/// YCbCr422_8 and ffmpeg's yuyv422.
+	/// </summary>
+	enum class PixelFormat {
+		Rgb8,
+		YCbCr422_8,
+	};
+
+	/// <summary>
+	/// Value range of YCbCr frames: full (0-255, JPEG; Basler cameras) or limited (Y 16-235,
+	/// Cb/Cr 16-240; BT.601 video, as decoded by ffmpeg and OpenCV).
+	/// </summary>
+	enum class YCbCrRange {
+		Full,
+		Limited,
+	};
+
+	/// <summary>
+	/// Vector instruction sets of the conversion, as far as compiled in (see KWA_NATIVE_ARCH).
+	/// </summary>
+	enum class SimdLevel {
+		Scalar,
+		Sse2,
+		Avx2,
+	};
+
+	/// <summary>
+	/// The best instruction set compiled in.
+	/// </summary>
+	SimdLevel MaxSimdLevel();
+	const char* SimdLevelName(SimdLevel level);
+
+	/// <summary>
+	/// Bytes per frame of <c>format</c>; rows are packed.
+	/// </summary>
+	size_t FrameBytes(PixelFormat format, int width, int height);
+
+	/// <summary>
+	/// Converts frames into network input in a single pass per pixel: the crop rectangle is
+	/// read from the frame, converted to RGB (BT.601), clamped to [0, 255], normalized
+	/// (value * scale + offset), and written as floats in NHWC or NCHW layout. YCbCr frames
+	/// are converted with SSE2 or AVX2, 4 or 8 pixels per step, and the remaining pixels of
+	/// each row scalar.
+	/// </summary>
+	class FrameConverter {
+	public:
+		FrameConverter();
+
+		/// <summary>
+		/// Set the frames to convert and the crop rectangle [x, x + width) x [y, y + height),
+		/// which must lie inside the frames.
+		/// </summary>
+		/// <returns><c>false</c> if the crop rectangle is invalid.</returns>
+		bool Configure(PixelFormat format, int frameWidth, int frameHeight, int x, int y, int width, int height,
+			bool channelsLast, YCbCrRange range = YCbCrRange::Full);
+
+		/// <summary>
+		/// Default: scale 1 and offset 0, i.e., values in [0, 255] as expected by DLC networks,
+		/// which subtract their mean pixel themselves.
+		/// </summary>
+		void SetNormalization(float scale, float offset);
+
+		/// <summary>
+		/// Restrict the instruction set, e.g., to compare them; capped at <c>MaxSimdLevel()</c>.
+		/// </summary>
+		void SetSimdLevel(SimdLevel level);
+		SimdLevel GetSimdLevel() const { return this->simdLevel; }
+
+		size_t FrameSize() const { return FrameBytes(this->format, this->frameWidth, this->frameHeight); }
+		/// <summary>
+		/// Floats per converted frame (width * height * 3).
+		/// </summary>
+		size_t OutputSize() const { return static_cast<size_t>(this->width) * this->height * 3; }
+
+		/// <summary>
+		/// Convert <c>frame</c> (<c>FrameSize()</c> bytes, rows top to bottom) into
+		/// <c>output</c> (<c>OutputSize()</c> floats).
+		/// </summary>
+		void Convert(const uint8_t* frame, float* output) const;
+
+	private:
+		PixelFormat format;
+		int frameWidth, frameHeight;
+		int x, y, width, height;
+		bool channelsLast;
+		SimdLevel simdLevel;
+
+		// Y' = (Y + yOffset) * yScale; R = Y' + crToR * Cr', G = Y' + cbToG * Cb' + crToG * Cr',
+		// B = Y' + cbToB * Cb' with Cb' = Cb - 128 and Cr' = Cr - 128.
+		float yOffset, yScale;
+		float crToR, cbToG, crToG, cbToB;
+		float scale, offset;
+	};
+}
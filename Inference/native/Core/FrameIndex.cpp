@@ -0,0 +1,499 @@
+#include "FrameIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "VideoReader.h"
+
+
+namespace KwaInference {
+
+	namespace {
+
+		const double MISSING = std::numeric_limits<double>::quiet_NaN();
+		// Frames over which the clock offset of frame timestamps is averaged, which smooths
+		// their jitter (e.g., of host timestamps) but follows the drift between the clocks.
+		const int64_t OFFSET_SAMPLES = 16;
+
+		/// <summary>
+		/// Parse the first <c>count</c> fields of a CSV row as numbers (NaN where a field is
+		/// empty or missing).
+		/// </summary>
+		/// <returns>The number of fields in the row, up to <c>count</c>.</returns>
+		size_t ParseRow(const char* cursor, double* values, size_t count) {
+			size_t fields = 0;
+			while (fields < count) {
+				char* end;
+				double value = std::strtod(cursor, &end);
+				values[fields++] = end != cursor ? value : MISSING;
+				const char* comma = std::strchr(cursor, ',');
+				if (comma == nullptr) {
+					break;
+				}
+				cursor = comma + 1;
+			}
+			std::fill(values + fields, values + count, MISSING);
+			return fields;
+		}
+
+		/// <summary>
+		/// Read a line of at most <c>size</c> - 1 characters, without the line break.
+		/// </summary>
+		bool ReadLine(FILE* file, char* line, size_t size) {
+			if (std::fgets(line, static_cast<int>(size), file) == nullptr) {
+				return false;
+			}
+			line[std::strcspn(line, "\r\n")] = '\0';
+			return true;
+		}
+	}
+
+	TriggerLogReader::TriggerLogReader() : file(nullptr), pulseCount(-1), hasNext(false), next(), hasLast(false), last(),
+		lastPeriodUs(0.0), interpolatedCount(0) {
+	}
+
+	TriggerLogReader::~TriggerLogReader() {
+		this->Close();
+	}
+
+	bool TriggerLogReader::Open(const std::string& path, int64_t pulseCount) {
+		this->Close();
+		this->file = std::fopen(path.c_str(), "r");
+		if (this->file == nullptr) {
+			this->lastError = "Cannot read " + path + ".";
+			return false;
+		}
+		char line[256];
+		if (!ReadLine(this->file, line, sizeof(line)) || std::strncmp(line, "index,ticks,time_us", 19) != 0) {
+			this->lastError = path + " is no trigger log.";
+			this->Close();
+			return false;
+		}
+		this->pulseCount = pulseCount;
+		this->hasNext = this->ReadRow(this->next);
+		this->hasLast = false;
+		this->lastPeriodUs = 0.0;
+		this->interpolatedCount = 0;
+		if (!this->hasNext && pulseCount < 0) {
+			this->lastError = path + " has no trigger edges.";
+			this->Close();
+			return false;
+		}
+		return true;
+	}
+
+	void TriggerLogReader::Close() {
+		if (this->file != nullptr) {
+			std::fclose(this->file);
+			this->file = nullptr;
+		}
+		this->hasNext = false;
+	}
+
+	bool TriggerLogReader::ReadRow(TriggerTime& row) {
+		char line[256];
+		double values[4];
+		int64_t expected = this->hasNext ? this->next.index + 1 : 0;
+		while (this->file != nullptr && ReadLine(this->file, line, sizeof(line))) {
+			if (ParseRow(line, values, 4) < 3 || !(values[0] >= expected) || !std::isfinite(values[2])) {
+				continue;
+			}
+			row.index = static_cast<int64_t>(values[0]);
+			row.timeUs = values[2];
+			row.hostTimeUs = values[3];
+			row.interpolated = false;
+			return true;
+		}
+		return false;
+	}
+
+	bool TriggerLogReader::Next(TriggerTime& trigger) {
+		int64_t index = this->hasLast ? this->last.index + 1 : 0;
+		if (this->pulseCount >= 0 && index >= this->pulseCount) {
+			return false;
+		}
+		if (this->hasNext && this->next.index == index) {
+			trigger = this->next;
+			this->hasNext = this->ReadRow(this->next);
+		}
+		else if (this->hasNext || this->pulseCount >= 0) {
+			// Lost in telemetry: between the edges around it, or at the period of the last
+			// ones after the end of the log. The first edge starts the recording's clock.
+			trigger.index = index;
+			trigger.interpolated = true;
+			trigger.hostTimeUs = MISSING;
+			if (!this->hasLast) {
+				trigger.timeUs = 0.0;
+			}
+			else if (this->hasNext) {
+				double fraction = 1.0 / static_cast<double>(this->next.index - this->last.index);
+				trigger.timeUs = this->last.timeUs + (this->next.timeUs - this->last.timeUs) * fraction;
+				trigger.hostTimeUs = this->last.hostTimeUs + (this->next.hostTimeUs - this->last.hostTimeUs) * fraction;
+			}
+			else {
+				trigger.timeUs = this->last.timeUs + this->lastPeriodUs;
+				trigger.hostTimeUs = this->last.hostTimeUs + this->lastPeriodUs;
+			}
+			this->interpolatedCount++;
+		}
+		else {
+			return false;
+		}
+		if (this->hasLast) {
+			this->lastPeriodUs = trigger.timeUs - this->last.timeUs;
+		}
+		this->last = trigger;
+		this->hasLast = true;
+		return true;
+	}
+
+	const char* FrameStampSourceName(FrameStampSource source) {
+		switch (source) {
+		case FrameStampSource::Counter: return "camera frame counter";
+		case FrameStampSource::CameraTime: return "camera timestamps";
+		case FrameStampSource::ContainerTime: return "video timestamps";
+		default: return "frame count only";
+		}
+	}
+
+	FrameStampReader::FrameStampReader() : timeBase(0.0), frame(0), chunks(nullptr), counterColumn(-1), timestampColumn(-1),
+		exposureColumn(-1), source(FrameStampSource::None) {
+	}
+
+	FrameStampReader::~FrameStampReader() {
+		this->Close();
+	}
+
+	bool FrameStampReader::Open(const std::string& videoPath, const std::string& chunkPath) {
+		this->Close();
+		this->frame = 0;
+		this->counterColumn = this->timestampColumn = this->exposureColumn = -1;
+		if (!ReadPacketTimes(videoPath, this->packetTimes, this->timeBase, this->lastError)) {
+			return false;
+		}
+		if (!chunkPath.empty()) {
+			this->chunks = std::fopen(chunkPath.c_str(), "r");
+			char line[256];
+			if (this->chunks == nullptr || !ReadLine(this->chunks, line, sizeof(line))) {
+				this->lastError = "Cannot read " + chunkPath + ".";
+				this->Close();
+				return false;
+			}
+			int column = 0;
+			for (char* name = line; name != nullptr; column++) {
+				char* comma = std::strchr(name, ',');
+				if (comma != nullptr) {
+					*comma = '\0';
+				}
+				if (std::strcmp(name, "frame_counter") == 0) {
+					this->counterColumn = column;
+				}
+				else if (std::strcmp(name, "timestamp_ns") == 0) {
+					this->timestampColumn = column;
+				}
+				else if (std::strcmp(name, "exposure_us") == 0) {
+					this->exposureColumn = column;
+				}
+				name = comma != nullptr ? comma + 1 : nullptr;
+			}
+			if (this->counterColumn < 0 && this->timestampColumn < 0 && this->exposureColumn < 0) {
+				this->lastError = chunkPath + " has none of the columns frame_counter, timestamp_ns, and exposure_us.";
+				this->Close();
+				return false;
+			}
+			this->chunkRow.resize(static_cast<size_t>(std::max(this->counterColumn, std::max(this->timestampColumn,
+				this->exposureColumn))) + 1);
+		}
+
+		// Times at a fixed rate were assigned by the recording software, not taken.
+		bool fixedRate = this->packetTimes.size() < 2;
+		if (!fixedRate) {
+			int64_t minStep = std::numeric_limits<int64_t>::max(), maxStep = 0;
+			for (size_t i = 1; i < this->packetTimes.size(); i++) {
+				int64_t step = this->packetTimes[i] - this->packetTimes[i - 1];
+				minStep = std::min(minStep, step);
+				maxStep = std::max(maxStep, step);
+			}
+			fixedRate = minStep > 0 && maxStep - minStep <= 1;  // Rounded to the time base.
+		}
+		this->source = this->counterColumn >= 0 ? FrameStampSource::Counter
+			: (this->timestampColumn >= 0 ? FrameStampSource::CameraTime
+			: (fixedRate ? FrameStampSource::None : FrameStampSource::ContainerTime));
+		if (fixedRate) {
+			this->timeBase = 0.0;
+		}
+		return true;
+	}
+
+	void FrameStampReader::Close() {
+		if (this->chunks != nullptr) {
+			std::fclose(this->chunks);
+			this->chunks = nullptr;
+		}
+	}
+
+	bool FrameStampReader::ReadChunkRow(FrameStamp& stamp) {
+		char line[256];
+		if (!ReadLine(this->chunks, line, sizeof(line))) {
+			return false;
+		}
+		ParseRow(line, this->chunkRow.data(), this->chunkRow.size());
+		if (this->counterColumn >= 0 && std::isfinite(this->chunkRow[this->counterColumn])) {
+			stamp.counter = static_cast<int64_t>(this->chunkRow[this->counterColumn]);
+		}
+		if (this->timestampColumn >= 0) {
+			stamp.timeUs = this->chunkRow[this->timestampColumn] / 1000.0;
+		}
+		if (this->exposureColumn >= 0) {
+			stamp.exposureUs = this->chunkRow[this->exposureColumn];
+		}
+		return true;
+	}
+
+	bool FrameStampReader::Next(FrameStamp& stamp) {
+		if (this->frame >= this->packetTimes.size()) {
+			char line[256];
+			if (this->chunks != nullptr && ReadLine(this->chunks, line, sizeof(line))) {
+				this->lastError = "The chunk data has more rows than the video has frames.";
+			}
+			return false;
+		}
+		stamp.counter = -1;
+		stamp.timeUs = this->timeBase > 0.0
+			? static_cast<double>(this->packetTimes[this->frame] - this->packetTimes[0]) * this->timeBase * 1e6 : MISSING;
+		stamp.exposureUs = MISSING;
+		if (this->chunks != nullptr) {
+			// The camera's timestamps take the place of the video's.
+			double containerTime = stamp.timeUs;
+			stamp.timeUs = MISSING;
+			if (!this->ReadChunkRow(stamp)) {
+				this->lastError = "The chunk data ends at frame " + std::to_string(this->frame) + " of "
+					+ std::to_string(this->packetTimes.size()) + ".";
+				return false;
+			}
+			if (this->timestampColumn < 0) {
+				stamp.timeUs = containerTime;
+			}
+		}
+		this->frame++;
+		return true;
+	}
+
+	FrameReconciler::FrameReconciler(TriggerLogReader& triggers, FrameStampSource source, int64_t firstTrigger)
+		: triggers(triggers), source(source), triggersEnded(false), triggerCount(0), frame(0),
+		firstTrigger(std::max<int64_t>(0, firstTrigger)), lastTrigger(-1), lastStamp(), hasOffset(false), offsetUs(0.0),
+		offsetSamples(0) {
+	}
+
+	bool FrameReconciler::Fetch(int64_t index) {
+		int64_t keep = (this->lastTrigger >= 0 ? this->lastTrigger : this->firstTrigger) - 1;
+		while ((this->window.empty() || this->window.back().index < index) && !this->triggersEnded) {
+			TriggerTime trigger;
+			if (!this->triggers.Next(trigger)) {
+				this->triggersEnded = true;
+				break;
+			}
+			this->triggerCount++;
+			this->window.push_back(trigger);
+			while (this->window.size() > 1 && this->window.front().index < keep) {
+				this->window.pop_front();
+			}
+		}
+		return !this->window.empty() && this->window.front().index <= index && this->window.back().index >= index;
+	}
+
+	double FrameReconciler::PeriodUs(int64_t index) const {
+		if (this->window.empty()) {
+			return MISSING;
+		}
+		if (index + 1 <= this->window.back().index && index >= this->window.front().index) {
+			return this->Trigger(index + 1).timeUs - this->Trigger(index).timeUs;
+		}
+		if (index - 1 >= this->window.front().index && index <= this->window.back().index) {
+			return this->Trigger(index).timeUs - this->Trigger(index - 1).timeUs;
+		}
+		return MISSING;
+	}
+
+	void FrameReconciler::Match(const FrameStamp& stamp, FrameMatch& match) {
+		match.frame = this->frame++;
+		match.trigger = -1;
+		match.timeUs = match.hostTimeUs = match.residualUs = MISSING;
+		match.exposureUs = stamp.exposureUs;
+		match.dropped = 0;
+		match.flags = 0;
+
+		bool byTime = (this->source == FrameStampSource::CameraTime || this->source == FrameStampSource::ContainerTime)
+			&& std::isfinite(stamp.timeUs);
+		bool byCounter = this->source == FrameStampSource::Counter && stamp.counter >= 0;
+		bool duplicate = false;
+		int64_t trigger;
+		if (this->lastTrigger < 0) {
+			trigger = this->firstTrigger;
+		}
+		else if (byCounter && this->lastStamp.counter >= 0) {
+			// The counter counts every exposure; it may wrap at 32 bits.
+			int64_t exposures = static_cast<uint32_t>(stamp.counter - this->lastStamp.counter);
+			duplicate = exposures == 0;
+			trigger = this->lastTrigger + exposures;
+		}
+		else if (byTime && this->hasOffset) {
+			double period = this->PeriodUs(this->lastTrigger);
+			if (std::isfinite(this->lastStamp.timeUs) && std::isfinite(period) && stamp.timeUs - this->lastStamp.timeUs < period / 4.0) {
+				duplicate = true;
+				trigger = this->lastTrigger;
+			}
+			else {
+				// The trigger nearest to the frame's time on the Arduino's clock.
+				trigger = this->lastTrigger + 1;
+				double time = stamp.timeUs - this->offsetUs;
+				while (this->Fetch(trigger + 1) && std::fabs(this->Trigger(trigger + 1).timeUs - time)
+					< std::fabs(this->Trigger(trigger).timeUs - time)) {
+					trigger++;
+				}
+			}
+		}
+		else {
+			trigger = this->lastTrigger + 1;
+			match.flags |= FRAME_UNVERIFIED;
+		}
+
+		if (duplicate) {
+			match.flags |= FRAME_DUPLICATE;
+		}
+		else if (this->lastTrigger >= 0 && trigger > this->lastTrigger + 1) {
+			match.dropped = trigger - this->lastTrigger - 1;
+			match.flags |= FRAME_AFTER_DROP;
+		}
+		bool found = this->Fetch(trigger);
+		if (found && byTime && this->hasOffset && this->triggersEnded && trigger == this->window.back().index) {
+			// Frames after the last trigger match it at more than half a period.
+			double period = this->PeriodUs(trigger);
+			found = !(std::fabs(stamp.timeUs - this->offsetUs - this->Trigger(trigger).timeUs) > period / 2.0);
+		}
+		if (found) {
+			const TriggerTime& edge = this->Trigger(trigger);
+			match.trigger = trigger;
+			match.timeUs = edge.timeUs;
+			match.hostTimeUs = edge.hostTimeUs;
+			if (edge.interpolated) {
+				match.flags |= FRAME_INTERPOLATED_TIME;
+			}
+			if (std::isfinite(stamp.timeUs)) {
+				double offset = stamp.timeUs - edge.timeUs;
+				if (!this->hasOffset) {
+					this->offsetUs = offset;
+					this->hasOffset = true;
+				}
+				match.residualUs = offset - this->offsetUs;
+				if (!duplicate) {
+					this->offsetSamples = std::min(this->offsetSamples + 1, OFFSET_SAMPLES);
+					this->offsetUs += (offset - this->offsetUs) / static_cast<double>(this->offsetSamples);
+				}
+			}
+		}
+		else {
+			match.flags |= FRAME_NO_TRIGGER;
+		}
+		this->lastTrigger = trigger;
+		this->lastStamp = stamp;
+	}
+
+	int64_t FrameReconciler::Finish() {
+		TriggerTime trigger;
+		while (!this->triggersEnded && this->triggers.Next(trigger)) {
+			this->triggerCount++;
+		}
+		this->triggersEnded = true;
+		this->window.clear();
+		return std::max<int64_t>(0, this->triggerCount - std::max(this->lastTrigger + 1, this->firstTrigger));
+	}
+
+	FrameIndexWriter::FrameIndexWriter() : file(nullptr), failed(false) {
+	}
+
+	FrameIndexWriter::~FrameIndexWriter() {
+		this->Close();
+	}
+
+	bool FrameIndexWriter::Open(const std::string& path) {
+		this->Close();
+		this->file = std::fopen(path.c_str(), "w");
+		if (this->file == nullptr) {
+			return false;
+		}
+		this->failed = false;
+		std::fputs("frame,trigger,time_us,host_time_us,residual_us,exposure_us,flags\n", this->file);
+		return true;
+	}
+
+	bool FrameIndexWriter::Write(const FrameMatch& match) {
+		if (this->file == nullptr) {
+			return false;
+		}
+		std::fprintf(this->file, "%lld,", static_cast<long long>(match.frame));
+		if (match.trigger >= 0) {
+			std::fprintf(this->file, "%lld,%.4f", static_cast<long long>(match.trigger), match.timeUs);
+		}
+		else {
+			std::fputc(',', this->file);
+		}
+		const double optional[] = { match.hostTimeUs, match.residualUs, match.exposureUs };
+		for (double value : optional) {
+			std::fputc(',', this->file);
+			if (std::isfinite(value)) {
+				std::fprintf(this->file, "%.1f", value);
+			}
+		}
+		std::fprintf(this->file, ",%u\n", static_cast<unsigned>(match.flags));
+		this->failed |= std::ferror(this->file) != 0;
+		return !this->failed;
+	}
+
+	bool FrameIndexWriter::Close() {
+		if (this->file == nullptr) {
+			return !this->failed;
+		}
+		this->failed |= std::fclose(this->file) != 0;
+		this->file = nullptr;
+		return !this->failed;
+	}
+
+	bool ReadFrameTimes(const std::string& path, std::vector<double>& times) {
+		FILE* file = std::fopen(path.c_str(), "r");
+		if (file == nullptr) {
+			return false;
+		}
+		times.clear();
+		char line[256];
+		if (!ReadLine(file, line, sizeof(line)) || std::strncmp(line, "frame,trigger,time_us,host_time_us", 34) != 0) {
+			std::fclose(file);
+			return false;
+		}
+		std::vector<double> hostTimes;
+		bool hasHostTimes = false;
+		double values[4];
+		while (ReadLine(file, line, sizeof(line))) {
+			if (ParseRow(line, values, 4) < 3 || !(values[0] >= 0.0)) {
+				continue;
+			}
+			size_t frame = static_cast<size_t>(values[0]);
+			if (frame >= times.size()) {
+				times.resize(frame + 1, MISSING);
+				hostTimes.resize(frame + 1, MISSING);
+			}
+			times[frame] = values[2];
+			hostTimes[frame] = values[3];
+			hasHostTimes |= std::isfinite(values[3]);
+		}
+		std::fclose(file);
+		// Either clock for all frames; host times are unknown until the clock model is valid.
+		if (hasHostTimes) {
+			times.swap(hostTimes);
+		}
+		return true;
+	}
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Time of a trigger edge of a recording.
+	/// </summary>
+	struct TriggerTime {
+		int64_t index;       // Index of the trigger pulse since recording start.
+		double timeUs;       // On the Arduino's clock, since recording start.
+		double hostTimeUs;   // On the host's monotonic clock; NaN if unknown.
+		bool interpolated;   // The edge was lost in telemetry; its time is interpolated.
+	};
+
+	/// <summary>
+	/// Reads the trigger log of a recording (as written by KWA-Controller or kwa-cli: columns
+	/// index, ticks, time_us, host_time_us) a trigger at a time, in constant memory. Edges lost in
+	/// telemetry (missing indices) are filled in, their times interpolated from the edges around
+	/// them, so that every trigger pulse is returned.
+	/// </summary>
+	class TriggerLogReader {
+	public:
+		TriggerLogReader();
+		~TriggerLogReader();
+
+		TriggerLogReader(const TriggerLogReader&) = delete;
+		TriggerLogReader& operator=(const TriggerLogReader&) = delete;
+
+		/// <param name="pulseCount">Number of pulses sent, as reported by the Arduino when the
+		/// recording stopped; edges after the last one logged are extrapolated at its period.
+		/// -1: the pulses logged.</param>
+		/// <returns><c>false</c> if the file cannot be read; see <c>LastError()</c>.</returns>
+		bool Open(const std::string& path, int64_t pulseCount = -1);
+		void Close();
+
+		/// <summary>
+		/// Read the next trigger, in order of their indices.
+		/// </summary>
+		/// <returns><c>false</c> after the last trigger.</returns>
+		bool Next(TriggerTime& trigger);
+
+		/// <summary>
+		/// Edges that were not logged, of the triggers returned so far.
+		/// </summary>
+		int64_t InterpolatedCount() const { return this->interpolatedCount; }
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		bool ReadRow(TriggerTime& row);
+
+		FILE* file;
+		int64_t pulseCount;
+		bool hasNext;
+		TriggerTime next;      // Next logged edge.
+		bool hasLast;
+		TriggerTime last;      // Last trigger returned.
+		double lastPeriodUs;
+		int64_t interpolatedCount;
+		std::string lastError;
+	};
+
+	/// <summary>
+	/// Where the identity of the recorded frames is taken from, best first.
+	/// </summary>
+	enum class FrameStampSource {
+		Counter,        // The camera's frame counter (chunk data), which counts every exposure.
+		CameraTime,     // The camera's timestamp of each exposure (chunk data).
+		ContainerTime,  // The presentation time of each frame in the video file.
+		None,           // Nothing but the number of frames (e.g., videos of fixed playback speed).
+	};
+
+	const char* FrameStampSourceName(FrameStampSource source);
+
+	/// <summary>
+	/// Metadata of a recorded frame.
+	/// </summary>
+	struct FrameStamp {
+		int64_t counter;     // Frame counter of the camera; -1 if unknown.
+		double timeUs;       // Timestamp of the frame in microseconds on the clock of its
+		                     // source (camera or video file); NaN if unknown.
+		double exposureUs;   // Exposure time; NaN if unknown.
+	};
+
+	/// <summary>
+	/// Reads the metadata of the frames of a recorded video a frame at a time, without decoding
+	/// them: the presentation times from the container (see <c>ReadPacketTimes()</c>) and, if
+	/// the recording software saved it, the chunk data of the camera (a CSV file with a row per
+	/// recorded frame, with any of the columns frame_counter, timestamp_ns, and exposure_us).
+	/// Presentation times at a fixed rate (as pylon Viewer writes with a fixed playback speed)
+	/// tell nothing about the frames and are not used.
+	/// </summary>
+	class FrameStampReader {
+	public:
+		FrameStampReader();
+		~FrameStampReader();
+
+		FrameStampReader(const FrameStampReader&) = delete;
+		FrameStampReader& operator=(const FrameStampReader&) = delete;
+
+		/// <param name="chunkPath">Chunk data of the recording; empty if there is none.</param>
+		/// <returns><c>false</c> if the video or the chunk data cannot be read, or they differ
+		/// in their number of frames; see <c>LastError()</c>.</returns>
+		bool Open(const std::string& videoPath, const std::string& chunkPath = std::string());
+		void Close();
+
+		/// <returns><c>false</c> after the last frame.</returns>
+		bool Next(FrameStamp& stamp);
+
+		FrameStampSource Source() const { return this->source; }
+		int64_t FrameCount() const { return static_cast<int64_t>(this->packetTimes.size()); }
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		bool ReadChunkRow(FrameStamp& stamp);
+
+		std::vector<int64_t> packetTimes;
+		double timeBase;
+		size_t frame;
+		FILE* chunks;
+		int counterColumn;
+		int timestampColumn;
+		int exposureColumn;
+		std::vector<double> chunkRow;
+		FrameStampSource source;
+		std::string lastError;
+	};
+
+	/// <summary>
+	/// Flags of a frame in the frame index (see <c>FrameMatch</c>).
+	/// </summary>
+	enum FrameFlags : uint8_t {
+		FRAME_DUPLICATE = 1,          // The same exposure as the previous frame.
+		FRAME_AFTER_DROP = 2,         // Triggers were not recorded before this frame.
+		FRAME_NO_TRIGGER = 4,         // After the last trigger of the log.
+		FRAME_INTERPOLATED_TIME = 8,  // The trigger edge was lost in telemetry.
+		FRAME_UNVERIFIED = 16,        // Assigned by count, as the frame has no metadata.
+	};
+
+	/// <summary>
+	/// The trigger a recorded frame was exposed at.
+	/// </summary>
+	struct FrameMatch {
+		int64_t frame;
+		int64_t trigger;     // -1 if none.
+		double timeUs;       // Trigger time on the Arduino's clock; NaN if no trigger.
+		double hostTimeUs;   // Trigger time on the host's clock; NaN if unknown.
+		double residualUs;   // Deviation of the frame's timestamp from the trigger; NaN if
+		                     // the frame has no timestamp.
+		double exposureUs;
+		int64_t dropped;     // Triggers not recorded between the previous frame and this one.
+		uint8_t flags;       // FrameFlags.
+	};
+
+	/// <summary>
+	/// Matches the frames of a recorded video to the trigger pulses of the Arduino, a frame at a
+	/// time, to find frames the camera or the recording software dropped or repeated. The
+	/// first frame is taken to be of a given trigger (by default, the first); each further frame
+	/// is assigned
+	/// - by the camera's frame counter: the number of exposures since the previous frame;
+	/// - by timestamp: the trigger nearest to the frame's time, on a clock offset that follows
+	///   the drift between the camera's (or host's) clock and the Arduino's over the recording;
+	///   frames less than a quarter period after the previous one repeat it;
+	/// - else by count, i.e., to the next trigger, which finds no drops.
+	/// </summary>
+	class FrameReconciler {
+	public:
+		/// <param name="triggers">Triggers of the recording, read as the frames need them.</param>
+		FrameReconciler(TriggerLogReader& triggers, FrameStampSource source, int64_t firstTrigger = 0);
+
+		/// <summary>
+		/// Match the next frame.
+		/// </summary>
+		void Match(const FrameStamp& stamp, FrameMatch& match);
+
+		/// <summary>
+		/// Read the triggers after the last frame matched.
+		/// </summary>
+		/// <returns>Their number.</returns>
+		int64_t Finish();
+
+		int64_t TriggerCount() const { return this->triggerCount; }
+
+	private:
+		bool Fetch(int64_t index);
+		const TriggerTime& Trigger(int64_t index) const { return this->window[static_cast<size_t>(index - this->window.front().index)]; }
+		double PeriodUs(int64_t index) const;
+
+		TriggerLogReader& triggers;
+		FrameStampSource source;
+		std::deque<TriggerTime> window;   // Triggers from the previous frame's on.
+		bool triggersEnded;
+		int64_t triggerCount;             // Triggers read so far.
+		int64_t frame;
+		int64_t firstTrigger;
+		int64_t lastTrigger;              // Trigger of the previous frame; -1 if none.
+		FrameStamp lastStamp;
+		bool hasOffset;
+		double offsetUs;                  // Frame time minus trigger time.
+		int64_t offsetSamples;
+	};
+
+	/// <summary>
+	/// Writes the frame index of a recording: a CSV file with a row per recorded frame and
+	/// columns frame, trigger, time_us (on the Arduino's clock), host_time_us, residual_us,
+	/// exposure_us, and flags (see <c>FrameFlags</c>); unknown values are empty.
+	/// </summary>
+	class FrameIndexWriter {
+	public:
+		FrameIndexWriter();
+		~FrameIndexWriter();
+
+		/// <returns><c>false</c> if the file cannot be created.</returns>
+		bool Open(const std::string& path);
+		bool Write(const FrameMatch& match);
+		/// <returns><c>false</c> if writing failed.</returns>
+		bool Close();
+
+	private:
+		FILE* file;
+		bool failed;
+	};
+
+	/// <summary>
+	/// Read the trigger time of each frame from a frame index (see <c>FrameIndexWriter</c>): the
+	/// host time if the index has it, else the Arduino's time; NaN where unknown (e.g., for
+	/// frames without a trigger, or before the host clock was synchronized).
+	/// </summary>
+	/// <returns><c>false</c> if the file cannot be read or is no frame index.</returns>
+	bool ReadFrameTimes(const std::string& path, std::vector<double>& times);
+}
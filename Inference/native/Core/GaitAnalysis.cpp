@@ -0,0 +1,368 @@
+#include "GaitAnalysis.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+
+namespace KwaInference {
+
+	namespace {
+
+		const float MISSING = std::numeric_limits<float>::quiet_NaN();
+		// Standard deviation of the velocity a track starts with, in pixels per frame.
+		const double INITIAL_VELOCITY_STDEV = 10.0;
+		// Bodyparts whose horizontal motion is the running direction.
+		const char* const PAW_PREFIX = "SIDE_PROFILE_VIEW-";
+		// Filtered frames collected before they are written to the store.
+		const size_t WRITE_FRAMES = 1024;
+	}
+
+	GaitSettings::GaitSettings() : pcutoff(0.6), measurementNoise(2.0), processNoise(0.2), gate(5.0), maxGap(10),
+		swingSpeed(50.0), minPhase(0.005), direction(1), maxStride(1.0) {
+	}
+
+	PoseFilter::PoseFilter(size_t bodypartCount, const GaitSettings& settings)
+		: bodypartCount(bodypartCount), settings(settings), tracks(bodypartCount), head(0), held(0), finished(false),
+		lastPosition(bodypartCount * 2, MISSING), sinceLast(bodypartCount, -1), output(bodypartCount * 3),
+		outputVelocity(bodypartCount * 2), outputTime(0.0) {
+		this->settings.maxGap = std::max(0, settings.maxGap);
+		for (Track& track : this->tracks) {
+			track.tracking = false;
+			track.missed = 0;
+		}
+		this->ring.resize(static_cast<size_t>(this->settings.maxGap) + 1);
+		for (Slot& slot : this->ring) {
+			slot.pose.resize(bodypartCount * 3);
+			slot.velocity.resize(bodypartCount * 2);
+			slot.accepted.resize(bodypartCount);
+			slot.time = 0.0;
+		}
+	}
+
+	void PoseFilter::Update(Track& track, const float* position, bool measured, float* filtered, float* velocity,
+		uint8_t& accepted) const {
+		double r2 = this->settings.measurementNoise * this->settings.measurementNoise;
+		double q2 = this->settings.processNoise * this->settings.processNoise;
+		if (track.tracking) {
+			// Predict one frame ahead: p += v, with noise of a random acceleration.
+			for (int k = 0; k < 2; k++) {
+				double* c = track.covariance[k];
+				track.position[k] += track.velocity[k];
+				c[0] += 2.0 * c[1] + c[2] + q2 / 4.0;
+				c[1] += c[2] + q2 / 2.0;
+				c[2] += q2;
+			}
+		}
+		accepted = 0;
+		if (measured && !track.tracking) {
+			for (int k = 0; k < 2; k++) {
+				track.position[k] = position[k];
+				track.velocity[k] = 0.0;
+				track.covariance[k][0] = r2;
+				track.covariance[k][1] = 0.0;
+				track.covariance[k][2] = INITIAL_VELOCITY_STDEV * INITIAL_VELOCITY_STDEV;
+			}
+			track.tracking = true;
+			accepted = 1;
+		}
+		else if (measured) {
+			// Take the position if it lies within the gate (Mahalanobis distance).
+			double distance2 = 0.0;
+			for (int k = 0; k < 2; k++) {
+				double innovation = position[k] - track.position[k];
+				distance2 += innovation * innovation / (track.covariance[k][0] + r2);
+			}
+			if (distance2 <= this->settings.gate * this->settings.gate) {
+				for (int k = 0; k < 2; k++) {
+					double* c = track.covariance[k];
+					double innovation = position[k] - track.position[k];
+					double s = c[0] + r2;
+					double gainPosition = c[0] / s, gainVelocity = c[1] / s;
+					track.position[k] += gainPosition * innovation;
+					track.velocity[k] += gainVelocity * innovation;
+					c[2] -= gainVelocity * c[1];
+					c[1] -= gainVelocity * c[0];
+					c[0] -= gainPosition * c[0];
+				}
+				accepted = 1;
+			}
+		}
+		track.missed = accepted ? 0 : track.missed + 1;
+		if (track.missed > this->settings.maxGap) {
+			track.tracking = false;
+		}
+		for (int k = 0; k < 2; k++) {
+			filtered[k] = accepted ? static_cast<float>(track.position[k]) : MISSING;
+			velocity[k] = accepted ? static_cast<float>(track.velocity[k]) : MISSING;
+		}
+	}
+
+	void PoseFilter::Push(const float* pose, double time) {
+		Slot& slot = this->ring[(this->head + this->held) % this->ring.size()];
+		for (size_t j = 0; j < this->bodypartCount; j++) {
+			// NaN (frames not analyzed) fails the comparison as well.
+			bool measured = pose[3 * j + 2] >= this->settings.pcutoff;
+			this->Update(this->tracks[j], pose + 3 * j, measured, &slot.pose[3 * j], &slot.velocity[2 * j], slot.accepted[j]);
+			slot.pose[3 * j + 2] = pose[3 * j + 2];
+		}
+		slot.time = time;
+		this->held++;
+	}
+
+	void PoseFilter::Finish() {
+		this->finished = true;
+	}
+
+	bool PoseFilter::Pop(float* pose, float* velocity, double& time) {
+		if (this->held == 0 || (this->held < this->ring.size() && !this->finished)) {
+			return false;
+		}
+		this->Emit(this->ring[this->head]);
+		this->head = (this->head + 1) % this->ring.size();
+		this->held--;
+		std::memcpy(pose, this->output.data(), this->output.size() * sizeof(float));
+		std::memcpy(velocity, this->outputVelocity.data(), this->outputVelocity.size() * sizeof(float));
+		time = this->outputTime;
+		return true;
+	}
+
+	void PoseFilter::Emit(Slot& slot) {
+		for (size_t j = 0; j < this->bodypartCount; j++) {
+			float* position = &this->output[3 * j];
+			float* velocity = &this->outputVelocity[2 * j];
+			position[2] = slot.pose[3 * j + 2];
+			if (slot.accepted[j]) {
+				for (int k = 0; k < 2; k++) {
+					position[k] = slot.pose[3 * j + k];
+					velocity[k] = slot.velocity[2 * j + k];
+					this->lastPosition[2 * j + k] = position[k];
+				}
+				this->sinceLast[j] = 0;
+				continue;
+			}
+			position[0] = position[1] = velocity[0] = velocity[1] = MISSING;
+			if (this->sinceLast[j] < 0) {
+				continue;
+			}
+			// In a gap: interpolate if the next accepted position is held and the gap is short.
+			int before = ++this->sinceLast[j];
+			for (size_t ahead = 1; ahead < this->held; ahead++) {
+				const Slot& next = this->ring[(this->head + ahead) % this->ring.size()];
+				if (!next.accepted[j]) {
+					continue;
+				}
+				int span = before + static_cast<int>(ahead);
+				if (span - 1 <= this->settings.maxGap) {
+					for (int k = 0; k < 2; k++) {
+						float last = this->lastPosition[2 * j + k];
+						float slope = (next.pose[3 * j + k] - last) / span;
+						position[k] = last + slope * before;
+						velocity[k] = slope;
+					}
+				}
+				break;
+			}
+		}
+		this->outputTime = slot.time;
+	}
+
+	GaitDetector::GaitDetector(const GaitSettings& settings) : settings(settings), phase(Phase::Unknown),
+		pending(Phase::Unknown), pendingFrame(0), pendingTime(0.0), pendingX(0.0f), hasTouchdown(false), hasLiftoff(false),
+		touchdownFrame(0), liftoffFrame(0), touchdownTime(0.0), liftoffTime(0.0), touchdownX(0.0f), liftoffX(0.0f) {
+	}
+
+	bool GaitDetector::Push(int64_t frame, double time, float x, float velocity, Stride& stride) {
+		if (!std::isfinite(x) || !std::isfinite(velocity)) {
+			// A gap: the phases around it are unknown.
+			this->phase = this->pending = Phase::Unknown;
+			this->hasTouchdown = false;
+			return false;
+		}
+		// Hysteresis: swing above swingSpeed forward, stance at no forward motion.
+		double forward = this->settings.direction * static_cast<double>(velocity);
+		Phase seen = forward > this->settings.swingSpeed ? Phase::Swing
+			: (forward <= 0.0 ? Phase::Stance : (this->pending != Phase::Unknown ? this->pending : this->phase));
+		if (seen != this->pending) {
+			this->pending = seen;
+			this->pendingFrame = frame;
+			this->pendingTime = time;
+			this->pendingX = x;
+		}
+		if (this->pending == this->phase || time - this->pendingTime < this->settings.minPhase) {
+			return false;
+		}
+		return this->Enter(this->pending, stride);
+	}
+
+	bool GaitDetector::Enter(Phase phase, Stride& stride) {
+		Phase previous = this->phase;
+		this->phase = phase;
+		if (previous == Phase::Unknown) {
+			return false;
+		}
+		if (phase == Phase::Swing) {
+			this->hasLiftoff = this->hasTouchdown;
+			this->liftoffFrame = this->pendingFrame;
+			this->liftoffTime = this->pendingTime;
+			this->liftoffX = this->pendingX;
+			return false;
+		}
+		// Touchdown: the end of a stride, if it began with one.
+		bool completed = this->hasTouchdown && this->hasLiftoff;
+		if (completed) {
+			stride.touchdown = this->touchdownFrame;
+			stride.liftoff = this->liftoffFrame;
+			stride.end = this->pendingFrame;
+			stride.touchdownTime = this->touchdownTime;
+			stride.duration = this->pendingTime - this->touchdownTime;
+			stride.stance = this->liftoffTime - this->touchdownTime;
+			stride.length = stride.stance > 0.0 ? std::fabs(this->liftoffX - this->touchdownX) / stride.stance * stride.duration : 0.0;
+			completed = stride.duration > 0.0 && stride.duration <= this->settings.maxStride;
+		}
+		this->hasTouchdown = true;
+		this->hasLiftoff = false;
+		this->touchdownFrame = this->pendingFrame;
+		this->touchdownTime = this->pendingTime;
+		this->touchdownX = this->pendingX;
+		return completed;
+	}
+
+	GaitAnalyzer::GaitAnalyzer() : bodypartCount(0), timestamps(false), fps(0.0), pushed(0), analyzed(0), steps(nullptr),
+		failed(false) {
+	}
+
+	GaitAnalyzer::~GaitAnalyzer() {
+		this->Close();
+	}
+
+	bool GaitAnalyzer::Open(const std::string& basePath, const std::string& scorer, const std::vector<std::string>& bodyparts,
+		bool timestamps, double fps, const GaitSettings& settings) {
+		this->Close();
+		this->basePath = basePath;
+		if (!this->store.Open(basePath + "_filtered.kwapose", scorer, bodyparts, timestamps)) {
+			return this->Fail("Cannot create " + basePath + "_filtered.kwapose.");
+		}
+		this->steps = std::fopen((basePath + "_steps.csv").c_str(), "w");
+		if (this->steps == nullptr) {
+			this->store.Close();
+			return this->Fail("Cannot create " + basePath + "_steps.csv.");
+		}
+		std::fprintf(this->steps, "paw,touchdown_frame,liftoff_frame,end_frame,touchdown_s,stride_s,stance_s,duty_factor,"
+			"cadence_hz,stride_length_px\n");
+
+		this->paws.clear();
+		this->summary.clear();
+		size_t prefix = std::strlen(PAW_PREFIX);
+		for (size_t j = 0; j < bodyparts.size(); j++) {
+			if (bodyparts[j].compare(0, prefix, PAW_PREFIX) == 0) {
+				this->paws.push_back(j);
+				this->summary.push_back(GaitSummary{ bodyparts[j].substr(prefix), 0, 0.0, 0.0, 0.0 });
+			}
+		}
+		if (this->paws.empty()) {
+			for (size_t j = 0; j < bodyparts.size(); j++) {
+				this->paws.push_back(j);
+				this->summary.push_back(GaitSummary{ bodyparts[j], 0, 0.0, 0.0, 0.0 });
+			}
+		}
+		this->detectors.assign(this->paws.size(), GaitDetector(settings));
+		this->dutySums.assign(this->paws.size(), 0.0);
+		this->filter.reset(new PoseFilter(bodyparts.size(), settings));
+		this->bodypartCount = bodyparts.size();
+		this->timestamps = timestamps;
+		this->fps = fps > 0.0 ? fps : 1.0;
+		this->pushed = 0;
+		this->analyzed = 0;
+		this->frame.resize(this->bodypartCount * 3);
+		this->velocity.resize(this->bodypartCount * 2);
+		this->filtered.clear();
+		this->filteredTimes.clear();
+		this->failed = false;
+		return true;
+	}
+
+	bool GaitAnalyzer::Write(const std::vector<float>& poses, int64_t frameCount, float offsetX, float offsetY,
+		const double* timestamps) {
+		if (!this->filter || this->failed) {
+			return false;
+		}
+		size_t columns = this->bodypartCount * 3;
+		for (int64_t i = 0; i < frameCount; i++) {
+			const float* pose = poses.data() + static_cast<size_t>(i) * columns;
+			for (size_t j = 0; j < this->bodypartCount; j++) {
+				this->frame[3 * j] = pose[3 * j] + offsetX;
+				this->frame[3 * j + 1] = pose[3 * j + 1] + offsetY;
+				this->frame[3 * j + 2] = pose[3 * j + 2];
+			}
+			this->filter->Push(this->frame.data(), this->timestamps && timestamps != nullptr ? timestamps[i]
+				: std::numeric_limits<double>::quiet_NaN());
+			this->pushed++;
+			if (!this->Drain()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool GaitAnalyzer::Drain() {
+		double time;
+		Stride stride;
+		while (this->filter->Pop(this->frame.data(), this->velocity.data(), time)) {
+			this->filtered.insert(this->filtered.end(), this->frame.begin(), this->frame.end());
+			this->filteredTimes.push_back(time);
+			// Trigger times where known, else the frame rate.
+			double seconds = std::isfinite(time) ? time / 1e6 : this->analyzed / this->fps;
+			for (size_t p = 0; p < this->paws.size(); p++) {
+				size_t j = this->paws[p];
+				float speed = this->velocity[2 * j] * static_cast<float>(this->fps);
+				if (!this->detectors[p].Push(this->analyzed, seconds, this->frame[3 * j], speed, stride)) {
+					continue;
+				}
+				std::fprintf(this->steps, "%s,%lld,%lld,%lld,%.6f,%.6f,%.6f,%.4f,%.4f,%.2f\n", this->summary[p].paw.c_str(),
+					static_cast<long long>(stride.touchdown), static_cast<long long>(stride.liftoff), static_cast<long long>(stride.end),
+					stride.touchdownTime, stride.duration, stride.stance, stride.stance / stride.duration, 1.0 / stride.duration,
+					stride.length);
+				GaitSummary& total = this->summary[p];
+				total.strides++;
+				total.cadence += stride.duration;
+				total.strideLength += stride.length;
+				this->dutySums[p] += stride.stance / stride.duration;
+			}
+			this->analyzed++;
+		}
+		if (!this->filtered.empty()) {
+			int64_t count = static_cast<int64_t>(this->filteredTimes.size());
+			if (static_cast<size_t>(count) >= WRITE_FRAMES || this->analyzed == this->pushed) {
+				this->failed = !this->store.Write(this->filtered, count, 0.0f, 0.0f, this->filteredTimes.data());
+				this->filtered.clear();
+				this->filteredTimes.clear();
+			}
+		}
+		return !this->failed || this->Fail("Cannot write " + this->basePath + "_filtered.kwapose.");
+	}
+
+	bool GaitAnalyzer::Close() {
+		if (!this->filter) {
+			return !this->failed;
+		}
+		this->filter->Finish();
+		bool ok = this->Drain();
+		ok = this->store.Close() && ok;
+		ok = std::fclose(this->steps) == 0 && ok;
+		this->steps = nullptr;
+		this->filter.reset();
+		for (size_t p = 0; p < this->summary.size(); p++) {
+			// Totals to means; cadence from the total duration of the strides.
+			GaitSummary& total = this->summary[p];
+			if (total.strides > 0) {
+				total.cadence = total.strides / total.cadence;
+				total.strideLength /= total.strides;
+				total.dutyFactor = this->dutySums[p] / total.strides;
+			}
+		}
+		this->failed = !ok;
+		return ok || this->Fail("Cannot write the gait analysis of " + this->basePath + ".");
+	}
+}
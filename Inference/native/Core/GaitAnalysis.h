@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "PoseStore.h"
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Parameters of <c>PoseFilter</c> and <c>GaitDetector</c>.
+	/// </summary>
+	struct GaitSettings {
+		double pcutoff;            // Positions of a lower likelihood are gaps.
+		double measurementNoise;   // Standard deviation of a predicted position in pixels.
+		double processNoise;       // Standard deviation of the acceleration in pixels per frame^2.
+		double gate;               // Positions further off the filter's prediction (in standard deviations) are gaps.
+		int maxGap;                // Longer gaps (in frames) are left NaN and restart the filter.
+		double swingSpeed;         // Forward speed in pixels per second above which a paw swings.
+		double minPhase;           // Shorter phases (in seconds) are taken as noise.
+		int direction;             // +1: the animal faces +x (to the right in the side profile view); -1: -x.
+		double maxStride;          // Longer strides (in seconds, e.g., pauses) are not reported.
+
+		GaitSettings();
+	};
+
+	/// <summary>
+	/// Smooths the poses of a recording frame by frame, with constant memory per bodypart: a
+	/// constant-velocity Kalman filter per bodypart and coordinate, which takes positions of a
+	/// likelihood of at least pcutoff that lie within the gate around its prediction. Gaps (the
+	/// frames without such a position) of up to maxGap frames are interpolated linearly between
+	/// the filtered positions around them; for that, frames are output maxGap + 1 frames after
+	/// they are pushed (or at <c>Finish()</c>).
+	/// </summary>
+	class PoseFilter {
+	public:
+		PoseFilter(size_t bodypartCount, const GaitSettings& settings);
+
+		/// <summary>
+		/// Add the pose of the next frame (x, y, likelihood per bodypart); <c>Pop()</c> the
+		/// frame that is ready first, if any.
+		/// </summary>
+		void Push(const float* pose, double time);
+		/// <summary>
+		/// No more frames follow: output the frames held back.
+		/// </summary>
+		void Finish();
+		/// <summary>
+		/// Take the next filtered frame: the pose (x, y, likelihood as pushed per bodypart; x and
+		/// y NaN in gaps that are not interpolated), the velocity (x, y per bodypart in pixels
+		/// per frame), and the time it was pushed with.
+		/// </summary>
+		/// <returns><c>false</c> if no frame is ready.</returns>
+		bool Pop(float* pose, float* velocity, double& time);
+
+	private:
+		struct Track {
+			double position[2];
+			double velocity[2];
+			double covariance[2][3];  // Per coordinate: position, position-velocity, velocity.
+			bool tracking;
+			int missed;               // Frames since the last accepted position.
+		};
+
+		struct Slot {
+			std::vector<float> pose;      // Filtered x, y, likelihood per bodypart.
+			std::vector<float> velocity;
+			std::vector<uint8_t> accepted;
+			double time;
+		};
+
+		void Update(Track& track, const float* position, bool measured, float* filtered, float* velocity, uint8_t& accepted) const;
+		void Emit(Slot& slot);
+
+		size_t bodypartCount;
+		GaitSettings settings;
+		std::vector<Track> tracks;
+		std::vector<Slot> ring;         // The last maxGap + 1 frames.
+		size_t head;                    // Oldest frame in the ring.
+		size_t held;                    // Frames in the ring.
+		bool finished;
+		// The last accepted output position per bodypart, to interpolate gaps from.
+		std::vector<float> lastPosition;
+		std::vector<int> sinceLast;     // Frames since lastPosition; -1 if none.
+		std::vector<float> output;
+		std::vector<float> outputVelocity;
+		double outputTime;
+	};
+
+	/// <summary>
+	/// A stride of a paw: from touchdown (swing to stance) to its next touchdown.
+	/// </summary>
+	struct Stride {
+		int64_t touchdown;       // Frames.
+		int64_t liftoff;
+		int64_t end;
+		double touchdownTime;    // Seconds.
+		double duration;
+		double stance;
+		double length;           // Pixels the wheel surface moved under the paw.
+	};
+
+	/// <summary>
+	/// Finds the stance and swing phases of a paw from its filtered horizontal position: in
+	/// swing, the paw moves forward faster than swingSpeed; in stance, it moves backward with
+	/// the wheel surface. On the wheel, the animal runs on the spot, so that the stride length
+	/// is estimated as the distance the surface moves under the paw: the paw's backward speed
+	/// in stance times the stride's duration. A change of phase counts once the new phase
+	/// lasted minPhase, from the frame it began in.
+	/// </summary>
+	class GaitDetector {
+	public:
+		enum class Phase {
+			Unknown,
+			Stance,
+			Swing,
+		};
+
+		explicit GaitDetector(const GaitSettings& settings);
+
+		/// <summary>
+		/// Add a frame: the paw's position and velocity (pixels per second; NaN in gaps, which
+		/// end the current stride).
+		/// </summary>
+		/// <returns><c>true</c> if a stride was completed in this frame.</returns>
+		bool Push(int64_t frame, double time, float x, float velocity, Stride& stride);
+
+		/// <summary>
+		/// The phase the paw is in as of the last frame (a change counts once it lasted minPhase).
+		/// </summary>
+		Phase CurrentPhase() const { return this->phase; }
+
+	private:
+		/// <summary>
+		/// Enter <c>phase</c> at the frame the pending change began in.
+		/// </summary>
+		bool Enter(Phase phase, Stride& stride);
+
+		GaitSettings settings;
+		Phase phase;
+		Phase pending;            // The phase the paw seems to change to; <c>phase</c> if none.
+		int64_t pendingFrame;
+		double pendingTime;
+		float pendingX;
+		bool hasTouchdown;        // The current stride started with an observed touchdown.
+		bool hasLiftoff;
+		int64_t touchdownFrame, liftoffFrame;
+		double touchdownTime, liftoffTime;
+		float touchdownX, liftoffX;
+	};
+
+	/// <summary>
+	/// Per-paw totals of <c>GaitAnalyzer</c>.
+	/// </summary>
+	struct GaitSummary {
+		std::string paw;
+		int64_t strides;
+		double cadence;       // Mean strides per second.
+		double strideLength;  // Mean stride length in pixels.
+		double dutyFactor;    // Mean fraction of a stride in stance.
+	};
+
+	/// <summary>
+	/// Streaming analysis of a recording's poses, fed in frame order as they are predicted (or
+	/// read): writes the filtered poses (see <c>PoseFilter</c>) to the pose store
+	/// &lt;base&gt;_filtered.kwapose and the strides of the paws (see <c>GaitDetector</c>) to
+	/// &lt;base&gt;_steps.csv. Paws are the SIDE_PROFILE_VIEW-* bodyparts, whose horizontal
+	/// motion is the running direction, or all bodyparts if there are none.
+	/// </summary>
+	class GaitAnalyzer {
+	public:
+		GaitAnalyzer();
+		~GaitAnalyzer();
+
+		GaitAnalyzer(const GaitAnalyzer&) = delete;
+		GaitAnalyzer& operator=(const GaitAnalyzer&) = delete;
+
+		/// <param name="fps">Frame rate to time frames by where they have no trigger time.</param>
+		/// <returns><c>false</c> if the files cannot be created; see <c>LastError()</c>.</returns>
+		bool Open(const std::string& basePath, const std::string& scorer, const std::vector<std::string>& bodyparts,
+			bool timestamps, double fps, const GaitSettings& settings);
+		/// <summary>
+		/// Add the poses of <c>frameCount</c> consecutive frames, as <c>PoseStoreWriter::Write()</c>.
+		/// </summary>
+		bool Write(const std::vector<float>& poses, int64_t frameCount, float offsetX = 0.0f, float offsetY = 0.0f,
+			const double* timestamps = nullptr);
+		/// <summary>
+		/// Analyze the frames held back and close the files.
+		/// </summary>
+		bool Close();
+
+		const std::vector<GaitSummary>& Summary() const { return this->summary; }
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		bool Fail(const std::string& message) {
+			this->lastError = message;
+			return false;
+		}
+
+		/// <summary>
+		/// Analyze and write the frames the filter outputs.
+		/// </summary>
+		bool Drain();
+
+		std::unique_ptr<PoseFilter> filter;
+		std::vector<GaitDetector> detectors;
+		std::vector<size_t> paws;        // Bodypart of each detector.
+		std::vector<GaitSummary> summary;
+		std::vector<double> dutySums;
+		size_t bodypartCount;
+		bool timestamps;
+		double fps;
+		int64_t pushed;                  // Frames pushed to the filter.
+		int64_t analyzed;                // Frames output by the filter.
+		PoseStoreWriter store;
+		FILE* steps;
+		std::string basePath;
+		std::vector<float> frame;
+		std::vector<float> velocity;
+		std::vector<float> filtered;     // Filtered frames to write at once.
+		std::vector<double> filteredTimes;
+		bool failed;
+		std::string lastError;
+	};
+}
@@ -0,0 +1,993 @@
+#include "InferenceEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <sstream>
+
+#include "Kernels.h"
+#include "ThreadPool.h"
+
+
+namespace KwaInference {
+
+	namespace {
+
+		enum class OpKind { Conv, ConvTranspose, MaxPool, BatchNorm, Unary, Binary, Transpose, Pad, Concat, View };
+
+		enum class AutoPad { NotSet, SameUpper, SameLower, Valid };
+
+		/// <summary>
+		/// A tensor of the graph: a constant, a model input, or the output of a layer.
+		/// </summary>
+		struct Value {
+			std::string name;
+			Shape shape;
+			const float* data;           // Float data; for runtime values set while running.
+			const uint8_t* raw;          // Float constant stored misaligned in the model file.
+			std::vector<int64_t> ints;   // Data of integer constants (e.g., shapes and pads).
+			bool isConstant;
+			bool isFloat;
+			int root;                    // Value whose buffer holds the data (differs for views).
+			int lastUse;                 // Last layer reading the value or a view of it.
+			bool keep;                   // Graph output (or viewed by one): never released.
+			int slot;                    // Buffer slot while running; -1 if none.
+		};
+
+		struct Op {
+			OpKind kind;
+			std::string name;
+			std::vector<int> inputs;
+			int output;
+			// Conv, ConvTranspose, MaxPool.
+			int weightValue;             // Constant of the weights as stored in the model.
+			const float* weights;        // Weights as used (see `PrepareWeights()`).
+			int64_t weightCount;
+			const float* foldScale;      // Scale per output channel folded into the weights, or nullptr.
+			const float* bias;
+			int64_t outChannels;
+			int64_t kernel[2];
+			int64_t strides[2];
+			int64_t dilations[2];
+			int64_t pads[4];             // Top, left, bottom, right.
+			int64_t outputPadding[2];
+			int64_t outputShape[2];      // ConvTranspose; -1 if not given.
+			AutoPad autoPad;
+			bool ceilMode;
+			bool relu;                   // Fused ReLU.
+			// BatchNorm.
+			const float* scale;
+			const float* shift;
+			UnaryOp unary;
+			BinaryOp binary;
+			std::vector<int64_t> perm;   // Transpose; empty: reverse the axes.
+			std::vector<int64_t> padAmounts;  // Pad.
+			float padValue;
+			std::vector<int64_t> targetShape;  // View (Reshape); empty: same shape.
+			bool allowZero;
+			int64_t axis;                // Concat.
+
+			Op()
+				: kind(OpKind::View), output(-1), weightValue(-1), weights(nullptr), weightCount(0), foldScale(nullptr), bias(nullptr), outChannels(0), kernel{ 1, 1 },
+				strides{ 1, 1 }, dilations{ 1, 1 }, pads{ 0, 0, 0, 0 }, outputPadding{ 0, 0 }, outputShape{ -1, -1 },
+				autoPad(AutoPad::NotSet), ceilMode(false), relu(false), scale(nullptr), shift(nullptr),
+				unary(UnaryOp::Relu), binary(BinaryOp::Add), padValue(0.0f), allowZero(false), axis(0) {
+			}
+		};
+
+		/// <summary>
+		/// Output size of a convolution or pooling window along one axis, and the padding
+		/// before the first element.
+		/// </summary>
+		bool WindowOutput(int64_t in, int64_t kernel, int64_t stride, int64_t dilation, int64_t padBegin, int64_t padEnd,
+			AutoPad autoPad, bool ceilMode, int64_t& out, int64_t& padBefore) {
+			int64_t extent = (kernel - 1) * dilation + 1;
+			switch (autoPad) {
+			case AutoPad::SameUpper:
+			case AutoPad::SameLower: {
+				out = (in + stride - 1) / stride;
+				int64_t total = std::max<int64_t>(0, (out - 1) * stride + extent - in);
+				padBefore = autoPad == AutoPad::SameUpper ? total / 2 : total - total / 2;
+				break;
+			}
+			case AutoPad::Valid:
+				out = in >= extent ? (in - extent) / stride + 1 : 0;
+				padBefore = 0;
+				break;
+			case AutoPad::NotSet: {
+				int64_t span = in + padBegin + padEnd - extent;
+				if (span < 0) {
+					out = 0;
+				}
+				else {
+					out = (ceilMode ? (span + stride - 1) / stride : span / stride) + 1;
+					// With ceil mode, the last window must start inside the input or the leading padding.
+					if (ceilMode && (out - 1) * stride >= in + padBegin) {
+						out--;
+					}
+				}
+				padBefore = padBegin;
+				break;
+			}
+			}
+			return out > 0;
+		}
+
+		/// <summary>
+		/// Output shape of a NumPy-style broadcast of two shapes.
+		/// </summary>
+		bool BroadcastShape(const Shape& a, const Shape& b, Shape& out) {
+			size_t rank = std::max(a.size(), b.size());
+			out.assign(rank, 1);
+			for (size_t k = 0; k < rank; k++) {
+				int64_t aDim = k < a.size() ? a[a.size() - 1 - k] : 1;
+				int64_t bDim = k < b.size() ? b[b.size() - 1 - k] : 1;
+				if (aDim != bDim && aDim != 1 && bDim != 1) {
+					return false;
+				}
+				out[rank - 1 - k] = aDim == 1 ? bDim : aDim;
+			}
+			return true;
+		}
+
+		AutoPad ParseAutoPad(const std::string& text) {
+			if (text == "SAME_UPPER") {
+				return AutoPad::SameUpper;
+			}
+			if (text == "SAME_LOWER") {
+				return AutoPad::SameLower;
+			}
+			if (text == "VALID") {
+				return AutoPad::Valid;
+			}
+			return AutoPad::NotSet;
+		}
+	}
+
+	class InferenceEngine::Impl {
+	public:
+		explicit Impl(size_t threadCount) : pool(threadCount), scratch(pool.Size()), weightCount(0), copiedBytes(0) {
+		}
+
+		bool Load(const std::string& modelPath);
+		bool Run(const float* input, const Shape& shape);
+		bool Fail(const std::string& message) {
+			this->lastError = message;
+			return false;
+		}
+
+		ThreadPool pool;
+		ScratchBuffers scratch;
+		std::vector<float> columns;  // Column matrix of transposed convolutions.
+
+		OnnxModel model;
+		std::vector<Value> values;
+		std::map<std::string, int> valueIndex;
+		std::vector<std::unique_ptr<float[]>> ownedData;  // Constants not used in place.
+		std::vector<Op> ops;
+		std::vector<int> inputValues;
+		std::vector<int> outputValues;
+		std::vector<TensorInfo> inputs;
+		std::vector<TensorInfo> outputs;
+		int64_t weightCount;
+		size_t copiedBytes;
+
+		std::vector<std::vector<float>> buffers;
+		std::vector<bool> bufferFree;
+
+		std::string lastError;
+
+	private:
+		int AddValue(const std::string& name) {
+			Value value;
+			value.name = name;
+			value.data = nullptr;
+			value.raw = nullptr;
+			value.isConstant = false;
+			value.isFloat = true;
+			value.root = static_cast<int>(this->values.size());
+			value.lastUse = -1;
+			value.keep = false;
+			value.slot = -1;
+			this->values.push_back(value);
+			this->valueIndex[name] = value.root;
+			return value.root;
+		}
+
+		/// <summary>
+		/// Uninitialized storage for constants, so that its pages are first touched by the thread
+		/// filling it.
+		/// </summary>
+		float* Allocate(size_t count) {
+			this->ownedData.emplace_back(new float[count]);
+			return this->ownedData.back().get();
+		}
+
+		const float* Own(const std::vector<float>& data) {
+			float* copy = this->Allocate(data.size());
+			std::copy(data.begin(), data.end(), copy);
+			return copy;
+		}
+
+		/// <summary>
+		/// Float data of a constant, copied from the model file if misaligned there.
+		/// </summary>
+		const float* ConstantData(Value& value) {
+			if (value.data == nullptr && value.raw != nullptr) {
+				size_t count = static_cast<size_t>(ElementCount(value.shape));
+				float* copy = this->Allocate(count);
+				std::memcpy(copy, value.raw, count * sizeof(float));
+				this->copiedBytes += count * sizeof(float);
+				value.data = copy;
+			}
+			return value.data;
+		}
+
+		bool AddConstant(const OnnxTensor& tensor, const std::string& name);
+		bool AddOp(const OnnxNode& node);
+		bool ConstantFloats(const OnnxNode& node, size_t input, int64_t expectedCount, const float*& data);
+		void FuseLayers();
+		void PlanBuffers();
+		void PrepareWeights();
+		int Acquire(int64_t count);
+		bool Execute(size_t index);
+	};
+
+	bool InferenceEngine::Impl::AddConstant(const OnnxTensor& tensor, const std::string& name) {
+		int index = this->AddValue(name);
+		Value& value = this->values[index];
+		value.isConstant = true;
+		value.shape = tensor.dims;
+		if (tensor.dataType == ONNX_INT64 || tensor.dataType == ONNX_INT32) {
+			value.isFloat = false;
+			return tensor.ToInts(value.ints);
+		}
+		if (tensor.dataType != ONNX_FLOAT && tensor.dataType != ONNX_DOUBLE) {
+			return this->Fail("Constant " + name + " has an unsupported element type.");
+		}
+		// Weights stored as raw bytes are used in place, unless misaligned for floats; these are
+		// copied when used (see `ConstantData()`), convolution weights once when preparing them.
+		const uint8_t* raw = tensor.RawFloats();
+		if (raw != nullptr) {
+			if (reinterpret_cast<uintptr_t>(raw) % alignof(float) == 0) {
+				value.data = reinterpret_cast<const float*>(raw);
+			}
+			else {
+				value.raw = raw;
+			}
+			return true;
+		}
+		std::vector<float> data;
+		if (!tensor.ToFloats(data)) {
+			return this->Fail("Constant " + name + " has too few elements.");
+		}
+		this->copiedBytes += data.size() * sizeof(float);
+		value.data = this->Own(data);
+		return true;
+	}
+
+	bool InferenceEngine::Impl::ConstantFloats(const OnnxNode& node, size_t input, int64_t expectedCount, const float*& data) {
+		data = nullptr;
+		if (input >= node.inputs.size() || node.inputs[input].empty()) {
+			return true;  // Optional input omitted.
+		}
+		auto found = this->valueIndex.find(node.inputs[input]);
+		if (found == this->valueIndex.end() || !this->values[found->second].isConstant
+			|| !this->values[found->second].isFloat) {
+			return this->Fail(node.opType + " " + node.name + ": input " + node.inputs[input] + " must be a float constant.");
+		}
+		Value& value = this->values[found->second];
+		if (expectedCount >= 0 && ElementCount(value.shape) != expectedCount) {
+			return this->Fail(node.opType + " " + node.name + ": constant " + value.name + " has shape "
+				+ FormatShape(value.shape) + ".");
+		}
+		data = this->ConstantData(value);
+		return true;
+	}
+
+	bool InferenceEngine::Impl::AddOp(const OnnxNode& node) {
+		const std::string& type = node.opType;
+		if (!node.domain.empty() && node.domain != "ai.onnx") {
+			return this->Fail("Unsupported operator " + node.domain + "." + type + " (node " + node.name + ").");
+		}
+		if (type == "Constant") {
+			const OnnxAttribute* attribute = node.Attribute("value");
+			if (attribute != nullptr && !attribute->tensors.empty()) {
+				return this->AddConstant(attribute->tensors[0], node.outputs[0]);
+			}
+			OnnxTensor tensor;
+			if ((attribute = node.Attribute("value_float")) != nullptr) {
+				tensor.dataType = ONNX_FLOAT;
+				tensor.floats.push_back(attribute->f);
+			}
+			else if ((attribute = node.Attribute("value_floats")) != nullptr) {
+				tensor.dataType = ONNX_FLOAT;
+				tensor.floats = attribute->floats;
+				tensor.dims.push_back(static_cast<int64_t>(tensor.floats.size()));
+			}
+			else if ((attribute = node.Attribute("value_int")) != nullptr) {
+				tensor.dataType = ONNX_INT64;
+				tensor.ints.push_back(attribute->i);
+			}
+			else if ((attribute = node.Attribute("value_ints")) != nullptr) {
+				tensor.dataType = ONNX_INT64;
+				tensor.ints = attribute->ints;
+				tensor.dims.push_back(static_cast<int64_t>(tensor.ints.size()));
+			}
+			else {
+				return this->Fail("Constant " + node.name + " has an unsupported value.");
+			}
+			return this->AddConstant(tensor, node.outputs[0]);
+		}
+
+		Op op;
+		op.name = node.name;
+		for (size_t input = 0; input < node.inputs.size(); input++) {
+			if (node.inputs[input].empty()) {
+				continue;
+			}
+			auto found = this->valueIndex.find(node.inputs[input]);
+			if (found == this->valueIndex.end()) {
+				return this->Fail(type + " " + node.name + ": unknown input " + node.inputs[input] + ".");
+			}
+			if (input == 0 && !this->values[found->second].isFloat) {
+				return this->Fail(type + " " + node.name + ": input " + node.inputs[input] + " is not a float tensor.");
+			}
+			op.inputs.push_back(found->second);
+		}
+		for (size_t output = 1; output < node.outputs.size(); output++) {
+			if (!node.outputs[output].empty() && type != "Dropout" && type != "BatchNormalization") {
+				return this->Fail(type + " " + node.name + ": optional outputs are not supported.");
+			}
+		}
+		if (op.inputs.empty() || node.outputs.empty()) {
+			return this->Fail(type + " " + node.name + " has no input or output.");
+		}
+
+		if (type == "Conv" || type == "ConvTranspose" || type == "MaxPool") {
+			op.kind = type == "Conv" ? OpKind::Conv : (type == "ConvTranspose" ? OpKind::ConvTranspose : OpKind::MaxPool);
+			std::vector<int64_t> kernelShape = node.IntsAttribute("kernel_shape");
+			if (op.kind != OpKind::MaxPool) {
+				if (node.IntAttribute("group", 1) != 1) {
+					return this->Fail(type + " " + node.name + ": grouped convolutions are not supported.");
+				}
+				if (op.inputs.size() < 2 || this->values[op.inputs[1]].shape.size() != 4) {
+					return this->Fail(type + " " + node.name + ": only 2-D convolutions are supported.");
+				}
+				const Shape& weightShape = this->values[op.inputs[1]].shape;
+				op.outChannels = op.kind == OpKind::Conv ? weightShape[0] : weightShape[1];
+				kernelShape = { weightShape[2], weightShape[3] };
+				const Value& weights = this->values[op.inputs[1]];
+				if (!weights.isConstant || !weights.isFloat) {
+					return this->Fail(type + " " + node.name + ": the weights must be a float constant.");
+				}
+				op.weightValue = op.inputs[1];
+				if (!this->ConstantFloats(node, 2, op.outChannels, op.bias)) {
+					return false;
+				}
+				op.weightCount = ElementCount(weightShape);
+				this->weightCount += op.weightCount + (op.bias != nullptr ? op.outChannels : 0);
+				op.inputs.resize(1);
+			}
+			if (kernelShape.size() != 2) {
+				return this->Fail(type + " " + node.name + ": only 2-D windows are supported.");
+			}
+			std::vector<int64_t> strides = node.IntsAttribute("strides");
+			std::vector<int64_t> dilations = node.IntsAttribute("dilations");
+			std::vector<int64_t> pads = node.IntsAttribute("pads");
+			std::vector<int64_t> outputPadding = node.IntsAttribute("output_padding");
+			std::vector<int64_t> outputShape = node.IntsAttribute("output_shape");
+			for (int k = 0; k < 2; k++) {
+				op.kernel[k] = kernelShape[k];
+				op.strides[k] = strides.size() == 2 ? strides[k] : 1;
+				op.dilations[k] = dilations.size() == 2 ? dilations[k] : 1;
+				op.outputPadding[k] = outputPadding.size() == 2 ? outputPadding[k] : 0;
+				if (outputShape.size() >= 2) {
+					op.outputShape[k] = outputShape[outputShape.size() - 2 + k];
+				}
+			}
+			for (int k = 0; k < 4; k++) {
+				op.pads[k] = pads.size() == 4 ? pads[k] : 0;
+			}
+			op.autoPad = ParseAutoPad(node.StringAttribute("auto_pad", "NOTSET"));
+			op.ceilMode = node.IntAttribute("ceil_mode", 0) != 0;
+		}
+		else if (type == "BatchNormalization") {
+			op.kind = OpKind::BatchNorm;
+			if (node.inputs.size() < 5) {
+				return this->Fail("BatchNormalization " + node.name + " has too few inputs.");
+			}
+			const float* gamma;
+			const float* beta;
+			const float* mean;
+			const float* variance;
+			const Shape& scaleShape = this->values[op.inputs[1]].shape;
+			int64_t channels = ElementCount(scaleShape);
+			if (!this->ConstantFloats(node, 1, channels, gamma) || !this->ConstantFloats(node, 2, channels, beta)
+				|| !this->ConstantFloats(node, 3, channels, mean) || !this->ConstantFloats(node, 4, channels, variance)) {
+				return false;
+			}
+			float epsilon = node.FloatAttribute("epsilon", 1e-5f);
+			std::vector<float> scale(static_cast<size_t>(channels)), shift(static_cast<size_t>(channels));
+			for (int64_t c = 0; c < channels; c++) {
+				scale[c] = gamma[c] / std::sqrt(variance[c] + epsilon);
+				shift[c] = beta[c] - mean[c] * scale[c];
+			}
+			op.outChannels = channels;
+			op.scale = this->Own(scale);
+			op.shift = this->Own(shift);
+			op.inputs.resize(1);
+		}
+		else if (type == "Relu" || type == "Sigmoid") {
+			op.kind = OpKind::Unary;
+			op.unary = type == "Relu" ? UnaryOp::Relu : UnaryOp::Sigmoid;
+		}
+		else if (type == "Add" || type == "Sub" || type == "Mul" || type == "Div") {
+			op.kind = OpKind::Binary;
+			op.binary = type == "Add" ? BinaryOp::Add : (type == "Sub" ? BinaryOp::Sub : (type == "Mul" ? BinaryOp::Mul : BinaryOp::Div));
+			if (op.inputs.size() != 2 || !this->values[op.inputs[1]].isFloat) {
+				return this->Fail(type + " " + node.name + " needs two float inputs.");
+			}
+		}
+		else if (type == "Transpose") {
+			op.kind = OpKind::Transpose;
+			op.perm = node.IntsAttribute("perm");
+		}
+		else if (type == "Pad") {
+			op.kind = OpKind::Pad;
+			if (node.StringAttribute("mode", "constant") != "constant") {
+				return this->Fail("Pad " + node.name + ": only constant padding is supported.");
+			}
+			if (this->model.Graph().opsetVersion < 11) {
+				op.padAmounts = node.IntsAttribute("pads");
+				op.padValue = node.FloatAttribute("value", 0.0f);
+			}
+			else {
+				if (op.inputs.size() < 2 || !this->values[op.inputs[1]].isConstant || this->values[op.inputs[1]].isFloat) {
+					return this->Fail("Pad " + node.name + ": pads must be constant.");
+				}
+				op.padAmounts = this->values[op.inputs[1]].ints;
+				if (op.inputs.size() >= 3) {
+					const float* value;
+					if (!this->ConstantFloats(node, 2, 1, value)) {
+						return false;
+					}
+					op.padValue = value != nullptr ? value[0] : 0.0f;
+				}
+				op.inputs.resize(1);
+			}
+		}
+		else if (type == "Concat") {
+			op.kind = OpKind::Concat;
+			op.axis = node.IntAttribute("axis", 0);
+		}
+		else if (type == "Reshape") {
+			op.kind = OpKind::View;
+			if (op.inputs.size() < 2 || !this->values[op.inputs[1]].isConstant || this->values[op.inputs[1]].isFloat) {
+				return this->Fail("Reshape " + node.name + ": the shape must be constant (export the model with a fixed input size).");
+			}
+			op.targetShape = this->values[op.inputs[1]].ints;
+			op.allowZero = node.IntAttribute("allowzero", 0) != 0;
+			op.inputs.resize(1);
+		}
+		else if (type == "Identity" || type == "Dropout" || type == "Cast") {
+			op.kind = OpKind::View;
+			if (type == "Cast" && node.IntAttribute("to", ONNX_FLOAT) != ONNX_FLOAT) {
+				return this->Fail("Cast " + node.name + ": only casts to float are supported.");
+			}
+			op.inputs.resize(1);
+		}
+		else {
+			return this->Fail("Unsupported operator " + type + " (node " + node.name + ").");
+		}
+
+		op.output = this->AddValue(node.outputs[0]);
+		this->ops.push_back(op);
+		return true;
+	}
+
+	void InferenceEngine::Impl::FuseLayers() {
+		std::vector<int> producer(this->values.size(), -1);
+		std::vector<int> consumers(this->values.size(), 0);
+		for (size_t i = 0; i < this->ops.size(); i++) {
+			producer[this->ops[i].output] = static_cast<int>(i);
+			for (int input : this->ops[i].inputs) {
+				consumers[input]++;
+			}
+		}
+		for (int output : this->outputValues) {
+			consumers[output]++;
+		}
+
+		std::vector<bool> removed(this->ops.size(), false);
+		for (size_t i = 0; i < this->ops.size(); i++) {
+			Op& op = this->ops[i];
+			bool isBatchNorm = op.kind == OpKind::BatchNorm;
+			bool isRelu = op.kind == OpKind::Unary && op.unary == UnaryOp::Relu;
+			if (!isBatchNorm && !isRelu) {
+				continue;
+			}
+			int input = op.inputs[0];
+			int p = producer[input];
+			if (p < 0 || consumers[input] != 1 || this->ops[p].kind != OpKind::Conv || this->ops[p].relu
+				|| (isBatchNorm && op.outChannels != this->ops[p].outChannels)) {
+				continue;
+			}
+			Op& conv = this->ops[p];
+			if (isBatchNorm) {
+				// Scale the weights of each output channel (when preparing them) and shift its bias.
+				std::vector<float> scale(op.scale, op.scale + conv.outChannels);
+				std::vector<float> bias(static_cast<size_t>(conv.outChannels));
+				for (int64_t c = 0; c < conv.outChannels; c++) {
+					if (conv.foldScale != nullptr) {
+						scale[c] *= conv.foldScale[c];
+					}
+					bias[c] = (conv.bias != nullptr ? conv.bias[c] : 0.0f) * op.scale[c] + op.shift[c];
+				}
+				conv.foldScale = this->Own(scale);
+				conv.bias = this->Own(bias);
+			}
+			else {
+				conv.relu = true;
+			}
+			conv.output = op.output;
+			producer[op.output] = p;
+			removed[i] = true;
+		}
+
+		std::vector<Op> fused;
+		for (size_t i = 0; i < this->ops.size(); i++) {
+			if (!removed[i]) {
+				fused.push_back(this->ops[i]);
+			}
+		}
+		this->ops.swap(fused);
+	}
+
+	void InferenceEngine::Impl::PlanBuffers() {
+		for (size_t i = 0; i < this->ops.size(); i++) {
+			const Op& op = this->ops[i];
+			for (int input : op.inputs) {
+				Value& root = this->values[this->values[input].root];
+				root.lastUse = std::max(root.lastUse, static_cast<int>(i));
+			}
+			if (op.kind == OpKind::View) {
+				this->values[op.output].root = this->values[op.inputs[0]].root;
+			}
+		}
+		for (int output : this->outputValues) {
+			this->values[this->values[output].root].keep = true;
+		}
+	}
+
+	void InferenceEngine::Impl::PrepareWeights() {
+		// Weights used as stored are referenced in place; the others (misaligned in the file,
+		// or with a batch normalization folded in) are copied once, on all threads.
+		struct Copy {
+			const uint8_t* source;
+			float* target;
+			int64_t count;
+			int64_t rows;
+			const float* scale;
+		};
+		std::vector<Copy> copies;
+		for (Op& op : this->ops) {
+			if (op.weightValue < 0) {
+				continue;
+			}
+			Value& stored = this->values[op.weightValue];
+			const uint8_t* source = stored.data != nullptr ? reinterpret_cast<const uint8_t*>(stored.data) : stored.raw;
+			if (op.foldScale == nullptr && stored.data != nullptr) {
+				op.weights = stored.data;
+				continue;
+			}
+			float* target = this->Allocate(static_cast<size_t>(op.weightCount));
+			copies.push_back(Copy{ source, target, op.weightCount, op.outChannels, op.foldScale });
+			this->copiedBytes += static_cast<size_t>(op.weightCount) * sizeof(float);
+			op.weights = target;
+			if (op.foldScale == nullptr) {
+				stored.data = target;  // Shared by the layers using the same weights.
+			}
+		}
+		this->pool.ParallelFor(copies.size(), [&](size_t index, size_t) {
+			const Copy& copy = copies[index];
+			std::memcpy(copy.target, copy.source, static_cast<size_t>(copy.count) * sizeof(float));
+			if (copy.scale == nullptr) {
+				return;
+			}
+			int64_t rowSize = copy.count / copy.rows;
+			for (int64_t row = 0; row < copy.rows; row++) {
+				float* weights = copy.target + row * rowSize;
+				for (int64_t k = 0; k < rowSize; k++) {
+					weights[k] *= copy.scale[row];
+				}
+			}
+		});
+
+		// Other constant operands, e.g. of additions, are read in place while running.
+		for (const Op& op : this->ops) {
+			for (int input : op.inputs) {
+				if (input != op.weightValue && this->values[input].isConstant) {
+					this->ConstantData(this->values[input]);
+				}
+			}
+		}
+	}
+
+	bool InferenceEngine::Impl::Load(const std::string& modelPath) {
+		this->values.clear();
+		this->valueIndex.clear();
+		this->ownedData.clear();
+		this->ops.clear();
+		this->inputValues.clear();
+		this->outputValues.clear();
+		this->inputs.clear();
+		this->outputs.clear();
+		this->buffers.clear();
+		this->bufferFree.clear();
+		this->weightCount = 0;
+		this->copiedBytes = 0;
+
+		if (!this->model.Load(modelPath)) {
+			return this->Fail(this->model.LastError());
+		}
+		const OnnxGraph& graph = this->model.Graph();
+		for (const OnnxTensor& initializer : graph.initializers) {
+			if (!this->AddConstant(initializer, initializer.name)) {
+				return false;
+			}
+		}
+		for (const OnnxValueInfo& info : graph.inputs) {
+			if (this->valueIndex.count(info.name) > 0) {
+				continue;  // Initializer listed as input (IR version < 4).
+			}
+			if (info.dataType != ONNX_FLOAT) {
+				return this->Fail("Model input " + info.name + " is not a float tensor.");
+			}
+			this->inputValues.push_back(this->AddValue(info.name));
+			this->inputs.push_back(TensorInfo{ info.name, info.dims });
+		}
+		if (this->inputValues.size() != 1) {
+			return this->Fail("The model must have a single input; it has " + std::to_string(this->inputValues.size()) + ".");
+		}
+		for (const OnnxNode& node : graph.nodes) {
+			if (!this->AddOp(node)) {
+				return false;
+			}
+		}
+		for (const OnnxValueInfo& info : graph.outputs) {
+			auto found = this->valueIndex.find(info.name);
+			if (found == this->valueIndex.end() || !this->values[found->second].isFloat) {
+				return this->Fail("Model output " + info.name + " is not computed by the graph or not a float tensor.");
+			}
+			this->outputValues.push_back(found->second);
+			this->outputs.push_back(TensorInfo{ info.name, info.dims });
+		}
+
+		this->FuseLayers();
+		this->PlanBuffers();
+		this->PrepareWeights();
+		return true;
+	}
+
+	int InferenceEngine::Impl::Acquire(int64_t count) {
+		size_t size = static_cast<size_t>(count);
+		int best = -1;
+		int largest = -1;
+		for (size_t slot = 0; slot < this->buffers.size(); slot++) {
+			if (!this->bufferFree[slot]) {
+				continue;
+			}
+			size_t capacity = this->buffers[slot].size();
+			if (capacity >= size && (best < 0 || capacity < this->buffers[best].size())) {
+				best = static_cast<int>(slot);
+			}
+			if (largest < 0 || capacity > this->buffers[largest].size()) {
+				largest = static_cast<int>(slot);
+			}
+		}
+		if (best < 0 && largest >= 0) {
+			// Grow the largest free buffer instead of adding one; its contents are dead.
+			this->buffers[largest] = std::vector<float>(size);
+			best = largest;
+		}
+		if (best < 0) {
+			this->buffers.emplace_back(size);
+			this->bufferFree.push_back(true);
+			best = static_cast<int>(this->buffers.size() - 1);
+		}
+		this->bufferFree[best] = false;
+		return best;
+	}
+
+	bool InferenceEngine::Impl::Execute(size_t index) {
+		const Op& op = this->ops[index];
+		Value& out = this->values[op.output];
+		const Value& in = this->values[op.inputs[0]];
+		const Shape& inShape = in.shape;
+		bool inPlace = false;  // Whether the output may overwrite the first input.
+		Window2d window;
+		std::vector<int64_t> perm;
+
+		switch (op.kind) {
+		case OpKind::View: {
+			out.shape = inShape;
+			if (!op.targetShape.empty()) {
+				out.shape = op.targetShape;
+				int64_t known = 1;
+				int inferred = -1;
+				for (size_t axis = 0; axis < out.shape.size(); axis++) {
+					if (out.shape[axis] == 0 && !op.allowZero) {
+						out.shape[axis] = axis < inShape.size() ? inShape[axis] : 0;
+					}
+					if (out.shape[axis] == -1) {
+						inferred = static_cast<int>(axis);
+					}
+					else {
+						known *= out.shape[axis];
+					}
+				}
+				if (inferred >= 0 && known > 0) {
+					out.shape[inferred] = ElementCount(inShape) / known;
+				}
+				if (ElementCount(out.shape) != ElementCount(inShape)) {
+					return this->Fail("Reshape " + op.name + ": cannot reshape " + FormatShape(inShape) + " to "
+						+ FormatShape(op.targetShape) + ".");
+				}
+			}
+			out.data = in.data;
+			return true;
+		}
+		case OpKind::Conv:
+		case OpKind::ConvTranspose:
+		case OpKind::MaxPool: {
+			if (inShape.size() != 4) {
+				return this->Fail("Layer " + op.name + " needs an NCHW input; got " + FormatShape(inShape) + ".");
+			}
+			window.batch = inShape[0];
+			window.inChannels = inShape[1];
+			window.inHeight = inShape[2];
+			window.inWidth = inShape[3];
+			window.outChannels = op.kind == OpKind::MaxPool ? inShape[1] : op.outChannels;
+			window.kernelHeight = op.kernel[0];
+			window.kernelWidth = op.kernel[1];
+			window.strideHeight = op.strides[0];
+			window.strideWidth = op.strides[1];
+			window.dilationHeight = op.dilations[0];
+			window.dilationWidth = op.dilations[1];
+			if (op.kind != OpKind::MaxPool
+				&& op.weightCount != window.inChannels * window.outChannels * window.kernelHeight * window.kernelWidth) {
+				return this->Fail("Layer " + op.name + ": the weights do not fit input " + FormatShape(inShape) + ".");
+			}
+			int64_t* outSizes[2] = { &window.outHeight, &window.outWidth };
+			int64_t* padsBefore[2] = { &window.padTop, &window.padLeft };
+			int64_t inSizes[2] = { window.inHeight, window.inWidth };
+			for (int k = 0; k < 2; k++) {
+				if (op.kind != OpKind::ConvTranspose) {
+					if (!WindowOutput(inSizes[k], op.kernel[k], op.strides[k], op.dilations[k], op.pads[k], op.pads[k + 2],
+						op.autoPad, op.ceilMode, *outSizes[k], *padsBefore[k])) {
+						return this->Fail("Layer " + op.name + ": input " + FormatShape(inShape) + " is smaller than its window.");
+					}
+					continue;
+				}
+				int64_t extent = (op.kernel[k] - 1) * op.dilations[k] + 1;
+				int64_t full = op.strides[k] * (inSizes[k] - 1) + op.outputPadding[k] + extent;
+				if (op.outputShape[k] >= 0 || op.autoPad == AutoPad::SameUpper || op.autoPad == AutoPad::SameLower) {
+					*outSizes[k] = op.outputShape[k] >= 0 ? op.outputShape[k] : inSizes[k] * op.strides[k];
+					int64_t total = full - *outSizes[k];
+					*padsBefore[k] = op.autoPad == AutoPad::SameUpper ? total / 2 : total - total / 2;
+				}
+				else {
+					*outSizes[k] = full - op.pads[k] - op.pads[k + 2];
+					*padsBefore[k] = op.pads[k];
+				}
+			}
+			out.shape = { window.batch, window.outChannels, window.outHeight, window.outWidth };
+			break;
+		}
+		case OpKind::BatchNorm:
+			if (inShape.size() < 2 || inShape[1] != op.outChannels) {
+				return this->Fail("BatchNormalization " + op.name + ": input " + FormatShape(inShape) + " has the wrong number of channels.");
+			}
+			out.shape = inShape;
+			inPlace = true;
+			break;
+		case OpKind::Unary:
+			out.shape = inShape;
+			inPlace = true;
+			break;
+		case OpKind::Binary:
+			if (!BroadcastShape(inShape, this->values[op.inputs[1]].shape, out.shape)) {
+				return this->Fail("Layer " + op.name + ": shapes " + FormatShape(inShape) + " and "
+					+ FormatShape(this->values[op.inputs[1]].shape) + " cannot be broadcast.");
+			}
+			inPlace = true;
+			break;
+		case OpKind::Transpose: {
+			perm = op.perm;
+			if (perm.empty()) {
+				for (size_t axis = inShape.size(); axis-- > 0;) {
+					perm.push_back(static_cast<int64_t>(axis));
+				}
+			}
+			if (perm.size() != inShape.size()) {
+				return this->Fail("Transpose " + op.name + ": the permutation does not fit input " + FormatShape(inShape) + ".");
+			}
+			out.shape.resize(perm.size());
+			for (size_t axis = 0; axis < perm.size(); axis++) {
+				out.shape[axis] = inShape[perm[axis]];
+			}
+			break;
+		}
+		case OpKind::Pad:
+			if (op.padAmounts.size() != 2 * inShape.size()) {
+				return this->Fail("Pad " + op.name + ": the pads do not fit input " + FormatShape(inShape) + ".");
+			}
+			out.shape = inShape;
+			for (size_t axis = 0; axis < inShape.size(); axis++) {
+				out.shape[axis] += op.padAmounts[axis] + op.padAmounts[inShape.size() + axis];
+			}
+			break;
+		case OpKind::Concat: {
+			int64_t axis = op.axis < 0 ? op.axis + static_cast<int64_t>(inShape.size()) : op.axis;
+			out.shape = inShape;
+			out.shape[axis] = 0;
+			for (int input : op.inputs) {
+				const Shape& shape = this->values[input].shape;
+				for (size_t k = 0; k < inShape.size(); k++) {
+					if (shape.size() != inShape.size() || (static_cast<int64_t>(k) != axis && shape[k] != inShape[k])) {
+						return this->Fail("Concat " + op.name + ": input shapes differ.");
+					}
+				}
+				out.shape[axis] += shape[axis];
+			}
+			break;
+		}
+		}
+
+		int64_t count = ElementCount(out.shape);
+		Value& inRoot = this->values[in.root];
+		if (inPlace && inRoot.slot >= 0 && inRoot.lastUse == static_cast<int>(index) && !inRoot.keep
+			&& ElementCount(inShape) == count) {
+			out.slot = inRoot.slot;
+			inRoot.slot = -1;
+		}
+		else {
+			out.slot = this->Acquire(count);
+		}
+		float* result = this->buffers[out.slot].data();
+		out.data = result;
+
+		switch (op.kind) {
+		case OpKind::Conv:
+			Conv2d(this->pool, this->scratch, window, in.data, op.weights, op.bias, op.relu, result);
+			break;
+		case OpKind::ConvTranspose:
+			ConvTranspose2d(this->pool, this->columns, window, in.data, op.weights, op.bias, result);
+			break;
+		case OpKind::MaxPool:
+			MaxPool2d(this->pool, window, in.data, result);
+			break;
+		case OpKind::BatchNorm:
+			ChannelAffine(this->pool, inShape[0], inShape[1], count / (inShape[0] * inShape[1]), in.data, op.scale, op.shift, result);
+			break;
+		case OpKind::Unary:
+			Unary(this->pool, op.unary, count, in.data, result);
+			break;
+		case OpKind::Binary: {
+			const Value& other = this->values[op.inputs[1]];
+			Binary(this->pool, op.binary, in.data, inShape, other.data, other.shape, result, out.shape);
+			break;
+		}
+		case OpKind::Transpose:
+			Transpose(this->pool, in.data, inShape, perm, result);
+			break;
+		case OpKind::Pad:
+			PadConstant(this->pool, in.data, inShape, op.padAmounts, op.padValue, result);
+			break;
+		case OpKind::Concat: {
+			std::vector<const float*> data;
+			std::vector<Shape> shapes;
+			for (int input : op.inputs) {
+				data.push_back(this->values[input].data);
+				shapes.push_back(this->values[input].shape);
+			}
+			Concat(data, shapes, op.axis < 0 ? op.axis + static_cast<int64_t>(inShape.size()) : op.axis, result);
+			break;
+		}
+		case OpKind::View:
+			break;
+		}
+		return true;
+	}
+
+	bool InferenceEngine::Impl::Run(const float* input, const Shape& shape) {
+		if (this->inputValues.empty()) {
+			return this->Fail("No model loaded.");
+		}
+		const Shape& expected = this->inputs[0].shape;
+		bool fits = expected.empty() || expected.size() == shape.size();
+		for (size_t axis = 0; fits && axis < expected.size(); axis++) {
+			fits = expected[axis] < 0 || expected[axis] == shape[axis];
+		}
+		if (!fits) {
+			return this->Fail("Input " + FormatShape(shape) + " does not fit the model's input " + FormatShape(expected) + ".");
+		}
+
+		std::fill(this->bufferFree.begin(), this->bufferFree.end(), true);
+		for (Value& value : this->values) {
+			value.slot = -1;
+		}
+		Value& inputValue = this->values[this->inputValues[0]];
+		inputValue.data = input;
+		inputValue.shape = shape;
+
+		for (size_t index = 0; index < this->ops.size(); index++) {
+			if (!this->Execute(index)) {
+				return false;
+			}
+			// Release the buffers of tensors read for the last time.
+			for (int input : this->ops[index].inputs) {
+				Value& root = this->values[this->values[input].root];
+				if (root.slot >= 0 && root.lastUse == static_cast<int>(index) && !root.keep) {
+					this->bufferFree[root.slot] = true;
+					root.slot = -1;
+				}
+			}
+		}
+		return true;
+	}
+
+	InferenceEngine::InferenceEngine(size_t threadCount) : impl(new Impl(threadCount)) {
+	}
+
+	InferenceEngine::~InferenceEngine() {
+	}
+
+	bool InferenceEngine::Load(const std::string& modelPath) {
+		return this->impl->Load(modelPath);
+	}
+
+	const std::vector<TensorInfo>& InferenceEngine::Inputs() const {
+		return this->impl->inputs;
+	}
+
+	const std::vector<TensorInfo>& InferenceEngine::Outputs() const {
+		return this->impl->outputs;
+	}
+
+	bool InferenceEngine::Run(const float* input, const Shape& shape) {
+		return this->impl->Run(input, shape);
+	}
+
+	const float* InferenceEngine::Output(size_t index) const {
+		return this->impl->values[this->impl->outputValues[index]].data;
+	}
+
+	const Shape& InferenceEngine::OutputShape(size_t index) const {
+		return this->impl->values[this->impl->outputValues[index]].shape;
+	}
+
+	size_t InferenceEngine::ThreadCount() const {
+		return this->impl->pool.Size();
+	}
+
+	std::string InferenceEngine::Summary() const {
+		std::ostringstream text;
+		text << "ONNX opset " << this->impl->model.Graph().opsetVersion;
+		if (!this->impl->model.Producer().empty()) {
+			text << " (" << this->impl->model.Producer() << ")";
+		}
+		text << ", " << this->impl->ops.size() << " layers, " << this->impl->weightCount << " weights";
+		if (this->impl->copiedBytes > 0) {
+			text << ", " << this->impl->copiedBytes / 1024 << " KB of constants copied";
+		}
+		return text.str();
+	}
+
+	const std::string& InferenceEngine::LastError() const {
+		return this->impl->lastError;
+	}
+}
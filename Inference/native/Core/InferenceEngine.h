@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "OnnxModel.h"
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Name and shape of a model input or output; dimensions fixed at export time are >= 0,
+	/// the others (e.g., a dynamic batch size) -1.
+	/// </summary>
+	struct TensorInfo {
+		std::string name;
+		Shape shape;
+	};
+
+	/// <summary>
+	/// Runs an ONNX model of a convolutional network on the CPU. Loading maps the model file
+	/// and plans the computation once: batch normalizations are folded into the preceding
+	/// convolutions, ReLUs fused into them, reshapes turned into views, and intermediate
+	/// tensors assigned to a pool of buffers that are reused as soon as a tensor is no longer
+	/// needed (also in place for element-wise layers), so that running a batch allocates
+	/// nothing once the buffers have grown to size.
+	///
+	/// Supported operators (float tensors, 2-D convolutions and pooling, NCHW): Conv (group 1),
+	/// ConvTranspose (group 1), BatchNormalization, MaxPool, Relu, Sigmoid, Add, Sub, Mul, Div,
+	/// Transpose, Pad (constant mode), Concat, Reshape, Identity, Cast (to float), Dropout, and
+	/// Constant. Shape computations (Shape, Gather, ...) are not: export the model with a fixed
+	/// input size, so that the exporter folds them into constants.
+	/// </summary>
+	class InferenceEngine {
+	public:
+		/// <param name="threadCount">Threads to run layers on; 0: one per hardware thread.</param>
+		explicit InferenceEngine(size_t threadCount = 0);
+		~InferenceEngine();
+
+		/// <returns><c>false</c> if the model cannot be read or uses unsupported operators;
+		/// see <c>LastError()</c>.</returns>
+		bool Load(const std::string& modelPath);
+
+		const std::vector<TensorInfo>& Inputs() const;
+		const std::vector<TensorInfo>& Outputs() const;
+
+		/// <summary>
+		/// Run the model on <c>input</c>, the first (float) model input, of <c>shape</c>. The
+		/// input is read in place and must stay valid until <c>Run()</c> returns.
+		/// </summary>
+		/// <returns><c>false</c> if the shape does not fit the model; see <c>LastError()</c>.</returns>
+		bool Run(const float* input, const Shape& shape);
+
+		/// <summary>
+		/// Output <c>index</c> of the last run (in the order of <c>Outputs()</c>); valid until
+		/// the next run.
+		/// </summary>
+		const float* Output(size_t index) const;
+		const Shape& OutputShape(size_t index) const;
+
+		size_t ThreadCount() const;
+		/// <summary>
+		/// One-line description of the loaded model, e.g., its number of layers and weights.
+		/// </summary>
+		std::string Summary() const;
+		const std::string& LastError() const;
+
+	private:
+		class Impl;
+		std::unique_ptr<Impl> impl;
+	};
+}
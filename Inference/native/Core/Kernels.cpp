@@ -0,0 +1,461 @@
+#include "Kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <Eigen/Core>
+
+
+namespace KwaInference {
+
+	namespace {
+		typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+		typedef Eigen::Map<const RowMatrix, Eigen::Unaligned, Eigen::OuterStride<>> ConstMatrixMap;
+		typedef Eigen::Map<RowMatrix, Eigen::Unaligned, Eigen::OuterStride<>> MatrixMap;
+
+		// Target size of an image-to-column block in floats (1 MB), a trade-off between the
+		// cache footprint of a block and its output and the cost of packing the weights once
+		// per block.
+		const int64_t COLUMN_BLOCK_FLOATS = 1 << 18;
+		const int64_t MIN_COLUMN_BLOCK = 64;
+		const int64_t MAX_COLUMN_BLOCK = 512;
+		// Elements per task of element-wise kernels.
+		const int64_t ELEMENTWISE_CHUNK = 1 << 16;
+		// Tasks per thread to aim for, so that threads finishing early can take more work.
+		const int64_t TASKS_PER_THREAD = 2;
+
+		int64_t CeilDiv(int64_t a, int64_t b) {
+			return (a + b - 1) / b;
+		}
+
+		/// <summary>
+		/// Number of output pixels per convolution task: as many as fit a column block, but
+		/// few enough that all threads get work.
+		/// </summary>
+		int64_t ColumnBlockSize(int64_t rows, int64_t pixels, int64_t batch, size_t threads) {
+			int64_t block = std::max(MIN_COLUMN_BLOCK, std::min(MAX_COLUMN_BLOCK, COLUMN_BLOCK_FLOATS / rows));
+			int64_t minTasks = static_cast<int64_t>(threads) * TASKS_PER_THREAD;
+			if (batch * CeilDiv(pixels, block) < minTasks) {
+				block = std::max(MIN_COLUMN_BLOCK, CeilDiv(pixels * batch, minTasks));
+			}
+			return std::min(block, pixels);
+		}
+
+		/// <summary>
+		/// Copy the input pixels under the kernel for output pixels [p0, p0 + count) of one
+		/// image into rows of the column matrix (one row per input channel and kernel
+		/// position); padding reads as 0.
+		/// </summary>
+		void Im2Col(const Window2d& w, const float* image, int64_t p0, int64_t count, float* columns) {
+			for (int64_t c = 0; c < w.inChannels; c++) {
+				const float* plane = image + c * w.inHeight * w.inWidth;
+				for (int64_t i = 0; i < w.kernelHeight; i++) {
+					for (int64_t j = 0; j < w.kernelWidth; j++) {
+						float* dst = columns + ((c * w.kernelHeight + i) * w.kernelWidth + j) * count;
+						int64_t p = p0;
+						int64_t end = p0 + count;
+						while (p < end) {
+							int64_t oh = p / w.outWidth;
+							int64_t ow = p - oh * w.outWidth;
+							int64_t segment = std::min(end, (oh + 1) * w.outWidth) - p;
+							int64_t ih = oh * w.strideHeight - w.padTop + i * w.dilationHeight;
+							if (ih < 0 || ih >= w.inHeight) {
+								std::fill(dst, dst + segment, 0.0f);
+							}
+							else {
+								const float* src = plane + ih * w.inWidth;
+								int64_t iw = ow * w.strideWidth - w.padLeft + j * w.dilationWidth;
+								if (w.strideWidth == 1) {
+									// Contiguous: zeros left of the image, a copy, zeros right of it.
+									int64_t left = std::min(segment, std::max<int64_t>(0, -iw));
+									int64_t right = std::max<int64_t>(left, std::min(segment, w.inWidth - iw));
+									std::fill(dst, dst + left, 0.0f);
+									std::memcpy(dst + left, src + iw + left, (right - left) * sizeof(float));
+									std::fill(dst + right, dst + segment, 0.0f);
+								}
+								else {
+									for (int64_t k = 0; k < segment; k++, iw += w.strideWidth) {
+										dst[k] = (iw >= 0 && iw < w.inWidth) ? src[iw] : 0.0f;
+									}
+								}
+							}
+							dst += segment;
+							p += segment;
+						}
+					}
+				}
+			}
+		}
+
+		template <typename Op>
+		void BinaryLoop(ThreadPool& pool, const float* a, const Shape& aShape, const float* b, const Shape& bShape,
+			float* output, const Shape& outShape, Op op) {
+			int64_t count = ElementCount(outShape);
+			int64_t aCount = ElementCount(aShape);
+			int64_t bCount = ElementCount(bShape);
+			if ((aCount == count && bCount == count) || aCount == 1 || bCount == 1) {
+				// Same shapes or a scalar operand: one flat loop.
+				int64_t aStep = aCount == 1 ? 0 : 1;
+				int64_t bStep = bCount == 1 ? 0 : 1;
+				pool.ParallelFor(static_cast<size_t>(CeilDiv(count, ELEMENTWISE_CHUNK)), [&](size_t task, size_t) {
+					int64_t begin = static_cast<int64_t>(task) * ELEMENTWISE_CHUNK;
+					int64_t end = std::min(count, begin + ELEMENTWISE_CHUNK);
+					if (aStep == 1 && bStep == 1) {
+						for (int64_t i = begin; i < end; i++) {
+							output[i] = op(a[i], b[i]);
+						}
+					}
+					else if (aStep == 1) {
+						float bValue = b[0];
+						for (int64_t i = begin; i < end; i++) {
+							output[i] = op(a[i], bValue);
+						}
+					}
+					else {
+						float aValue = a[0];
+						for (int64_t i = begin; i < end; i++) {
+							output[i] = op(aValue, b[i * bStep]);
+						}
+					}
+				});
+				return;
+			}
+
+			// General case: element strides of both operands per output axis (0 on broadcast
+			// axes); the innermost axis is a loop, the outer axes are decomposed per row.
+			size_t rank = outShape.size();
+			std::vector<int64_t> aStrides(rank, 0), bStrides(rank, 0);
+			int64_t aStride = 1, bStride = 1;
+			for (size_t k = 0; k < rank; k++) {
+				size_t axis = rank - 1 - k;
+				if (k < aShape.size()) {
+					int64_t dim = aShape[aShape.size() - 1 - k];
+					aStrides[axis] = dim == 1 ? 0 : aStride;
+					aStride *= dim;
+				}
+				if (k < bShape.size()) {
+					int64_t dim = bShape[bShape.size() - 1 - k];
+					bStrides[axis] = dim == 1 ? 0 : bStride;
+					bStride *= dim;
+				}
+			}
+			int64_t inner = rank > 0 ? outShape[rank - 1] : 1;
+			int64_t rows = count / std::max<int64_t>(inner, 1);
+			int64_t rowsPerTask = std::max<int64_t>(1, ELEMENTWISE_CHUNK / std::max<int64_t>(inner, 1));
+			int64_t aInner = rank > 0 ? aStrides[rank - 1] : 0;
+			int64_t bInner = rank > 0 ? bStrides[rank - 1] : 0;
+			pool.ParallelFor(static_cast<size_t>(CeilDiv(rows, rowsPerTask)), [&](size_t task, size_t) {
+				int64_t rowBegin = static_cast<int64_t>(task) * rowsPerTask;
+				int64_t rowEnd = std::min(rows, rowBegin + rowsPerTask);
+				for (int64_t row = rowBegin; row < rowEnd; row++) {
+					int64_t aOffset = 0, bOffset = 0;
+					int64_t rest = row;
+					for (size_t k = 1; k < rank; k++) {
+						size_t axis = rank - 1 - k;
+						int64_t index = rest % outShape[axis];
+						rest /= outShape[axis];
+						aOffset += index * aStrides[axis];
+						bOffset += index * bStrides[axis];
+					}
+					const float* aRow = a + aOffset;
+					const float* bRow = b + bOffset;
+					float* outRow = output + row * inner;
+					for (int64_t i = 0; i < inner; i++) {
+						outRow[i] = op(aRow[i * aInner], bRow[i * bInner]);
+					}
+				}
+			});
+		}
+	}
+
+	Window2d::Window2d()
+		: batch(0), inChannels(0), inHeight(0), inWidth(0), outChannels(0), outHeight(0), outWidth(0), kernelHeight(1),
+		kernelWidth(1), strideHeight(1), strideWidth(1), dilationHeight(1), dilationWidth(1), padTop(0), padLeft(0) {
+	}
+
+	void Conv2d(ThreadPool& pool, ScratchBuffers& scratch, const Window2d& window, const float* input,
+		const float* weights, const float* bias, bool relu, float* output) {
+		const Window2d& w = window;
+		int64_t rows = w.inChannels * w.kernelHeight * w.kernelWidth;
+		int64_t pixels = w.outHeight * w.outWidth;
+		bool direct = w.kernelHeight == 1 && w.kernelWidth == 1 && w.strideHeight == 1 && w.strideWidth == 1
+			&& w.padTop == 0 && w.padLeft == 0 && w.outHeight == w.inHeight && w.outWidth == w.inWidth;
+		int64_t block = ColumnBlockSize(rows, pixels, w.batch, pool.Size());
+		int64_t blocksPerImage = CeilDiv(pixels, block);
+		ConstMatrixMap kernel(weights, w.outChannels, rows, Eigen::OuterStride<>(rows));
+
+		pool.ParallelFor(static_cast<size_t>(w.batch * blocksPerImage), [&](size_t task, size_t thread) {
+			int64_t n = static_cast<int64_t>(task) / blocksPerImage;
+			int64_t p0 = (static_cast<int64_t>(task) % blocksPerImage) * block;
+			int64_t count = std::min(block, pixels - p0);
+			const float* image = input + n * w.inChannels * w.inHeight * w.inWidth;
+			float* result = output + n * w.outChannels * pixels + p0;
+
+			const float* columns;
+			int64_t columnStride;
+			if (direct) {
+				columns = image + p0;
+				columnStride = pixels;
+			}
+			else {
+				std::vector<float>& buffer = scratch[thread];
+				if (buffer.size() < static_cast<size_t>(rows * count)) {
+					buffer.resize(static_cast<size_t>(rows * count));
+				}
+				Im2Col(w, image, p0, count, buffer.data());
+				columns = buffer.data();
+				columnStride = count;
+			}
+			ConstMatrixMap columnMatrix(columns, rows, count, Eigen::OuterStride<>(columnStride));
+			MatrixMap resultMatrix(result, w.outChannels, count, Eigen::OuterStride<>(pixels));
+			resultMatrix.noalias() = kernel * columnMatrix;
+
+			if (bias != nullptr || relu) {
+				for (int64_t c = 0; c < w.outChannels; c++) {
+					float* row = result + c * pixels;
+					float offset = bias != nullptr ? bias[c] : 0.0f;
+					if (relu) {
+						for (int64_t i = 0; i < count; i++) {
+							row[i] = std::max(row[i] + offset, 0.0f);
+						}
+					}
+					else {
+						for (int64_t i = 0; i < count; i++) {
+							row[i] += offset;
+						}
+					}
+				}
+			}
+		});
+	}
+
+	void ConvTranspose2d(ThreadPool& pool, std::vector<float>& columns, const Window2d& window, const float* input,
+		const float* weights, const float* bias, float* output) {
+		const Window2d& w = window;
+		int64_t rows = w.outChannels * w.kernelHeight * w.kernelWidth;
+		int64_t pixels = w.inHeight * w.inWidth;
+		int64_t block = ColumnBlockSize(w.inChannels, pixels, w.batch, pool.Size());
+		int64_t blocksPerImage = CeilDiv(pixels, block);
+		if (columns.size() < static_cast<size_t>(w.batch * rows * pixels)) {
+			columns.resize(static_cast<size_t>(w.batch * rows * pixels));
+		}
+		ConstMatrixMap kernel(weights, w.inChannels, rows, Eigen::OuterStride<>(rows));
+
+		pool.ParallelFor(static_cast<size_t>(w.batch * blocksPerImage), [&](size_t task, size_t) {
+			int64_t n = static_cast<int64_t>(task) / blocksPerImage;
+			int64_t p0 = (static_cast<int64_t>(task) % blocksPerImage) * block;
+			int64_t count = std::min(block, pixels - p0);
+			ConstMatrixMap image(input + n * w.inChannels * pixels + p0, w.inChannels, count, Eigen::OuterStride<>(pixels));
+			MatrixMap result(columns.data() + n * rows * pixels + p0, rows, count, Eigen::OuterStride<>(pixels));
+			result.noalias() = kernel.transpose() * image;
+		});
+
+		int64_t outPixels = w.outHeight * w.outWidth;
+		pool.ParallelFor(static_cast<size_t>(w.batch * w.outChannels), [&](size_t task, size_t) {
+			int64_t n = static_cast<int64_t>(task) / w.outChannels;
+			int64_t c = static_cast<int64_t>(task) % w.outChannels;
+			float* plane = output + (n * w.outChannels + c) * outPixels;
+			std::fill(plane, plane + outPixels, bias != nullptr ? bias[c] : 0.0f);
+			for (int64_t i = 0; i < w.kernelHeight; i++) {
+				for (int64_t j = 0; j < w.kernelWidth; j++) {
+					const float* src = columns.data() + n * rows * pixels + ((c * w.kernelHeight + i) * w.kernelWidth + j) * pixels;
+					for (int64_t h = 0; h < w.inHeight; h++) {
+						int64_t oh = h * w.strideHeight - w.padTop + i * w.dilationHeight;
+						if (oh < 0 || oh >= w.outHeight) {
+							continue;
+						}
+						float* dst = plane + oh * w.outWidth;
+						const float* srcRow = src + h * w.inWidth;
+						int64_t ow = -w.padLeft + j * w.dilationWidth;
+						for (int64_t x = 0; x < w.inWidth; x++, ow += w.strideWidth) {
+							if (ow >= 0 && ow < w.outWidth) {
+								dst[ow] += srcRow[x];
+							}
+						}
+					}
+				}
+			}
+		});
+	}
+
+	void MaxPool2d(ThreadPool& pool, const Window2d& window, const float* input, float* output) {
+		const Window2d& w = window;
+		pool.ParallelFor(static_cast<size_t>(w.batch * w.inChannels), [&](size_t plane, size_t) {
+			const float* src = input + static_cast<int64_t>(plane) * w.inHeight * w.inWidth;
+			float* dst = output + static_cast<int64_t>(plane) * w.outHeight * w.outWidth;
+			for (int64_t oh = 0; oh < w.outHeight; oh++) {
+				for (int64_t ow = 0; ow < w.outWidth; ow++) {
+					float value = -std::numeric_limits<float>::infinity();
+					for (int64_t i = 0; i < w.kernelHeight; i++) {
+						int64_t ih = oh * w.strideHeight - w.padTop + i * w.dilationHeight;
+						if (ih < 0 || ih >= w.inHeight) {
+							continue;
+						}
+						for (int64_t j = 0; j < w.kernelWidth; j++) {
+							int64_t iw = ow * w.strideWidth - w.padLeft + j * w.dilationWidth;
+							if (iw >= 0 && iw < w.inWidth) {
+								value = std::max(value, src[ih * w.inWidth + iw]);
+							}
+						}
+					}
+					dst[oh * w.outWidth + ow] = value;
+				}
+			}
+		});
+	}
+
+	void ChannelAffine(ThreadPool& pool, int64_t batch, int64_t channels, int64_t innerSize, const float* input,
+		const float* scale, const float* shift, float* output) {
+		pool.ParallelFor(static_cast<size_t>(batch * channels), [&](size_t plane, size_t) {
+			int64_t c = static_cast<int64_t>(plane) % channels;
+			const float* src = input + static_cast<int64_t>(plane) * innerSize;
+			float* dst = output + static_cast<int64_t>(plane) * innerSize;
+			float a = scale[c];
+			float b = shift[c];
+			for (int64_t i = 0; i < innerSize; i++) {
+				dst[i] = src[i] * a + b;
+			}
+		});
+	}
+
+	void Unary(ThreadPool& pool, UnaryOp op, int64_t count, const float* input, float* output) {
+		pool.ParallelFor(static_cast<size_t>(CeilDiv(count, ELEMENTWISE_CHUNK)), [&](size_t task, size_t) {
+			int64_t begin = static_cast<int64_t>(task) * ELEMENTWISE_CHUNK;
+			int64_t end = std::min(count, begin + ELEMENTWISE_CHUNK);
+			switch (op) {
+			case UnaryOp::Relu:
+				for (int64_t i = begin; i < end; i++) {
+					output[i] = std::max(input[i], 0.0f);
+				}
+				break;
+			case UnaryOp::Sigmoid:
+				for (int64_t i = begin; i < end; i++) {
+					output[i] = 1.0f / (1.0f + std::exp(-input[i]));
+				}
+				break;
+			}
+		});
+	}
+
+	void Binary(ThreadPool& pool, BinaryOp op, const float* a, const Shape& aShape, const float* b,
+		const Shape& bShape, float* output, const Shape& outShape) {
+		switch (op) {
+		case BinaryOp::Add:
+			BinaryLoop(pool, a, aShape, b, bShape, output, outShape, [](float x, float y) { return x + y; });
+			break;
+		case BinaryOp::Sub:
+			BinaryLoop(pool, a, aShape, b, bShape, output, outShape, [](float x, float y) { return x - y; });
+			break;
+		case BinaryOp::Mul:
+			BinaryLoop(pool, a, aShape, b, bShape, output, outShape, [](float x, float y) { return x * y; });
+			break;
+		case BinaryOp::Div:
+			BinaryLoop(pool, a, aShape, b, bShape, output, outShape, [](float x, float y) { return x / y; });
+			break;
+		}
+	}
+
+	void Transpose(ThreadPool& pool, const float* input, const Shape& inShape, const std::vector<int64_t>& perm,
+		float* output) {
+		size_t rank = inShape.size();
+		std::vector<int64_t> inStrides(rank, 1);
+		for (size_t axis = rank; axis-- > 1;) {
+			inStrides[axis - 1] = inStrides[axis] * inShape[axis];
+		}
+		Shape outShape(rank);
+		std::vector<int64_t> strides(rank);  // Input stride per output axis.
+		for (size_t axis = 0; axis < rank; axis++) {
+			outShape[axis] = inShape[perm[axis]];
+			strides[axis] = inStrides[perm[axis]];
+		}
+		int64_t inner = rank > 0 ? outShape[rank - 1] : 1;
+		int64_t innerStride = rank > 0 ? strides[rank - 1] : 1;
+		int64_t rows = ElementCount(outShape) / std::max<int64_t>(inner, 1);
+		int64_t rowsPerTask = std::max<int64_t>(1, ELEMENTWISE_CHUNK / std::max<int64_t>(inner, 1));
+		pool.ParallelFor(static_cast<size_t>(CeilDiv(rows, rowsPerTask)), [&](size_t task, size_t) {
+			int64_t rowBegin = static_cast<int64_t>(task) * rowsPerTask;
+			int64_t rowEnd = std::min(rows, rowBegin + rowsPerTask);
+			for (int64_t row = rowBegin; row < rowEnd; row++) {
+				int64_t offset = 0;
+				int64_t rest = row;
+				for (size_t k = 1; k < rank; k++) {
+					size_t axis = rank - 1 - k;
+					offset += (rest % outShape[axis]) * strides[axis];
+					rest /= outShape[axis];
+				}
+				float* dst = output + row * inner;
+				const float* src = input + offset;
+				for (int64_t i = 0; i < inner; i++) {
+					dst[i] = src[i * innerStride];
+				}
+			}
+		});
+	}
+
+	void PadConstant(ThreadPool& pool, const float* input, const Shape& inShape, const std::vector<int64_t>& pads,
+		float value, float* output) {
+		size_t rank = inShape.size();
+		Shape outShape(rank);
+		std::vector<int64_t> inStrides(rank, 1);
+		for (size_t axis = 0; axis < rank; axis++) {
+			outShape[axis] = inShape[axis] + pads[axis] + pads[rank + axis];
+		}
+		for (size_t axis = rank; axis-- > 1;) {
+			inStrides[axis - 1] = inStrides[axis] * inShape[axis];
+		}
+		int64_t inner = rank > 0 ? outShape[rank - 1] : 1;
+		int64_t innerPad = rank > 0 ? pads[rank - 1] : 0;
+		int64_t innerSize = rank > 0 ? inShape[rank - 1] : 1;
+		int64_t rows = ElementCount(outShape) / std::max<int64_t>(inner, 1);
+		int64_t rowsPerTask = std::max<int64_t>(1, ELEMENTWISE_CHUNK / std::max<int64_t>(inner, 1));
+		pool.ParallelFor(static_cast<size_t>(CeilDiv(rows, rowsPerTask)), [&](size_t task, size_t) {
+			int64_t rowBegin = static_cast<int64_t>(task) * rowsPerTask;
+			int64_t rowEnd = std::min(rows, rowBegin + rowsPerTask);
+			for (int64_t row = rowBegin; row < rowEnd; row++) {
+				float* dst = output + row * inner;
+				int64_t offset = 0;
+				bool inside = true;
+				int64_t rest = row;
+				for (size_t k = 1; k < rank && inside; k++) {
+					size_t axis = rank - 1 - k;
+					int64_t index = rest % outShape[axis] - pads[axis];
+					rest /= outShape[axis];
+					inside = index >= 0 && index < inShape[axis];
+					offset += index * inStrides[axis];
+				}
+				if (!inside) {
+					std::fill(dst, dst + inner, value);
+					continue;
+				}
+				// Output columns [left, right) come from the input row.
+				int64_t left = std::max<int64_t>(0, innerPad);
+				int64_t right = std::min(inner, innerPad + innerSize);
+				std::fill(dst, dst + left, value);
+				if (right > left) {
+					std::memcpy(dst + left, input + offset + (left - innerPad), (right - left) * sizeof(float));
+				}
+				std::fill(dst + std::max(left, right), dst + inner, value);
+			}
+		});
+	}
+
+	void Concat(const std::vector<const float*>& inputs, const std::vector<Shape>& inShapes, int64_t axis,
+		float* output) {
+		int64_t outer = 1;
+		for (int64_t k = 0; k < axis; k++) {
+			outer *= inShapes[0][k];
+		}
+		std::vector<int64_t> blockSizes(inputs.size());
+		for (size_t input = 0; input < inputs.size(); input++) {
+			blockSizes[input] = ElementCount(inShapes[input]) / std::max<int64_t>(outer, 1);
+		}
+		for (int64_t o = 0; o < outer; o++) {
+			for (size_t input = 0; input < inputs.size(); input++) {
+				std::memcpy(output, inputs[input] + o * blockSizes[input], blockSizes[input] * sizeof(float));
+				output += blockSizes[input];
+			}
+		}
+	}
+}
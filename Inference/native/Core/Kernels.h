@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "OnnxModel.h"
+#include "ThreadPool.h"
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Per-thread scratch buffers of the kernels (e.g., for image-to-column matrices), indexed
+	/// by the thread index of <c>ThreadPool::ParallelFor()</c>. Buffers grow to the largest
+	/// size needed and are kept, so that steady-state inference does not allocate.
+	/// </summary>
+	typedef std::vector<std::vector<float>> ScratchBuffers;
+
+	/// <summary>
+	/// Geometry of a 2-D convolution or pooling window over a batch of NCHW tensors. Padding
+	/// at the bottom/right is implied by the output size.
+	/// </summary>
+	struct Window2d {
+		int64_t batch;
+		int64_t inChannels, inHeight, inWidth;
+		int64_t outChannels, outHeight, outWidth;
+		int64_t kernelHeight, kernelWidth;
+		int64_t strideHeight, strideWidth;
+		int64_t dilationHeight, dilationWidth;
+		int64_t padTop, padLeft;
+
+		Window2d();
+	};
+
+	/// <summary>
+	/// Convolution (group 1) as a matrix product per image: weights [Cout, Cin*kH*kW] times
+	/// the image-to-column matrix [Cin*kH*kW, outH*outW], computed in column blocks that fit
+	/// the cache, on all threads. 1x1 convolutions with stride 1 use the input as is.
+	/// <c>weights</c> are in ONNX layout [Cout, Cin, kH, kW]; <c>bias</c> (per output
+	/// channel) may be nullptr. If <c>relu</c>, negative outputs are clamped to 0.
+	/// </summary>
+	void Conv2d(ThreadPool& pool, ScratchBuffers& scratch, const Window2d& window, const float* input,
+		const float* weights, const float* bias, bool relu, float* output);
+
+	/// <summary>
+	/// Transposed convolution (group 1): the matrix product weights^T [Cout*kH*kW, Cin] times
+	/// the input [Cin, H*W] per image, kept in <c>columns</c>, is scattered into the output
+	/// (column-to-image): input pixel (h, w) adds to output pixel
+	/// (h * stride - padTop + i * dilation, ...) for each kernel position (i, j).
+	/// <c>weights</c> are in ONNX layout [Cin, Cout, kH, kW].
+	/// </summary>
+	void ConvTranspose2d(ThreadPool& pool, std::vector<float>& columns, const Window2d& window, const float* input,
+		const float* weights, const float* bias, float* output);
+
+	/// <summary>
+	/// Max pooling; padded elements are ignored.
+	/// </summary>
+	void MaxPool2d(ThreadPool& pool, const Window2d& window, const float* input, float* output);
+
+	/// <summary>
+	/// <c>output = input * scale[c] + shift[c]</c> per channel of an [N, C, ...] tensor with
+	/// <c>innerSize</c> elements per channel and image (e.g., batch normalization). In place if
+	/// <c>output == input</c>.
+	/// </summary>
+	void ChannelAffine(ThreadPool& pool, int64_t batch, int64_t channels, int64_t innerSize, const float* input,
+		const float* scale, const float* shift, float* output);
+
+	enum class UnaryOp { Relu, Sigmoid };
+
+	/// <summary>
+	/// Element-wise function; in place if <c>output == input</c>.
+	/// </summary>
+	void Unary(ThreadPool& pool, UnaryOp op, int64_t count, const float* input, float* output);
+
+	enum class BinaryOp { Add, Sub, Mul, Div };
+
+	/// <summary>
+	/// Element-wise operation with multidirectional (NumPy) broadcasting of <c>a</c> and
+	/// <c>b</c> to <c>outShape</c>. In place if <c>output</c> is an input of the output's shape.
+	/// </summary>
+	void Binary(ThreadPool& pool, BinaryOp op, const float* a, const Shape& aShape, const float* b,
+		const Shape& bShape, float* output, const Shape& outShape);
+
+	/// <summary>
+	/// Permute the axes of a tensor: output axis i is input axis <c>perm[i]</c>.
+	/// </summary>
+	void Transpose(ThreadPool& pool, const float* input, const Shape& inShape, const std::vector<int64_t>& perm,
+		float* output);
+
+	/// <summary>
+	/// Pad a tensor with a constant; <c>pads</c> holds the number of elements added at the
+	/// beginning of each axis, then at the end of each axis (ONNX layout). Negative pads crop.
+	/// </summary>
+	void PadConstant(ThreadPool& pool, const float* input, const Shape& inShape, const std::vector<int64_t>& pads,
+		float value, float* output);
+
+	/// <summary>
+	/// Concatenate tensors along <c>axis</c>.
+	/// </summary>
+	void Concat(const std::vector<const float*>& inputs, const std::vector<Shape>& inShapes, int64_t axis,
+		float* output);
+}
@@ -0,0 +1,179 @@
+#include "LabelRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Simd.h"
+
+
+namespace KwaInference {
+
+	namespace {
+
+		const double PI = 3.14159265358979323846;
+		// Entries of matplotlib's colormap lookup tables.
+		const int COLORMAP_ENTRIES = 256;
+
+		struct Segment {
+			double x, y;
+		};
+
+		// Segments of matplotlib's jet colormap (_jet_data).
+		const Segment JET_RED[] = { { 0.0, 0.0 }, { 0.35, 0.0 }, { 0.66, 1.0 }, { 0.89, 1.0 }, { 1.0, 0.5 } };
+		const Segment JET_GREEN[] = { { 0.0, 0.0 }, { 0.125, 0.0 }, { 0.375, 1.0 }, { 0.64, 1.0 }, { 0.91, 0.0 }, { 1.0, 0.0 } };
+		const Segment JET_BLUE[] = { { 0.0, 0.5 }, { 0.11, 1.0 }, { 0.34, 1.0 }, { 0.65, 0.0 }, { 1.0, 0.0 } };
+
+		template <size_t N>
+		double Interpolate(const Segment (&segments)[N], double x) {
+			for (size_t i = 1; i < N; i++) {
+				if (x <= segments[i].x) {
+					double t = (x - segments[i - 1].x) / (segments[i].x - segments[i - 1].x);
+					return segments[i - 1].y + t * (segments[i].y - segments[i - 1].y);
+				}
+			}
+			return segments[N - 1].y;
+		}
+
+		uint8_t ToByte(double value) {
+			return static_cast<uint8_t>(std::min(std::max(value, 0.0), 1.0) * 255.0);
+		}
+
+		/// <summary>
+		/// Blend <c>bytes</c> bytes of RGB pixels with a color: dst = (dst * (256 - a) + c * a
+		/// + 128) / 256. The sums fit 16 bits, as dst * (256 - a) + c * a &lt;= 255 * 256.
+		/// </summary>
+		struct Blender {
+			uint8_t color[3];
+			uint16_t alpha;
+#ifdef KWA_SIMD_SSE2
+			// Color * alpha + 128 per byte of 16 bytes starting at color channel k, split into
+			// the lower and upper 8 bytes.
+			__m128i weightedLow[3], weightedHigh[3];
+#endif
+
+			Blender(const Rgb& rgb, uint16_t alpha) : alpha(alpha) {
+				this->color[0] = rgb.r;
+				this->color[1] = rgb.g;
+				this->color[2] = rgb.b;
+#ifdef KWA_SIMD_SSE2
+				for (int phase = 0; phase < 3; phase++) {
+					alignas(16) uint16_t weighted[16];
+					for (int j = 0; j < 16; j++) {
+						weighted[j] = static_cast<uint16_t>(this->color[(j + phase) % 3] * alpha + 128);
+					}
+					this->weightedLow[phase] = _mm_load_si128(reinterpret_cast<const __m128i*>(weighted));
+					this->weightedHigh[phase] = _mm_load_si128(reinterpret_cast<const __m128i*>(weighted + 8));
+				}
+#endif
+			}
+
+			void Blend(uint8_t* dst, size_t bytes, SimdLevel level) const {
+				size_t i = 0;
+#ifdef KWA_SIMD_SSE2
+				if (level >= SimdLevel::Sse2) {
+					const __m128i zero = _mm_setzero_si128();
+					const __m128i inverse = _mm_set1_epi16(static_cast<short>(256 - this->alpha));
+					// A step of 16 bytes advances the color channel by one (16 % 3).
+					for (int phase = 0; i + 16 <= bytes; i += 16, phase = (phase + 1) % 3) {
+						__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+						__m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), inverse), this->weightedLow[phase]);
+						__m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), inverse), this->weightedHigh[phase]);
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+							_mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8)));
+					}
+				}
+#endif
+				(void)level;
+				for (; i < bytes; i++) {
+					dst[i] = static_cast<uint8_t>((dst[i] * (256 - this->alpha) + this->color[i % 3] * this->alpha + 128) >> 8);
+				}
+			}
+		};
+	}
+
+	bool ColormapColors(const std::string& name, size_t count, std::vector<Rgb>& colors) {
+		colors.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			// As matplotlib's ScalarMappable.to_rgba() of evenly spaced values in [0, 1]: the
+			// entry of the lookup table the value falls into.
+			double value = count > 1 ? static_cast<double>(i) / (count - 1) : 0.0;
+			int entry = std::min(static_cast<int>(value * COLORMAP_ENTRIES), COLORMAP_ENTRIES - 1);
+			double x = static_cast<double>(entry) / (COLORMAP_ENTRIES - 1);
+			double r, g, b;
+			if (name == "rainbow") {
+				r = std::fabs(2.0 * x - 0.5);
+				g = std::sin(PI * x);
+				b = std::cos(PI * x / 2.0);
+			}
+			else if (name == "jet") {
+				r = Interpolate(JET_RED, x);
+				g = Interpolate(JET_GREEN, x);
+				b = Interpolate(JET_BLUE, x);
+			}
+			else if (name == "cool") {
+				r = x;
+				g = 1.0 - x;
+				b = 1.0;
+			}
+			else if (name == "gray") {
+				r = g = b = x;
+			}
+			else {
+				return false;
+			}
+			colors[i] = Rgb{ ToByte(r), ToByte(g), ToByte(b) };
+		}
+		return true;
+	}
+
+	LabelStyle::LabelStyle() : dotSize(6.0), alpha(0.7), pcutoff(0.6) {
+	}
+
+	bool LabelStyle::Load(const YamlFile& config, size_t bodypartCount) {
+		this->dotSize = config.GetNumber("dotsize", this->dotSize);
+		this->alpha = std::min(std::max(config.GetNumber("alphavalue", this->alpha), 0.0), 1.0);
+		this->pcutoff = config.GetNumber("pcutoff", this->pcutoff);
+		if (ColormapColors(config.Get("colormap", "rainbow"), bodypartCount, this->colors)) {
+			return true;
+		}
+		ColormapColors("rainbow", bodypartCount, this->colors);
+		return false;
+	}
+
+	LabelRenderer::LabelRenderer(const LabelStyle& style) : style(style), simdLevel(MaxSimdLevel()) {
+		this->alpha = static_cast<uint16_t>(std::lround(style.alpha * 256.0));
+	}
+
+	void LabelRenderer::SetSimdLevel(SimdLevel level) {
+		this->simdLevel = std::min(level, MaxSimdLevel());
+	}
+
+	void LabelRenderer::Draw(uint8_t* rgb, int width, int height, const float* pose) const {
+		double radius = this->style.dotSize;
+		for (size_t bodypart = 0; bodypart < this->style.colors.size(); bodypart++, pose += 3) {
+			double x = pose[0], y = pose[1];
+			// NaN (e.g., frames not analyzed) fails the comparisons as well.
+			if (!(pose[2] >= this->style.pcutoff) || !(x > -radius && x < width + radius && y > -radius && y < height + radius)) {
+				continue;
+			}
+			Blender blender(this->style.colors[bodypart], this->alpha);
+			int top = std::max(0, static_cast<int>(std::ceil(y - radius)));
+			int bottom = std::min(height - 1, static_cast<int>(std::floor(y + radius)));
+			for (int row = top; row <= bottom; row++) {
+				double halfWidth2 = radius * radius - (row - y) * (row - y);
+				if (halfWidth2 <= 0.0) {
+					continue;
+				}
+				double halfWidth = std::sqrt(halfWidth2);
+				// Columns c with |c - x| < halfWidth.
+				int left = std::max(0, static_cast<int>(std::floor(x - halfWidth)) + 1);
+				int right = std::min(width - 1, static_cast<int>(std::ceil(x + halfWidth)) - 1);
+				if (left > right) {
+					continue;
+				}
+				uint8_t* span = rgb + (static_cast<size_t>(row) * width + left) * 3;
+				blender.Blend(span, static_cast<size_t>(right - left + 1) * 3, this->simdLevel);
+			}
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DlcConfig.h"
+#include "FrameConverter.h"
+
+
+namespace KwaInference {
+
+	struct Rgb {
+		uint8_t r, g, b;
+	};
+
+	/// <summary>
+	/// Colors of <c>count</c> bodyparts from the matplotlib colormap <c>name</c>, picked as
+	/// by DLC's create_labeled_video (evenly from 0 to 1). Known colormaps: rainbow, jet, cool,
+	/// and gray.
+	/// </summary>
+	/// <returns><c>false</c> if the colormap is unknown.</returns>
+	bool ColormapColors(const std::string& name, size_t count, std::vector<Rgb>& colors);
+
+	/// <summary>
+	/// How bodyparts are drawn, from a DLC project's config.yaml.
+	/// </summary>
+	struct LabelStyle {
+		double dotSize;          // Radius of a marker in pixels (dotsize).
+		double alpha;            // Opacity of a marker (alphavalue).
+		double pcutoff;          // Markers are drawn if the likelihood is at least pcutoff.
+		std::vector<Rgb> colors; // Per bodypart (colormap).
+
+		LabelStyle();
+
+		/// <summary>
+		/// Read dotsize, alphavalue, pcutoff, and colormap; an unknown colormap is replaced
+		/// by rainbow (DLC's default), which returns <c>false</c>.
+		/// </summary>
+		bool Load(const YamlFile& config, size_t bodypartCount);
+	};
+
+	/// <summary>
+	/// Draws the bodypart markers of a frame as DLC's create_labeled_video does: for each
+	/// bodypart with a likelihood of at least pcutoff, in order, a disk of radius dotsize
+	/// around its position (the pixels whose centers are less than the radius away),
+	/// blended with its color at alphavalue. The disk is drawn in spans of a row, which are
+	/// blended 16 bytes per step with SSE2 (in 8-bit fixed point).
+	/// </summary>
+	class LabelRenderer {
+	public:
+		explicit LabelRenderer(const LabelStyle& style);
+
+		/// <summary>
+		/// Restrict the instruction set, e.g., to compare them; capped at <c>MaxSimdLevel()</c>.
+		/// </summary>
+		void SetSimdLevel(SimdLevel level);
+
+		/// <summary>
+		/// Draw the markers of <c>pose</c> (x, y, likelihood per bodypart, as in
+		/// <c>PoseStoreReader::ReadPoses()</c>) into an RGB frame.
+		/// </summary>
+		void Draw(uint8_t* rgb, int width, int height, const float* pose) const;
+
+	private:
+		LabelStyle style;
+		uint16_t alpha;  // Opacity in 1/256.
+		SimdLevel simdLevel;
+	};
+}
@@ -0,0 +1,98 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace KwaInference {
+
+#ifdef _WIN32
+	MappedFile::MappedFile() : data(nullptr), size(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr) {
+	}
+#else
+	MappedFile::MappedFile() : data(nullptr), size(0) {
+	}
+#endif
+
+	MappedFile::~MappedFile() {
+		this->Close();
+	}
+
+#ifdef _WIN32
+	bool MappedFile::Open(const std::string& path) {
+		this->Close();
+		this->fileHandle = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER fileSize;
+		if (this->fileHandle == INVALID_HANDLE_VALUE || !::GetFileSizeEx(this->fileHandle, &fileSize)
+			|| fileSize.QuadPart == 0) {
+			this->Close();
+			return false;
+		}
+		this->mappingHandle = ::CreateFileMappingA(this->fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (this->mappingHandle == nullptr) {
+			this->Close();
+			return false;
+		}
+		this->data = static_cast<const uint8_t*>(::MapViewOfFile(this->mappingHandle, FILE_MAP_READ, 0, 0, 0));
+		if (this->data == nullptr) {
+			this->Close();
+			return false;
+		}
+		this->size = static_cast<size_t>(fileSize.QuadPart);
+		return true;
+	}
+
+	void MappedFile::Close() {
+		if (this->data != nullptr) {
+			::UnmapViewOfFile(this->data);
+			this->data = nullptr;
+		}
+		if (this->mappingHandle != nullptr) {
+			::CloseHandle(this->mappingHandle);
+			this->mappingHandle = nullptr;
+		}
+		if (this->fileHandle != INVALID_HANDLE_VALUE) {
+			::CloseHandle(this->fileHandle);
+			this->fileHandle = INVALID_HANDLE_VALUE;
+		}
+		this->size = 0;
+	}
+#else
+	bool MappedFile::Open(const std::string& path) {
+		this->Close();
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+		void* mapping = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);  // The mapping keeps the file open.
+		if (mapping == MAP_FAILED) {
+			return false;
+		}
+		this->data = static_cast<const uint8_t*>(mapping);
+		this->size = static_cast<size_t>(info.st_size);
+		return true;
+	}
+
+	void MappedFile::Close() {
+		if (this->data != nullptr) {
+			::munmap(const_cast<uint8_t*>(this->data), this->size);
+			this->data = nullptr;
+		}
+		this->size = 0;
+	}
+#endif
+}
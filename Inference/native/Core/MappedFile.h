@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Read-only memory mapping of a file. Mapping the model instead of reading it lets the
+	/// weights be used in place: loading costs no copy, and pages are read on first use (or
+	/// are already in the page cache on later runs).
+	/// </summary>
+	class MappedFile {
+	public:
+		MappedFile();
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		/// <returns><c>false</c> if the file cannot be opened or mapped.</returns>
+		bool Open(const std::string& path);
+		void Close();
+
+		const uint8_t* Data() const { return this->data; }
+		size_t Size() const { return this->size; }
+
+	private:
+		const uint8_t* data;
+		size_t size;
+#ifdef _WIN32
+		void* fileHandle;
+		void* mappingHandle;
+#endif
+	};
+}
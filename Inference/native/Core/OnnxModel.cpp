@@ -0,0 +1,526 @@
+#include "OnnxModel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+
+namespace KwaInference {
+
+	namespace {
+
+		// Protobuf wire types.
+		const uint32_t WIRE_VARINT = 0;
+		const uint32_t WIRE_FIXED64 = 1;
+		const uint32_t WIRE_BYTES = 2;
+		const uint32_t WIRE_FIXED32 = 5;
+
+		// TensorProto.DataLocation of tensors in external files.
+		const uint64_t DATA_LOCATION_EXTERNAL = 1;
+
+		/// <summary>
+		/// Decoder of the protobuf wire format. Reading past the end or an unknown wire type
+		/// sets the failed flag, after which all reads return zero.
+		/// </summary>
+		class ProtoReader {
+		public:
+			ProtoReader(const uint8_t* data, size_t size) : pos(data), end(data + size), failed(false) {
+			}
+
+			bool Failed() const { return this->failed; }
+
+			/// <summary>
+			/// Read the key of the next field; returns <c>false</c> at the end of the message.
+			/// </summary>
+			bool Next(uint32_t& field, uint32_t& wireType) {
+				if (this->failed || this->pos >= this->end) {
+					return false;
+				}
+				uint64_t key = this->Varint();
+				field = static_cast<uint32_t>(key >> 3);
+				wireType = static_cast<uint32_t>(key & 7);
+				return !this->failed;
+			}
+
+			uint64_t Varint() {
+				uint64_t value = 0;
+				for (int shift = 0; shift < 64; shift += 7) {
+					if (this->pos >= this->end) {
+						break;
+					}
+					uint8_t byte = *this->pos++;
+					value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+					if ((byte & 0x80) == 0) {
+						return value;
+					}
+				}
+				this->failed = true;
+				return 0;
+			}
+
+			uint32_t Fixed32() {
+				uint32_t value = 0;
+				if (this->Take(4)) {
+					std::memcpy(&value, this->pos - 4, 4);
+				}
+				return value;
+			}
+
+			uint64_t Fixed64() {
+				uint64_t value = 0;
+				if (this->Take(8)) {
+					std::memcpy(&value, this->pos - 8, 8);
+				}
+				return value;
+			}
+
+			/// <summary>
+			/// Read a length-delimited field (a string, bytes, a message, or a packed array).
+			/// </summary>
+			ProtoReader Bytes() {
+				uint64_t size = this->Varint();
+				if (this->failed || size > static_cast<uint64_t>(this->end - this->pos)) {
+					this->failed = true;
+					return ProtoReader(this->end, 0);
+				}
+				this->pos += size;
+				return ProtoReader(this->pos - size, static_cast<size_t>(size));
+			}
+
+			std::string String() {
+				ProtoReader bytes = this->Bytes();
+				return std::string(reinterpret_cast<const char*>(bytes.pos), bytes.end - bytes.pos);
+			}
+
+			const uint8_t* Position() const { return this->pos; }
+			size_t Remaining() const { return static_cast<size_t>(this->end - this->pos); }
+
+			void Skip(uint32_t wireType) {
+				switch (wireType) {
+				case WIRE_VARINT: this->Varint(); break;
+				case WIRE_FIXED64: this->Take(8); break;
+				case WIRE_BYTES: this->Bytes(); break;
+				case WIRE_FIXED32: this->Take(4); break;
+				default: this->failed = true; break;
+				}
+			}
+
+			/// <summary>
+			/// Read a repeated integer field, packed or not.
+			/// </summary>
+			void Ints(uint32_t wireType, std::vector<int64_t>& values) {
+				if (wireType == WIRE_BYTES) {
+					ProtoReader packed = this->Bytes();
+					while (packed.Remaining() > 0 && !packed.Failed()) {
+						values.push_back(static_cast<int64_t>(packed.Varint()));
+					}
+					this->failed |= packed.Failed();
+				}
+				else if (wireType == WIRE_VARINT) {
+					values.push_back(static_cast<int64_t>(this->Varint()));
+				}
+				else {
+					this->failed = true;
+				}
+			}
+
+			/// <summary>
+			/// Read a repeated float field, packed or not.
+			/// </summary>
+			void Floats(uint32_t wireType, std::vector<float>& values) {
+				if (wireType == WIRE_BYTES) {
+					ProtoReader packed = this->Bytes();
+					size_t count = packed.Remaining() / 4;
+					size_t offset = values.size();
+					values.resize(offset + count);
+					std::memcpy(values.data() + offset, packed.pos, count * 4);
+				}
+				else if (wireType == WIRE_FIXED32) {
+					values.push_back(this->Float());
+				}
+				else {
+					this->failed = true;
+				}
+			}
+
+			/// <summary>
+			/// Read a repeated double field, packed or not, converting to float.
+			/// </summary>
+			void Doubles(uint32_t wireType, std::vector<float>& values) {
+				if (wireType == WIRE_BYTES) {
+					ProtoReader packed = this->Bytes();
+					while (packed.Remaining() >= 8) {
+						values.push_back(static_cast<float>(packed.Double()));
+					}
+				}
+				else if (wireType == WIRE_FIXED64) {
+					values.push_back(static_cast<float>(this->Double()));
+				}
+				else {
+					this->failed = true;
+				}
+			}
+
+			float Float() {
+				uint32_t bits = this->Fixed32();
+				float value;
+				std::memcpy(&value, &bits, 4);
+				return value;
+			}
+
+			double Double() {
+				uint64_t bits = this->Fixed64();
+				double value;
+				std::memcpy(&value, &bits, 8);
+				return value;
+			}
+
+		private:
+			bool Take(size_t count) {
+				if (this->failed || count > static_cast<size_t>(this->end - this->pos)) {
+					this->failed = true;
+					return false;
+				}
+				this->pos += count;
+				return true;
+			}
+
+			const uint8_t* pos;
+			const uint8_t* end;
+			bool failed;
+		};
+
+		bool ParseTensor(ProtoReader reader, OnnxTensor& tensor) {
+			uint32_t field, wireType;
+			uint64_t dataLocation = 0;
+			while (reader.Next(field, wireType)) {
+				switch (field) {
+				case 1: reader.Ints(wireType, tensor.dims); break;
+				case 2: tensor.dataType = static_cast<int32_t>(reader.Varint()); break;
+				case 4: reader.Floats(wireType, tensor.floats); break;
+				case 5:
+				case 7: reader.Ints(wireType, tensor.ints); break;
+				case 8: tensor.name = reader.String(); break;
+				case 9: {
+					ProtoReader raw = reader.Bytes();
+					tensor.raw = raw.Position();
+					tensor.rawSize = raw.Remaining();
+					break;
+				}
+				case 10: reader.Doubles(wireType, tensor.floats); break;
+				case 14: dataLocation = reader.Varint(); break;
+				default: reader.Skip(wireType); break;
+				}
+			}
+			return !reader.Failed() && dataLocation != DATA_LOCATION_EXTERNAL;
+		}
+
+		bool ParseAttribute(ProtoReader reader, OnnxAttribute& attribute) {
+			uint32_t field, wireType;
+			while (reader.Next(field, wireType)) {
+				switch (field) {
+				case 1: attribute.name = reader.String(); break;
+				case 2: attribute.f = reader.Float(); break;
+				case 3: attribute.i = static_cast<int64_t>(reader.Varint()); break;
+				case 4: attribute.s = reader.String(); break;
+				case 5: {
+					attribute.tensors.emplace_back();
+					if (!ParseTensor(reader.Bytes(), attribute.tensors.back())) {
+						return false;
+					}
+					break;
+				}
+				case 7: reader.Floats(wireType, attribute.floats); break;
+				case 8: reader.Ints(wireType, attribute.ints); break;
+				default: reader.Skip(wireType); break;
+				}
+			}
+			return !reader.Failed();
+		}
+
+		bool ParseNode(ProtoReader reader, OnnxNode& node) {
+			uint32_t field, wireType;
+			while (reader.Next(field, wireType)) {
+				switch (field) {
+				case 1: node.inputs.push_back(reader.String()); break;
+				case 2: node.outputs.push_back(reader.String()); break;
+				case 3: node.name = reader.String(); break;
+				case 4: node.opType = reader.String(); break;
+				case 5: {
+					node.attributes.emplace_back();
+					if (!ParseAttribute(reader.Bytes(), node.attributes.back())) {
+						return false;
+					}
+					break;
+				}
+				case 7: node.domain = reader.String(); break;
+				default: reader.Skip(wireType); break;
+				}
+			}
+			return !reader.Failed();
+		}
+
+		void ParseShape(ProtoReader reader, Shape& dims) {
+			uint32_t field, wireType;
+			while (reader.Next(field, wireType)) {
+				if (field != 1) {
+					reader.Skip(wireType);
+					continue;
+				}
+				int64_t value = -1;  // Symbolic or unset dimension.
+				ProtoReader dim = reader.Bytes();
+				uint32_t dimField, dimWireType;
+				while (dim.Next(dimField, dimWireType)) {
+					if (dimField == 1) {
+						value = static_cast<int64_t>(dim.Varint());
+					}
+					else {
+						dim.Skip(dimWireType);
+					}
+				}
+				dims.push_back(value);
+			}
+		}
+
+		bool ParseValueInfo(ProtoReader reader, OnnxValueInfo& info) {
+			info.dataType = 0;
+			uint32_t field, wireType;
+			while (reader.Next(field, wireType)) {
+				if (field == 1) {
+					info.name = reader.String();
+				}
+				else if (field == 2) {
+					// TypeProto.tensor_type: elem_type and shape.
+					ProtoReader type = reader.Bytes();
+					uint32_t typeField, typeWireType;
+					while (type.Next(typeField, typeWireType)) {
+						if (typeField != 1) {
+							type.Skip(typeWireType);
+							continue;
+						}
+						ProtoReader tensorType = type.Bytes();
+						uint32_t tensorField, tensorWireType;
+						while (tensorType.Next(tensorField, tensorWireType)) {
+							if (tensorField == 1) {
+								info.dataType = static_cast<int32_t>(tensorType.Varint());
+							}
+							else if (tensorField == 2) {
+								ParseShape(tensorType.Bytes(), info.dims);
+							}
+							else {
+								tensorType.Skip(tensorWireType);
+							}
+						}
+					}
+				}
+				else {
+					reader.Skip(wireType);
+				}
+			}
+			return !reader.Failed();
+		}
+
+		bool ParseGraph(ProtoReader reader, OnnxGraph& graph) {
+			uint32_t field, wireType;
+			while (reader.Next(field, wireType)) {
+				bool valid = true;
+				switch (field) {
+				case 1:
+					graph.nodes.emplace_back();
+					valid = ParseNode(reader.Bytes(), graph.nodes.back());
+					break;
+				case 5:
+					graph.initializers.emplace_back();
+					valid = ParseTensor(reader.Bytes(), graph.initializers.back());
+					break;
+				case 11:
+					graph.inputs.emplace_back();
+					valid = ParseValueInfo(reader.Bytes(), graph.inputs.back());
+					break;
+				case 12:
+					graph.outputs.emplace_back();
+					valid = ParseValueInfo(reader.Bytes(), graph.outputs.back());
+					break;
+				default:
+					reader.Skip(wireType);
+					break;
+				}
+				if (!valid) {
+					return false;
+				}
+			}
+			return !reader.Failed();
+		}
+	}
+
+	int64_t ElementCount(const Shape& shape) {
+		int64_t count = 1;
+		for (int64_t dim : shape) {
+			count *= dim;
+		}
+		return count;
+	}
+
+	std::string FormatShape(const Shape& shape) {
+		std::ostringstream text;
+		text << "[";
+		for (size_t i = 0; i < shape.size(); i++) {
+			text << (i > 0 ? ", " : "");
+			if (shape[i] < 0) {
+				text << "?";
+			}
+			else {
+				text << shape[i];
+			}
+		}
+		text << "]";
+		return text.str();
+	}
+
+	OnnxTensor::OnnxTensor() : dataType(0), raw(nullptr), rawSize(0) {
+	}
+
+	bool OnnxTensor::ToFloats(std::vector<float>& values) const {
+		size_t count = static_cast<size_t>(ElementCount(this->dims));
+		values.resize(count);
+		if (this->raw != nullptr && this->dataType == ONNX_FLOAT && this->rawSize >= count * 4) {
+			std::memcpy(values.data(), this->raw, count * 4);
+			return true;
+		}
+		if (this->raw != nullptr && this->dataType == ONNX_DOUBLE && this->rawSize >= count * 8) {
+			for (size_t i = 0; i < count; i++) {
+				double value;
+				std::memcpy(&value, this->raw + i * 8, 8);
+				values[i] = static_cast<float>(value);
+			}
+			return true;
+		}
+		if ((this->dataType == ONNX_FLOAT || this->dataType == ONNX_DOUBLE) && this->floats.size() >= count) {
+			std::copy(this->floats.begin(), this->floats.begin() + count, values.begin());
+			return true;
+		}
+		return false;
+	}
+
+	bool OnnxTensor::ToInts(std::vector<int64_t>& values) const {
+		size_t count = static_cast<size_t>(ElementCount(this->dims));
+		values.resize(count);
+		if (this->raw != nullptr && this->dataType == ONNX_INT64 && this->rawSize >= count * 8) {
+			std::memcpy(values.data(), this->raw, count * 8);
+			return true;
+		}
+		if (this->raw != nullptr && this->dataType == ONNX_INT32 && this->rawSize >= count * 4) {
+			for (size_t i = 0; i < count; i++) {
+				int32_t value;
+				std::memcpy(&value, this->raw + i * 4, 4);
+				values[i] = value;
+			}
+			return true;
+		}
+		if ((this->dataType == ONNX_INT64 || this->dataType == ONNX_INT32) && this->ints.size() >= count) {
+			std::copy(this->ints.begin(), this->ints.begin() + count, values.begin());
+			return true;
+		}
+		return false;
+	}
+
+	const uint8_t* OnnxTensor::RawFloats() const {
+		size_t count = static_cast<size_t>(ElementCount(this->dims));
+		return (this->dataType == ONNX_FLOAT && this->raw != nullptr && this->rawSize >= count * 4) ? this->raw : nullptr;
+	}
+
+	OnnxAttribute::OnnxAttribute() : f(0.0f), i(0) {
+	}
+
+	const OnnxAttribute* OnnxNode::Attribute(const std::string& attributeName) const {
+		for (const OnnxAttribute& attribute : this->attributes) {
+			if (attribute.name == attributeName) {
+				return &attribute;
+			}
+		}
+		return nullptr;
+	}
+
+	int64_t OnnxNode::IntAttribute(const std::string& attributeName, int64_t defaultValue) const {
+		const OnnxAttribute* attribute = this->Attribute(attributeName);
+		return attribute ? attribute->i : defaultValue;
+	}
+
+	float OnnxNode::FloatAttribute(const std::string& attributeName, float defaultValue) const {
+		const OnnxAttribute* attribute = this->Attribute(attributeName);
+		return attribute ? attribute->f : defaultValue;
+	}
+
+	std::string OnnxNode::StringAttribute(const std::string& attributeName, const std::string& defaultValue) const {
+		const OnnxAttribute* attribute = this->Attribute(attributeName);
+		return attribute ? attribute->s : defaultValue;
+	}
+
+	std::vector<int64_t> OnnxNode::IntsAttribute(const std::string& attributeName) const {
+		const OnnxAttribute* attribute = this->Attribute(attributeName);
+		return attribute ? attribute->ints : std::vector<int64_t>();
+	}
+
+	OnnxModel::OnnxModel() {
+		this->graph.opsetVersion = 0;
+	}
+
+	bool OnnxModel::Load(const std::string& path) {
+		this->graph = OnnxGraph();
+		this->graph.opsetVersion = 0;
+		this->producer.clear();
+		if (!this->file.Open(path)) {
+			this->lastError = "Cannot open model file " + path + ".";
+			return false;
+		}
+
+		ProtoReader reader(this->file.Data(), this->file.Size());
+		bool hasGraph = false;
+		std::string producerName, producerVersion;
+		uint32_t field, wireType;
+		while (reader.Next(field, wireType)) {
+			switch (field) {
+			case 2: producerName = reader.String(); break;
+			case 3: producerVersion = reader.String(); break;
+			case 7:
+				if (!ParseGraph(reader.Bytes(), this->graph)) {
+					this->lastError = "Model file " + path + " has an invalid graph (tensors in external files are not supported).";
+					return false;
+				}
+				hasGraph = true;
+				break;
+			case 8: {
+				// OperatorSetIdProto: domain, version.
+				ProtoReader opset = reader.Bytes();
+				std::string domain;
+				int64_t version = 0;
+				uint32_t opsetField, opsetWireType;
+				while (opset.Next(opsetField, opsetWireType)) {
+					if (opsetField == 1) {
+						domain = opset.String();
+					}
+					else if (opsetField == 2) {
+						version = static_cast<int64_t>(opset.Varint());
+					}
+					else {
+						opset.Skip(opsetWireType);
+					}
+				}
+				if (domain.empty() || domain == "ai.onnx") {
+					this->graph.opsetVersion = version;
+				}
+				break;
+			}
+			default:
+				reader.Skip(wireType);
+				break;
+			}
+		}
+		if (reader.Failed() || !hasGraph) {
+			this->lastError = "File " + path + " is not an ONNX model.";
+			return false;
+		}
+		this->producer = producerName + (producerVersion.empty() ? "" : " " + producerVersion);
+		return true;
+	}
+}
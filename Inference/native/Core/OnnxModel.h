@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Dimensions of a tensor, outermost first; -1 for a dimension unknown until run time
+	/// (e.g., the batch size of a model input).
+	/// </summary>
+	typedef std::vector<int64_t> Shape;
+
+	/// <summary>
+	/// Number of elements of a tensor of <c>shape</c> (1 for a scalar).
+	/// </summary>
+	int64_t ElementCount(const Shape& shape);
+
+	/// <summary>
+	/// Format a shape as, e.g., "[8, 364, 720, 3]".
+	/// </summary>
+	std::string FormatShape(const Shape& shape);
+
+	/// <summary>
+	/// ONNX element types (TensorProto.DataType) the engine handles.
+	/// </summary>
+	enum OnnxDataType {
+		ONNX_FLOAT = 1,
+		ONNX_INT32 = 6,
+		ONNX_INT64 = 7,
+		ONNX_DOUBLE = 11,
+	};
+
+	/// <summary>
+	/// Constant tensor of the model (an initializer or the value of a Constant node). Float
+	/// data stored as raw bytes are not copied: <c>raw</c> points into the mapped model file.
+	/// </summary>
+	struct OnnxTensor {
+		std::string name;
+		Shape dims;
+		int32_t dataType;
+		const uint8_t* raw;          // Little-endian element data, or nullptr.
+		size_t rawSize;
+		std::vector<float> floats;   // Typed data (float_data, or converted double_data).
+		std::vector<int64_t> ints;   // Typed data (int64_data, int32_data).
+
+		OnnxTensor();
+
+		/// <summary>
+		/// Copy the elements as floats (of a float or double tensor).
+		/// </summary>
+		/// <returns><c>false</c> if the tensor has another type or too few elements.</returns>
+		bool ToFloats(std::vector<float>& values) const;
+		/// <summary>
+		/// Copy the elements as integers (of an int32 or int64 tensor).
+		/// </summary>
+		bool ToInts(std::vector<int64_t>& values) const;
+		/// <summary>
+		/// Float elements in place, if stored as raw bytes (which may be unaligned); else nullptr.
+		/// </summary>
+		const uint8_t* RawFloats() const;
+	};
+
+	struct OnnxAttribute {
+		std::string name;
+		float f;
+		int64_t i;
+		std::string s;
+		std::vector<float> floats;
+		std::vector<int64_t> ints;
+		std::vector<OnnxTensor> tensors;  // At most one (attribute `t`, e.g., of Constant nodes).
+
+		OnnxAttribute();
+	};
+
+	struct OnnxNode {
+		std::string name;
+		std::string opType;
+		std::string domain;
+		std::vector<std::string> inputs;   // Empty names denote omitted optional inputs.
+		std::vector<std::string> outputs;
+		std::vector<OnnxAttribute> attributes;
+
+		const OnnxAttribute* Attribute(const std::string& attributeName) const;
+		int64_t IntAttribute(const std::string& attributeName, int64_t defaultValue) const;
+		float FloatAttribute(const std::string& attributeName, float defaultValue) const;
+		std::string StringAttribute(const std::string& attributeName, const std::string& defaultValue) const;
+		std::vector<int64_t> IntsAttribute(const std::string& attributeName) const;
+	};
+
+	struct OnnxValueInfo {
+		std::string name;
+		int32_t dataType;
+		Shape dims;
+	};
+
+	/// <summary>
+	/// Computation graph of an ONNX model; nodes are in topological order, as required by the
+	/// ONNX specification.
+	/// </summary>
+	struct OnnxGraph {
+		std::vector<OnnxNode> nodes;
+		std::vector<OnnxTensor> initializers;
+		std::vector<OnnxValueInfo> inputs;   // Includes initializers in models of IR version < 4.
+		std::vector<OnnxValueInfo> outputs;
+		int64_t opsetVersion;                // Of the default ("ai.onnx") domain.
+	};
+
+	/// <summary>
+	/// Reads an ONNX model (a protocol buffer of type ModelProto) with a minimal protobuf
+	/// decoder, so that no protobuf or ONNX library is needed. The file is mapped into memory
+	/// and must stay open while the graph's tensors are used. Tensors in external data files
+	/// (models larger than 2 GB) are not supported.
+	/// </summary>
+	class OnnxModel {
+	public:
+		OnnxModel();
+
+		/// <returns><c>false</c> if the file cannot be read or is not a valid ONNX model; see
+		/// <c>LastError()</c>.</returns>
+		bool Load(const std::string& path);
+
+		const OnnxGraph& Graph() const { return this->graph; }
+		/// <summary>
+		/// Producer of the model as recorded in the file, e.g., "tf2onnx 1.9.3".
+		/// </summary>
+		const std::string& Producer() const { return this->producer; }
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		MappedFile file;
+		OnnxGraph graph;
+		std::string producer;
+		std::string lastError;
+	};
+}
@@ -0,0 +1,166 @@
+#include "PoseCsv.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+
+namespace KwaInference {
+
+	PoseCsvWriter::PoseCsvWriter() : file(nullptr), bodypartCount(0), frameIndex(0), failed(false) {
+	}
+
+	PoseCsvWriter::~PoseCsvWriter() {
+		this->Close();
+	}
+
+	bool PoseCsvWriter::Open(const std::string& path, const std::string& scorer, const std::vector<std::string>& bodyparts) {
+		this->Close();
+		this->file = std::fopen(path.c_str(), "w");
+		if (this->file == nullptr) {
+			return false;
+		}
+		this->bodypartCount = bodyparts.size();
+		this->frameIndex = 0;
+		this->failed = false;
+		std::fputs("scorer", this->file);
+		for (size_t i = 0; i < 3 * bodyparts.size(); i++) {
+			std::fprintf(this->file, ",%s", scorer.c_str());
+		}
+		std::fputs("\nbodyparts", this->file);
+		for (const std::string& bodypart : bodyparts) {
+			std::fprintf(this->file, ",%s,%s,%s", bodypart.c_str(), bodypart.c_str(), bodypart.c_str());
+		}
+		std::fputs("\ncoords", this->file);
+		for (size_t i = 0; i < bodyparts.size(); i++) {
+			std::fputs(",x,y,likelihood", this->file);
+		}
+		std::fputs("\n", this->file);
+		return true;
+	}
+
+	bool PoseCsvWriter::Write(const std::vector<float>& poses, int64_t frameCount, float offsetX, float offsetY) {
+		if (this->file == nullptr) {
+			return false;
+		}
+		for (int64_t frame = 0; frame < frameCount; frame++) {
+			std::fprintf(this->file, "%lld", static_cast<long long>(this->frameIndex++));
+			const float* pose = poses.data() + frame * this->bodypartCount * 3;
+			for (size_t bodypart = 0; bodypart < this->bodypartCount; bodypart++, pose += 3) {
+				std::fprintf(this->file, ",%.9g,%.9g,%.9g", pose[0] + offsetX, pose[1] + offsetY, pose[2]);
+			}
+			std::fputs("\n", this->file);
+		}
+		this->failed |= std::ferror(this->file) != 0;
+		return !this->failed;
+	}
+
+	bool PoseCsvWriter::Close() {
+		if (this->file == nullptr) {
+			return !this->failed;
+		}
+		this->failed |= std::fclose(this->file) != 0;
+		this->file = nullptr;
+		return !this->failed;
+	}
+
+	namespace {
+
+		/// <summary>
+		/// Split a CSV row at commas (DLC's files quote no fields).
+		/// </summary>
+		std::vector<std::string> SplitRow(const std::string& line) {
+			std::vector<std::string> fields;
+			size_t begin = 0;
+			for (;;) {
+				size_t end = line.find(',', begin);
+				fields.push_back(line.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+				if (end == std::string::npos) {
+					return fields;
+				}
+				begin = end + 1;
+			}
+		}
+	}
+
+	PoseCsvReader::PoseCsvReader() : file(nullptr) {
+	}
+
+	PoseCsvReader::~PoseCsvReader() {
+		this->Close();
+	}
+
+	bool PoseCsvReader::Open(const std::string& path) {
+		this->Close();
+		this->file = std::fopen(path.c_str(), "r");
+		if (this->file == nullptr) {
+			return false;
+		}
+		std::string rows[3];
+		for (std::string& row : rows) {
+			if (!this->ReadLine(row)) {
+				this->Close();
+				return false;
+			}
+		}
+		std::vector<std::string> scorers = SplitRow(rows[0]);
+		std::vector<std::string> names = SplitRow(rows[1]);
+		std::vector<std::string> coords = SplitRow(rows[2]);
+		if (scorers[0] != "scorer" || names[0] != "bodyparts" || coords[0] != "coords" || names.size() < 4
+			|| (names.size() - 1) % 3 != 0 || coords.size() != names.size()) {
+			this->Close();
+			return false;
+		}
+		this->scorer = scorers.size() > 1 ? scorers[1] : std::string();
+		this->bodyparts.clear();
+		for (size_t i = 1; i < names.size(); i += 3) {
+			this->bodyparts.push_back(names[i]);
+		}
+		return true;
+	}
+
+	void PoseCsvReader::Close() {
+		if (this->file != nullptr) {
+			std::fclose(this->file);
+			this->file = nullptr;
+		}
+	}
+
+	bool PoseCsvReader::Read(std::vector<float>& pose) {
+		if (!this->ReadLine(this->line)) {
+			return false;
+		}
+		pose.assign(this->bodyparts.size() * 3, std::numeric_limits<float>::quiet_NaN());
+		// Skip the frame index; fields may be empty (e.g., frames DLC could not read).
+		const char* cursor = this->line.c_str();
+		const char* comma = std::strchr(cursor, ',');
+		for (size_t column = 0; comma != nullptr && column < pose.size(); column++) {
+			cursor = comma + 1;
+			char* end;
+			float value = std::strtof(cursor, &end);
+			if (end != cursor) {
+				pose[column] = value;
+			}
+			comma = std::strchr(cursor, ',');
+		}
+		return true;
+	}
+
+	bool PoseCsvReader::ReadLine(std::string& text) {
+		text.clear();
+		if (this->file == nullptr) {
+			return false;
+		}
+		char buffer[4096];
+		while (std::fgets(buffer, sizeof(buffer), this->file) != nullptr) {
+			text += buffer;
+			if (!text.empty() && text.back() == '\n') {
+				break;
+			}
+		}
+		while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) {
+			text.pop_back();
+		}
+		return !text.empty();
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Writes poses in the CSV layout of DLC's analyze_videos (save_as_csv): header rows
+	/// "scorer", "bodyparts", and "coords" (x, y, likelihood per bodypart), then one row per
+	/// frame, led by the frame index.
+	/// </summary>
+	class PoseCsvWriter {
+	public:
+		PoseCsvWriter();
+		~PoseCsvWriter();
+
+		/// <returns><c>false</c> if the file cannot be created.</returns>
+		bool Open(const std::string& path, const std::string& scorer, const std::vector<std::string>& bodyparts);
+		/// <summary>
+		/// Write the poses of <c>frameCount</c> consecutive frames, laid out as by
+		/// <c>PoseDecoder::Decode()</c>, adding <c>offsetX</c>/<c>offsetY</c> to the coordinates
+		/// (e.g., the origin of a crop rectangle).
+		/// </summary>
+		bool Write(const std::vector<float>& poses, int64_t frameCount, float offsetX = 0.0f, float offsetY = 0.0f);
+		/// <returns><c>false</c> if writing failed.</returns>
+		bool Close();
+
+		int64_t FrameCount() const { return this->frameIndex; }
+
+	private:
+		FILE* file;
+		size_t bodypartCount;
+		int64_t frameIndex;
+		bool failed;
+	};
+
+	/// <summary>
+	/// Reads poses from a CSV file in the layout of <c>PoseCsvWriter</c> (e.g., of
+	/// `inference.py predict`) a frame at a time, so that files of any length are read in
+	/// constant memory.
+	/// </summary>
+	class PoseCsvReader {
+	public:
+		PoseCsvReader();
+		~PoseCsvReader();
+
+		PoseCsvReader(const PoseCsvReader&) = delete;
+		PoseCsvReader& operator=(const PoseCsvReader&) = delete;
+
+		/// <summary>
+		/// Open a file and read its header rows.
+		/// </summary>
+		/// <returns><c>false</c> if the file cannot be read or has no such header.</returns>
+		bool Open(const std::string& path);
+		void Close();
+
+		/// <summary>
+		/// Read the next frame: x, y, likelihood per bodypart (NaN where the row is empty).
+		/// </summary>
+		/// <returns><c>false</c> at the end of the file.</returns>
+		bool Read(std::vector<float>& pose);
+
+		const std::string& Scorer() const { return this->scorer; }
+		const std::vector<std::string>& Bodyparts() const { return this->bodyparts; }
+
+	private:
+		bool ReadLine(std::string& line);
+
+		FILE* file;
+		std::string scorer;
+		std::vector<std::string> bodyparts;
+		std::string line;
+	};
+}
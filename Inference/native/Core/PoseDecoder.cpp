@@ -0,0 +1,119 @@
+#include "PoseDecoder.h"
+
+#include <algorithm>
+
+
+namespace KwaInference {
+
+	namespace {
+		const size_t NONE = static_cast<size_t>(-1);
+	}
+
+	PoseDecoder::PoseDecoder(const PoseConfig& config)
+		: config(config), scoremapOutput(NONE), locrefOutput(NONE), channelsLast(true) {
+	}
+
+	bool PoseDecoder::Bind(const std::vector<TensorInfo>& outputs) {
+		int64_t joints = static_cast<int64_t>(this->config.JointCount());
+		this->scoremapOutput = this->locrefOutput = NONE;
+		for (size_t index = 0; index < outputs.size(); index++) {
+			const Shape& shape = outputs[index].shape;
+			if (shape.size() != 4) {
+				continue;
+			}
+			if (this->scoremapOutput == NONE && (shape[3] == joints || shape[1] == joints)) {
+				this->scoremapOutput = index;
+				this->channelsLast = shape[3] == joints;
+			}
+			else if (this->locrefOutput == NONE && (shape[3] == 2 * joints || shape[1] == 2 * joints)) {
+				this->locrefOutput = index;
+			}
+		}
+		if (this->scoremapOutput == NONE) {
+			return this->Fail("The model has no scoremap output with " + std::to_string(joints) + " channels (one per bodypart).");
+		}
+		if (this->config.locationRefinement && this->locrefOutput == NONE) {
+			return this->Fail("The model has no location refinement output with " + std::to_string(2 * joints) + " channels.");
+		}
+		if (!this->config.locationRefinement) {
+			this->locrefOutput = NONE;
+		}
+		return true;
+	}
+
+	bool PoseDecoder::Decode(const float* scoremap, const Shape& scoremapShape, const float* locref,
+		const Shape& locrefShape, std::vector<float>& poses) {
+		int64_t joints = static_cast<int64_t>(this->config.JointCount());
+		if (scoremapShape.size() != 4 || (this->channelsLast ? scoremapShape[3] : scoremapShape[1]) != joints) {
+			return this->Fail("Unexpected scoremap shape " + FormatShape(scoremapShape) + ".");
+		}
+		int64_t batch = scoremapShape[0];
+		int64_t height = this->channelsLast ? scoremapShape[1] : scoremapShape[2];
+		int64_t width = this->channelsLast ? scoremapShape[2] : scoremapShape[3];
+		int64_t cells = height * width;
+		if (locref != nullptr && ElementCount(locrefShape) != batch * cells * joints * 2) {
+			return this->Fail("Unexpected location refinement shape " + FormatShape(locrefShape) + ".");
+		}
+
+		poses.resize(static_cast<size_t>(batch * joints * 3));
+		std::vector<int64_t> best(static_cast<size_t>(joints));
+		float stride = static_cast<float>(this->config.stride);
+		float stdev = static_cast<float>(this->config.locrefStdev);
+		for (int64_t n = 0; n < batch; n++) {
+			// Cell of the highest score per joint; the first one on ties, as np.argmax.
+			const float* frame = scoremap + n * cells * joints;
+			if (this->channelsLast) {
+				std::fill(best.begin(), best.end(), 0);
+				for (int64_t cell = 1; cell < cells; cell++) {
+					const float* scores = frame + cell * joints;
+					for (int64_t joint = 0; joint < joints; joint++) {
+						if (scores[joint] > frame[best[joint] * joints + joint]) {
+							best[joint] = cell;
+						}
+					}
+				}
+			}
+			else {
+				for (int64_t joint = 0; joint < joints; joint++) {
+					const float* plane = frame + joint * cells;
+					float maximum = plane[0];
+					for (int64_t cell = 1; cell < cells; cell++) {
+						maximum = std::max(maximum, plane[cell]);
+					}
+					int64_t cell = 0;
+					while (cell < cells - 1 && plane[cell] != maximum) {
+						cell++;
+					}
+					best[joint] = cell;
+				}
+			}
+
+			const float* offsets = locref != nullptr ? locref + n * cells * joints * 2 : nullptr;
+			for (int64_t joint = 0; joint < joints; joint++) {
+				int64_t cell = best[joint];
+				float dx = 0.0f;
+				float dy = 0.0f;
+				float score;
+				if (this->channelsLast) {
+					score = frame[cell * joints + joint];
+					if (offsets != nullptr) {
+						dx = offsets[(cell * joints + joint) * 2];
+						dy = offsets[(cell * joints + joint) * 2 + 1];
+					}
+				}
+				else {
+					score = frame[joint * cells + cell];
+					if (offsets != nullptr) {
+						dx = offsets[(joint * 2) * cells + cell];
+						dy = offsets[(joint * 2 + 1) * cells + cell];
+					}
+				}
+				float* pose = poses.data() + (n * joints + joint) * 3;
+				pose[0] = static_cast<float>(cell % width) * stride + 0.5f * stride + dx * stdev;
+				pose[1] = static_cast<float>(cell / width) * stride + 0.5f * stride + dy * stdev;
+				pose[2] = score;
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "DlcConfig.h"
+#include "InferenceEngine.h"
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Decodes the outputs of a DLC pose network into one pose per frame as DLC does
+	/// (<c>predict.getposeNP</c>): for each joint, the scoremap cell of the highest score,
+	/// mapped to pixels (cell * stride + stride / 2), plus the location refinement vector of
+	/// that cell and joint (scaled by locref_stdev). The score is the likelihood.
+	/// </summary>
+	class PoseDecoder {
+	public:
+		explicit PoseDecoder(const PoseConfig& config);
+
+		/// <summary>
+		/// Identify the scoremap (one channel per joint) and the location refinement output
+		/// (two channels per joint) among the model outputs, in NHWC or NCHW layout.
+		/// </summary>
+		/// <returns><c>false</c> if the outputs do not fit the pose configuration; see
+		/// <c>LastError()</c>.</returns>
+		bool Bind(const std::vector<TensorInfo>& outputs);
+
+		size_t ScoremapOutput() const { return this->scoremapOutput; }
+		/// <summary>
+		/// Index of the location refinement output; >= the number of outputs if there is none.
+		/// </summary>
+		size_t LocrefOutput() const { return this->locrefOutput; }
+
+		/// <summary>
+		/// Decode a batch of network outputs. <c>poses</c> receives x, y, and likelihood per
+		/// joint and frame: <c>poses[(frame * joints + joint) * 3 + {0, 1, 2}]</c>.
+		/// <c>locref</c> may be nullptr.
+		/// </summary>
+		bool Decode(const float* scoremap, const Shape& scoremapShape, const float* locref, const Shape& locrefShape,
+			std::vector<float>& poses);
+
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		bool Fail(const std::string& message) {
+			this->lastError = message;
+			return false;
+		}
+
+		PoseConfig config;
+		size_t scoremapOutput;
+		size_t locrefOutput;
+		bool channelsLast;  // NHWC (as exported from TensorFlow), else NCHW.
+		std::string lastError;
+	};
+}
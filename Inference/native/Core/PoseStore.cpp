@@ -0,0 +1,260 @@
+#include "PoseStore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+
+namespace KwaInference {
+
+	namespace {
+
+		const char MAGIC[8] = { 'K', 'W', 'A', 'P', 'O', 'S', 'E', '\0' };
+		const uint32_t VERSION = 1;
+		const uint32_t FLAG_TIMESTAMPS = 1;
+		// Chunks start at a page boundary, so that columns are aligned in a memory mapping.
+		const uint64_t DATA_ALIGNMENT = 4096;
+
+		struct Header {
+			char magic[8];
+			uint32_t version;
+			uint32_t bodypartCount;
+			uint32_t chunkFrames;
+			uint32_t flags;
+			uint64_t frameCount;
+			uint64_t dataOffset;
+			uint32_t namesSize;
+			uint8_t reserved[20];
+		};
+		static_assert(sizeof(Header) == 64, "The pose store header must have 64 bytes.");
+
+		const float MISSING = std::numeric_limits<float>::quiet_NaN();
+
+		uint64_t ChunkBytes(size_t bodypartCount, uint32_t chunkFrames, bool timestamps) {
+			return static_cast<uint64_t>(chunkFrames) * (bodypartCount * 3 * sizeof(float) + (timestamps ? sizeof(double) : 0));
+		}
+
+		bool Seek(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+			return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+			return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+		}
+	}
+
+	PoseStoreWriter::PoseStoreWriter() : file(nullptr), bodypartCount(0), timestamps(false), chunkFrames(0), dataOffset(0),
+		frameCount(0), chunkIndex(0), failed(false) {
+	}
+
+	PoseStoreWriter::~PoseStoreWriter() {
+		this->Close();
+	}
+
+	bool PoseStoreWriter::Open(const std::string& path, const std::string& scorer, const std::vector<std::string>& bodyparts,
+		bool timestamps, uint32_t chunkFrames) {
+		this->Close();
+		if (bodyparts.empty() || chunkFrames == 0) {
+			return false;
+		}
+		this->file = std::fopen(path.c_str(), "wb");
+		if (this->file == nullptr) {
+			return false;
+		}
+		this->bodypartCount = bodyparts.size();
+		this->timestamps = timestamps;
+		this->chunkFrames = chunkFrames;
+		this->frameCount = 0;
+		this->chunkIndex = 0;
+		this->failed = false;
+		this->columns.assign(this->bodypartCount * 3 * chunkFrames, MISSING);
+		this->times.assign(timestamps ? chunkFrames : 0, std::numeric_limits<double>::quiet_NaN());
+
+		std::string names = scorer + '\0';
+		for (const std::string& bodypart : bodyparts) {
+			names += bodypart + '\0';
+		}
+		Header header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.bodypartCount = static_cast<uint32_t>(this->bodypartCount);
+		header.chunkFrames = chunkFrames;
+		header.flags = timestamps ? FLAG_TIMESTAMPS : 0;
+		header.namesSize = static_cast<uint32_t>(names.size());
+		this->dataOffset = (sizeof(Header) + names.size() + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+		header.dataOffset = this->dataOffset;
+		std::vector<char> padding(static_cast<size_t>(this->dataOffset - sizeof(Header) - names.size()), 0);
+		this->failed = std::fwrite(&header, sizeof(header), 1, this->file) != 1
+			|| std::fwrite(names.data(), 1, names.size(), this->file) != names.size()
+			|| std::fwrite(padding.data(), 1, padding.size(), this->file) != padding.size()
+			|| std::fflush(this->file) != 0;
+		return !this->failed;
+	}
+
+	bool PoseStoreWriter::Write(const std::vector<float>& poses, int64_t frameCount, float offsetX, float offsetY,
+		const double* timestamps) {
+		if (this->file == nullptr || (this->timestamps && timestamps == nullptr)) {
+			return false;
+		}
+		const float offsets[3] = { offsetX, offsetY, 0.0f };
+		for (int64_t frame = 0; frame < frameCount && !this->failed; frame++) {
+			size_t row = static_cast<size_t>(this->frameCount % this->chunkFrames);
+			const float* pose = poses.data() + frame * this->bodypartCount * 3;
+			for (size_t column = 0; column < this->bodypartCount * 3; column++) {
+				this->columns[column * this->chunkFrames + row] = pose[column] + offsets[column % 3];
+			}
+			if (this->timestamps) {
+				this->times[row] = timestamps[frame];
+			}
+			this->frameCount++;
+			if (row + 1 == this->chunkFrames) {
+				this->failed = !this->WriteChunk();
+				std::fill(this->columns.begin(), this->columns.end(), MISSING);
+				std::fill(this->times.begin(), this->times.end(), std::numeric_limits<double>::quiet_NaN());
+				this->chunkIndex++;
+			}
+		}
+		return !this->failed;
+	}
+
+	bool PoseStoreWriter::WriteChunk() {
+		uint64_t chunkBytes = ChunkBytes(this->bodypartCount, this->chunkFrames, this->timestamps);
+		uint64_t count = static_cast<uint64_t>(this->frameCount);
+		return Seek(this->file, this->dataOffset + static_cast<uint64_t>(this->chunkIndex) * chunkBytes)
+			&& std::fwrite(this->columns.data(), sizeof(float), this->columns.size(), this->file) == this->columns.size()
+			&& std::fwrite(this->times.data(), sizeof(double), this->times.size(), this->file) == this->times.size()
+			// Publish the frames only once their chunk is written.
+			&& std::fflush(this->file) == 0
+			&& Seek(this->file, offsetof(Header, frameCount))
+			&& std::fwrite(&count, sizeof(count), 1, this->file) == 1
+			&& std::fflush(this->file) == 0;
+	}
+
+	bool PoseStoreWriter::Close() {
+		if (this->file == nullptr) {
+			return !this->failed;
+		}
+		if (!this->failed && this->frameCount % this->chunkFrames != 0) {
+			this->failed = !this->WriteChunk();
+		}
+		this->failed |= std::fclose(this->file) != 0;
+		this->file = nullptr;
+		return !this->failed;
+	}
+
+	PoseStoreReader::PoseStoreReader() : frameCount(0), chunkFrames(0), dataOffset(0), chunkBytes(0), timestamps(false) {
+	}
+
+	bool PoseStoreReader::Open(const std::string& path) {
+		this->Close();
+		if (!this->file.Open(path)) {
+			return this->Fail("Cannot read " + path + ".");
+		}
+		Header header;
+		if (this->file.Size() < sizeof(header)) {
+			return this->Fail(path + " is no pose store.");
+		}
+		std::memcpy(&header, this->file.Data(), sizeof(header));
+		if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+			return this->Fail(path + " is no pose store.");
+		}
+		if (header.version != VERSION) {
+			return this->Fail(path + " has pose store version " + std::to_string(header.version) + ", which is not supported.");
+		}
+		if (header.bodypartCount == 0 || header.chunkFrames == 0 || header.dataOffset < sizeof(header) + header.namesSize
+			|| header.dataOffset > this->file.Size()) {
+			return this->Fail(path + " has an invalid header.");
+		}
+		this->chunkFrames = header.chunkFrames;
+		this->dataOffset = header.dataOffset;
+		this->timestamps = (header.flags & FLAG_TIMESTAMPS) != 0;
+		this->chunkBytes = ChunkBytes(header.bodypartCount, header.chunkFrames, this->timestamps);
+
+		const char* names = reinterpret_cast<const char*>(this->file.Data()) + sizeof(header);
+		const char* namesEnd = names + header.namesSize;
+		std::vector<std::string> strings;
+		while (names < namesEnd) {
+			const char* end = std::find(names, namesEnd, '\0');
+			strings.emplace_back(names, end);
+			names = end + 1;
+		}
+		if (strings.size() != header.bodypartCount + 1) {
+			return this->Fail(path + " has " + std::to_string(strings.size()) + " names for "
+				+ std::to_string(header.bodypartCount) + " bodyparts.");
+		}
+		this->scorer = strings[0];
+		this->bodyparts.assign(strings.begin() + 1, strings.end());
+
+		// A store being written may be mapped before its last chunk is complete.
+		uint64_t chunks = (this->file.Size() - this->dataOffset) / this->chunkBytes;
+		this->frameCount = static_cast<int64_t>(std::min<uint64_t>(header.frameCount, chunks * this->chunkFrames));
+		return true;
+	}
+
+	void PoseStoreReader::Close() {
+		this->file.Close();
+		this->frameCount = 0;
+		this->scorer.clear();
+		this->bodyparts.clear();
+	}
+
+	const uint8_t* PoseStoreReader::Column(int64_t frame, size_t column, int64_t& row) const {
+		uint64_t chunk = static_cast<uint64_t>(frame) / this->chunkFrames;
+		row = frame % this->chunkFrames;
+		return this->file.Data() + this->dataOffset + chunk * this->chunkBytes + column * this->chunkFrames * sizeof(float);
+	}
+
+	float PoseStoreReader::Value(int64_t frame, size_t bodypart, PoseCoordinate coordinate) const {
+		int64_t row;
+		const uint8_t* column = this->Column(frame, bodypart * 3 + static_cast<size_t>(coordinate), row);
+		float value;
+		std::memcpy(&value, column + row * sizeof(float), sizeof(value));
+		return value;
+	}
+
+	double PoseStoreReader::Timestamp(int64_t frame) const {
+		if (!this->timestamps) {
+			return std::numeric_limits<double>::quiet_NaN();
+		}
+		int64_t row;
+		const uint8_t* column = this->Column(frame, this->bodyparts.size() * 3, row);
+		double value;
+		std::memcpy(&value, column + row * sizeof(double), sizeof(value));
+		return value;
+	}
+
+	bool PoseStoreReader::ReadColumn(int64_t first, int64_t count, size_t bodypart, PoseCoordinate coordinate,
+		float* values) const {
+		if (first < 0 || count < 0 || first + count > this->frameCount || bodypart >= this->bodyparts.size()) {
+			return false;
+		}
+		// Copy the run of each chunk at once.
+		while (count > 0) {
+			int64_t row;
+			const uint8_t* column = this->Column(first, bodypart * 3 + static_cast<size_t>(coordinate), row);
+			int64_t run = std::min<int64_t>(count, this->chunkFrames - row);
+			std::memcpy(values, column + row * sizeof(float), static_cast<size_t>(run) * sizeof(float));
+			values += run;
+			first += run;
+			count -= run;
+		}
+		return true;
+	}
+
+	bool PoseStoreReader::ReadPoses(int64_t first, int64_t count, std::vector<float>& poses) const {
+		if (first < 0 || count < 0 || first + count > this->frameCount) {
+			return false;
+		}
+		size_t columns = this->bodyparts.size() * 3;
+		poses.resize(static_cast<size_t>(count) * columns);
+		for (int64_t frame = 0; frame < count; frame++) {
+			for (size_t column = 0; column < columns; column++) {
+				poses[frame * columns + column] = this->Value(first + frame, column / 3, static_cast<PoseCoordinate>(column % 3));
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Columns of a bodypart in a pose store.
+	/// </summary>
+	enum class PoseCoordinate {
+		X = 0,
+		Y = 1,
+		Likelihood = 2,
+	};
+
+	/// <summary>
+	/// Writes poses to a pose store (.kwapose) while they are predicted. The file is columnar
+	/// in chunks of a fixed number of frames, so that any frame is found by its index alone:
+	///
+	///   header (64 bytes): "KWAPOSE\0", version, bodypart count, frames per chunk, flags,
+	///     frame count, offset of the first chunk, size of the names (little endian)
+	///   names: scorer and bodyparts, each terminated by '\0'
+	///   chunks (from a 4096-byte boundary), each of all columns of its frames:
+	///     float32 x, y, likelihood [frames per chunk] per bodypart, in order, then
+	///     float64 trigger time in microseconds [frames per chunk] if the store has timestamps
+	///
+	/// The frame index is implied by the position. Each full chunk is written as soon as it is
+	/// complete, and the frame count updated, so that the store can be read while it grows and
+	/// keeps all complete chunks if the analysis is aborted; <c>Close()</c> writes the last
+	/// chunk, padded with NaN. Inference/posestore.py reads stores in Python and converts them
+	/// to DLC's HDF5 and CSV files.
+	/// </summary>
+	class PoseStoreWriter {
+	public:
+		/// <summary>
+		/// Frames per chunk: about 0.4 MB for 8 bodyparts, 6 s of a recording at 720 Hz.
+		/// </summary>
+		static const uint32_t DEFAULT_CHUNK_FRAMES = 4096;
+
+		PoseStoreWriter();
+		~PoseStoreWriter();
+
+		PoseStoreWriter(const PoseStoreWriter&) = delete;
+		PoseStoreWriter& operator=(const PoseStoreWriter&) = delete;
+
+		/// <returns><c>false</c> if the file cannot be created.</returns>
+		bool Open(const std::string& path, const std::string& scorer, const std::vector<std::string>& bodyparts,
+			bool timestamps = false, uint32_t chunkFrames = DEFAULT_CHUNK_FRAMES);
+		/// <summary>
+		/// Append the poses of <c>frameCount</c> consecutive frames, laid out as by
+		/// <c>PoseDecoder::Decode()</c>, adding <c>offsetX</c>/<c>offsetY</c> to the coordinates
+		/// (e.g., the origin of a crop rectangle). <c>timestamps</c> (one per frame; NaN if
+		/// unknown) is required if the store has timestamps, and ignored otherwise.
+		/// </summary>
+		bool Write(const std::vector<float>& poses, int64_t frameCount, float offsetX = 0.0f, float offsetY = 0.0f,
+			const double* timestamps = nullptr);
+		/// <returns><c>false</c> if writing failed.</returns>
+		bool Close();
+
+		int64_t FrameCount() const { return this->frameCount; }
+
+	private:
+		/// <summary>
+		/// Write the current chunk and the frame count to the file.
+		/// </summary>
+		bool WriteChunk();
+
+		FILE* file;
+		size_t bodypartCount;
+		bool timestamps;
+		uint32_t chunkFrames;
+		uint64_t dataOffset;
+		int64_t frameCount;
+		std::vector<float> columns;     // Columns of the current chunk.
+		std::vector<double> times;
+		int64_t chunkIndex;             // Index of the current chunk.
+		bool failed;
+	};
+
+	/// <summary>
+	/// Reads a pose store (see <c>PoseStoreWriter</c>) through a memory mapping: opening it
+	/// reads only its header, and frames are read by their index without parsing the rest.
+	/// </summary>
+	class PoseStoreReader {
+	public:
+		PoseStoreReader();
+
+		/// <returns><c>false</c> if the file cannot be read or is no pose store; see
+		/// <c>LastError()</c>.</returns>
+		bool Open(const std::string& path);
+		void Close();
+
+		int64_t FrameCount() const { return this->frameCount; }
+		const std::string& Scorer() const { return this->scorer; }
+		const std::vector<std::string>& Bodyparts() const { return this->bodyparts; }
+		bool HasTimestamps() const { return this->timestamps; }
+
+		/// <summary>
+		/// A coordinate of a bodypart in frame <c>frame</c> (&lt; <c>FrameCount()</c>).
+		/// </summary>
+		float Value(int64_t frame, size_t bodypart, PoseCoordinate coordinate) const;
+		/// <summary>
+		/// Trigger time of frame <c>frame</c> in microseconds; NaN if unknown.
+		/// </summary>
+		double Timestamp(int64_t frame) const;
+
+		/// <summary>
+		/// Copy a coordinate of a bodypart in frames [first, first + count) to <c>values</c>.
+		/// </summary>
+		/// <returns><c>false</c> if the frames are not in the store.</returns>
+		bool ReadColumn(int64_t first, int64_t count, size_t bodypart, PoseCoordinate coordinate, float* values) const;
+
+		/// <summary>
+		/// Read frames [first, first + count) laid out as by <c>PoseDecoder::Decode()</c>.
+		/// </summary>
+		/// <returns><c>false</c> if the frames are not in the store.</returns>
+		bool ReadPoses(int64_t first, int64_t count, std::vector<float>& poses) const;
+
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		bool Fail(const std::string& message) {
+			this->lastError = message;
+			this->Close();
+			return false;
+		}
+
+		/// <summary>
+		/// Start of a column of the chunk of <c>frame</c>, and the frame's row in it.
+		/// </summary>
+		const uint8_t* Column(int64_t frame, size_t column, int64_t& row) const;
+
+		MappedFile file;
+		int64_t frameCount;
+		uint32_t chunkFrames;
+		uint64_t dataOffset;
+		uint64_t chunkBytes;
+		bool timestamps;
+		std::string scorer;
+		std::vector<std::string> bodyparts;
+		std::string lastError;
+	};
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// Vector instruction sets available to hand-vectorized code, as compiled for (see
+// KWA_NATIVE_ARCH): SSE2 is part of every x86-64 CPU; AVX2 needs -march/arch flags.
+#if defined(__AVX2__)
+#define KWA_SIMD_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KWA_SIMD_SSE2
+#endif
+
+#if defined(KWA_SIMD_AVX2)
+#include <immintrin.h>
+#elif defined(KWA_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
@@ -0,0 +1,97 @@
+#include "StimulusRule.h"
+
+#include <algorithm>
+#include <cstdio>
+
+
+namespace KwaInference {
+
+	StimulusRule::StimulusRule() : condition(StimulusCondition::Region), x1(0.0f), y1(0.0f), x2(0.0f), y2(0.0f) {
+	}
+
+	bool ParseStimulusRule(const std::string& text, StimulusRule& rule) {
+		size_t colon = text.find(':');
+		if (colon == std::string::npos) {
+			return false;
+		}
+		std::string condition = text.substr(0, colon);
+		std::string rest = text.substr(colon + 1);
+		StimulusRule parsed;
+		if (condition == "stance" || condition == "swing") {
+			parsed.condition = condition == "stance" ? StimulusCondition::Stance : StimulusCondition::Swing;
+			parsed.bodypart = rest;
+		}
+		else if (condition == "region") {
+			// The bodypart may contain ":", the coordinates do not.
+			size_t last = rest.rfind(':');
+			if (last == std::string::npos) {
+				return false;
+			}
+			parsed.condition = StimulusCondition::Region;
+			parsed.bodypart = rest.substr(0, last);
+			char extra;
+			if (std::sscanf(rest.c_str() + last + 1, "%f,%f,%f,%f%c", &parsed.x1, &parsed.y1, &parsed.x2, &parsed.y2, &extra) != 4 ||
+				!(parsed.x1 < parsed.x2) || !(parsed.y1 < parsed.y2)) {
+				return false;
+			}
+		}
+		else {
+			return false;
+		}
+		if (parsed.bodypart.empty()) {
+			return false;
+		}
+		rule = parsed;
+		return true;
+	}
+
+	StimulusRuleEvaluator::StimulusRuleEvaluator() : bodypart(0), holds(false), hasLastTime(false), lastTime(0.0) {
+	}
+
+	bool StimulusRuleEvaluator::Configure(const StimulusRule& rule, const std::vector<std::string>& bodyparts,
+		const GaitSettings& settings) {
+		auto found = std::find(bodyparts.begin(), bodyparts.end(), rule.bodypart);
+		if (found == bodyparts.end()) {
+			this->lastError = "The project has no bodypart " + rule.bodypart + ".";
+			return false;
+		}
+		this->rule = rule;
+		this->settings = settings;
+		this->settings.maxGap = 0;  // Frames are output as they are pushed.
+		this->bodypart = static_cast<size_t>(found - bodyparts.begin());
+		this->filter.reset(new PoseFilter(1, this->settings));
+		this->detector.reset(new GaitDetector(this->settings));
+		this->holds = false;
+		this->hasLastTime = false;
+		this->lastTime = 0.0;
+		return true;
+	}
+
+	bool StimulusRuleEvaluator::Update(int64_t frame, double time, const float* pose) {
+		const float* position = pose + 3 * this->bodypart;
+		if (this->rule.condition == StimulusCondition::Region) {
+			// NaN (frames not analyzed) fails the comparison as well.
+			if (position[2] >= this->settings.pcutoff) {
+				this->holds = position[0] >= this->rule.x1 && position[0] < this->rule.x2 && position[1] >= this->rule.y1
+					&& position[1] < this->rule.y2;
+			}
+			return this->holds;
+		}
+
+		float filtered[3], velocity[2];
+		double filteredTime;
+		this->filter->Push(position, time);
+		this->filter->Pop(filtered, velocity, filteredTime);
+		// The filter's velocity is per pushed frame; the frames pushed may be apart.
+		double elapsed = this->hasLastTime ? time - this->lastTime : 0.0;
+		this->hasLastTime = true;
+		this->lastTime = time;
+		float speed = elapsed > 0.0 ? static_cast<float>(velocity[0] / elapsed) : 0.0f;
+		Stride stride;
+		this->detector->Push(frame, time, filtered[0], speed, stride);
+		GaitDetector::Phase phase = this->detector->CurrentPhase();
+		this->holds = phase == (this->rule.condition == StimulusCondition::Stance ? GaitDetector::Phase::Stance
+			: GaitDetector::Phase::Swing);
+		return this->holds;
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "GaitAnalysis.h"
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// When a stimulus rule holds: while a paw is within a region, or in a phase of its stride.
+	/// </summary>
+	enum class StimulusCondition {
+		Region,
+		Stance,
+		Swing,
+	};
+
+	/// <summary>
+	/// Condition of a closed loop on the pose of a bodypart, e.g., to switch a stimulus on while
+	/// the paw is in swing.
+	/// </summary>
+	struct StimulusRule {
+		StimulusCondition condition;
+		std::string bodypart;
+		float x1, y1, x2, y2;  // Region [x1, x2) x [y1, y2) in pixels of the full frame.
+
+		StimulusRule();
+	};
+
+	/// <summary>
+	/// Parse a rule given as "region:&lt;bodypart&gt;:&lt;x1&gt;,&lt;y1&gt;,&lt;x2&gt;,&lt;y2&gt;",
+	/// "stance:&lt;bodypart&gt;", or "swing:&lt;bodypart&gt;" (e.g., "swing:SIDE_PROFILE_VIEW-HL").
+	/// </summary>
+	/// <returns><c>false</c> if <c>text</c> is not a valid rule.</returns>
+	bool ParseStimulusRule(const std::string& text, StimulusRule& rule);
+
+	/// <summary>
+	/// Evaluates a <c>StimulusRule</c> on the poses of a recording as they are predicted, with no
+	/// delay: a region rule on the predicted position, a phase rule on a <c>GaitDetector</c> fed by
+	/// a causal <c>PoseFilter</c> of the bodypart (without gap interpolation, which would hold frames
+	/// back). Frames may be skipped (e.g., while the network cannot keep up with the camera); the
+	/// velocity is then taken per elapsed time. A frame in which the bodypart was not found (below
+	/// pcutoff) keeps the result of a region rule and ends the phase of a phase rule.
+	/// </summary>
+	class StimulusRuleEvaluator {
+	public:
+		StimulusRuleEvaluator();
+
+		/// <returns><c>false</c> if the rule's bodypart is not among <c>bodyparts</c>; see
+		/// <c>LastError()</c>.</returns>
+		bool Configure(const StimulusRule& rule, const std::vector<std::string>& bodyparts, const GaitSettings& settings);
+
+		/// <summary>
+		/// Evaluate the rule on the pose of frame <c>frame</c> (x, y, likelihood per bodypart in
+		/// pixels of the full frame), taken at <c>time</c> seconds.
+		/// </summary>
+		/// <returns>Whether the rule holds.</returns>
+		bool Update(int64_t frame, double time, const float* pose);
+
+		bool Holds() const { return this->holds; }
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		StimulusRule rule;
+		GaitSettings settings;
+		size_t bodypart;
+		std::unique_ptr<PoseFilter> filter;
+		std::unique_ptr<GaitDetector> detector;
+		bool holds;
+		bool hasLastTime;
+		double lastTime;
+		std::string lastError;
+	};
+}
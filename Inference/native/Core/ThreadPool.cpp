@@ -0,0 +1,89 @@
+#include "ThreadPool.h"
+
+
+namespace KwaInference {
+
+	ThreadPool::ThreadPool(size_t threadCount)
+		: body(nullptr), count(0), nextIndex(0), pendingIterations(0), generation(0), stopping(false) {
+		if (threadCount == 0) {
+			threadCount = std::thread::hardware_concurrency();
+		}
+		for (size_t thread = 1; thread < threadCount; thread++) {
+			this->workers.emplace_back(&ThreadPool::WorkerLoop, this, thread);
+		}
+	}
+
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopping = true;
+		}
+		this->workAvailable.notify_all();
+		for (std::thread& worker : this->workers) {
+			worker.join();
+		}
+	}
+
+	void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t, size_t)>& body) {
+		if (count == 0) {
+			return;
+		}
+		if (this->workers.empty() || count == 1) {
+			for (size_t index = 0; index < count; index++) {
+				body(index, 0);
+			}
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->body = &body;
+			this->count = count;
+			this->nextIndex = 0;
+			this->pendingIterations = count;
+			this->generation++;
+		}
+		this->workAvailable.notify_all();
+		this->RunIterations(0);
+
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->workDone.wait(lock, [this] { return this->pendingIterations == 0; });
+		this->body = nullptr;
+	}
+
+	void ThreadPool::WorkerLoop(size_t thread) {
+		size_t seenGeneration = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(this->mutex);
+				this->workAvailable.wait(lock, [&] { return this->stopping || this->generation != seenGeneration; });
+				if (this->stopping) {
+					return;
+				}
+				seenGeneration = this->generation;
+			}
+			this->RunIterations(thread);
+		}
+	}
+
+	void ThreadPool::RunIterations(size_t thread) {
+		for (;;) {
+			const std::function<void(size_t, size_t)>* loopBody;
+			size_t index;
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				if (this->body == nullptr || this->nextIndex >= this->count) {
+					return;
+				}
+				loopBody = this->body;
+				index = this->nextIndex++;
+			}
+			(*loopBody)(index, thread);
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				if (--this->pendingIterations == 0) {
+					this->workDone.notify_one();
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Fixed set of worker threads that run the iterations of a loop in parallel. The threads
+	/// are started once and wait for work in between, so that dispatching a loop costs a few
+	/// microseconds, which matters for the many small layers of a network.
+	/// </summary>
+	class ThreadPool {
+	public:
+		/// <param name="threadCount">Number of threads including the calling one; 0: one per
+		/// hardware thread.</param>
+		explicit ThreadPool(size_t threadCount = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		/// <summary>
+		/// Number of threads loops are run on, including the calling thread.
+		/// </summary>
+		size_t Size() const { return this->workers.size() + 1; }
+
+		/// <summary>
+		/// Call <c>body(index, thread)</c> for each index in [0, <c>count</c>) and return when
+		/// all calls returned. Indices are handed out dynamically, one at a time, to the
+		/// workers and the calling thread; <c>thread</c> (in [0, <c>Size()</c>)) identifies the
+		/// calling thread, e.g., to select its scratch buffer. Not reentrant.
+		/// </summary>
+		void ParallelFor(size_t count, const std::function<void(size_t index, size_t thread)>& body);
+
+	private:
+		void WorkerLoop(size_t thread);
+		/// <summary>
+		/// Run iterations of the current loop until none is left.
+		/// </summary>
+		void RunIterations(size_t thread);
+
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable workAvailable;
+		std::condition_variable workDone;
+		const std::function<void(size_t, size_t)>* body;  // Loop being run; guarded by `mutex`.
+		size_t count;
+		size_t nextIndex;
+		size_t pendingIterations;
+		size_t generation;  // Incremented for each loop, so that workers tell new loops apart.
+		bool stopping;
+	};
+}
@@ -0,0 +1,261 @@
+#include "Triangulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <Eigen/Dense>
+
+#include "DlcConfig.h"
+
+
+namespace KwaInference {
+
+	namespace {
+
+		// Weight of a view whose likelihood is 0, which keeps the equations solvable; the
+		// position is flagged anyway.
+		const double MIN_WEIGHT = 0.01;
+		// Relative singular value below which the calibration points are degenerate (e.g., in
+		// one plane).
+		const double DEGENERATE_SINGULAR_VALUE = 1e-9;
+		// Frames triangulated per block (on the stack).
+		const size_t BLOCK_FRAMES = 256;
+
+		/// <summary>
+		/// Similarity transform of points to their centroid and a mean distance of
+		/// sqrt(dimensions), as Hartley's normalization before the DLT.
+		/// </summary>
+		template <int D>
+		Eigen::Matrix<double, D + 1, D + 1> Normalization(const std::vector<Eigen::Matrix<double, D, 1>>& points) {
+			Eigen::Matrix<double, D, 1> centroid = Eigen::Matrix<double, D, 1>::Zero();
+			for (const auto& point : points) {
+				centroid += point;
+			}
+			centroid /= static_cast<double>(points.size());
+			double distance = 0.0;
+			for (const auto& point : points) {
+				distance += (point - centroid).norm();
+			}
+			distance /= static_cast<double>(points.size());
+			double scale = distance > 0.0 ? std::sqrt(static_cast<double>(D)) / distance : 1.0;
+			Eigen::Matrix<double, D + 1, D + 1> transform = Eigen::Matrix<double, D + 1, D + 1>::Identity() * scale;
+			transform.template topRightCorner<D, 1>() = -scale * centroid;
+			transform(D, D) = 1.0;
+			return transform;
+		}
+
+		/// <summary>
+		/// DLT estimate of the projection of <c>world</c> to <c>image</c>, scaled so that the
+		/// depth row has unit length and the points are in front of the (virtual) camera.
+		/// </summary>
+		bool EstimateProjection(const std::vector<Eigen::Vector3d>& world, const std::vector<Eigen::Vector2d>& image,
+			Projection& projection) {
+			Eigen::Matrix4d worldTransform = Normalization<3>(world);
+			Eigen::Matrix3d imageTransform = Normalization<2>(image);
+			Eigen::MatrixXd equations = Eigen::MatrixXd::Zero(2 * world.size(), 12);
+			for (size_t i = 0; i < world.size(); i++) {
+				Eigen::RowVector4d point = (worldTransform * world[i].homogeneous()).transpose();
+				Eigen::Vector3d pixel = imageTransform * image[i].homogeneous();
+				Eigen::Index row = static_cast<Eigen::Index>(2 * i);
+				equations.block<1, 4>(row, 0) = point;
+				equations.block<1, 4>(row, 8) = -pixel.x() * point;
+				equations.block<1, 4>(row + 1, 4) = point;
+				equations.block<1, 4>(row + 1, 8) = -pixel.y() * point;
+			}
+			Eigen::JacobiSVD<Eigen::MatrixXd> svd(equations, Eigen::ComputeFullV);
+			const Eigen::VectorXd& singular = svd.singularValues();
+			if (singular(10) < DEGENERATE_SINGULAR_VALUE * singular(0)) {
+				return false;
+			}
+			Eigen::Matrix<double, 3, 4, Eigen::RowMajor> normalized;
+			for (int i = 0; i < 12; i++) {
+				normalized(i / 4, i % 4) = svd.matrixV()(i, 11);
+			}
+			Eigen::Matrix<double, 3, 4, Eigen::RowMajor> matrix = imageTransform.inverse() * normalized * worldTransform;
+			matrix /= matrix.block<1, 3>(2, 0).norm();
+			if (matrix.row(2).dot(world[0].homogeneous()) < 0.0) {
+				matrix = -matrix;
+			}
+			std::copy(matrix.data(), matrix.data() + 12, projection.begin());
+			return true;
+		}
+
+		/// <summary>
+		/// Squared distance of the projection of (x, y, z) to pixel (u, v).
+		/// </summary>
+		inline double SquaredError(const Projection& p, double x, double y, double z, double u, double v) {
+			double depth = p[8] * x + p[9] * y + p[10] * z + p[11];
+			double du = (p[0] * x + p[1] * y + p[2] * z + p[3]) / depth - u;
+			double dv = (p[4] * x + p[5] * y + p[6] * z + p[7]) / depth - v;
+			return du * du + dv * dv;
+		}
+
+		/// <summary>
+		/// Add the equations of a view, (u p3 - p1) X = 0 and (v p3 - p2) X = 0 weighted by
+		/// <c>w</c>, to the normal equations n X = b (n symmetric; upper triangle).
+		/// </summary>
+		inline void AddView(const Projection& p, double u, double v, double w, double n[6], double b[3]) {
+			for (int row = 0; row < 2; row++) {
+				double coordinate = row == 0 ? u : v;
+				const double* q = p.data() + 4 * row;
+				double a0 = w * (coordinate * p[8] - q[0]);
+				double a1 = w * (coordinate * p[9] - q[1]);
+				double a2 = w * (coordinate * p[10] - q[2]);
+				double d = w * (coordinate * p[11] - q[3]);
+				n[0] += a0 * a0;
+				n[1] += a0 * a1;
+				n[2] += a0 * a2;
+				n[3] += a1 * a1;
+				n[4] += a1 * a2;
+				n[5] += a2 * a2;
+				b[0] -= a0 * d;
+				b[1] -= a1 * d;
+				b[2] -= a2 * d;
+			}
+		}
+
+		bool ParseProjection(const std::string& text, Projection& projection) {
+			// A flow sequence: [p00, p01, ..., p23].
+			size_t begin = text.find('[');
+			if (begin == std::string::npos) {
+				return false;
+			}
+			const char* cursor = text.c_str() + begin + 1;
+			for (double& value : projection) {
+				char* end;
+				value = std::strtod(cursor, &end);
+				if (end == cursor) {
+					return false;
+				}
+				cursor = end;
+				while (*cursor == ' ' || *cursor == ',') {
+					cursor++;
+				}
+			}
+			return *cursor == ']';
+		}
+	}
+
+	MirrorCalibration::MirrorCalibration() : side(), mirror(), rmsError(0.0), pointCount(0) {
+	}
+
+	bool MirrorCalibration::Calibrate(const std::vector<CalibrationPoint>& points) {
+		if (points.size() < MIN_POINTS) {
+			return this->Fail("A calibration takes at least " + std::to_string(MIN_POINTS) + " points; got "
+				+ std::to_string(points.size()) + ".");
+		}
+		std::vector<Eigen::Vector3d> world;
+		std::vector<Eigen::Vector2d> sidePixels, mirrorPixels;
+		for (const CalibrationPoint& point : points) {
+			world.emplace_back(point.x, point.y, point.z);
+			sidePixels.emplace_back(point.sideU, point.sideV);
+			mirrorPixels.emplace_back(point.mirrorU, point.mirrorV);
+		}
+		if (!EstimateProjection(world, sidePixels, this->side) || !EstimateProjection(world, mirrorPixels, this->mirror)) {
+			return this->Fail("The calibration points are degenerate; they must not lie in one plane.");
+		}
+		double sum = 0.0;
+		for (const CalibrationPoint& point : points) {
+			sum += SquaredError(this->side, point.x, point.y, point.z, point.sideU, point.sideV);
+			sum += SquaredError(this->mirror, point.x, point.y, point.z, point.mirrorU, point.mirrorV);
+		}
+		this->rmsError = std::sqrt(sum / (2.0 * points.size()));
+		this->pointCount = points.size();
+		return true;
+	}
+
+	bool MirrorCalibration::Load(const std::string& path) {
+		YamlFile file;
+		if (!file.Load(path)) {
+			return this->Fail("Cannot read " + path + ".");
+		}
+		if (!ParseProjection(file.Get("side_projection"), this->side) || !ParseProjection(file.Get("mirror_projection"), this->mirror)) {
+			return this->Fail(path + " is no mirror calibration (side_projection, mirror_projection).");
+		}
+		this->rmsError = file.GetNumber("rms_error", 0.0);
+		this->pointCount = static_cast<size_t>(file.GetNumber("points", 0.0));
+		return true;
+	}
+
+	bool MirrorCalibration::Save(const std::string& path) const {
+		FILE* file = std::fopen(path.c_str(), "w");
+		if (file == nullptr) {
+			return false;
+		}
+		std::fprintf(file, "# Mirror calibration of kwa-triangulate: projection matrices (3x4, row-major) of the side\n"
+			"# profile view and of the mirror view, from pixels to the units of the calibration points.\n");
+		std::fprintf(file, "points: %zu\nrms_error: %.4f  # pixels\n", this->pointCount, this->rmsError);
+		const char* names[] = { "side_projection", "mirror_projection" };
+		const Projection* projections[] = { &this->side, &this->mirror };
+		for (int view = 0; view < 2; view++) {
+			std::fprintf(file, "%s: [", names[view]);
+			for (size_t i = 0; i < 12; i++) {
+				std::fprintf(file, i == 0 ? "%.17g" : ", %.17g", (*projections[view])[i]);
+			}
+			std::fprintf(file, "]\n");
+		}
+		return std::fclose(file) == 0;
+	}
+
+	Triangulator::Triangulator(const MirrorCalibration& calibration, double pcutoff)
+		: side(calibration.Side()), mirror(calibration.Mirror()), pcutoff(static_cast<float>(pcutoff)) {
+	}
+
+	void Triangulator::Triangulate(const ViewColumns& side, const ViewColumns& mirror, size_t count,
+		const PointColumns& points) const {
+		// Outputs go to local blocks first, which the compiler knows not to overlap the inputs;
+		// otherwise it would have to check each output against each input at run time, more
+		// checks than it versions a loop for.
+		float x[BLOCK_FRAMES], y[BLOCK_FRAMES], z[BLOCK_FRAMES], error[BLOCK_FRAMES];
+		for (size_t first = 0; first < count; first += BLOCK_FRAMES) {
+			size_t frames = std::min(BLOCK_FRAMES, count - first);
+			const float* sideX = side.x + first;
+			const float* sideY = side.y + first;
+			const float* sideLikelihood = side.likelihood + first;
+			const float* mirrorX = mirror.x + first;
+			const float* mirrorY = mirror.y + first;
+			const float* mirrorLikelihood = mirror.likelihood + first;
+			for (size_t i = 0; i < frames; i++) {
+				double sideU = sideX[i], sideV = sideY[i];
+				double mirrorU = mirrorX[i], mirrorV = mirrorY[i];
+				// NaN (frames not analyzed) propagates to the position.
+				double sideWeight = std::max(static_cast<double>(sideLikelihood[i]), MIN_WEIGHT);
+				double mirrorWeight = std::max(static_cast<double>(mirrorLikelihood[i]), MIN_WEIGHT);
+				double n[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+				double b[3] = { 0.0, 0.0, 0.0 };
+				AddView(this->side, sideU, sideV, sideWeight, n, b);
+				AddView(this->mirror, mirrorU, mirrorV, mirrorWeight, n, b);
+
+				// Solve by the adjugate of n.
+				double c00 = n[3] * n[5] - n[4] * n[4];
+				double c01 = n[2] * n[4] - n[1] * n[5];
+				double c02 = n[1] * n[4] - n[2] * n[3];
+				double c11 = n[0] * n[5] - n[2] * n[2];
+				double c12 = n[1] * n[2] - n[0] * n[4];
+				double c22 = n[0] * n[3] - n[1] * n[1];
+				double inverse = 1.0 / (n[0] * c00 + n[1] * c01 + n[2] * c02);
+				double px = (c00 * b[0] + c01 * b[1] + c02 * b[2]) * inverse;
+				double py = (c01 * b[0] + c11 * b[1] + c12 * b[2]) * inverse;
+				double pz = (c02 * b[0] + c12 * b[1] + c22 * b[2]) * inverse;
+
+				double squared = SquaredError(this->side, px, py, pz, sideU, sideV) + SquaredError(this->mirror, px, py, pz, mirrorU, mirrorV);
+				x[i] = static_cast<float>(px);
+				y[i] = static_cast<float>(py);
+				z[i] = static_cast<float>(pz);
+				error[i] = static_cast<float>(std::sqrt(0.5 * squared));
+			}
+			std::memcpy(points.x + first, x, frames * sizeof(float));
+			std::memcpy(points.y + first, y, frames * sizeof(float));
+			std::memcpy(points.z + first, z, frames * sizeof(float));
+			std::memcpy(points.error + first, error, frames * sizeof(float));
+			uint8_t* flags = points.flags + first;
+			for (size_t i = 0; i < frames; i++) {
+				flags[i] = static_cast<uint8_t>((sideLikelihood[i] >= this->pcutoff ? 0 : SIDE_BELOW_PCUTOFF)
+					| (mirrorLikelihood[i] >= this->pcutoff ? 0 : MIRROR_BELOW_PCUTOFF));
+			}
+		}
+	}
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// 3x4 projection matrix of a view, row-major: pixel (u, v) ~ P (x, y, z, 1).
+	/// </summary>
+	typedef std::array<double, 12> Projection;
+
+	/// <summary>
+	/// A point of known 3D position (e.g., a corner of a calibration block, in mm) and its
+	/// pixel positions in the side profile view and in the mirror view.
+	/// </summary>
+	struct CalibrationPoint {
+		double x, y, z;
+		double sideU, sideV;
+		double mirrorU, mirrorV;
+	};
+
+	/// <summary>
+	/// Projections of the side profile view and of the mirror view of the camera. The mirror
+	/// view is that of a virtual camera behind the mirror, so that the two views are a stereo
+	/// pair of a single camera; the calibration holds as long as camera and mirror do not move.
+	/// </summary>
+	class MirrorCalibration {
+	public:
+		/// <summary>
+		/// Minimum number of calibration points: 6 of the 11 degrees of freedom per view
+		/// take 2 equations each.
+		/// </summary>
+		static const size_t MIN_POINTS = 6;
+
+		MirrorCalibration();
+
+		/// <summary>
+		/// Estimate both projections from at least <c>MIN_POINTS</c> points, which must not
+		/// lie in one plane, by the normalized direct linear transform (DLT).
+		/// </summary>
+		/// <returns><c>false</c> if the points are too few or degenerate; see
+		/// <c>LastError()</c>.</returns>
+		bool Calibrate(const std::vector<CalibrationPoint>& points);
+
+		/// <summary>
+		/// Read a calibration written by <c>Save()</c> (YAML: side_projection and
+		/// mirror_projection as lists of 12 numbers).
+		/// </summary>
+		bool Load(const std::string& path);
+		bool Save(const std::string& path) const;
+
+		const Projection& Side() const { return this->side; }
+		const Projection& Mirror() const { return this->mirror; }
+		/// <summary>
+		/// Root mean square distance in pixels of the calibration points to their projections,
+		/// over both views.
+		/// </summary>
+		double RmsError() const { return this->rmsError; }
+		size_t PointCount() const { return this->pointCount; }
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		bool Fail(const std::string& message) {
+			this->lastError = message;
+			return false;
+		}
+
+		Projection side;
+		Projection mirror;
+		double rmsError;
+		size_t pointCount;
+		std::string lastError;
+	};
+
+	// Flags of a triangulated position: the likelihood of a view was below pcutoff (or the
+	// frame was not analyzed), so that the position rests on the other view alone.
+	const uint8_t SIDE_BELOW_PCUTOFF = 1;
+	const uint8_t MIRROR_BELOW_PCUTOFF = 2;
+
+	/// <summary>
+	/// Columns of a bodypart in a view for consecutive frames, e.g., as read by
+	/// <c>PoseStoreReader::ReadColumn()</c>.
+	/// </summary>
+	struct ViewColumns {
+		const float* x;
+		const float* y;
+		const float* likelihood;
+	};
+
+	/// <summary>
+	/// Columns of a triangulated paw for consecutive frames.
+	/// </summary>
+	struct PointColumns {
+		float* x;
+		float* y;
+		float* z;
+		float* error;    // Root mean square reprojection error of both views in pixels.
+		uint8_t* flags;  // SIDE_BELOW_PCUTOFF, MIRROR_BELOW_PCUTOFF.
+	};
+
+	/// <summary>
+	/// Triangulates the positions of a paw in the side profile and mirror views to 3D by the
+	/// linear least squares (DLT) solution, in which the equations of each view are weighted
+	/// by its likelihood, so that the more certain view dominates. The frames are processed
+	/// as columns with one 3x3 solve each and no branches, which the compiler vectorizes.
+	/// </summary>
+	class Triangulator {
+	public:
+		explicit Triangulator(const MirrorCalibration& calibration, double pcutoff);
+
+		void Triangulate(const ViewColumns& side, const ViewColumns& mirror, size_t count, const PointColumns& points) const;
+
+	private:
+		Projection side;
+		Projection mirror;
+		float pcutoff;
+	};
+}
@@ -0,0 +1,202 @@
+#include "VideoReader.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+
+namespace KwaInference {
+
+	namespace {
+
+		/// <summary>
+		/// Parse a frame rate given as a fraction (e.g., "30000/1001") or a number.
+		/// </summary>
+		double ParseRate(const std::string& text) {
+			size_t slash = text.find('/');
+			double numerator = std::atof(text.substr(0, slash).c_str());
+			if (slash == std::string::npos) {
+				return numerator;
+			}
+			double denominator = std::atof(text.substr(slash + 1).c_str());
+			return denominator > 0.0 ? numerator / denominator : 0.0;
+		}
+	}
+
+	std::string QuoteArgument(const std::string& text) {
+#ifdef _WIN32
+		return "\"" + text + "\"";
+#else
+		std::string quoted = "'";
+		for (char c : text) {
+			quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+		}
+		return quoted + "'";
+#endif
+	}
+
+	bool ReadPacketTimes(const std::string& path, std::vector<int64_t>& times, double& timeBase, std::string& error) {
+		times.clear();
+		timeBase = 0.0;
+		std::string probe = "ffprobe -v error -select_streams v:0 -show_entries stream=time_base:packet=pts,dts "
+			"-of compact " + QuoteArgument(path);
+		FILE* probePipe = popen(probe.c_str(), "r");
+		if (probePipe == nullptr) {
+			error = "Cannot run ffprobe; is FFmpeg installed and on the PATH?";
+			return false;
+		}
+		// Lines "packet|pts=<pts>|dts=<dts>" in decoding order, and "stream|time_base=<num>/<den>".
+		char line[256];
+		while (std::fgets(line, sizeof(line), probePipe)) {
+			if (std::strncmp(line, "packet|", 7) == 0) {
+				const char* pts = std::strstr(line, "pts=");
+				const char* dts = std::strstr(line, "dts=");
+				char* end = nullptr;
+				long long time = pts != nullptr ? std::strtoll(pts + 4, &end, 10) : 0;
+				if (end == nullptr || end == pts + 4) {
+					// No presentation time (e.g., AVI): the decoding time is the frame's.
+					end = nullptr;
+					time = dts != nullptr ? std::strtoll(dts + 4, &end, 10) : 0;
+					if (end == nullptr || end == dts + 4) {
+						time = times.empty() ? 0 : times.back();
+					}
+				}
+				times.push_back(time);
+			}
+			else if (std::strncmp(line, "stream|time_base=", 17) == 0) {
+				std::string rate(line + 17);
+				rate.erase(rate.find_last_not_of("\r\n") + 1);
+				timeBase = ParseRate(rate);
+			}
+		}
+		pclose(probePipe);
+		if (timeBase <= 0.0) {
+			error = "Cannot read video " + path + " (ffprobe found no video stream).";
+			return false;
+		}
+		// Packets of B-frames precede the frames they refer to.
+		std::sort(times.begin(), times.end());
+		return true;
+	}
+
+	VideoInfo::VideoInfo() : width(0), height(0), fps(0.0), frameCount(-1) {
+	}
+
+	VideoReader::VideoReader() : pipe(nullptr), format(PixelFormat::Rgb8) {
+	}
+
+	VideoReader::~VideoReader() {
+		this->Close();
+	}
+
+	bool VideoReader::Open(const std::string& path, PixelFormat format, int64_t firstFrame, int frameStep) {
+		this->Close();
+		this->info = VideoInfo();
+		this->format = format;
+
+		std::string probe = "ffprobe -v error -select_streams v:0 -show_entries stream=width,height,r_frame_rate,nb_frames "
+			"-of default=noprint_wrappers=1 " + QuoteArgument(path);
+		FILE* probePipe = popen(probe.c_str(), "r");
+		if (probePipe == nullptr) {
+			this->lastError = "Cannot run ffprobe; is FFmpeg installed and on the PATH?";
+			return false;
+		}
+		char line[256];
+		while (std::fgets(line, sizeof(line), probePipe)) {
+			std::string entry(line);
+			entry.erase(entry.find_last_not_of("\r\n") + 1);
+			size_t equals = entry.find('=');
+			if (equals == std::string::npos) {
+				continue;
+			}
+			std::string key = entry.substr(0, equals);
+			std::string value = entry.substr(equals + 1);
+			if (key == "width") {
+				this->info.width = std::atoi(value.c_str());
+			}
+			else if (key == "height") {
+				this->info.height = std::atoi(value.c_str());
+			}
+			else if (key == "r_frame_rate") {
+				this->info.fps = ParseRate(value);
+			}
+			else if (key == "nb_frames" && value != "N/A") {
+				this->info.frameCount = std::atoll(value.c_str());
+			}
+		}
+		pclose(probePipe);
+		if (this->info.width <= 0 || this->info.height <= 0) {
+			this->lastError = "Cannot read video " + path + " (ffprobe found no video stream).";
+			return false;
+		}
+
+		if (format == PixelFormat::YCbCr422_8 && this->info.width % 2 != 0) {
+			this->format = format = PixelFormat::Rgb8;
+		}
+		std::string decode = "ffmpeg -v error -nostdin ";
+		if (firstFrame > 0) {
+			// Seek by the frames' presentation times, as recordings with dropped frames have
+			// gaps; halfway between the frame and the previous one, relative to the first frame
+			// (ffmpeg adds the video's start time).
+			std::vector<int64_t> times;
+			double timeBase = 0.0;
+			if (!ReadPacketTimes(path, times, timeBase, this->lastError)) {
+				return false;
+			}
+			if (firstFrame >= static_cast<int64_t>(times.size())) {
+				this->lastError = "Video " + path + " has only " + std::to_string(times.size()) + " frames.";
+				return false;
+			}
+			size_t first = static_cast<size_t>(firstFrame);
+			char seek[64];
+			std::snprintf(seek, sizeof(seek), "-ss %.6f ",
+				(0.5 * (times[first - 1] + times[first]) - times[0]) * timeBase);
+			decode += seek;
+		}
+		// Without passthrough, ffmpeg fills gaps in the timestamps (of dropped frames, or left
+		// by `select`) with duplicates, as the raw output has a constant frame rate; decoded
+		// frames must match the video's frames (and rows of its frame index) one to one.
+		decode += "-i " + QuoteArgument(path) + " -f rawvideo -fps_mode passthrough ";
+		std::string filters;
+		if (frameStep > 1) {
+			filters = "select=not(mod(n\\," + std::to_string(frameStep) + "))";
+		}
+		if (format == PixelFormat::YCbCr422_8) {
+			// Convert full-range (JPEG) YUV to limited range, as assumed for the output.
+			filters += std::string(filters.empty() ? "" : ",") + "scale=out_range=tv";
+		}
+		if (!filters.empty()) {
+			decode += "-vf " + QuoteArgument(filters) + " ";
+		}
+		decode += format == PixelFormat::Rgb8 ? "-pix_fmt rgb24 -" : "-pix_fmt yuyv422 -";
+#ifdef _WIN32
+		this->pipe = popen(decode.c_str(), "rb");
+#else
+		this->pipe = popen(decode.c_str(), "r");
+#endif
+		if (this->pipe == nullptr) {
+			this->lastError = "Cannot run ffmpeg; is FFmpeg installed and on the PATH?";
+			return false;
+		}
+		return true;
+	}
+
+	void VideoReader::Close() {
+		if (this->pipe != nullptr) {
+			pclose(this->pipe);
+			this->pipe = nullptr;
+		}
+	}
+
+	bool VideoReader::Read(uint8_t* frame) {
+		if (this->pipe == nullptr) {
+			return false;
+		}
+		return std::fread(frame, 1, this->FrameSize(), this->pipe) == this->FrameSize();
+	}
+}
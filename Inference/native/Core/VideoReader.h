@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "FrameConverter.h"
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Quote a path as a single argument of the shell command line (of ffmpeg).
+	/// </summary>
+	std::string QuoteArgument(const std::string& text);
+
+	/// <summary>
+	/// Read the presentation time of each frame of a video's first video stream from its
+	/// container, without decoding any frame: ffprobe lists the stream's packets, which hold a
+	/// frame each. The times are returned in presentation order, in units of <c>timeBase</c>
+	/// seconds.
+	/// </summary>
+	/// <returns><c>false</c> if the video cannot be read; see <c>error</c>.</returns>
+	bool ReadPacketTimes(const std::string& path, std::vector<int64_t>& times, double& timeBase, std::string& error);
+
+	struct VideoInfo {
+		int width;
+		int height;
+		double fps;
+		int64_t frameCount;  // -1 if the container does not tell.
+
+		VideoInfo();
+	};
+
+	/// <summary>
+	/// Decodes a video into RGB or YCbCr 4:2:2 frames with FFmpeg, run as a child process whose
+	/// output is read through a pipe (ffprobe for the video's properties, ffmpeg for the frames).
+	/// Both must be on the PATH. Decoding runs concurrently with the reading process.
+	/// </summary>
+	class VideoReader {
+	public:
+		VideoReader();
+		~VideoReader();
+
+		VideoReader(const VideoReader&) = delete;
+		VideoReader& operator=(const VideoReader&) = delete;
+
+		/// <summary>
+		/// Open a video to decode into frames of <c>format</c>. YCbCr frames have a third fewer
+		/// bytes than RGB ones and are cheaper for ffmpeg to produce from the YUV 4:2:0 of
+		/// compressed videos; they are in limited range (<c>YCbCrRange::Limited</c>). Videos of
+		/// odd width are decoded to RGB (see <c>Format()</c>).
+		/// Decoding starts at frame <c>firstFrame</c> (sought by its presentation time, see
+		/// <c>ReadPacketTimes()</c>) and yields every <c>frameStep</c>-th frame from there;
+		/// frames in between are dropped by ffmpeg instead of being piped. Frames are never
+		/// duplicated to fill gaps in the timestamps, e.g., of dropped frames.
+		/// </summary>
+		/// <returns><c>false</c> if the video cannot be opened; see <c>LastError()</c>.</returns>
+		bool Open(const std::string& path, PixelFormat format = PixelFormat::Rgb8, int64_t firstFrame = 0, int frameStep = 1);
+		void Close();
+
+		const VideoInfo& Info() const { return this->info; }
+		PixelFormat Format() const { return this->format; }
+		size_t FrameSize() const { return FrameBytes(this->format, this->info.width, this->info.height); }
+
+		/// <summary>
+		/// Read the next frame into <c>frame</c> (<c>FrameSize()</c> bytes, rows top to bottom).
+		/// </summary>
+		/// <returns><c>false</c> at the end of the video.</returns>
+		bool Read(uint8_t* frame);
+
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		FILE* pipe;
+		PixelFormat format;
+		VideoInfo info;
+		std::string lastError;
+	};
+}
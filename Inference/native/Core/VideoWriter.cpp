@@ -0,0 +1,67 @@
+#include "VideoWriter.h"
+
+#include "VideoReader.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+
+namespace KwaInference {
+
+	VideoWriter::VideoWriter() : pipe(nullptr), frameSize(0), failed(false) {
+	}
+
+	VideoWriter::~VideoWriter() {
+		this->Close();
+	}
+
+	bool VideoWriter::Open(const std::string& path, int width, int height, double fps) {
+		this->Close();
+		if (width <= 0 || height <= 0 || width % 2 != 0 || height % 2 != 0 || fps <= 0.0) {
+			this->lastError = "Cannot encode " + std::to_string(width) + "x" + std::to_string(height) + " frames at "
+				+ std::to_string(fps) + " fps (H.264 with 4:2:0 chroma needs an even width and height).";
+			return false;
+		}
+		char input[128];
+		std::snprintf(input, sizeof(input), "-f rawvideo -pix_fmt rgb24 -s %dx%d -framerate %.6f -i - ", width, height, fps);
+		std::string encode = std::string("ffmpeg -v error -y ") + input
+			+ "-c:v libx264 -preset veryfast -crf 18 -pix_fmt yuv420p " + QuoteArgument(path);
+#ifdef _WIN32
+		this->pipe = popen(encode.c_str(), "wb");
+#else
+		this->pipe = popen(encode.c_str(), "w");
+#endif
+		if (this->pipe == nullptr) {
+			this->lastError = "Cannot run ffmpeg; is FFmpeg installed and on the PATH?";
+			return false;
+		}
+		this->frameSize = static_cast<size_t>(width) * height * 3;
+		this->failed = false;
+		return true;
+	}
+
+	bool VideoWriter::Write(const uint8_t* rgb) {
+		if (this->pipe == nullptr || this->failed) {
+			return false;
+		}
+		this->failed = std::fwrite(rgb, 1, this->frameSize, this->pipe) != this->frameSize;
+		if (this->failed) {
+			this->lastError = "ffmpeg stopped encoding.";
+		}
+		return !this->failed;
+	}
+
+	bool VideoWriter::Close() {
+		if (this->pipe == nullptr) {
+			return !this->failed;
+		}
+		if (pclose(this->pipe) != 0 && !this->failed) {
+			this->failed = true;
+			this->lastError = "ffmpeg failed to encode the video.";
+		}
+		this->pipe = nullptr;
+		return !this->failed;
+	}
+}
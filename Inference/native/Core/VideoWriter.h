@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+
+namespace KwaInference {
+
+	/// <summary>
+	/// Encodes RGB frames into a video (H.264 in MP4, as DLC's labeled videos) with FFmpeg,
+	/// run as a child process that reads the frames from a pipe; ffmpeg must be on the PATH.
+	/// Encoding runs concurrently with the writing process.
+	/// </summary>
+	class VideoWriter {
+	public:
+		VideoWriter();
+		~VideoWriter();
+
+		VideoWriter(const VideoWriter&) = delete;
+		VideoWriter& operator=(const VideoWriter&) = delete;
+
+		/// <summary>
+		/// Create the video <c>path</c> (replacing an existing one) of <c>width</c> x
+		/// <c>height</c> frames (both even) played at <c>fps</c>.
+		/// </summary>
+		/// <returns><c>false</c> if ffmpeg cannot be started; see <c>LastError()</c>.</returns>
+		bool Open(const std::string& path, int width, int height, double fps);
+		/// <summary>
+		/// Wait until ffmpeg has encoded all frames.
+		/// </summary>
+		/// <returns><c>false</c> if writing or encoding failed.</returns>
+		bool Close();
+
+		/// <summary>
+		/// Append a frame (width * height * 3 bytes, RGB, rows top to bottom).
+		/// </summary>
+		bool Write(const uint8_t* rgb);
+
+		const std::string& LastError() const { return this->lastError; }
+
+	private:
+		FILE* pipe;
+		size_t frameSize;
+		bool failed;
+		std::string lastError;
+	};
+}
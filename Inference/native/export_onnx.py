@@ -0,0 +1,154 @@
+"""
+This command-line program exports a trained DLC snapshot to ONNX, so that the
+native inference program `kwa-pose` can run it without TensorFlow.
+
+The network is rebuilt from the test `pose_cfg.yaml` of the DLC project's model
+folder, exactly as `deeplabcut.analyze_videos()` builds it, the snapshot
+selected by `snapshotindex` in `config.yaml` is restored, and the frozen graph
+is converted with `tf2onnx`. The ONNX file is written next to the snapshot, e.g.
+`dlc-models/iteration-2/<model folder>/train/snapshot-1030000.onnx`, where
+`kwa-pose` looks for it.
+
+The network input is exported with a fixed shape [batch, height, width, 3]
+(RGB, values in [0, 255]), which lets `kwa-pose` plan all buffers once. Export
+with the size of the (cropped) videos to analyze; videos of other sizes need
+their own export (`kwa-pose -m <file.onnx>`).
+
+Requires the `kwa` conda environment and `tf2onnx`:
+
+```console
+pip install tf2onnx
+python export_onnx.py -c /path/to/dlc/config.yaml --size 720x364
+```
+
+
+Date modified: Oct 17, 2026
+"""
+
+from argparse import ArgumentParser
+import logging
+import os
+from pathlib import Path
+from typing import Any, Dict, Tuple
+import yaml
+
+# No GUI is needed for exporting.
+os.environ["DLClight"] = "True"
+
+
+logging.basicConfig(format='%(levelname)s:%(message)s', level=logging.INFO)
+logger = logging.getLogger(__name__)
+
+INPUT_NAME = 'image'
+OUTPUT_NAMES = ('part_prob', 'locref')
+ONNX_OPSET = 13
+
+
+def load_yaml(path: Path) -> Dict[str, Any]:
+    """Load the YAML file at `path` and return it as dict."""
+    if not path.is_file():
+        raise FileNotFoundError(f'File not found: {path}')
+    with open(path, 'r') as yml_file:
+        return yaml.load(yml_file, Loader=yaml.SafeLoader)
+
+
+def find_model_folder(cfg_path: Path, cfg: Dict[str, Any], shuffle: int) -> Path:
+    """Return the model folder of `shuffle` for the project at `cfg_path`, as
+    named by DLC: dlc-models/iteration-<n>/<Task><date>-trainset<p>shuffle<s>.
+    """
+    train_fraction = int(round(100 * cfg['TrainingFraction'][0]))
+    name = f"{cfg['Task']}{cfg['date']}-trainset{train_fraction}shuffle{shuffle}"
+    # The project folder is where config.yaml resides, as project_path may be
+    # stale after copying the project.
+    return cfg_path.parent / 'dlc-models' / f"iteration-{cfg['iteration']}" / name
+
+
+def find_snapshot(train_folder: Path, snapshot_index: int) -> Path:
+    """Return the snapshot (checkpoint prefix) selected by `snapshot_index`
+    (-1: the last one) in `train_folder`.
+    """
+    snapshots = sorted(
+        (path.with_suffix('') for path in train_folder.glob('snapshot-*.index')),
+        key=lambda path: int(path.name.split('-')[1]))
+    if not snapshots:
+        raise FileNotFoundError(f'No snapshots in {train_folder}')
+    return snapshots[snapshot_index]
+
+
+def export(cfg_path: str, shuffle: int, size: Tuple[int, int], batch_size: int):
+    """Export the snapshot selected in the DLC config at `cfg_path` to ONNX.
+
+    Args:
+        cfg_path (str): Path to DLC config file.
+        shuffle (int): Shuffle of the model to export.
+        size (tuple[int, int]): Width and height of the network input.
+        batch_size (int): Frames per batch; 0: `batch_size` of the config.
+    """
+    # NOTE: Importing TensorFlow and DLC takes some time.
+    import tensorflow as tf
+    import tf2onnx
+    from deeplabcut.pose_estimation_tensorflow.config import load_config
+    from deeplabcut.pose_estimation_tensorflow.nnets import PoseNetFactory
+
+    path = Path(cfg_path).resolve()
+    cfg = load_yaml(path)
+    model_folder = find_model_folder(path, cfg, shuffle)
+    snapshot = find_snapshot(model_folder / 'train', cfg.get('snapshotindex', -1))
+    if batch_size <= 0:
+        batch_size = cfg.get('batch_size', 1)
+    width, height = size
+    logger.info(f'Exporting {snapshot} for {batch_size} frames of {width}x{height}')
+
+    pose_cfg = load_config(str(model_folder / 'test' / 'pose_cfg.yaml'))
+    pose_cfg['batch_size'] = batch_size
+    pose_cfg['init_weights'] = str(snapshot)
+
+    tf.compat.v1.reset_default_graph()
+    inputs = tf.compat.v1.placeholder(
+        tf.float32, shape=[batch_size, height, width, 3], name=INPUT_NAME)
+    heads = PoseNetFactory.create(pose_cfg).test(inputs)
+    outputs = [tf.identity(heads['part_prob'], name=OUTPUT_NAMES[0])]
+    if pose_cfg.get('location_refinement', True):
+        outputs.append(tf.identity(heads['locref'], name=OUTPUT_NAMES[1]))
+    output_names = [output.op.name for output in outputs]
+
+    with tf.compat.v1.Session() as sess:
+        sess.run(tf.compat.v1.global_variables_initializer())
+        tf.compat.v1.train.Saver().restore(sess, str(snapshot))
+        graph_def = tf.compat.v1.graph_util.convert_variables_to_constants(
+            sess, sess.graph.as_graph_def(), output_names)
+
+    onnx_path = snapshot.with_suffix('.onnx')
+    tf2onnx.convert.from_graph_def(
+        graph_def,
+        input_names=[f'{INPUT_NAME}:0'],
+        output_names=[f'{name}:0' for name in output_names],
+        opset=ONNX_OPSET,
+        output_path=str(onnx_path))
+    logger.info(f'Saved {onnx_path}')
+
+
+def parse_size(text: str) -> Tuple[int, int]:
+    """Parse an image size given as <width>x<height>."""
+    width, height = (int(value) for value in text.lower().split('x'))
+    return width, height
+
+
+if __name__ == '__main__':
+
+    parser = ArgumentParser(
+        prog='export_onnx',
+        description='Export the trained DLC snapshot selected in config.yaml '
+                    'to ONNX for the native inference program kwa-pose.')
+    parser.add_argument('-c', '--cfg', dest='cfg_path', type=str, required=True,
+                        help='Path to DLC project config file')
+    parser.add_argument('--shuffle', type=int, default=1,
+                        help='Shuffle of the model to export (default: 1)')
+    parser.add_argument('--size', type=parse_size, default=(720, 364),
+                        help='Width x height of the videos to analyze '
+                             '(default: 720x364)')
+    parser.add_argument('-b', '--batch', dest='batch_size', type=int, default=0,
+                        help='Frames per batch (default: batch_size in config.yaml)')
+    args = parser.parse_args()
+
+    export(args.cfg_path, args.shuffle, args.size, args.batch_size)
@@ -0,0 +1,235 @@
+"""
+This module reads pose stores (`.kwapose` files), as written by the native
+inference program `kwa-pose`, and converts them to the HDF5 and CSV files of
+`deeplabcut.analyze_videos()`.
+
+A pose store keeps the predicted x, y, and likelihood of each bodypart per
+frame in columns, in chunks of a fixed number of frames (see `PoseStoreWriter`
+in `Inference/native/Core/PoseStore.h`). It is read through a memory mapping,
+so that a time window of a multi-hour recording is read without loading or
+parsing the whole file:
+
+```python
+from posestore import PoseStore
+
+store = PoseStore('video1DLC_resnet50_sa-GA-Basler-acA720-520ucAug23shuffle1_1030000.kwapose')
+window = store.to_dataframe(720 * 60, 720 * 70)  # DLC layout, frames 43200-50399
+x = store.column('Left Fore Paw', 'x', 720 * 60, 720 * 70)
+```
+
+Below are 2 examples on how to call the command-line program. The general
+format is:
+
+```console
+python posestore.py <operation> <flags>
+```
+
+Example 1: Summary
+
+Prints the scorer, bodyparts, and frame count of a pose store.
+
+```console
+python posestore.py info -s /path/to/video1DLC_resnet50_...kwapose
+```
+
+Example 2: Conversion
+
+Writes the HDF5 and CSV file of DLC (e.g., for `inference.py label`) next to
+the pose store; `--csv` or `--h5` writes only one of them.
+
+```console
+python posestore.py convert -s /path/to/video1DLC_resnet50_...kwapose
+```
+
+
+Date modified: Oct 17, 2026
+"""
+
+from argparse import ArgumentParser
+import logging
+from pathlib import Path
+import struct
+from typing import Optional, Tuple
+
+import numpy as np
+import pandas as pd
+
+
+logging.basicConfig(format='%(levelname)s:%(message)s', level=logging.INFO)
+logger = logging.getLogger(__name__)
+
+MAGIC = b'KWAPOSE\0'
+VERSION = 1
+FLAG_TIMESTAMPS = 1
+# magic, version, bodypart count, frames per chunk, flags, frame count,
+# offset of the first chunk, size of the names; 64 bytes.
+HEADER = struct.Struct('<8sIIIIQQI20x')
+COORDS = ('x', 'y', 'likelihood')
+# Key of the data frame in DLC's HDF5 files.
+HDF_KEY = 'df_with_missing'
+# Frames per data frame when converting, to bound the memory needed.
+CONVERT_FRAMES = 1 << 18
+
+
+class PoseStore:
+    """Memory-mapped pose store. Frames are selected by index with Python's
+    slice semantics (`start` inclusive, `stop` exclusive; None: the end).
+    """
+
+    def __init__(self, path: str):
+        self.path = Path(path)
+        with open(self.path, 'rb') as file:
+            header = file.read(HEADER.size)
+            if len(header) < HEADER.size or header[:8] != MAGIC:
+                raise ValueError(f'{self.path} is no pose store.')
+            (_, version, bodypart_count, self.chunk_frames, flags, frame_count,
+             data_offset, names_size) = HEADER.unpack(header)
+            if version != VERSION:
+                raise ValueError(
+                    f'{self.path} has pose store version {version}, which is '
+                    'not supported.')
+            names = file.read(names_size).split(b'\0')[:-1]
+        if len(names) != bodypart_count + 1:
+            raise ValueError(f'{self.path} has an invalid header.')
+        self.scorer = names[0].decode()
+        self.bodyparts = [name.decode() for name in names[1:]]
+        self.has_timestamps = bool(flags & FLAG_TIMESTAMPS)
+
+        fields = [('poses', '<f4', (3 * bodypart_count, self.chunk_frames))]
+        if self.has_timestamps:
+            fields.append(('time', '<f8', (self.chunk_frames,)))
+        chunk_dtype = np.dtype(fields)
+        # A store being written may end with an incomplete chunk.
+        chunks = (self.path.stat().st_size - data_offset) // chunk_dtype.itemsize
+        self.frame_count = min(frame_count, chunks * self.chunk_frames)
+        if chunks > 0:
+            self._chunks = np.memmap(self.path, dtype=chunk_dtype, mode='r',
+                                     offset=data_offset, shape=(chunks,))
+        else:  # Empty files cannot be mapped.
+            self._chunks = np.zeros(0, dtype=chunk_dtype)
+
+    def __len__(self) -> int:
+        return self.frame_count
+
+    def _range(self, start: Optional[int], stop: Optional[int]) -> Tuple[int, int]:
+        start, stop, _ = slice(start, stop).indices(self.frame_count)
+        return start, max(start, stop)
+
+    def _chunk_slice(self, start: int, stop: int) -> Tuple[slice, slice]:
+        """Chunks holding frames [start, stop), and the frames in them."""
+        first = start // self.chunk_frames
+        last = max(first, (stop - 1) // self.chunk_frames + 1)
+        offset = first * self.chunk_frames
+        return slice(first, last), slice(start - offset, stop - offset)
+
+    def column(self, bodypart: str, coord: str, start: Optional[int] = None,
+               stop: Optional[int] = None) -> np.ndarray:
+        """Return a coordinate ('x', 'y', or 'likelihood') of a bodypart in
+        frames [start, stop) as float32 array.
+        """
+        index = 3 * self.bodyparts.index(bodypart) + COORDS.index(coord)
+        start, stop = self._range(start, stop)
+        chunks, frames = self._chunk_slice(start, stop)
+        return self._chunks['poses'][chunks, index, :].reshape(-1)[frames]
+
+    def timestamps(self, start: Optional[int] = None,
+                   stop: Optional[int] = None) -> np.ndarray:
+        """Return the trigger time in microseconds of frames [start, stop)
+        (NaN if unknown).
+        """
+        start, stop = self._range(start, stop)
+        if not self.has_timestamps:
+            return np.full(stop - start, np.nan)
+        chunks, frames = self._chunk_slice(start, stop)
+        return self._chunks['time'][chunks].reshape(-1)[frames]
+
+    def to_dataframe(self, start: Optional[int] = None,
+                     stop: Optional[int] = None) -> pd.DataFrame:
+        """Return frames [start, stop) as data frame in the layout of DLC's
+        analysis results (columns scorer/bodyparts/coords, index: frame).
+        """
+        start, stop = self._range(start, stop)
+        chunks, frames = self._chunk_slice(start, stop)
+        poses = self._chunks['poses'][chunks]
+        values = poses.transpose(0, 2, 1).reshape(-1, poses.shape[1])[frames]
+        columns = pd.MultiIndex.from_product(
+            [[self.scorer], self.bodyparts, COORDS],
+            names=['scorer', 'bodyparts', 'coords'])
+        return pd.DataFrame(values.astype(np.float64), columns=columns,
+                            index=pd.RangeIndex(start, stop))
+
+
+def convert(store_path: str, h5: bool = True, csv: bool = True):
+    """Write the HDF5 and/or CSV file of DLC's analysis results next to the
+    pose store at `store_path`, converting a part of the frames at a time.
+
+    Args:
+        store_path (str): Path to the pose store (.kwapose).
+        h5 (bool): Write the HDF5 file.
+        csv (bool): Write the CSV file.
+    """
+    store = PoseStore(store_path)
+    h5_path = store.path.with_suffix('.h5')
+    csv_path = store.path.with_suffix('.csv')
+    for start in range(0, max(len(store), 1), CONVERT_FRAMES):
+        frames = store.to_dataframe(start, start + CONVERT_FRAMES)
+        first = start == 0
+        if h5:
+            frames.to_hdf(h5_path, key=HDF_KEY, format='table',
+                          mode='w' if first else 'a', append=not first)
+        if csv:
+            frames.to_csv(csv_path, mode='w' if first else 'a', header=first)
+    for path, written in ((h5_path, h5), (csv_path, csv)):
+        if written:
+            logger.info(f'Saved {path}')
+
+
+def info(store_path: str):
+    """Print a summary of the pose store at `store_path`."""
+    store = PoseStore(store_path)
+    print(f'{store.path}: {len(store)} frames, scorer {store.scorer}')
+    print(f'Bodyparts: {", ".join(store.bodyparts)}')
+    if store.has_timestamps and len(store) > 0:
+        times = store.timestamps()
+        known = times[~np.isnan(times)]
+        if len(known) > 0:
+            print(f'Trigger times: {len(known)} frames, '
+                  f'{(known[-1] - known[0]) / 1e6:.3f} s')
+
+
+if __name__ == '__main__':
+
+    parser = ArgumentParser(
+        prog='posestore',
+        description='Command-line program to inspect pose stores (.kwapose) '
+                    'written by kwa-pose and to convert them to the HDF5 and '
+                    'CSV files of DLC.')
+
+    subparser_name = 'mode'
+    subparsers = parser.add_subparsers(title='Modes', dest=subparser_name)
+
+    store_cmd = dict(dest='store_path', help='Path to a pose store (.kwapose)',
+                     type=str, required=True)
+    sub_cmd_info = 'info'
+    parser_info = subparsers.add_parser(name=sub_cmd_info,
+                                        help='Print a summary')
+    parser_info.add_argument('-s', '--store', **store_cmd)
+    sub_cmd_convert = 'convert'
+    parser_convert = subparsers.add_parser(
+        name=sub_cmd_convert, help='Convert to DLC HDF5 and CSV files')
+    parser_convert.add_argument('-s', '--store', **store_cmd)
+    parser_convert.add_argument('--h5', action='store_true',
+                                help='Write only the HDF5 file')
+    parser_convert.add_argument('--csv', action='store_true',
+                                help='Write only the CSV file')
+
+    args = parser.parse_args()
+    selected_sub_cmd = getattr(args, subparser_name)
+
+    if selected_sub_cmd == sub_cmd_info:
+        info(args.store_path)
+    elif selected_sub_cmd == sub_cmd_convert:
+        both = not args.h5 and not args.csv
+        convert(args.store_path, h5=args.h5 or both, csv=args.csv or both)
+    else:
+        parser.print_help()